@@ -41,10 +41,17 @@ class Transaction(models.Model):
     transaction_id = models.CharField(max_length=50, unique=True)
     balance_before = models.DecimalField(max_digits=12, decimal_places=2)
     balance_after = models.DecimalField(max_digits=12, decimal_places=2)
+    # Client-generated; a retried request with the same key is answered from
+    # the original row instead of moving money twice
+    idempotency_key = models.CharField(max_length=64, blank=True, null=True)
     created_at = models.DateTimeField(auto_now_add=True)
 
     class Meta:
         ordering = ['-created_at']
+        constraints = [
+            models.UniqueConstraint(fields=['account', 'idempotency_key'],
+                                    name='unique_idempotency_key_per_account'),
+        ]
 
     def __str__(self):
         return f"{self.transaction_id} - {self.transaction_type} - KES {self.amount}"
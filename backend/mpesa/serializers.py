@@ -36,17 +36,20 @@ class SendMoneySerializer(serializers.Serializer):
     amount = serializers.DecimalField(max_digits=12, decimal_places=2, min_value=1)
     pin = serializers.CharField(max_length=10, write_only=True)
     description = serializers.CharField(max_length=200, required=False, default='')
+    idempotency_key = serializers.CharField(max_length=64, required=False, allow_blank=True, default='')
 
 
 class DepositSerializer(serializers.Serializer):
     amount = serializers.DecimalField(max_digits=12, decimal_places=2, min_value=1)
     reference = serializers.CharField(max_length=100, required=False, default='')
+    idempotency_key = serializers.CharField(max_length=64, required=False, allow_blank=True, default='')
 
 
 class WithdrawSerializer(serializers.Serializer):
     amount = serializers.DecimalField(max_digits=12, decimal_places=2, min_value=1)
     pin = serializers.CharField(max_length=10, write_only=True)
     description = serializers.CharField(max_length=200, required=False, default='')
+    idempotency_key = serializers.CharField(max_length=64, required=False, allow_blank=True, default='')
 
 
 class LoginSerializer(serializers.Serializer):
@@ -1,3 +1,340 @@
-from django.test import TestCase
+import gzip
+import json
+from datetime import timedelta
+from decimal import Decimal
+from unittest import mock
 
-# Create your tests here.
+from django.contrib.auth.hashers import make_password
+from django.contrib.auth.models import User
+from django.test import override_settings
+from django.utils import timezone
+from rest_framework.test import APITestCase
+from rest_framework_simplejwt.tokens import RefreshToken
+
+from .models import MpesaAccount, Transaction
+from .views import MAX_BATCH_CALLS, MAX_HISTORY_PAGE, generate_transaction_id
+
+
+# PINs and passwords are hashed per request; the default hasher is slow on purpose
+@override_settings(PASSWORD_HASHERS=['django.contrib.auth.hashers.MD5PasswordHasher'])
+class MpesaTestCase(APITestCase):
+    """john (KES 5,000) and jane (KES 2,000), PIN 1234; requests go out as john."""
+
+    def setUp(self):
+        self.john = self.make_account('john', '0712345678', '5000.00')
+        self.jane = self.make_account('jane', '0722345678', '2000.00')
+        self.login(self.john)
+
+    def make_account(self, username, phone, balance):
+        user = User.objects.create_user(username=username, password='password123')
+        return MpesaAccount.objects.create(user=user, phone_number=phone,
+                                           balance=Decimal(balance), pin=make_password('1234'))
+
+    def login(self, account):
+        token = RefreshToken.for_user(account.user).access_token
+        self.client.credentials(HTTP_AUTHORIZATION=f'Bearer {token}')
+
+    def balance(self, account):
+        account.refresh_from_db()
+        return account.balance
+
+    def add_rows(self, account, n):
+        """n deposits of KES 1, oldest first; returns them in that order."""
+        Transaction.objects.bulk_create(
+            Transaction(account=account, transaction_type='DEPOSIT', amount=Decimal('1.00'),
+                        status='SUCCESS', transaction_id=generate_transaction_id(),
+                        balance_before=Decimal('0.00'), balance_after=Decimal('1.00'))
+            for _ in range(n))
+        return list(account.transactions.order_by('id'))
+
+
+class BatchViewTests(MpesaTestCase):
+    def batch(self, *calls):
+        return self.client.post('/api/batch/', {'requests': list(calls)}, format='json')
+
+    def test_calls_run_in_order_through_their_views(self):
+        r = self.batch(
+            {'method': 'GET', 'path': '/api/balance/'},
+            {'method': 'POST', 'path': '/api/deposit/', 'body': {'amount': '100.00'}},
+            {'method': 'GET', 'path': '/api/transactions/?limit=1'},
+            {'method': 'GET', 'path': '/api/nowhere/'},
+        )
+        self.assertEqual(r.status_code, 200)
+        balance, deposit, history, missing = r.data['responses']
+        self.assertEqual(balance['status'], 200)
+        self.assertEqual(balance['body']['balance'], '5000.00')
+        self.assertEqual(deposit['status'], 200)
+        self.assertEqual(deposit['body']['new_balance'], '5100.00')
+        self.assertEqual(history['status'], 200)
+        self.assertEqual(history['body']['transactions'][0]['transaction_id'],
+                         deposit['body']['transaction_id'])
+        self.assertEqual(missing['status'], 404)
+        self.assertEqual(self.balance(self.john), Decimal('5100.00'))
+
+    def test_one_failing_call_does_not_stop_the_rest(self):
+        r = self.batch(
+            {'method': 'POST', 'path': '/api/withdraw/', 'body': {'amount': '100.00', 'pin': '0000'}},
+            {'method': 'POST', 'path': '/api/send/',
+             'body': {'recipient_phone': '0722345678', 'amount': '250.00', 'pin': '1234'}},
+        )
+        bad_pin, sent = r.data['responses']
+        self.assertEqual(bad_pin['status'], 401)
+        self.assertEqual(bad_pin['body']['error'], 'Invalid PIN')
+        self.assertEqual(sent['status'], 200)
+        self.assertEqual(self.balance(self.john), Decimal('4750.00'))
+        self.assertEqual(self.balance(self.jane), Decimal('2250.00'))
+
+    def test_auth_batch_and_event_paths_are_refused(self):
+        paths = ['/api/auth/login/', '/api/auth/refresh/', '/api/batch/', '/api/events/',
+                 '/admin/', 42]
+        r = self.batch(*[{'method': 'POST', 'path': p} for p in paths])
+        self.assertEqual(r.status_code, 200)
+        for reply in r.data['responses']:
+            self.assertEqual(reply['status'], 400)
+            self.assertEqual(reply['body']['error'], 'Path not allowed in a batch')
+
+    def test_calls_use_the_outer_authorization(self):
+        self.login(self.jane)
+        r = self.batch({'method': 'GET', 'path': '/api/balance/'})
+        self.assertEqual(r.data['responses'][0]['body']['phone_number'], '0722345678')
+
+        self.client.credentials(HTTP_AUTHORIZATION='Bearer not-a-token')
+        r = self.batch({'method': 'GET', 'path': '/api/balance/'})
+        self.assertEqual(r.status_code, 401)
+
+    def test_request_list_is_checked(self):
+        self.assertEqual(self.client.post('/api/batch/', {}, format='json').status_code, 400)
+        self.assertEqual(self.batch().status_code, 400)
+        calls = [{'method': 'GET', 'path': '/api/balance/'}] * (MAX_BATCH_CALLS + 1)
+        self.assertEqual(self.batch(*calls).status_code, 400)
+        r = self.batch('not an object')
+        self.assertEqual(r.data['responses'][0]['status'], 400)
+
+
+class IdempotencyTests(MpesaTestCase):
+    def send(self, key, amount='250.00', to='0722345678'):
+        return self.client.post('/api/send/', {'recipient_phone': to, 'amount': amount,
+                                               'pin': '1234', 'idempotency_key': key}, format='json')
+
+    def test_send_retried_with_its_key_moves_money_once(self):
+        first = self.send('k-send-1')
+        again = self.send('k-send-1')
+        self.assertEqual(first.status_code, 200)
+        self.assertEqual(again.status_code, 200)
+        self.assertTrue(again.data['replayed'])
+        self.assertEqual(again.data['transaction_id'], first.data['transaction_id'])
+        self.assertEqual(again.data['new_balance'], first.data['new_balance'])
+        self.assertEqual(Transaction.objects.filter(idempotency_key='k-send-1').count(), 1)
+        self.assertEqual(self.jane.transactions.filter(transaction_type='RECEIVE').count(), 1)
+        self.assertEqual(self.balance(self.john), Decimal('4750.00'))
+        self.assertEqual(self.balance(self.jane), Decimal('2250.00'))
+
+    def test_deposit_and_withdraw_retries_replay(self):
+        for path, body in (('/api/deposit/', {'amount': '100.00'}),
+                           ('/api/withdraw/', {'amount': '40.00', 'pin': '1234'})):
+            body['idempotency_key'] = 'k' + path
+            first = self.client.post(path, body, format='json')
+            again = self.client.post(path, body, format='json')
+            self.assertEqual(again.status_code, 200)
+            self.assertEqual(again.data['transaction_id'], first.data['transaction_id'])
+            self.assertEqual(Transaction.objects.filter(idempotency_key=body['idempotency_key']).count(), 1)
+        self.assertEqual(self.balance(self.john), Decimal('5060.00'))
+
+    def test_key_reused_for_another_amount_or_type_is_refused(self):
+        self.assertEqual(self.send('k-send-2').status_code, 200)
+
+        other_amount = self.send('k-send-2', amount='300.00')
+        self.assertEqual(other_amount.status_code, 409)
+
+        other_type = self.client.post('/api/withdraw/', {'amount': '250.00', 'pin': '1234',
+                                                         'idempotency_key': 'k-send-2'}, format='json')
+        self.assertEqual(other_type.status_code, 409)
+        self.assertEqual(other_type.data['error'],
+                         'Idempotency key already used for a different transaction')
+        self.assertEqual(Transaction.objects.filter(idempotency_key='k-send-2').count(), 1)
+        self.assertEqual(self.balance(self.john), Decimal('4750.00'))
+
+    def test_key_reused_for_another_recipient_is_refused(self):
+        mary = self.make_account('mary', '0732345678', '0.00')
+        self.assertEqual(self.send('k-send-3').status_code, 200)
+
+        elsewhere = self.send('k-send-3', to='0732345678')
+        self.assertEqual(elsewhere.status_code, 409)
+        self.assertEqual(Transaction.objects.filter(idempotency_key='k-send-3').count(), 1)
+        self.assertFalse(mary.transactions.exists())
+        self.assertEqual(self.balance(mary), Decimal('0.00'))
+        self.assertEqual(self.balance(self.john), Decimal('4750.00'))
+
+    def test_keys_are_per_account(self):
+        self.assertEqual(self.send('k-shared').status_code, 200)
+        self.login(self.jane)
+        r = self.client.post('/api/deposit/', {'amount': '10.00', 'idempotency_key': 'k-shared'},
+                             format='json')
+        self.assertEqual(r.status_code, 200)
+        self.assertNotIn('replayed', r.data)
+
+    def test_requests_without_a_key_are_never_replayed(self):
+        self.assertEqual(self.send('').status_code, 200)
+        self.assertEqual(self.send('').status_code, 200)
+        self.assertEqual(self.balance(self.john), Decimal('4500.00'))
+
+
+class HistoryTests(MpesaTestCase):
+    def history(self, query='', **headers):
+        return self.client.get(f'/api/transactions/{query}', **headers)
+
+    def ids(self, r):
+        return [row['id'] for row in r.data['transactions']]
+
+    def test_unchanged_history_and_balance_answer_304(self):
+        self.add_rows(self.john, 3)
+        for path in ('/api/transactions/?limit=2', '/api/balance/'):
+            first = self.client.get(path)
+            self.assertEqual(first.status_code, 200)
+            again = self.client.get(path, HTTP_IF_NONE_MATCH=first['ETag'])
+            self.assertEqual(again.status_code, 304)
+            self.assertEqual(again.content, b'')
+            self.assertEqual(again['ETag'], first['ETag'])
+
+    def test_history_honours_if_modified_since(self):
+        self.add_rows(self.john, 2)
+        first = self.history()
+        again = self.history(HTTP_IF_MODIFIED_SINCE=first['Last-Modified'])
+        self.assertEqual(again.status_code, 304)
+
+    def test_new_row_changes_the_etag(self):
+        self.add_rows(self.john, 3)
+        first = self.history('?limit=2')
+        self.client.post('/api/deposit/', {'amount': '5.00'}, format='json')
+        again = self.history('?limit=2', HTTP_IF_NONE_MATCH=first['ETag'])
+        self.assertEqual(again.status_code, 200)
+        self.assertNotEqual(again['ETag'], first['ETag'])
+        self.assertEqual(again.data['count'], 4)
+
+    def test_etag_is_per_page(self):
+        self.add_rows(self.john, 3)
+        first = self.history('?limit=1')
+        other = self.history('?limit=2', HTTP_IF_NONE_MATCH=first['ETag'])
+        self.assertEqual(other.status_code, 200)
+
+    def test_history_is_gzipped_only_when_asked(self):
+        self.add_rows(self.john, 20)
+        plain = self.history('?limit=20')
+        self.assertNotIn('Content-Encoding', plain)
+        packed = self.history('?limit=20', HTTP_ACCEPT_ENCODING='gzip, deflate')
+        self.assertEqual(packed['Content-Encoding'], 'gzip')
+        self.assertIn('Accept-Encoding', packed['Vary'])
+        self.assertLess(len(packed.content), len(plain.content))
+        self.assertEqual(json.loads(gzip.decompress(packed.content)), json.loads(plain.content))
+
+    def test_cursor_pages_cover_every_row_once(self):
+        rows = self.add_rows(self.john, 7)
+        seen, cursor = [], ''
+        while True:
+            r = self.history(f'?limit=3{cursor}')
+            self.assertEqual(r.data['count'], 7)
+            seen += self.ids(r)
+            if r.data['next_cursor'] is None:
+                break
+            cursor = f"&cursor={r.data['next_cursor']}"
+        self.assertEqual(seen, [t.id for t in reversed(rows)])
+
+    def test_cursor_is_stable_while_rows_arrive(self):
+        rows = self.add_rows(self.john, 4)
+        first = self.history('?limit=2')
+        self.add_rows(self.jane, 1)
+        self.client.post('/api/deposit/', {'amount': '5.00'}, format='json')
+        r = self.history(f"?limit=2&cursor={first.data['next_cursor']}")
+        self.assertEqual(self.ids(r), [rows[1].id, rows[0].id])
+        self.assertIsNone(r.data['next_cursor'])
+
+    def test_offset_skips_rows(self):
+        rows = self.add_rows(self.john, 5)
+        r = self.history('?limit=2&offset=3')
+        self.assertEqual(self.ids(r), [rows[1].id, rows[0].id])
+        self.assertEqual(self.ids(self.history('?limit=2&offset=-4')), [rows[4].id, rows[3].id])
+
+    def test_since_returns_rows_at_or_after_it(self):
+        rows = self.add_rows(self.john, 4)
+        base = timezone.now() - timedelta(hours=1)
+        for i, row in enumerate(rows):
+            Transaction.objects.filter(pk=row.pk).update(created_at=base + timedelta(minutes=i))
+        since = (base + timedelta(minutes=2)).isoformat()
+        r = self.client.get('/api/transactions/', {'since': since})
+        self.assertEqual(self.ids(r), [rows[3].id, rows[2].id])
+        self.assertEqual(self.history('?since=yesterday').status_code, 400)
+
+    def test_limit_is_clamped(self):
+        self.add_rows(self.john, MAX_HISTORY_PAGE + 2)
+        r = self.history(f'?limit={MAX_HISTORY_PAGE * 10}')
+        self.assertEqual(len(r.data['transactions']), MAX_HISTORY_PAGE)
+        self.assertIsNotNone(r.data['next_cursor'])
+        self.assertEqual(len(self.history('?limit=0').data['transactions']), 1)
+        self.assertEqual(self.history('?limit=ten').status_code, 400)
+        self.assertEqual(self.history('?cursor=abc').status_code, 400)
+
+
+@mock.patch('mpesa.views.EVENTS_POLL_S', 0)
+class EventStreamTests(MpesaTestCase):
+    def open(self, query='', **headers):
+        r = self.client.get(f'/api/events/{query}', **headers)
+        self.assertEqual(r.status_code, 200)
+        self.assertEqual(r['Content-Type'], 'text/event-stream')
+        self.addCleanup(r.close)
+        return r, iter(r.streaming_content)
+
+    def read(self, chunks, n):
+        """The next n events as {'id', 'event', 'data'}; checks each frame's layout."""
+        events = []
+        while len(events) < n:
+            frame = next(chunks).decode()
+            self.assertTrue(frame.endswith('\n\n'), frame)
+            if frame.startswith(('retry:', ':')):
+                continue
+            fields = dict(line.split(': ', 1) for line in frame.rstrip('\n').split('\n'))
+            self.assertEqual(sorted(fields), ['data', 'event', 'id'])
+            events.append({'id': int(fields['id']), 'event': fields['event'],
+                           'data': json.loads(fields['data'])})
+        return events
+
+    def test_stream_starts_with_retry_then_the_balance(self):
+        rows = self.add_rows(self.john, 2)
+        r, chunks = self.open()
+        self.assertEqual(r['Cache-Control'], 'no-cache')
+        self.assertEqual(next(chunks), b'retry: 3000\n\n')
+        [balance] = self.read(chunks, 1)
+        self.assertEqual(balance, {'id': rows[-1].id, 'event': 'balance',
+                                   'data': {'balance': '5000.00', 'currency': 'KES'}})
+
+    def test_last_event_id_resumes_after_that_row(self):
+        rows = self.add_rows(self.john, 5)
+        self.add_rows(self.jane, 2)
+        r, chunks = self.open(HTTP_LAST_EVENT_ID=str(rows[1].id))
+        events = self.read(chunks, 4)
+        self.assertEqual([(e['event'], e['id']) for e in events],
+                         [('txn', rows[2].id), ('txn', rows[3].id), ('txn', rows[4].id),
+                          ('balance', rows[4].id)])
+        self.assertEqual(events[0]['data']['transaction_id'], rows[2].transaction_id)
+
+    def test_after_parameter_wins_over_last_event_id(self):
+        rows = self.add_rows(self.john, 3)
+        r, chunks = self.open(f'?after={rows[1].id}', HTTP_LAST_EVENT_ID=str(rows[0].id))
+        self.assertEqual([e['id'] for e in self.read(chunks, 2)], [rows[2].id, rows[2].id])
+
+    def test_new_rows_are_pushed_once(self):
+        r, chunks = self.open()
+        self.read(chunks, 1)
+        deposit = self.client.post('/api/deposit/', {'amount': '5.00'}, format='json')
+        txn, balance = self.read(chunks, 2)
+        self.assertEqual(txn['event'], 'txn')
+        self.assertEqual(txn['data']['transaction_id'], deposit.data['transaction_id'])
+        self.assertEqual(balance['id'], txn['id'])
+        self.assertEqual(balance['data']['balance'], '5005.00')
+
+        self.add_rows(self.john, 1)
+        [next_txn] = self.read(chunks, 1)
+        self.assertGreater(next_txn['id'], txn['id'])
+
+    def test_bad_resume_id_is_refused(self):
+        r = self.client.get('/api/events/', HTTP_LAST_EVENT_ID='abc')
+        self.assertEqual(r.status_code, 400)
@@ -1,7 +1,8 @@
 from django.urls import path
 from .views import (
     BalanceView, SendMoneyView, DepositView,
-    WithdrawView, TransactionHistoryView
+    WithdrawView, TransactionHistoryView, BatchView, HealthView,
+    EventStreamView
 )
 
 urlpatterns = [
@@ -10,4 +11,7 @@ urlpatterns = [
     path('deposit/', DepositView.as_view(), name='deposit'),
     path('withdraw/', WithdrawView.as_view(), name='withdraw'),
     path('transactions/', TransactionHistoryView.as_view(), name='transactions'),
+    path('batch/', BatchView.as_view(), name='batch'),
+    path('health/', HealthView.as_view(), name='health'),
+    path('events/', EventStreamView.as_view(), name='events'),
 ]
\ No newline at end of file
@@ -1,12 +1,25 @@
 from rest_framework import status
 from rest_framework.views import APIView
 from rest_framework.response import Response
+from rest_framework.renderers import BaseRenderer, JSONRenderer
 from rest_framework.permissions import AllowAny, IsAuthenticated
 from rest_framework_simplejwt.tokens import RefreshToken
 from rest_framework_simplejwt.authentication import JWTAuthentication
 from django.contrib.auth import authenticate
 from django.contrib.auth.hashers import check_password, make_password
-from django.db import transaction as db_transaction
+from django.db import DatabaseError, IntegrityError, connection, transaction as db_transaction
+from django.db.models import Count, F, Max
+from django.http import HttpRequest, QueryDict, StreamingHttpResponse
+from django.urls import resolve, Resolver404
+from django.utils.cache import get_conditional_response
+from django.utils.dateparse import parse_datetime
+from django.utils.decorators import method_decorator
+from django.utils.http import http_date, quote_etag
+from django.views.decorators.gzip import gzip_page
+import hashlib
+import io
+import json
+import time
 import uuid
 import decimal
 
@@ -18,10 +31,79 @@ from .serializers import (
 )
 
 
+MAX_HISTORY_PAGE = 500
+MAX_BATCH_CALLS = 20
+EVENTS_POLL_S = 1           # how often a stream looks for new rows
+EVENTS_KEEPALIVE_S = 15     # comment line so proxies and clients see a live link
+EVENTS_MAX_S = 300          # the client reconnects with Last-Event-ID
+EVENTS_BATCH = 100
+
+
 def generate_transaction_id():
     return f"TXN{uuid.uuid4().hex[:12].upper()}"
 
 
+def apply_balance_delta(account_id, delta):
+    """
+    Add delta to an account balance in one UPDATE, so concurrent requests
+    (e.g. a batch client with several in flight) cannot lose updates.
+    Debits only apply if the balance covers them. Must run inside
+    atomic(); returns (balance_before, balance_after) or None.
+    """
+    rows = MpesaAccount.objects.filter(pk=account_id)
+    if delta < 0:
+        rows = rows.filter(balance__gte=-delta)
+    if not rows.update(balance=F('balance') + delta):
+        return None
+    after = MpesaAccount.objects.get(pk=account_id).balance
+    return after - delta, after
+
+
+def find_replay(account, key, txn_type, amount, recipient=None):
+    """
+    The original answer for a retried request, or None if the key is new.
+    A key reused for a different operation (or, for a send, a different
+    recipient) is a client bug and gets 409.
+    """
+    if not key:
+        return None
+    txn = account.transactions.filter(idempotency_key=key).first()
+    if txn is None:
+        return None
+    if (txn.transaction_type != txn_type or txn.amount != amount
+            or (recipient is not None and txn.recipient_phone != recipient)):
+        return Response({'error': 'Idempotency key already used for a different transaction'},
+                        status=status.HTTP_409_CONFLICT)
+    return Response({
+        'message': 'Already processed',
+        'transaction_id': txn.transaction_id,
+        'amount': str(txn.amount),
+        'new_balance': str(txn.balance_after),
+        'currency': 'KES',
+        'replayed': True,
+    })
+
+
+def conditional(request, state, last_modified=None):
+    """
+    Validators for a GET the terminal client repeats (balance polls,
+    history pages). state is everything the body depends on; last_modified
+    a datetime or None. Returns (headers, response): response is an empty
+    304 when the client already holds this version, else None and the
+    caller builds the body and adds headers to it.
+    """
+    etag = quote_etag(hashlib.md5(state.encode()).hexdigest())
+    ts = int(last_modified.timestamp()) if last_modified else None
+    headers = {'ETag': etag, 'Cache-Control': 'private, no-cache'}
+    if ts is not None:
+        headers['Last-Modified'] = http_date(ts)
+    response = get_conditional_response(request, etag=etag, last_modified=ts)
+    if response is not None:
+        for name, value in headers.items():
+            response[name] = value
+    return headers, response
+
+
 class LoginView(APIView):
     permission_classes = [AllowAny]
 
@@ -85,24 +167,46 @@ class LogoutView(APIView):
             return Response({'message': 'Logged out'}, status=status.HTTP_200_OK)
 
 
+class HealthView(APIView):
+    """
+    Probed by the terminal client's load balancer every few seconds, so it
+    skips authentication and only checks that the database answers. A 503
+    takes this instance out of rotation until it recovers.
+    """
+    permission_classes = [AllowAny]
+    authentication_classes = []
+
+    def get(self, request):
+        try:
+            connection.ensure_connection()
+        except DatabaseError:
+            return Response({'status': 'unavailable'}, status=status.HTTP_503_SERVICE_UNAVAILABLE)
+        return Response({'status': 'ok'})
+
+
 class BalanceView(APIView):
     permission_classes = [IsAuthenticated]
 
     def get(self, request):
         try:
             account = request.user.mpesa_account
-            return Response({
-                'phone_number': account.phone_number,
-                'balance': str(account.balance),
-                'currency': 'KES',
-                'account_holder': f"{request.user.first_name} {request.user.last_name}".strip()
-                    or request.user.username,
-            })
         except MpesaAccount.DoesNotExist:
             return Response(
                 {'error': 'M-Pesa account not found'},
                 status=status.HTTP_404_NOT_FOUND
             )
+        holder = (f"{request.user.first_name} {request.user.last_name}".strip()
+                  or request.user.username)
+        headers, not_modified = conditional(
+            request, f"{account.id}|{account.phone_number}|{account.balance}|{holder}")
+        if not_modified:
+            return not_modified
+        return Response({
+            'phone_number': account.phone_number,
+            'balance': str(account.balance),
+            'currency': 'KES',
+            'account_holder': holder,
+        }, headers=headers)
 
 
 class SendMoneyView(APIView):
@@ -125,6 +229,10 @@ class SendMoneyView(APIView):
             return Response({'error': 'Invalid PIN'}, status=status.HTTP_401_UNAUTHORIZED)
 
         amount = decimal.Decimal(str(data['amount']))
+        key = data['idempotency_key'] or None
+        replay = find_replay(sender_account, key, 'SEND', amount, data['recipient_phone'])
+        if replay:
+            return replay
 
         if sender_account.balance < amount:
             return Response({'error': 'Insufficient balance'}, status=status.HTTP_400_BAD_REQUEST)
@@ -141,42 +249,51 @@ class SendMoneyView(APIView):
         if recipient_account == sender_account:
             return Response({'error': 'Cannot send money to yourself'}, status=status.HTTP_400_BAD_REQUEST)
 
-        with db_transaction.atomic():
-            txn_id = generate_transaction_id()
-            sender_balance_before = sender_account.balance
-            sender_account.balance -= amount
-            sender_account.save()
-
-            # Debit transaction
-            Transaction.objects.create(
-                account=sender_account,
-                transaction_type='SEND',
-                amount=amount,
-                recipient_phone=data['recipient_phone'],
-                description=data.get('description', ''),
-                status='SUCCESS',
-                transaction_id=txn_id,
-                balance_before=sender_balance_before,
-                balance_after=sender_account.balance,
-            )
-
-            # Credit recipient
-            recv_balance_before = recipient_account.balance
-            recipient_account.balance += amount
-            recipient_account.save()
-
-            recv_txn_id = generate_transaction_id()
-            Transaction.objects.create(
-                account=recipient_account,
-                transaction_type='RECEIVE',
-                amount=amount,
-                recipient_phone=sender_account.phone_number,
-                description=f"From {sender_account.phone_number}: {data.get('description', '')}",
-                status='SUCCESS',
-                transaction_id=recv_txn_id,
-                balance_before=recv_balance_before,
-                balance_after=recipient_account.balance,
-            )
+        try:
+            with db_transaction.atomic():
+                debit = apply_balance_delta(sender_account.pk, -amount)
+                if debit is None:
+                    return Response({'error': 'Insufficient balance'}, status=status.HTTP_400_BAD_REQUEST)
+                sender_balance_before, sender_account.balance = debit
+
+                txn_id = generate_transaction_id()
+
+                # Debit transaction
+                Transaction.objects.create(
+                    account=sender_account,
+                    transaction_type='SEND',
+                    amount=amount,
+                    recipient_phone=data['recipient_phone'],
+                    description=data.get('description', ''),
+                    status='SUCCESS',
+                    transaction_id=txn_id,
+                    balance_before=sender_balance_before,
+                    balance_after=sender_account.balance,
+                    idempotency_key=key,
+                )
+
+                # Credit recipient
+                recv_balance_before, recipient_account.balance = \
+                    apply_balance_delta(recipient_account.pk, amount)
+
+                recv_txn_id = generate_transaction_id()
+                Transaction.objects.create(
+                    account=recipient_account,
+                    transaction_type='RECEIVE',
+                    amount=amount,
+                    recipient_phone=sender_account.phone_number,
+                    description=f"From {sender_account.phone_number}: {data.get('description', '')}",
+                    status='SUCCESS',
+                    transaction_id=recv_txn_id,
+                    balance_before=recv_balance_before,
+                    balance_after=recipient_account.balance,
+                )
+        except IntegrityError:
+            # A concurrent retry with the same key committed first; this one rolled back
+            replay = find_replay(sender_account, key, 'SEND', amount, data['recipient_phone'])
+            if replay is None:
+                raise
+            return replay
 
         return Response({
             'message': 'Money sent successfully',
@@ -204,23 +321,33 @@ class DepositView(APIView):
         except MpesaAccount.DoesNotExist:
             return Response({'error': 'Account not found'}, status=status.HTTP_404_NOT_FOUND)
 
-        with db_transaction.atomic():
-            balance_before = account.balance
-            account.balance += amount
-            account.save()
-
-            txn_id = generate_transaction_id()
-            Transaction.objects.create(
-                account=account,
-                transaction_type='DEPOSIT',
-                amount=amount,
-                reference=data.get('reference', ''),
-                description=f"Deposit via agent",
-                status='SUCCESS',
-                transaction_id=txn_id,
-                balance_before=balance_before,
-                balance_after=account.balance,
-            )
+        key = data['idempotency_key'] or None
+        replay = find_replay(account, key, 'DEPOSIT', amount)
+        if replay:
+            return replay
+
+        try:
+            with db_transaction.atomic():
+                balance_before, account.balance = apply_balance_delta(account.pk, amount)
+
+                txn_id = generate_transaction_id()
+                Transaction.objects.create(
+                    account=account,
+                    transaction_type='DEPOSIT',
+                    amount=amount,
+                    reference=data.get('reference', ''),
+                    description=f"Deposit via agent",
+                    status='SUCCESS',
+                    transaction_id=txn_id,
+                    balance_before=balance_before,
+                    balance_after=account.balance,
+                    idempotency_key=key,
+                )
+        except IntegrityError:
+            replay = find_replay(account, key, 'DEPOSIT', amount)
+            if replay is None:
+                raise
+            return replay
 
         return Response({
             'message': 'Deposit successful',
@@ -251,26 +378,38 @@ class WithdrawView(APIView):
             return Response({'error': 'Invalid PIN'}, status=status.HTTP_401_UNAUTHORIZED)
 
         amount = decimal.Decimal(str(data['amount']))
+        key = data['idempotency_key'] or None
+        replay = find_replay(account, key, 'WITHDRAW', amount)
+        if replay:
+            return replay
 
         if account.balance < amount:
             return Response({'error': 'Insufficient balance'}, status=status.HTTP_400_BAD_REQUEST)
 
-        with db_transaction.atomic():
-            balance_before = account.balance
-            account.balance -= amount
-            account.save()
-
-            txn_id = generate_transaction_id()
-            Transaction.objects.create(
-                account=account,
-                transaction_type='WITHDRAW',
-                amount=amount,
-                description=data.get('description', 'Cash withdrawal'),
-                status='SUCCESS',
-                transaction_id=txn_id,
-                balance_before=balance_before,
-                balance_after=account.balance,
-            )
+        try:
+            with db_transaction.atomic():
+                debit = apply_balance_delta(account.pk, -amount)
+                if debit is None:
+                    return Response({'error': 'Insufficient balance'}, status=status.HTTP_400_BAD_REQUEST)
+                balance_before, account.balance = debit
+
+                txn_id = generate_transaction_id()
+                Transaction.objects.create(
+                    account=account,
+                    transaction_type='WITHDRAW',
+                    amount=amount,
+                    description=data.get('description', 'Cash withdrawal'),
+                    status='SUCCESS',
+                    transaction_id=txn_id,
+                    balance_before=balance_before,
+                    balance_after=account.balance,
+                    idempotency_key=key,
+                )
+        except IntegrityError:
+            replay = find_replay(account, key, 'WITHDRAW', amount)
+            if replay is None:
+                raise
+            return replay
 
         return Response({
             'message': 'Withdrawal successful',
@@ -281,6 +420,7 @@ class WithdrawView(APIView):
         })
 
 
+@method_decorator(gzip_page, name='dispatch')
 class TransactionHistoryView(APIView):
     permission_classes = [IsAuthenticated]
 
@@ -290,10 +430,195 @@ class TransactionHistoryView(APIView):
         except MpesaAccount.DoesNotExist:
             return Response({'error': 'Account not found'}, status=status.HTTP_404_NOT_FOUND)
 
-        limit = int(request.query_params.get('limit', 10))
-        transactions = account.transactions.all()[:limit]
-        serializer = TransactionSerializer(transactions, many=True)
+        # Pagination: ?limit=N with either ?cursor=<id> (rows older than that
+        # transaction, stable while new rows arrive) or ?offset=N.
+        # ?since=<created_at> limits the result to rows at or after that time,
+        # so a client with a local cache only downloads what it has not seen.
+        since = request.query_params.get('since')
+        if since:
+            since = parse_datetime(since)
+            if since is None:
+                return Response({'error': 'since must be an ISO-8601 datetime'},
+                                status=status.HTTP_400_BAD_REQUEST)
+        try:
+            limit = min(max(int(request.query_params.get('limit', 10)), 1), MAX_HISTORY_PAGE)
+            offset = max(int(request.query_params.get('offset', 0)), 0)
+            cursor = request.query_params.get('cursor')
+            cursor = int(cursor) if cursor else None
+        except ValueError:
+            return Response({'error': 'limit, offset and cursor must be integers'},
+                            status=status.HTTP_400_BAD_REQUEST)
+
+        # Rows are never edited, only added: the newest id and the count
+        # identify every page, so an unchanged page costs one aggregate
+        latest = account.transactions.aggregate(n=Count('id'), last=Max('id'),
+                                                at=Max('created_at'))
+        headers, not_modified = conditional(
+            request, f"{account.id}|{request.get_full_path()}|{latest['n']}|{latest['last']}",
+            latest['at'])
+        if not_modified:
+            return not_modified
+
+        transactions = account.transactions.order_by('-created_at', '-id')
+        if cursor is not None:
+            transactions = transactions.filter(id__lt=cursor)
+        if since:
+            transactions = transactions.filter(created_at__gte=since)
+        page = list(transactions[offset:offset + limit + 1])
+        has_more = len(page) > limit
+        page = page[:limit]
+
+        serializer = TransactionSerializer(page, many=True)
         return Response({
-            'count': account.transactions.count(),
-            'transactions': serializer.data
-        })
\ No newline at end of file
+            'count': latest['n'],
+            'transactions': serializer.data,
+            'next_cursor': page[-1].id if has_more else None,
+        }, headers=headers)
+
+
+@method_decorator(gzip_page, name='dispatch')
+class BatchView(APIView):
+    """
+    Several API calls in one round-trip, for clients on slow links:
+
+        POST {"requests": [{"method": "GET", "path": "/api/balance/"},
+                           {"method": "POST", "path": "/api/send/", "body": {...}}]}
+        -> {"responses": [{"status": 200, "body": {...}}, ...]}
+
+    Calls run in order through the normal views with the caller's
+    Authorization header, so each one is authenticated, validated and
+    committed exactly as if it had been sent on its own. One failing
+    call does not stop the rest.
+
+    Replies (and history pages) are gzipped for clients that ask; both
+    are mostly repeated keys. Nothing carrying a token is compressed.
+    """
+    permission_classes = [IsAuthenticated]
+
+    def post(self, request):
+        calls = request.data.get('requests')
+        if not isinstance(calls, list) or not calls:
+            return Response({'error': 'requests must be a non-empty list'},
+                            status=status.HTTP_400_BAD_REQUEST)
+        if len(calls) > MAX_BATCH_CALLS:
+            return Response({'error': f'At most {MAX_BATCH_CALLS} requests per batch'},
+                            status=status.HTTP_400_BAD_REQUEST)
+        return Response({'responses': [self.run_call(request, c) for c in calls]})
+
+    def run_call(self, request, call):
+        if not isinstance(call, dict):
+            return {'status': 400, 'body': {'error': 'Each request must be an object'}}
+        method = str(call.get('method', 'GET')).upper()
+        path = call.get('path')
+        # Only the account API: no nested batches, no login/logout/refresh,
+        # no event streams
+        if (not isinstance(path, str) or not path.startswith('/api/')
+                or path.startswith(('/api/batch/', '/api/auth/', '/api/events/'))):
+            return {'status': 400, 'body': {'error': 'Path not allowed in a batch'}}
+        route, _, query = path.partition('?')
+        try:
+            match = resolve(route)
+        except Resolver404:
+            return {'status': 404, 'body': {'detail': 'Not found.'}}
+
+        body = json.dumps(call.get('body') or {}).encode()
+        sub = HttpRequest()
+        sub.method = method
+        sub.path = sub.path_info = route
+        sub.META = {
+            **request.META,
+            'REQUEST_METHOD': method,
+            'PATH_INFO': route,
+            'QUERY_STRING': query,
+            'CONTENT_TYPE': 'application/json',
+            'CONTENT_LENGTH': str(len(body)),
+        }
+        sub.GET = QueryDict(query)
+        sub._stream = io.BytesIO(body)
+        sub._read_started = False
+
+        response = match.func(sub, *match.args, **match.kwargs)
+        data = getattr(response, 'data', None)
+        if data is None:
+            data = json.loads(response.content or b'{}')
+        return {'status': response.status_code, 'body': data}
+
+
+class EventStreamRenderer(BaseRenderer):
+    """Lets clients ask for text/event-stream; errors still go out as JSON."""
+    media_type = 'text/event-stream'
+    format = 'event-stream'
+
+    def render(self, data, accepted_media_type=None, renderer_context=None):
+        return json.dumps(data).encode()
+
+
+def sse(event, event_id, data):
+    return f"id: {event_id}\nevent: {event}\ndata: {json.dumps(data)}\n\n"
+
+
+class EventStreamView(APIView):
+    """
+    Balance and transaction notifications as Server-Sent Events, so the
+    terminal client no longer polls /api/balance/:
+
+        GET /api/events/?after=<transaction id>     (or Last-Event-ID)
+        -> event: balance   data: {"balance": "...", "currency": "KES"}
+           event: txn       data: <TransactionSerializer row>
+
+    Every account row newer than `after` is sent oldest first, each with
+    its id as the event id, followed by the balance it leaves. Without
+    `after` the stream starts at the newest row. A client that reconnects
+    with the last id it saw misses nothing and gets nothing twice.
+
+    Rows are found by polling the database once every EVENTS_POLL_S per
+    open stream; ids only grow and rows are never edited. A stream ends
+    after EVENTS_MAX_S so a worker thread is never held for good.
+    """
+    permission_classes = [IsAuthenticated]
+    renderer_classes = [EventStreamRenderer, JSONRenderer]
+
+    def get(self, request):
+        try:
+            account = request.user.mpesa_account
+        except MpesaAccount.DoesNotExist:
+            return Response({'error': 'Account not found'}, status=status.HTTP_404_NOT_FOUND)
+        after = request.query_params.get('after') or request.META.get('HTTP_LAST_EVENT_ID')
+        try:
+            after = int(after) if after else None
+        except ValueError:
+            return Response({'error': 'after must be an integer'},
+                            status=status.HTTP_400_BAD_REQUEST)
+        if after is None:
+            after = account.transactions.aggregate(last=Max('id'))['last'] or 0
+
+        response = StreamingHttpResponse(self.events(account.pk, after),
+                                         content_type='text/event-stream')
+        response['Cache-Control'] = 'no-cache'
+        response['X-Accel-Buffering'] = 'no'       # nginx: pass each event on at once
+        return response
+
+    def events(self, account_pk, after):
+        try:
+            yield 'retry: 3000\n\n'
+            started = quiet = time.monotonic()
+            first = True
+            while time.monotonic() - started < EVENTS_MAX_S:
+                rows = list(Transaction.objects.filter(account_id=account_pk, id__gt=after)
+                            .order_by('id')[:EVENTS_BATCH])
+                for row in rows:
+                    after = row.id
+                    yield sse('txn', row.id, TransactionSerializer(row).data)
+                if rows or first:
+                    balance = MpesaAccount.objects.values_list('balance', flat=True).get(pk=account_pk)
+                    yield sse('balance', after, {'balance': str(balance), 'currency': 'KES'})
+                    quiet = time.monotonic()
+                    first = False
+                    if len(rows) == EVENTS_BATCH:
+                        continue
+                elif time.monotonic() - quiet >= EVENTS_KEEPALIVE_S:
+                    yield ': keep-alive\n\n'
+                    quiet = time.monotonic()
+                time.sleep(EVENTS_POLL_S)
+        finally:
+            connection.close()                      # this thread's, held for the whole stream
@@ -0,0 +1,165 @@
+/**
+ * ============================================
+ *   api_batch.h - several API calls, one round-trip
+ * ============================================
+ *
+ *  RequestBatch queues logical calls and sends them
+ *  as one POST /api/batch/ (BatchView in the backend).
+ *  Each call's status and body are copied back into
+ *  the caller's own HttpResponse / HistoryPage, so the
+ *  code reading them is the same as for a direct
+ *  request:
+ *
+ *      HttpResponse bal;
+ *      HistoryPage  recent;
+ *      RequestBatch b(token);
+ *      b.add("GET", "/api/balance/", "", &bal);
+ *      b.add_history("", 3, &recent);
+ *      g_async.submit(&b);          // or b.send(g_http)
+ *      b.wait();
+ *
+ *  Queued bodies must be JSON objects (every request
+ *  body in this client is). A server without the batch
+ *  endpoint answers 404; the calls then go out one by
+ *  one and batching stays off for the rest of the run.
+ * ============================================
+ */
+#ifndef MPESA_API_BATCH_H
+#define MPESA_API_BATCH_H
+
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include "http_pool.h"
+#include "json.h"
+#include "history.h"
+#include "transactions.h"
+#include "async.h"
+
+class RequestBatch : public AsyncTask {
+public:
+    enum { MAX_CALLS = 20 };                // MAX_BATCH_CALLS in views.py
+
+    explicit RequestBatch(const std::string& token) : token_(token), round_trips_(0), cancel_(NULL) {}
+    ~RequestBatch() { wait(); }
+
+    // Queue a call; *out is filled in by send()
+    void add(const std::string& method, const std::string& path, const std::string& body,
+             HttpResponse* out) {
+        Call c;
+        c.method = method; c.path = path; c.body = body;
+        c.response = out;
+        calls_.push_back(c);
+    }
+
+    void add_history(const std::string& cursor, int limit, HistoryPage* out) {
+        Call c;
+        c.method = HistoryEndpoint::method(); c.path = history_path(cursor, limit);
+        c.cursor = cursor; c.limit = limit;
+        c.page = out;
+        calls_.push_back(c);
+    }
+
+    // Not synchronised: set once before send(). cancel() stops the calls left.
+    void set_cancel(CancelToken* cancel) { cancel_ = cancel; }
+
+    size_t size() const        { return calls_.size(); }
+    int    round_trips() const { return round_trips_; }
+
+    // One POST per MAX_CALLS calls; one request per call if batching is off
+    void send(HttpPool& http) {
+        round_trips_ = 0;
+        for (size_t i = 0; i < calls_.size(); i += MAX_CALLS) {
+            size_t n = calls_.size() - i < (size_t)MAX_CALLS ? calls_.size() - i : (size_t)MAX_CALLS;
+            if (n == 1 || disabled()) { send_each(http, i, n); continue; }
+
+            const HttpRoute& route = endpoint_route<BatchEndpoint>();
+            std::string body = encode(i, n);
+            HttpResponse r = http.request(route, body.data(), body.size(), token_, NULL, cancel_);
+            round_trips_++;
+            if (r.status_code == 404) {     // older server: nothing ran, send them singly
+                disabled() = true;
+                send_each(http, i, n);
+            } else if (r.status_code != 200) {
+                for (size_t k = i; k < i + n; k++) deliver(calls_[k], r.status_code, r.body.data(), r.body.size());
+            } else if (!decode(r.body, i, n)) {
+                static const std::string bad = "{\"error\":\"Malformed batch response\"}";
+                for (size_t k = i; k < i + n; k++) deliver(calls_[k], 0, bad.data(), bad.size());
+            }
+        }
+    }
+
+    void run(HttpPool& http) { send(http); }
+
+private:
+    struct Call {
+        std::string   method, path, body;
+        std::string   cursor;              // history calls, for the unbatched path
+        int           limit;
+        HttpResponse* response;
+        HistoryPage*  page;
+
+        Call() : limit(0), response(NULL), page(NULL) {}
+    };
+
+    static volatile bool& disabled() {
+        static volatile bool off = false;
+        return off;
+    }
+
+    std::string encode(size_t first, size_t n) const {
+        std::string out = "{\"requests\":[";
+        for (size_t k = first; k < first + n; k++) {
+            const Call& c = calls_[k];
+            if (k > first) out += ",";
+            out += "{\"method\":\"";  json_escape_into(out, c.method);
+            out += "\",\"path\":\"";  json_escape_into(out, c.path);
+            out += "\"";
+            if (!c.body.empty()) { out += ",\"body\":"; out += c.body; }
+            out += "}";
+        }
+        out += "]}";
+        return out;
+    }
+
+    // {"responses":[{"status":200,"body":{...}}, ...]}, same order as sent
+    bool decode(const std::string& body, size_t first, size_t n) {
+        JsonIndex j(body);
+        uint32_t arr = j.find(j.root(), "responses");
+        if (arr == JsonIndex::NONE || j.array_size(arr) != n) return false;
+        size_t k = first;
+        for (uint32_t e = j.first_child(arr); e != JsonIndex::NONE; e = j.next_sibling(e), k++) {
+            size_t len;
+            const char* p = j.raw(j.find(e, "body"), len);
+            int status = atoi(j.str(j.find(e, "status")).c_str());
+            deliver(calls_[k], status, p ? p : "{}", p ? len : 2);
+        }
+        return true;
+    }
+
+    void send_each(HttpPool& http, size_t first, size_t n) {
+        for (size_t k = first; k < first + n; k++) {
+            const Call& c = calls_[k];
+            if (c.page) fetch_history_page(http, token_, c.cursor, c.limit, *c.page);
+            else        *c.response = http.request(HttpRoute(c.method, c.path), c.body.data(), c.body.size(),
+                                                   token_, NULL, cancel_);
+            round_trips_++;
+        }
+    }
+
+    static void deliver(const Call& c, int status, const char* p, size_t n) {
+        if (c.page) { parse_history_page(status, p, n, *c.page); return; }
+        c.response->status_code = status;
+        c.response->body.assign(p, n);
+    }
+
+    RequestBatch(const RequestBatch&);
+    RequestBatch& operator=(const RequestBatch&);
+
+    std::string       token_;
+    std::vector<Call> calls_;
+    int               round_trips_;
+    CancelToken*      cancel_;
+};
+
+#endif // MPESA_API_BATCH_H
@@ -0,0 +1,174 @@
+/**
+ * ============================================
+ *   async.h - request queue + worker pool
+ * ============================================
+ *
+ *  AsyncClient owns a fixed set of worker threads
+ *  that pull AsyncTasks off a FIFO queue and run them
+ *  against the shared HttpPool. Independent requests
+ *  (e.g. balance + recent history after login) then
+ *  overlap instead of running back-to-back, and the UI
+ *  thread only blocks when it actually needs a result.
+ *
+ *  A task is its own future:
+ *
+ *      HttpCall bal("GET", "/api/balance/", "", token);
+ *      HistoryCall recent(token, "", 5);
+ *      g_async.submit(&bal);
+ *      g_async.submit(&recent);
+ *      ...                        // UI keeps going
+ *      bal.wait();                // or bal.done() / wait_ms()
+ *
+ *  Override on_done() for a callback; it runs on the
+ *  worker thread. Tasks are owned by the caller and
+ *  must stay alive until done: the concrete tasks
+ *  below wait in their destructors.
+ * ============================================
+ */
+#ifndef MPESA_ASYNC_H
+#define MPESA_ASYNC_H
+
+#include <string>
+#include <deque>
+#include "platform.h"
+#include "http_pool.h"
+#include "history.h"
+
+// --- Task ---------------------------------------------------------------------
+class AsyncTask {
+public:
+    AsyncTask() { done_.set(); }           // nothing pending until submitted
+    virtual ~AsyncTask() {}
+
+    virtual void run(HttpPool& http) = 0;   // worker thread
+    virtual void on_done() {}               // worker thread, after run()
+
+    bool done()               { return done_.is_set(); }
+    void wait()               { done_.wait(); }
+    bool wait_ms(unsigned ms) { return done_.wait_ms(ms); }
+
+private:
+    friend class AsyncClient;
+    AsyncTask(const AsyncTask&);
+    AsyncTask& operator=(const AsyncTask&);
+
+    Event done_;
+};
+
+// One HTTP request; the result lands in `response`
+class HttpCall : public AsyncTask {
+public:
+    HttpCall(const std::string& method, const std::string& path,
+             const std::string& body, const std::string& token)
+        : method_(method), path_(path), body_(body), token_(token) {}
+    ~HttpCall() { wait(); }
+
+    void run(HttpPool& http) { response = http.request(method_, path_, body_, token_); }
+
+    HttpResponse response;
+
+private:
+    std::string method_, path_, body_, token_;
+};
+
+// One streamed history page (see history.h)
+class HistoryCall : public AsyncTask {
+public:
+    HistoryCall(const std::string& token, const std::string& cursor, int limit)
+        : token_(token), cursor_(cursor), limit_(limit) {}
+    ~HistoryCall() { wait(); }
+
+    void run(HttpPool& http) { fetch_history_page(http, token_, cursor_, limit_, page); }
+
+    HistoryPage page;
+
+private:
+    std::string token_, cursor_;
+    int         limit_;
+};
+
+// --- Worker pool --------------------------------------------------------------
+class AsyncClient {
+public:
+    AsyncClient(HttpPool& http, int workers)
+        : http_(http), n_(workers < 1 ? 1 : workers), threads_(NULL), started_(false) {}
+    ~AsyncClient() { stop(); }
+
+    // Queue a task. Workers start on first use, so a client that never
+    // submits anything never creates threads. Without threads the task
+    // runs inline and is done on return.
+    void submit(AsyncTask* t) {
+        t->done_.reset();
+        if (!start()) { execute(t); return; }
+        {
+            LockGuard lock(mu_);
+            queue_.push_back(t);
+        }
+        items_.post();
+    }
+
+    // Let queued tasks finish, then join the workers
+    void stop() {
+        {
+            LockGuard lock(mu_);
+            if (!started_) return;
+            for (int i = 0; i < n_; i++) queue_.push_back(NULL);   // one stop marker each
+        }
+        for (int i = 0; i < n_; i++) items_.post();
+        for (int i = 0; i < n_; i++) threads_[i].join();
+        delete[] threads_;
+        threads_ = NULL;
+        LockGuard lock(mu_);
+        queue_.clear();
+        started_ = false;
+    }
+
+    int workers() const { return n_; }
+
+private:
+    bool start() {
+        LockGuard lock(mu_);
+        if (started_) return true;
+        threads_ = new Thread[n_];
+        int ok = 0;
+        while (ok < n_ && threads_[ok].start(worker, this)) ok++;
+        if (ok == 0) { delete[] threads_; threads_ = NULL; return false; }
+        n_ = ok;                     // run with however many threads started
+        started_ = true;
+        return true;
+    }
+
+    static void worker(void* self) {
+        AsyncClient* c = (AsyncClient*)self;
+        for (;;) {
+            c->items_.wait();
+            AsyncTask* t;
+            {
+                LockGuard lock(c->mu_);
+                t = c->queue_.front();
+                c->queue_.pop_front();
+            }
+            if (!t) return;
+            c->execute(t);
+        }
+    }
+
+    void execute(AsyncTask* t) {
+        t->run(http_);
+        t->on_done();
+        t->done_.set();              // last touch: the owner may free t now
+    }
+
+    AsyncClient(const AsyncClient&);
+    AsyncClient& operator=(const AsyncClient&);
+
+    HttpPool&               http_;
+    int                     n_;
+    Thread*                 threads_;
+    bool                    started_;
+    Mutex                   mu_;
+    Semaphore               items_;
+    std::deque<AsyncTask*>  queue_;
+};
+
+#endif // MPESA_ASYNC_H
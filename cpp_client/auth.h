@@ -0,0 +1,314 @@
+/**
+ * ============================================
+ *   auth.h - JWT session with proactive refresh
+ * ============================================
+ *
+ *  TokenManager holds the access / refresh pair from
+ *  /api/auth/login/ and keeps the access token valid
+ *  without another password round-trip:
+ *
+ *      TokenManager g_auth(g_http);
+ *      g_auth.set(j.get("access"), j.get("refresh"));
+ *      ...
+ *      g_auth.request("GET", "/api/balance/", "");
+ *      post_txn(g_http, g_auth.access_token(), req);
+ *
+ *  The token's iat/exp claims are decoded locally
+ *  and turned into a monotonic deadline, so a skewed
+ *  terminal clock does not matter. A background
+ *  thread calls /api/auth/refresh/ once 80% of the
+ *  lifetime has passed. access_token() refreshes
+ *  inline only if that renewal has not landed by the
+ *  time the token is about to expire, and request()
+ *  retries once when the server rejects the token
+ *  (a 401 for a wrong PIN is an answer, not that).
+ *
+ *  Refreshes are single-flight: however many threads
+ *  find the same stale token, one request goes out
+ *  and the rest wait for its result.
+ * ============================================
+ */
+#ifndef MPESA_AUTH_H
+#define MPESA_AUTH_H
+
+#include <string>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "json.h"
+#include "json_writer.h"
+#include "endpoints.h"
+
+// --- JWT claims ---------------------------------------------------------------
+inline bool base64url_decode(const char* p, size_t n, std::string& out) {
+    out.clear();
+    uint32_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        char c = p[i];
+        int v;
+        if      (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-' || c == '+') v = 62;
+        else if (c == '_' || c == '/') v = 63;
+        else if (c == '=')             break;
+        else return false;
+        acc = (acc << 6) | (uint32_t)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += (char)((acc >> bits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+// iat / exp (seconds since the epoch) from the payload; the signature is
+// the server's business. 0 for a claim that is missing.
+inline bool jwt_claims(const std::string& token, int64_t& iat, int64_t& exp) {
+    iat = exp = 0;
+    size_t a = token.find('.');
+    size_t b = a == std::string::npos ? a : token.find('.', a + 1);
+    if (b == std::string::npos) return false;
+    std::string payload;
+    if (!base64url_decode(token.data() + a + 1, b - a - 1, payload)) return false;
+    JsonIndex j(payload);
+    std::string v = j.get(j.root(), "iat");
+    if (!v.empty()) iat = (int64_t)strtod(v.c_str(), NULL);
+    v = j.get(j.root(), "exp");
+    if (!v.empty()) exp = (int64_t)strtod(v.c_str(), NULL);
+    return exp > 0;
+}
+
+// Local deadlines for an access token received now: stale_ns once it is
+// about to expire, renew_ns after renew_percent of its lifetime. Both on the
+// now_ns() clock, so a skewed terminal clock does not matter; 0 for an
+// opaque token, which is then only replaced after a 401.
+inline void jwt_deadlines(const std::string& access, int renew_percent,
+                          uint64_t& stale_ns, uint64_t& renew_ns) {
+    enum { EXPIRY_SLACK_S = 5 };                // treat this close to exp as expired (max)
+    stale_ns = renew_ns = 0;
+    int64_t iat, exp;
+    if (!jwt_claims(access, iat, exp)) return;
+    int64_t life = iat ? exp - iat : exp - (int64_t)time(NULL);
+    if (life <= 0) return;
+    uint64_t now = now_ns();
+    uint64_t slack = (uint64_t)life * 100000000ULL;            // 10%, capped
+    if (slack > (uint64_t)EXPIRY_SLACK_S * 1000000000ULL) slack = (uint64_t)EXPIRY_SLACK_S * 1000000000ULL;
+    stale_ns = now + (uint64_t)life * 1000000000ULL - slack;
+    renew_ns = now + (uint64_t)life * renew_percent / 100 * 1000000000ULL;
+}
+
+// A 401 from authentication itself: the access token is missing, expired
+// or revoked, and a refresh may help. The views answer 401 for a wrong PIN
+// too, with an "error" as their own refusals have; DRF and simplejwt say
+// "detail". Only the former is final.
+inline bool token_rejected(const HttpResponse& r) {
+    if (r.status_code != 401) return false;
+    JsonIndex j(r.body);
+    return j.find(j.root(), "error") == JsonIndex::NONE;
+}
+
+// --- Token pair ---------------------------------------------------------------
+// The renewal schedule and refresh step TokenManager and SessionManager
+// (sessions.h) share; each adds its own locking and single flight.
+enum {
+    TOKEN_RENEW_PERCENT = 80,      // of the lifetime, then refresh in the background
+    TOKEN_RETRY_S       = 30       // after a failed background refresh
+};
+
+struct TokenPair {
+    std::string access, refresh;
+    uint64_t    stale_ns, renew_ns;    // now_ns() clock; 0 = unknown
+    bool        dead;                  // the server refused the refresh token
+
+    TokenPair() : stale_ns(0), renew_ns(0), dead(false) {}
+
+    void install(const std::string& tok) {
+        access = tok;
+        jwt_deadlines(tok, TOKEN_RENEW_PERCENT, stale_ns, renew_ns);
+    }
+
+    // access is good to send now, with no refresh first
+    bool usable(uint64_t now) const { return !access.empty() && (!stale_ns || now < stale_ns); }
+};
+
+// POST the refresh token; no lock held. The answer is for rotate_tokens().
+inline HttpResponse request_refresh(HttpPool& http, const HttpRoute& route, const std::string& refresh) {
+    RefreshRequest req;
+    req.refresh = refresh;
+    JsonBody<1024> body;
+    json_encode(body, req);
+    return http.request(route, body.data(), body.size(), "");
+}
+
+// Apply a refresh answer, under the owner's lock: the new access token and
+// the rotated refresh token (ROTATE_REFRESH_TOKENS); dead on a 401, else
+// another try in TOKEN_RETRY_S. True if renewed.
+inline bool rotate_tokens(TokenPair& t, const HttpResponse& r) {
+    RefreshReply reply;
+    if (json_decode(r.body, reply) && r.status_code == 200) {
+        if (!reply.refresh.empty()) t.refresh = reply.refresh;
+        t.install(reply.access);
+        return true;
+    }
+    if (r.status_code == 401) t.dead = true;   // refresh token expired or blacklisted
+    else t.renew_ns = now_ns() + (uint64_t)TOKEN_RETRY_S * 1000000000ULL;
+    return false;
+}
+
+// --- Token source -------------------------------------------------------------
+// Tokens for a background worker acting for one login (outbox.h, events.h):
+// the UI lends a session, batch mode and the benchmarks their own
+class TokenSource {
+public:
+    virtual ~TokenSource() {}
+    virtual std::string token() = 0;
+    virtual bool refresh(const std::string& stale) = 0;   // true if a new token came
+};
+
+// --- Token manager ------------------------------------------------------------
+class TokenManager {
+public:
+    explicit TokenManager(HttpPool& http, const std::string& path = RefreshEndpoint::path())
+        : http_(http), route_("POST", path), refreshing_(false), refreshes_(0) {
+        idle_.set();
+    }
+    ~TokenManager() { clear(); }
+
+    // After login. Starts the renewal thread on first use.
+    void set(const std::string& access, const std::string& refresh) {
+        {
+            LockGuard lock(mu_);
+            tokens_.refresh = refresh;
+            tokens_.dead = false;
+            tokens_.install(access);
+        }
+        if (!renewer_.running()) {
+            stop_.reset();
+            renewer_.start(renew_loop, this);    // no thread: inline refresh still works
+        }
+    }
+
+    // Logout: stop renewing and forget both tokens
+    void clear() {
+        stop_.set();
+        renewer_.join();
+        idle_.wait();                            // let an in-flight refresh land first
+        LockGuard lock(mu_);
+        tokens_ = TokenPair();
+    }
+
+    // A token that is not about to expire if one can be had; otherwise
+    // the last one, and the server answers 401.
+    std::string access_token() {
+        std::string tok;
+        {
+            LockGuard lock(mu_);
+            tok = tokens_.access;
+            if (tok.empty() || tokens_.usable(now_ns())) return tok;
+        }
+        refresh(tok);
+        LockGuard lock(mu_);
+        return tokens_.access;
+    }
+
+    std::string refresh_token() {
+        LockGuard lock(mu_);
+        return tokens_.refresh;
+    }
+
+    // The server refused the refresh token: only a new login helps
+    bool expired() {
+        LockGuard lock(mu_);
+        return tokens_.dead;
+    }
+
+    uint64_t refreshes() {
+        LockGuard lock(mu_);
+        return refreshes_;
+    }
+
+    // Replace `stale` with a fresh access token. Callers that arrive while
+    // a refresh is in flight wait for it instead of sending their own.
+    // True if the current token differs from `stale`.
+    bool refresh(const std::string& stale) {
+        std::string rt;
+        {
+            LockGuard lock(mu_);
+            if (tokens_.access != stale) return !tokens_.access.empty();
+            if (tokens_.dead || tokens_.refresh.empty()) return false;
+            if (!refreshing_) {
+                refreshing_ = true;
+                idle_.reset();
+                rt = tokens_.refresh;
+            }
+        }
+        if (rt.empty()) {                        // someone else is refreshing
+            idle_.wait();
+            LockGuard lock(mu_);
+            return tokens_.access != stale && !tokens_.access.empty();
+        }
+
+        HttpResponse r = request_refresh(http_, route_, rt);
+        LockGuard lock(mu_);
+        bool renewed = rotate_tokens(tokens_, r);
+        if (renewed) refreshes_++;
+        refreshing_ = false;
+        idle_.set();
+        return renewed;
+    }
+
+    // Authenticated request; a rejected token triggers one refresh and one retry
+    HttpResponse request(const std::string& method, const std::string& path, const std::string& body) {
+        return request(HttpRoute(method, path), body.data(), body.size());
+    }
+
+    HttpResponse request(const HttpRoute& route, const char* body, size_t body_len,
+                         CancelToken* cancel = NULL) {
+        std::string tok = access_token();
+        HttpResponse r = http_.request(route, body, body_len, tok, NULL, cancel);
+        if (token_rejected(r) && !tok.empty() && refresh(tok))
+            r = http_.request(route, body, body_len, access_token(), NULL, cancel);
+        return r;
+    }
+
+private:
+    static void renew_loop(void* self) {
+        TokenManager* t = (TokenManager*)self;
+        for (;;) {
+            std::string stale;
+            unsigned wait = 60000;
+            {
+                LockGuard lock(t->mu_);
+                uint64_t now = now_ns();
+                const TokenPair& k = t->tokens_;
+                if (k.renew_ns && !k.dead && !k.refresh.empty()) {
+                    if (now >= k.renew_ns) stale = k.access;
+                    else if (k.renew_ns - now < 60000ULL * 1000000ULL)
+                        wait = (unsigned)((k.renew_ns - now) / 1000000ULL) + 1;
+                }
+            }
+            if (!stale.empty()) { t->refresh(stale); continue; }
+            if (t->stop_.wait_ms(wait)) return;
+        }
+    }
+
+    TokenManager(const TokenManager&);
+    TokenManager& operator=(const TokenManager&);
+
+    HttpPool&    http_;
+    HttpRoute    route_;
+    Mutex        mu_;
+    TokenPair    tokens_;
+    bool         refreshing_;
+    uint64_t     refreshes_;
+    Event        idle_;                      // set while no refresh is in flight
+    Event        stop_;
+    Thread       renewer_;
+};
+
+#endif // MPESA_AUTH_H
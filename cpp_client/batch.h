@@ -0,0 +1,343 @@
+/**
+ * ============================================
+ *   batch.h - headless bulk send/deposit/withdraw
+ * ============================================
+ *
+ *  mpesa.exe --batch payroll.csv --user alice
+ *            [--password PW] [--pin PIN]
+ *            [--out results.jsonl] [--concurrency N]
+ *            [--metrics FILE.prom | FILE.json]
+ *
+ *  Input is CSV (header row required) or JSONL
+ *  (.jsonl / .json), one operation per row:
+ *
+ *      type,recipient_phone,amount,pin,description,reference
+ *      SEND,0722000001,1500.00,,March wages,
+ *      DEPOSIT,,20000,,,float top-up
+ *
+ *      {"type":"SEND","recipient_phone":"0722000001","amount":1500}
+ *
+ *  Missing pin columns fall back to --pin / MPESA_PIN,
+ *  the password to MPESA_PASSWORD. Every row goes
+ *  through post_txn() (transactions.h), the same path
+ *  the menus use, with up to N requests in flight over
+ *  one keep-alive pool. The access token is renewed as
+ *  the run goes (auth.h), so long files need one login.
+ *  One JSON result line per row is appended to the log
+ *  as it completes (in completion order; "line" ties it
+ *  back to the input).
+ *
+ *  MPESA_RECORD / MPESA_REPLAY record the run to a
+ *  trace or replay it from one (trace.h).
+ *
+ *  Exit code: 0 all rows OK, 1 some rows failed,
+ *  2 bad arguments / unreadable input / login failed.
+ * ============================================
+ */
+#ifndef MPESA_BATCH_H
+#define MPESA_BATCH_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "json.h"
+#include "transactions.h"
+#include "metrics.h"
+#include "auth.h"
+#include "config.h"
+#include "trace.h"
+#include "endpoints.h"
+
+// --- Input --------------------------------------------------------------------
+struct BatchOp {
+    size_t      line;              // 1-based line in the input file
+    TxnRequest  req;
+    std::string error;             // set if the row could not be parsed
+
+    BatchOp() : line(0) {}
+};
+
+inline std::string batch_trim(const std::string& s) {
+    size_t b = 0, e = s.size();
+    while (b < e && (s[b] == ' ' || s[b] == '\t')) b++;
+    while (e > b && (s[e-1] == ' ' || s[e-1] == '\t' || s[e-1] == '\r' || s[e-1] == '\n')) e--;
+    return s.substr(b, e - b);
+}
+
+// One CSV record; "quoted, fields" with "" for a literal quote
+inline void split_csv(const std::string& line, std::vector<std::string>& out) {
+    out.clear();
+    std::string f;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i+1] == '"') { f += '"'; i++; }
+            else if (c == '"') quoted = false;
+            else f += c;
+        } else if (c == '"') quoted = true;
+        else if (c == ',') { out.push_back(batch_trim(f)); f.clear(); }
+        else f += c;
+    }
+    out.push_back(batch_trim(f));
+}
+
+// Fills op.req from named fields; records the first problem in op.error
+inline void batch_fill(BatchOp& op, const std::string& type, const std::string& phone,
+                       const std::string& amount, const std::string& pin,
+                       const std::string& desc, const std::string& ref,
+                       const std::string& default_pin) {
+    if (!parse_txn_type(type, op.req.type)) { op.error = "unknown type '" + type + "'"; return; }
+    if (!Money::parse(amount, op.req.amount) || !op.req.amount.positive()) {
+        op.error = "invalid amount '" + amount + "'";
+        return;
+    }
+    op.req.recipient_phone = phone;
+    op.req.pin             = pin.empty() ? default_pin : pin;
+    op.req.description     = desc;
+    op.req.reference       = ref;
+    if (op.req.type == TXN_SEND && phone.empty()) { op.error = "recipient_phone is required"; return; }
+    if (op.req.type != TXN_DEPOSIT && op.req.pin.empty()) op.error = "pin is required (column or --pin)";
+}
+
+inline bool load_batch_file(const std::string& path, const std::string& default_pin,
+                            std::vector<BatchOp>& ops, std::string& error) {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in) { error = "cannot open " + path; return false; }
+
+    size_t dot = path.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : path.substr(dot);
+    bool jsonl = ext == ".jsonl" || ext == ".json" || ext == ".JSONL" || ext == ".JSON";
+
+    std::string line;
+    std::vector<std::string> header, f;
+    size_t n = 0;
+    JsonIndex j;
+    while (std::getline(in, line)) {
+        n++;
+        line = batch_trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        if (jsonl) {
+            BatchOp op;
+            op.line = n;
+            j.parse(line);
+            if (!j.ok()) op.error = "invalid JSON";
+            else {
+                // amount may be a number or a string
+                uint32_t r = j.root();
+                batch_fill(op, j.get(r, "type"), j.get(r, "recipient_phone"), j.get(r, "amount"),
+                           j.get(r, "pin"), j.get(r, "description"), j.get(r, "reference"), default_pin);
+            }
+            ops.push_back(op);
+            continue;
+        }
+
+        if (header.empty()) {
+            split_csv(line, header);
+            for (size_t i = 0; i < header.size(); i++)
+                for (size_t k = 0; k < header[i].size(); k++)
+                    header[i][k] = (char)tolower((unsigned char)header[i][k]);
+            bool has_type = false, has_amount = false;
+            for (size_t i = 0; i < header.size(); i++) {
+                if (header[i] == "type")   has_type = true;
+                if (header[i] == "amount") has_amount = true;
+                if (header[i] == "phone")  header[i] = "recipient_phone";
+            }
+            if (!has_type || !has_amount) { error = "CSV header must name at least 'type' and 'amount'"; return false; }
+            continue;
+        }
+
+        split_csv(line, f);
+        std::string type, phone, amount, pin, desc, ref;
+        for (size_t i = 0; i < header.size() && i < f.size(); i++) {
+            const std::string& h = header[i];
+            if      (h == "type")            type   = f[i];
+            else if (h == "recipient_phone") phone  = f[i];
+            else if (h == "amount")          amount = f[i];
+            else if (h == "pin")             pin    = f[i];
+            else if (h == "description")     desc   = f[i];
+            else if (h == "reference")       ref    = f[i];
+        }
+        BatchOp op;
+        op.line = n;
+        batch_fill(op, type, phone, amount, pin, desc, ref, default_pin);
+        ops.push_back(op);
+    }
+    return true;
+}
+
+// --- Runner -------------------------------------------------------------------
+struct BatchSummary {
+    size_t   ok, failed;
+    uint64_t elapsed_ms;
+
+    BatchSummary() : ok(0), failed(0), elapsed_ms(0) {}
+};
+
+class BatchRunner {
+public:
+    BatchRunner(HttpPool& http, TokenManager& auth, const std::vector<BatchOp>& ops,
+                FILE* log, int concurrency)
+        : http_(http), auth_(auth), ops_(ops), log_(log),
+          concurrency_(concurrency < 1 ? 1 : concurrency), next_(0), done_(0) {}
+
+    BatchSummary run() {
+        uint64_t t0 = now_ms();
+        int n = concurrency_ < (int)ops_.size() ? concurrency_ : (int)ops_.size();
+        Thread* workers = new Thread[n > 0 ? n : 1];
+        for (int i = 0; i < n; i++)
+            if (!workers[i].start(worker, this)) worker(this);   // no thread: run inline
+        for (int i = 0; i < n; i++) workers[i].join();
+        delete[] workers;
+        summary_.elapsed_ms = now_ms() - t0;
+        fprintf(stderr, "\r  %lu/%lu done\n", (unsigned long)done_, (unsigned long)ops_.size());
+        return summary_;
+    }
+
+private:
+    static void worker(void* self) {
+        BatchRunner* b = (BatchRunner*)self;
+        for (;;) {
+            size_t i;
+            {
+                LockGuard lock(b->mu_);
+                if (b->next_ >= b->ops_.size()) return;
+                i = b->next_++;
+            }
+            const BatchOp& op = b->ops_[i];
+            uint64_t t0 = now_ms();
+            TxnResult res;
+            if (op.error.empty()) res = post_txn(b->http_, b->auth_.access_token(), op.req);
+            else res.error = op.error;
+            b->record(op, res, now_ms() - t0);
+        }
+    }
+
+    void record(const BatchOp& op, const TxnResult& res, uint64_t ms) {
+        char head[96];
+        snprintf(head, sizeof(head), "{\"line\":%lu,\"type\":\"%s\",\"status\":%d,\"ok\":%s",
+                 (unsigned long)op.line, txn_type_name(op.req.type), res.status_code,
+                 res.ok() ? "true" : "false");
+        std::string s = head;
+        s += ",\"transaction_id\":\""; json_escape_into(s, res.transaction_id);
+        s += "\",\"new_balance\":\"";
+        if (res.ok()) {
+            char bal[Money::TEXT_SIZE];
+            s.append(bal, res.new_balance.format(bal));
+        }
+        s += "\",\"error\":\"";        json_escape_into(s, res.error);
+        char tail[48];
+        snprintf(tail, sizeof(tail), "\",\"attempts\":%d,\"ms\":%lu}\n", res.attempts, (unsigned long)ms);
+        s += tail;
+
+        LockGuard lock(mu_);
+        fputs(s.c_str(), log_);
+        fflush(log_);                  // a crash mid-run still leaves a usable log
+        if (res.ok()) summary_.ok++; else summary_.failed++;
+        if (++done_ % 100 == 0)
+            fprintf(stderr, "\r  %lu/%lu done", (unsigned long)done_, (unsigned long)ops_.size());
+    }
+
+    BatchRunner(const BatchRunner&);
+    BatchRunner& operator=(const BatchRunner&);
+
+    HttpPool&                   http_;
+    TokenManager&               auth_;
+    const std::vector<BatchOp>& ops_;
+    FILE*                       log_;
+    int                         concurrency_;
+    Mutex                       mu_;
+    size_t                      next_, done_;
+    BatchSummary                summary_;
+};
+
+// --- Command line -------------------------------------------------------------
+inline bool batch_login(HttpPool& http, const std::string& user, const std::string& pass,
+                        TokenManager& auth, std::string& error) {
+    LoginRequest req;
+    req.username = user;
+    req.password = pass;
+    LoginReply reply;
+    HttpResponse r;
+    if (endpoint_call<LoginEndpoint>(http, "", req, reply, &r)) {
+        auth.set(reply.access, reply.refresh);
+        return true;
+    }
+    error = reply.error;                // also set by the pool when the server is unreachable
+    if (error.empty()) {
+        char buf[48];
+        snprintf(buf, sizeof(buf), "login failed (HTTP %d)", r.status_code);
+        error = buf;
+    }
+    return false;
+}
+
+// conf: mpesa_client.conf as loaded by main(), with at least one server
+inline int batch_main(int argc, char** argv, const ClientConfig& conf) {
+    std::string input, user, out, metrics_file;
+    const char* env_pass = getenv("MPESA_PASSWORD");
+    const char* env_pin  = getenv("MPESA_PIN");
+    std::string pass = env_pass ? env_pass : "";
+    std::string pin  = env_pin  ? env_pin  : "";
+    int concurrency = 8;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if      (a == "--batch"       && has_val) input = argv[++i];
+        else if (a == "--user"        && has_val) user  = argv[++i];
+        else if (a == "--password"    && has_val) pass  = argv[++i];
+        else if (a == "--pin"         && has_val) pin   = argv[++i];
+        else if (a == "--out"         && has_val) out   = argv[++i];
+        else if (a == "--concurrency" && has_val) concurrency = atoi(argv[++i]);
+        else if (a == "--metrics"     && has_val) metrics_file = argv[++i];
+        else { fprintf(stderr, "Unknown or incomplete option: %s\n", a.c_str()); return 2; }
+    }
+    if (input.empty() || user.empty() || pass.empty()) {
+        fprintf(stderr, "Usage: %s --batch FILE --user NAME [--password PW | MPESA_PASSWORD]\n"
+                        "       [--pin PIN | MPESA_PIN] [--out results.jsonl] [--concurrency N]\n"
+                        "       [--metrics FILE.prom | FILE.json]\n", argv[0]);
+        return 2;
+    }
+    if (concurrency < 1)  concurrency = 1;
+    if (concurrency > 64) concurrency = 64;
+    if (out.empty()) out = input + ".results.jsonl";
+
+    std::vector<BatchOp> ops;
+    std::string error;
+    if (!load_batch_file(input, pin, ops, error)) { fprintf(stderr, "[ERROR] %s\n", error.c_str()); return 2; }
+
+    PoolConfig cfg;
+    cfg.max_idle = concurrency;        // every worker keeps its connection warm
+    HttpPool http(conf.servers[0].host, conf.servers[0].port, cfg);
+    http.set_servers(conf.servers, conf.balancer);
+    http.set_timeouts(conf.timeouts);
+    EndpointMetrics metrics;
+    if (!metrics_file.empty()) http.set_observer(&metrics);
+    TraceHook trace(http);             // MPESA_RECORD / MPESA_REPLAY
+    if (!trace.from_env(error)) { fprintf(stderr, "[ERROR] %s\n", error.c_str()); return 2; }
+    TokenManager auth(http);           // long runs outlive one access token
+    if (!batch_login(http, user, pass, auth, error)) { fprintf(stderr, "[ERROR] %s\n", error.c_str()); return 2; }
+
+    FILE* log = fopen(out.c_str(), "wb");
+    if (!log) { fprintf(stderr, "[ERROR] cannot write %s\n", out.c_str()); return 2; }
+
+    fprintf(stderr, "  %lu operations, %d in flight -> %s\n",
+            (unsigned long)ops.size(), concurrency, out.c_str());
+    BatchRunner runner(http, auth, ops, log, concurrency);
+    BatchSummary s = runner.run();
+    fclose(log);
+
+    fprintf(stderr, "  OK: %lu  Failed: %lu  Time: %.1f s\n",
+            (unsigned long)s.ok, (unsigned long)s.failed, (double)s.elapsed_ms / 1000.0);
+    if (!metrics_file.empty() && !metrics.write_file(metrics_file))
+        fprintf(stderr, "[ERROR] cannot write %s\n", metrics_file.c_str());
+    return s.failed ? 1 : 0;
+}
+
+#endif // MPESA_BATCH_H
@@ -0,0 +1,3165 @@
+/**
+ * ============================================
+ *   M-PESA Client Benchmarks
+ * ============================================
+ *
+ *  Build (Linux):
+ *      g++ -std=c++11 -O2 -o bench bench.cpp -lpthread
+ *
+ *  Usage:
+ *      ./bench pool [host] [port] [requests]
+ *          Balance requests through HttpPool with
+ *          keep-alive vs. a fresh connection per call.
+ *          Run against ./mock_server or runserver.
+ *
+ *      ./bench reader
+ *          Replays recorded /api/transactions/ responses
+ *          (1 KB .. 50 MB, Content-Length and chunked)
+ *          through the legacy per-chunk vector loop and
+ *          through ResponseReader. Reports heap allocs,
+ *          peak heap and user-space bytes copied per byte
+ *          of body.
+ *
+ *      ./bench json
+ *          History responses with 10 / 1,000 / 100,000
+ *          rows: the legacy json_get + substr(p, 500) row
+ *          loop vs. one JsonIndex scan and O(1) lookups.
+ *
+ *      ./bench flow [host] [port] [flows]
+ *          Login-then-dashboard (login, balance, recent
+ *          history): strictly sequential, balance and
+ *          history overlapped on AsyncClient, and both
+ *          in one /api/batch/ call (RequestBatch). Reports
+ *          round-trips per flow. Most telling against
+ *          ./mock_server --latency 20.
+ *
+ *      ./bench load [host] [port] [options]
+ *          N virtual terminals, each logged in with its
+ *          own keep-alive connection, running a weighted
+ *          mix of balance/send/deposit/withdraw/history
+ *          through the client's own request path. Reports
+ *          throughput, error rate and p50/p95/p99/p99.9
+ *          per endpoint from HDR-style histograms.
+ *            --terminals N     (default 10)
+ *            --duration S      seconds (default 10)
+ *            --mix balance=40,history=20,send=10,deposit=20,withdraw=10
+ *            --users john,jane --password password123 --pin 1234
+ *            --hdr             full percentile distribution
+ *
+ *      ./bench metrics
+ *          Cost per request of the instrumentation: one
+ *          now_ns() stamp, and EndpointMetrics recording
+ *          from 1 and 4 threads.
+ *
+ *      ./bench money
+ *          Amount parse / format: istringstream and
+ *          ostringstream (what the screens used) and
+ *          snprintf vs. Money, in ns and heap allocs per
+ *          op, plus a million amounts totalled as double
+ *          and as cents.
+ *
+ *      ./bench body
+ *          Builds a send-money request (JSON body,
+ *          request line, headers) the old way and with
+ *          JsonWriter + HttpRoute, counting heap
+ *          allocations. Also checks escaping. Exits 1 if
+ *          the warm path allocates or a check fails.
+ *
+ *      ./bench term
+ *          The main menu and a history page drawn the
+ *          old way (cls + a console call per colour and
+ *          write) and through Screen (terminal.h):
+ *          bytes and write calls for the first frame,
+ *          an unchanged redraw, the next page and each
+ *          key of a PIN.
+ *
+ *      ./bench sessions [host] [port] [sessions] [seconds]
+ *          Logs in N customers on one SessionManager:
+ *          heap per active and per idle session, the
+ *          cost of a switch (select, and select plus
+ *          remapping the history cache), then N x
+ *          balance from 8 threads while tokens renew and
+ *          balances poll in the background, and 8
+ *          threads finding the same dead token. Run
+ *          against ./mock_server --token-ttl 3. Exits 1
+ *          on a failed request or a duplicate refresh.
+ *
+ *      ./bench deadline [host] [port] [requests]
+ *          Deadlines and cancellation (deadline.h): a
+ *          black-hole listener that accepts nothing must
+ *          time out in the receive phase at the route's
+ *          receive_ms, or at total_ms; Esc-style cancel()
+ *          after 100 ms must end the call within
+ *          CANCEL_POLL_MS. Then N balance calls against
+ *          ./mock_server --slow 10:2000 --stall 5
+ *          --trickle 5: no call may outlive total_ms.
+ *          Exits 1 on any violation.
+ *
+ *      ./bench balance [host] [port,port,...] [seconds]
+ *          One HttpPool over the given mock servers plus
+ *          a refused port and a black hole: 8 threads of
+ *          balance calls, p2c balanced. Reports requests,
+ *          failures and ejections per server. Then a
+ *          stand-in server starts on the refused port,
+ *          and the health checker must bring it back.
+ *          Exits 1 if under 99% of calls succeed or the
+ *          server is not brought back.
+ *
+ *      ./bench wire [host] [port] [sessions]
+ *          Bytes on the wire per user session (login,
+ *          history sync, balance polls, history pages,
+ *          a send, a dashboard batch, logout) without
+ *          compression or validators, then with gzip and
+ *          the conditional-GET cache (http_cache.h).
+ *          First checks that plain, gzipped and 304-
+ *          replayed bodies are identical; exits 1 if not.
+ *          Run against ./mock_server --history 2000.
+ *
+ *      ./bench outbox [host] [port] [entries] [kills]
+ *          The offline queue (outbox.h). A torn last
+ *          record must be cut off on open, and 8 threads
+ *          enqueueing must share fsyncs. Then a child
+ *          process queues and flushes deposits and is
+ *          SIGKILLed mid-flush, again and again; every
+ *          restart recovers the log and carries on. Then
+ *          as many again are queued offline and sent in
+ *          groups. Exits 1 unless the server holds each
+ *          acknowledged deposit exactly once. Run against
+ *          its own ./mock_server --latency 5.
+ *
+ *      ./bench events [host] [port] [terminals] [seconds]
+ *          N terminals watch one account while a deposit
+ *          lands every 200 ms: first each polls the
+ *          balance every second, then each follows an
+ *          event stream (events.h). Reports requests,
+ *          bytes and how long a deposit took to reach a
+ *          terminal. Run against ./mock_server
+ *          --stream-max 3 so every stream is reopened
+ *          from its last id a few times. Exits 1 if a
+ *          stream misses, repeats or reorders a deposit.
+ *
+ *      ./bench trace [host] [port] [sessions] [calls]
+ *          Records N user sessions (wire's steps) to a
+ *          trace through TraceRecorder (trace.h), then
+ *          replays them with no server: at full speed,
+ *          at the recorded pace, and repeated up to
+ *          `calls` calls (default 1,000,000) streamed
+ *          from disk. Reports file size per call,
+ *          calls/s and peak heap. Exits 1 if a replayed
+ *          session parses differently, a call goes
+ *          unmatched, a secret reaches the file, heap
+ *          grows with the trace, or a cut-off file loses
+ *          more than its last record.
+ *
+ *      ./bench endpoints
+ *          Balance, login, send and error replies
+ *          decoded field by field with json_get, with
+ *          one reused JsonIndex, and in one pass into
+ *          the endpoint's reply struct (endpoints.h).
+ *          Reports ns and heap allocs per response.
+ *          Exits 1 if the three disagree.
+ *
+ *      ./bench ledger [accounts] [ops]
+ *          8 threads of sends, deposits, withdrawals and
+ *          reads on the in-memory ledger (ledger.h):
+ *          one global lock vs. striped locks, all on two
+ *          accounts, and with the group-committed log,
+ *          which is then replayed, a torn tail cut off.
+ *          Then 8 concurrent retries of one idempotency
+ *          key. Exits 1 unless money is conserved, every
+ *          account's rows add up to its balance, the
+ *          replay matches and the key applies once.
+ * ============================================
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <sstream>
+#include <stdlib.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#endif
+#include "http_pool.h"
+#include "json.h"
+#include "async.h"
+#include "transactions.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "api_batch.h"
+#include "money.h"
+#include "json_writer.h"
+#include "terminal.h"
+#include "sessions.h"
+#include "txn_cache.h"
+#include "outbox.h"
+#include "events.h"
+#include "trace.h"
+#include "endpoints.h"
+#include "ledger.h"
+
+using namespace std;
+
+// --- Counting allocator -------------------------------------------------------
+// Every operator new in this binary is tallied so modes can report heap use.
+static atomic<unsigned long long> g_allocs(0);
+static atomic<long long>          g_live_bytes(0);
+static atomic<long long>          g_peak_bytes(0);
+
+// noinline keeps GCC from "seeing through" the size header and warning
+__attribute__((noinline)) void* operator new(size_t n) {
+    size_t* p = (size_t*)malloc(n + sizeof(size_t) * 2);
+    if (!p) throw bad_alloc();
+    p[0] = n;
+    g_allocs++;
+    long long live = (g_live_bytes += (long long)n);
+    long long peak = g_peak_bytes.load();
+    while (live > peak && !g_peak_bytes.compare_exchange_weak(peak, live)) {}
+    return p + 2;
+}
+__attribute__((noinline)) void operator delete(void* q) noexcept {
+    if (!q) return;
+    size_t* p = (size_t*)q - 2;
+    g_live_bytes -= (long long)p[0];
+    free(p);
+}
+void* operator new[](size_t n) { return operator new(n); }
+void  operator delete[](void* q) noexcept { operator delete(q); }
+
+void reset_heap_stats() {
+    g_allocs = 0;
+    g_peak_bytes = g_live_bytes.load();
+}
+
+// --- Helpers ------------------------------------------------------------------
+double percentile_us(vector<uint64_t>& ns, double p) {
+    if (ns.empty()) return 0.0;
+    sort(ns.begin(), ns.end());
+    size_t i = (size_t)(p * (double)(ns.size() - 1));
+    return (double)ns[i] / 1000.0;
+}
+
+// --- bench pool ---------------------------------------------------------------
+void run_pool_case(const string& label, const string& host, unsigned short port,
+                   size_t max_idle, int n) {
+    PoolConfig cfg;
+    cfg.max_idle = max_idle;
+    HttpPool pool(host, port, cfg);
+
+    vector<uint64_t> lat;
+    lat.reserve(n);
+    int errors = 0;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        uint64_t s = now_ns();
+        HttpResponse r = pool.request("GET", "/api/balance/", "", "bench-token");
+        lat.push_back(now_ns() - s);
+        if (r.status_code != 200) errors++;
+    }
+    double secs = (double)(now_ns() - t0) / 1e9;
+    PoolStats st = pool.stats();
+
+    cout << "  " << left << setw(12) << label
+         << " req/s=" << setw(9) << fixed << setprecision(0) << (n / secs)
+         << " p50=" << setprecision(1) << percentile_us(lat, 0.50) << "us"
+         << " p99=" << percentile_us(lat, 0.99) << "us"
+         << " connects=" << st.connects
+         << " reused=" << st.reused
+         << " errors=" << errors << "\n";
+}
+
+int bench_pool(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int n = argc > 4 ? atoi(argv[4]) : 2000;
+
+    cout << "bench pool: " << n << " x GET /api/balance/ on " << host << ":" << port << "\n";
+    run_pool_case("fresh-conn", host, port, 0, n);
+    run_pool_case("keep-alive", host, port, 4, n);
+    return 0;
+}
+
+// --- bench reader -------------------------------------------------------------
+// A recorded history response: a JSON body of ~body_size bytes, framed
+// either with Content-Length or as 8 KB chunks like a streaming server.
+string record_response(size_t body_size, bool chunked) {
+    const string row =
+        "{\"id\":1,\"transaction_type\":\"SEND\",\"amount\":\"150.00\","
+        "\"recipient_phone\":\"0722345678\",\"reference\":\"\",\"description\":\"Lunch\","
+        "\"status\":\"SUCCESS\",\"transaction_id\":\"TXN0123456789AB\","
+        "\"balance_before\":\"5000.00\",\"balance_after\":\"4850.00\","
+        "\"created_at\":\"2026-02-18T14:24:00Z\"}";
+    string body = "{\"count\":0,\"transactions\":[";
+    while (body.size() + row.size() + 2 < body_size) {
+        if (body[body.size() - 1] == '}') body += ',';
+        body += row;
+    }
+    body += "]}";
+
+    string head = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n";
+    if (!chunked) {
+        char cl[64];
+        snprintf(cl, sizeof(cl), "Content-Length: %lu\r\n\r\n", (unsigned long)body.size());
+        return head + cl + body;
+    }
+    string out = head + "Transfer-Encoding: chunked\r\n\r\n";
+    for (size_t off = 0; off < body.size(); off += 8192) {
+        size_t n = min((size_t)8192, body.size() - off);
+        char sz[16];
+        snprintf(sz, sizeof(sz), "%lx\r\n", (unsigned long)n);
+        out += sz;
+        out.append(body, off, n);
+        out += "\r\n";
+    }
+    return out + "0\r\n\r\n";
+}
+
+struct ReaderResult {
+    unsigned long long allocs;
+    long long          peak;
+    unsigned long long copied;
+    double             ms;
+    size_t             body;
+};
+
+// The old WinHTTP loop: one vector per QueryDataAvailable, then append
+ReaderResult replay_legacy(const string& wire, size_t body_size) {
+    reset_heap_stats();
+    long long base = g_live_bytes.load();
+    ReaderResult res;
+    res.copied = 0;
+    uint64_t t0 = now_ns();
+    {
+        HttpResponse resp;
+        size_t body_at = wire.find("\r\n\r\n") + 4;
+        for (size_t off = body_at; off < wire.size(); off += 16384) {
+            size_t bytes_available = min((size_t)16384, wire.size() - off);
+            vector<char> buffer(bytes_available + 1, '\0');
+            memcpy(&buffer[0], wire.data() + off, bytes_available);   // WinHttpReadData
+            size_t cap = resp.body.capacity();
+            resp.body.append(&buffer[0], bytes_available);
+            res.copied += bytes_available;
+            if (resp.body.capacity() != cap) res.copied += resp.body.size() - bytes_available;
+        }
+        res.body = body_size;
+        res.ms = (double)(now_ns() - t0) / 1e6;
+        res.peak = g_peak_bytes.load() - base;
+    }
+    res.allocs = g_allocs.load();
+    return res;
+}
+
+// StringSink that also counts the copies std::string growth makes
+class GrowthCountingSink : public StringSink {
+public:
+    explicit GrowthCountingSink(string& out) : StringSink(out), out_(out), copied(0) {}
+    bool on_data(const char* p, size_t n) {
+        size_t cap = out_.capacity(), had = out_.size();
+        StringSink::on_data(p, n);
+        copied += n + (out_.capacity() != cap ? had : 0);
+        return true;
+    }
+    string& out_;
+    unsigned long long copied;
+};
+
+// Counts streamed bytes without keeping them, like an incremental parser
+class CountingSink : public BodySink {
+public:
+    CountingSink() : bytes(0) {}
+    bool on_data(const char*, size_t n) { bytes += n; return true; }
+    size_t bytes;
+};
+
+ReaderResult replay_reader(const string& wire, bool streaming) {
+    ByteBuffer buf;          // stands in for the pooled connection's buffer
+    ResponseReader reader;
+    reset_heap_stats();
+    long long base = g_live_bytes.load();
+    size_t peak_cap = 0;
+    ReaderResult res;
+    uint64_t t0 = now_ns();
+    {
+        HttpResponse resp;
+        GrowthCountingSink collect(resp.body);
+        CountingSink       counter;
+        reader.reset(streaming ? (BodySink*)&counter : (BodySink*)&collect);
+        size_t off = 0;
+        while (!reader.done() && off < wire.size()) {
+            size_t n = min((size_t)16384, wire.size() - off);
+            memcpy(buf.prepare(n), wire.data() + off, n);             // recv()
+            buf.commit(n);
+            off += n;
+            if (!reader.parse(buf)) break;
+            peak_cap = max(peak_cap, buf.capacity());
+        }
+        res.body   = reader.body_bytes();
+        res.ms     = (double)(now_ns() - t0) / 1e6;
+        res.copied = buf.bytes_moved() + (streaming ? 0 : collect.copied);
+        res.peak   = g_peak_bytes.load() - base + (long long)peak_cap;
+    }
+    res.allocs = g_allocs.load();
+    return res;
+}
+
+void print_reader_row(const char* label, const char* framing, size_t size, const ReaderResult& r) {
+    cout << "  " << left << setw(10) << label << setw(9) << framing
+         << right << setw(10) << size / 1024 << " KB"
+         << setw(8) << r.allocs << " allocs"
+         << setw(12) << r.peak / 1024 << " KB peak"
+         << setw(7) << fixed << setprecision(2) << (r.body ? (double)r.copied / (double)r.body : 0.0) << " copies/B"
+         << setw(10) << setprecision(2) << r.ms << " ms\n";
+}
+
+int bench_reader() {
+    const size_t sizes[] = { 1024, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024, 50 * 1024 * 1024 };
+    cout << "bench reader: legacy vector loop vs ResponseReader\n";
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int chunked = 0; chunked < 2; chunked++) {
+            string wire = record_response(sizes[i], chunked != 0);
+            const char* framing = chunked ? "chunked" : "length";
+            // Legacy WinHTTP got de-chunked data from the OS, so only replay length-framed
+            if (!chunked) print_reader_row("legacy", framing, sizes[i], replay_legacy(wire, sizes[i]));
+            print_reader_row("buffered", framing, sizes[i], replay_reader(wire, false));
+            print_reader_row("streaming", framing, sizes[i], replay_reader(wire, true));
+        }
+    }
+    return 0;
+}
+
+// --- bench json ---------------------------------------------------------------
+// The substring-scanning helper the client used before JsonIndex
+string legacy_json_get(const string& json, const string& key) {
+    string search = "\"" + key + "\":";
+    size_t pos = json.find(search);
+    if (pos == string::npos) return "";
+    pos += search.size();
+    while (pos < json.size() && json[pos] == ' ') pos++;
+    if (pos >= json.size()) return "";
+
+    if (json[pos] == '"') {
+        pos++;
+        string result;
+        while (pos < json.size() && json[pos] != '"') {
+            if (json[pos] == '\\' && pos + 1 < json.size()) pos++;
+            result += json[pos++];
+        }
+        return result;
+    }
+
+    size_t end = json.find_first_of(",}\n]", pos);
+    if (end == string::npos) end = json.size();
+    string val = json.substr(pos, end - pos);
+    while (!val.empty() && (val[val.size()-1] == ' ' || val[val.size()-1] == '\r')) val.erase(val.size()-1);
+    return val;
+}
+
+string history_body(size_t rows) {
+    string body = "{\"count\":";
+    char num[32];
+    snprintf(num, sizeof(num), "%lu", (unsigned long)rows);
+    body += num;
+    body += ",\"transactions\":[";
+    for (size_t i = 0; i < rows; i++) {
+        if (i) body += ',';
+        snprintf(num, sizeof(num), "%lu", (unsigned long)i);
+        body += "{\"id\":"; body += num;
+        body += ",\"transaction_type\":\""; body += (i % 3 ? "SEND" : "DEPOSIT");
+        body += "\",\"amount\":\"150.00\",\"recipient_phone\":\"0722345678\",\"reference\":\"\","
+                "\"description\":\"From 0712345678: rent \\\"march\\\"\",\"status\":\"SUCCESS\","
+                "\"transaction_id\":\"TXN"; body += num;
+        body += "\",\"balance_before\":\"5000.00\",\"balance_after\":\"4850.00\","
+                "\"created_at\":\"2026-02-18T14:24:00Z\"}";
+    }
+    return body + "]}";
+}
+
+// The pre-JsonIndex do_history() row loop, minus the printing
+size_t legacy_history(const string& body, string& sink) {
+    sink = legacy_json_get(body, "count");
+    size_t pos = 0, n = 0;
+    for (;;) {
+        size_t p = body.find("\"transaction_type\"", pos);
+        if (p == string::npos) break;
+        string sub = body.substr(p, 500);
+        sink  = legacy_json_get(sub, "transaction_type");
+        sink += legacy_json_get(sub, "amount");
+        sink += legacy_json_get(sub, "balance_after");
+        sink += legacy_json_get(sub, "transaction_id");
+        pos = p + 1;
+        n++;
+    }
+    return n;
+}
+
+size_t index_history(JsonIndex& j, const string& body, string& sink) {
+    j.parse(body);
+    sink = j.get("count");
+    uint32_t rows = j.find(j.root(), "transactions");
+    size_t n = 0;
+    for (uint32_t row = j.first_child(rows); row != JsonIndex::NONE; row = j.next_sibling(row)) {
+        sink  = j.get(row, "transaction_type");
+        sink += j.get(row, "amount");
+        sink += j.get(row, "balance_after");
+        sink += j.get(row, "transaction_id");
+        n++;
+    }
+    return n;
+}
+
+int bench_json() {
+    const size_t counts[] = { 10, 1000, 100000 };
+    cout << "bench json: decode every row of a /api/transactions/ body\n";
+    JsonIndex j;   // reused across iterations, as a screen would
+    for (size_t c = 0; c < 3; c++) {
+        string body = history_body(counts[c]);
+        int iters = counts[c] >= 100000 ? 3 : (counts[c] >= 1000 ? 200 : 20000);
+        string sink;
+
+        for (int impl = 0; impl < 2; impl++) {
+            size_t rows = 0;
+            reset_heap_stats();
+            uint64_t t0 = now_ns();
+            for (int i = 0; i < iters; i++)
+                rows = impl == 0 ? legacy_history(body, sink) : index_history(j, body, sink);
+            double per = (double)(now_ns() - t0) / iters / 1000.0;
+            cout << "  " << left << setw(10) << (impl == 0 ? "json_get" : "JsonIndex")
+                 << right << setw(8) << counts[c] << " rows"
+                 << setw(12) << fixed << setprecision(1) << per << " us/response"
+                 << setw(10) << setprecision(3) << per * 1000.0 / (double)(rows ? rows : 1) << " ns/row"
+                 << setw(10) << g_allocs.load() / iters << " allocs/response\n";
+        }
+    }
+    return 0;
+}
+
+// --- bench flow ---------------------------------------------------------------
+const char* FLOW_LOGIN = "{\"username\":\"bench\",\"password\":\"bench\"}";
+
+bool flow_sequential(HttpPool& http, AsyncClient&) {
+    HttpResponse login = http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    HttpResponse bal = http.request("GET", "/api/balance/", "", token);
+    HistoryPage recent;
+    fetch_history_page(http, token, "", 5, recent);
+    return login.status_code == 200 && bal.status_code == 200 && recent.status_code == 200;
+}
+
+bool flow_async(HttpPool& http, AsyncClient& async) {
+    HttpResponse login = http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    HttpCall bal("GET", "/api/balance/", "", token);
+    HistoryCall recent(token, "", 5);
+    async.submit(&bal);
+    async.submit(&recent);
+    bal.wait();
+    recent.wait();
+    return login.status_code == 200 && bal.response.status_code == 200 &&
+           recent.page.status_code == 200;
+}
+
+bool flow_batched(HttpPool& http, AsyncClient&) {
+    HttpResponse login = http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    HttpResponse bal;
+    HistoryPage recent;
+    RequestBatch dash(token);
+    dash.add("GET", "/api/balance/", "", &bal);
+    dash.add_history("", 5, &recent);
+    dash.send(http);
+    return login.status_code == 200 && bal.status_code == 200 && recent.status_code == 200;
+}
+
+struct RoundTripCounter : RequestObserver {
+    atomic<unsigned long> n;
+    RoundTripCounter() : n(0) {}
+    void on_request(const string&, const string&, const RequestTiming&) { n++; }
+};
+
+void run_flow_case(const string& label, bool (*flow)(HttpPool&, AsyncClient&),
+                   const string& host, unsigned short port, int n) {
+    HttpPool http(host, port);
+    AsyncClient async(http, 4);
+    RoundTripCounter trips;
+    flow(http, async);                       // warm connections and workers
+    http.set_observer(&trips);
+
+    vector<uint64_t> lat;
+    lat.reserve(n);
+    int errors = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t s = now_ns();
+        if (!flow(http, async)) errors++;
+        lat.push_back(now_ns() - s);
+    }
+    cout << "  " << left << setw(12) << label
+         << " p50=" << fixed << setprecision(1) << percentile_us(lat, 0.50) / 1000.0 << "ms"
+         << " p99=" << percentile_us(lat, 0.99) / 1000.0 << "ms"
+         << " round-trips/flow=" << (double)trips.n / n
+         << " errors=" << errors << "\n";
+}
+
+int bench_flow(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int n = argc > 4 ? atoi(argv[4]) : 200;
+
+    cout << "bench flow: " << n << " x login + balance + history(5) on " << host << ":" << port << "\n";
+    run_flow_case("sequential", flow_sequential, host, port, n);
+    run_flow_case("async", flow_async, host, port, n);
+    run_flow_case("batched", flow_batched, host, port, n);
+    return 0;
+}
+
+// --- bench load ---------------------------------------------------------------
+enum LoadOp { OP_LOGIN, OP_BALANCE, OP_HISTORY, OP_SEND, OP_DEPOSIT, OP_WITHDRAW, OP_COUNT };
+const char* LOAD_OP_NAMES[OP_COUNT] = { "login", "balance", "history", "send", "deposit", "withdraw" };
+
+struct LoadConfig {
+    string         host;
+    unsigned short port;
+    int            terminals;
+    double         duration_s;
+    int            weights[OP_COUNT];      // OP_LOGIN unused
+    vector<string> users;
+    string         password, pin;
+    vector<string> recipients;             // send to the first that is not us
+};
+
+struct Terminal {
+    const LoadConfig* cfg;
+    int               index;
+    uint64_t          deadline_ns;
+    LatencyHistogram  hist[OP_COUNT];
+    uint64_t          errors[OP_COUNT];
+    Thread            thread;
+
+    Terminal() : cfg(NULL), index(0), deadline_ns(0) { memset(errors, 0, sizeof(errors)); }
+};
+
+// Per-terminal xorshift: no shared RNG state between threads
+uint32_t xorshift(uint32_t& s) {
+    s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+    return s;
+}
+
+void run_terminal(void* arg) {
+    Terminal& t = *(Terminal*)arg;
+    const LoadConfig& cfg = *t.cfg;
+    HttpPool http(cfg.host, cfg.port);          // one keep-alive connection per terminal
+
+    string user = cfg.users[t.index % cfg.users.size()];
+    string login_body = "{\"username\":\"";
+    json_escape_into(login_body, user);
+    login_body += "\",\"password\":\"";
+    json_escape_into(login_body, cfg.password);
+    login_body += "\"}";
+
+    uint64_t s = now_ns();
+    HttpResponse login = http.request("POST", "/api/auth/login/", login_body, "");
+    t.hist[OP_LOGIN].record((now_ns() - s) / 1000);
+    if (login.status_code != 200) { t.errors[OP_LOGIN]++; return; }
+
+    JsonIndex j(login.body);
+    string token = j.get("access");
+    string phone = j.get(j.find(j.root(), "user"), "phone_number");
+    string recipient;
+    for (size_t i = 0; i < cfg.recipients.size() && recipient.empty(); i++)
+        if (cfg.recipients[i] != phone) recipient = cfg.recipients[i];
+
+    int total_weight = 0;
+    for (int op = OP_BALANCE; op < OP_COUNT; op++) total_weight += cfg.weights[op];
+    uint32_t rng = 2463534242u + (uint32_t)t.index * 7919u;
+    HistoryPage page;
+
+    while (now_ns() < t.deadline_ns) {
+        int pick = (int)(xorshift(rng) % (uint32_t)total_weight), op = OP_BALANCE;
+        while (pick >= cfg.weights[op]) pick -= cfg.weights[op++];
+
+        bool ok;
+        s = now_ns();
+        if (op == OP_BALANCE) {
+            HttpResponse r = http.request("GET", "/api/balance/", "", token);
+            ok = r.status_code == 200 && !json_get(r.body, "balance").empty();
+        } else if (op == OP_HISTORY) {
+            fetch_history_page(http, token, "", 10, page);
+            ok = page.status_code == 200;
+        } else {
+            TxnRequest req;
+            req.type   = op == OP_SEND ? TXN_SEND : op == OP_DEPOSIT ? TXN_DEPOSIT : TXN_WITHDRAW;
+            req.amount = Money::from_cents(100);    // sends+withdrawals ~ deposits in the default mix
+            req.pin    = cfg.pin;
+            req.recipient_phone = recipient;
+            req.description     = "load test";
+            req.reference       = "load test";
+            ok = post_txn(http, token, req).ok();
+        }
+        t.hist[op].record((now_ns() - s) / 1000);
+        if (!ok) t.errors[op]++;
+    }
+}
+
+void split_list(const string& s, vector<string>& out) {
+    out.clear();
+    size_t b = 0;
+    while (b <= s.size()) {
+        size_t e = s.find(',', b);
+        if (e == string::npos) e = s.size();
+        if (e > b) out.push_back(s.substr(b, e - b));
+        b = e + 1;
+    }
+}
+
+bool parse_mix(const string& s, int* weights) {
+    vector<string> parts;
+    split_list(s, parts);
+    for (int op = 0; op < OP_COUNT; op++) weights[op] = 0;
+    int total = 0;
+    for (size_t i = 0; i < parts.size(); i++) {
+        size_t eq = parts[i].find('=');
+        if (eq == string::npos) return false;
+        string name = parts[i].substr(0, eq);
+        int w = atoi(parts[i].c_str() + eq + 1), op = OP_BALANCE;
+        while (op < OP_COUNT && name != LOAD_OP_NAMES[op]) op++;
+        if (op == OP_COUNT || w < 0) return false;
+        weights[op] = w;
+        total += w;
+    }
+    return total > 0;
+}
+
+void print_load_row(const string& name, const LatencyHistogram& h, uint64_t errors, double secs) {
+    cout << "  " << left << setw(10) << name << right
+         << setw(9) << h.count()
+         << setw(9) << fixed << setprecision(1) << (double)h.count() / secs
+         << setw(8) << setprecision(2) << (h.count() ? 100.0 * (double)errors / (double)h.count() : 0.0)
+         << setw(9) << setprecision(2) << (double)h.percentile(50.0)  / 1000.0
+         << setw(9) << (double)h.percentile(95.0)  / 1000.0
+         << setw(9) << (double)h.percentile(99.0)  / 1000.0
+         << setw(9) << (double)h.percentile(99.9)  / 1000.0
+         << setw(9) << (double)h.max() / 1000.0 << "\n";
+}
+
+int bench_load(int argc, char** argv) {
+    LoadConfig cfg;
+    cfg.host = "127.0.0.1";
+    cfg.port = 8000;
+    cfg.terminals = 10;
+    cfg.duration_s = 10.0;
+    parse_mix("balance=40,history=20,send=10,deposit=20,withdraw=10", cfg.weights);
+    split_list("john,jane", cfg.users);
+    cfg.password = "password123";
+    cfg.pin = "1234";
+    split_list("0722345678,0712345678", cfg.recipients);
+    bool hdr = false;
+
+    int positional = 0;
+    for (int i = 2; i < argc; i++) {
+        string a = argv[i];
+        bool v = i + 1 < argc;
+        if      (a == "--terminals" && v) cfg.terminals  = atoi(argv[++i]);
+        else if (a == "--duration"  && v) cfg.duration_s = atof(argv[++i]);
+        else if (a == "--users"     && v) split_list(argv[++i], cfg.users);
+        else if (a == "--password"  && v) cfg.password   = argv[++i];
+        else if (a == "--pin"       && v) cfg.pin        = argv[++i];
+        else if (a == "--recipients" && v) split_list(argv[++i], cfg.recipients);
+        else if (a == "--hdr")            hdr = true;
+        else if (a == "--mix" && v) {
+            if (!parse_mix(argv[++i], cfg.weights)) { cerr << "bad --mix: " << argv[i] << "\n"; return 2; }
+        }
+        else if (a[0] != '-' && positional == 0) { cfg.host = a; positional++; }
+        else if (a[0] != '-' && positional == 1) { cfg.port = (unsigned short)atoi(a.c_str()); positional++; }
+        else { cerr << "unknown option: " << a << "\n"; return 2; }
+    }
+    if (cfg.terminals < 1 || cfg.users.empty() || cfg.duration_s <= 0) { cerr << "bad options\n"; return 2; }
+
+    cout << "bench load: " << cfg.terminals << " terminals x " << cfg.duration_s << " s on "
+         << cfg.host << ":" << cfg.port << "  mix:";
+    for (int op = OP_BALANCE; op < OP_COUNT; op++)
+        if (cfg.weights[op]) cout << " " << LOAD_OP_NAMES[op] << "=" << cfg.weights[op];
+    cout << "\n";
+
+    vector<Terminal*> terms;
+    uint64_t t0 = now_ns();
+    uint64_t deadline = t0 + (uint64_t)(cfg.duration_s * 1e9);
+    for (int i = 0; i < cfg.terminals; i++) {
+        Terminal* t = new Terminal();
+        t->cfg = &cfg; t->index = i; t->deadline_ns = deadline;
+        terms.push_back(t);
+        if (!t->thread.start(run_terminal, t)) { cerr << "cannot start terminal " << i << "\n"; return 1; }
+    }
+    LatencyHistogram total[OP_COUNT], all;
+    uint64_t errors[OP_COUNT] = { 0 }, all_errors = 0;
+    for (size_t i = 0; i < terms.size(); i++) {
+        terms[i]->thread.join();
+        for (int op = 0; op < OP_COUNT; op++) {
+            total[op].merge(terms[i]->hist[op]);
+            errors[op] += terms[i]->errors[op];
+        }
+        delete terms[i];
+    }
+    double secs = (double)(now_ns() - t0) / 1e9;
+
+    cout << "\n  " << left << setw(10) << "endpoint" << right
+         << setw(9) << "count" << setw(9) << "req/s" << setw(8) << "err%"
+         << setw(9) << "p50 ms" << setw(9) << "p95" << setw(9) << "p99"
+         << setw(9) << "p99.9" << setw(9) << "max" << "\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (!total[op].count()) continue;
+        print_load_row(LOAD_OP_NAMES[op], total[op], errors[op], secs);
+        if (op != OP_LOGIN) { all.merge(total[op]); all_errors += errors[op]; }
+    }
+    print_load_row("ALL", all, all_errors, secs);
+    if (errors[OP_LOGIN]) cout << "\n  " << errors[OP_LOGIN] << " terminal(s) failed to log in\n";
+
+    if (hdr) {
+        cout << "\n  Latency distribution (all endpoints except login):\n";
+        all.print_distribution(cout);
+    }
+    return all_errors || errors[OP_LOGIN] ? 1 : 0;
+}
+
+// --- bench metrics ------------------------------------------------------------
+struct MetricsWorker {
+    EndpointMetrics* m;
+    int              n;
+    uint64_t         ns;
+    Thread           thread;
+};
+
+// Recording only: timings are precomputed, the clock is measured separately
+void metrics_worker(void* arg) {
+    MetricsWorker& w = *(MetricsWorker*)arg;
+    static const char* paths[] = { "/api/balance/", "/api/send/", "/api/transactions/?limit=10",
+                                   "/api/deposit/", "/api/withdraw/" };
+    static const string methods[] = { "GET", "POST", "GET", "POST", "POST" };
+    string p[5];
+    for (int i = 0; i < 5; i++) p[i] = paths[i];
+    RequestTiming t[64];
+    for (int i = 0; i < 64; i++) {
+        t[i].start_ns      = 1000000;
+        t[i].sent_ns       = t[i].start_ns + 20000 + 997 * (uint64_t)i;
+        t[i].first_byte_ns = t[i].sent_ns + 500000 + 7919 * (uint64_t)i;
+        t[i].done_ns       = t[i].first_byte_ns + 3000;
+        t[i].bytes_out = 180; t[i].bytes_in = 120; t[i].status_code = 200; t[i].reused = true;
+    }
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < w.n; i++) w.m->on_request(methods[i % 5], p[i % 5], t[i & 63]);
+    w.ns = now_ns() - t0;
+}
+
+int bench_metrics() {
+    const int n = 2000000;
+    cout << "bench metrics: " << n << " simulated requests per thread\n";
+
+    uint64_t t0 = now_ns();
+    volatile uint64_t sink = 0;
+    for (int i = 0; i < n; i++) sink += now_ns();
+    double clock_ns = (double)(now_ns() - t0) / n;
+    cout << "  now_ns()               " << fixed << setprecision(1) << clock_ns
+         << " ns/call (request() takes 4-5 stamps)\n";
+
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        EndpointMetrics m;
+        vector<MetricsWorker> w(threads);
+        for (int i = 0; i < threads; i++) { w[i].m = &m; w[i].n = n; w[i].ns = 0; }
+        for (int i = 0; i < threads; i++) w[i].thread.start(metrics_worker, &w[i]);
+        double worst = 0;
+        for (int i = 0; i < threads; i++) {
+            w[i].thread.join();
+            worst = max(worst, (double)w[i].ns / n);
+        }
+        cout << "  record, " << threads << " thread(s)     " << setprecision(1) << worst
+             << " ns/request\n";
+    }
+    return 0;
+}
+
+// --- bench money --------------------------------------------------------------
+// What the screens did before Money: an istringstream per parse and an
+// ostringstream with fixed/setprecision(2) per display.
+double legacy_parse_amount(const string& s) {
+    double val = 0.0;
+    istringstream ss(s);
+    ss >> val;
+    return ss.fail() ? -1.0 : val;
+}
+
+string legacy_format_amount(double v) {
+    ostringstream ss;
+    ss << fixed << setprecision(2) << v;
+    return ss.str();
+}
+
+void print_money_row(const char* label, uint64_t ns, int n) {
+    cout << "  " << left << setw(24) << label << right << setw(9) << fixed << setprecision(1)
+         << (double)ns / n << " ns/op" << setw(8) << setprecision(2)
+         << (double)g_allocs.load() / n << " allocs/op\n";
+}
+
+// want < 0: the text must be rejected
+bool check_parse(const char* in, int64_t want) {
+    Money m;
+    bool ok = Money::parse(in, m);
+    if (want < 0 ? !ok : ok && m.cents() == want) return true;
+    cout << "  FAIL parse \"" << in << "\": ";
+    if (ok) cout << "got " << m.cents() << " cents";
+    else    cout << "rejected";
+    cout << ", want " << (want < 0 ? string("rejected") : Money::from_cents(want).str()) << "\n";
+    return false;
+}
+
+// Exit status 1 if an amount parses to the wrong value or bad text is accepted
+int bench_money() {
+    const int n = 1000000;
+    vector<string> text(1024);
+    for (size_t i = 0; i < text.size(); i++) {
+        char buf[32];
+        unsigned c = (unsigned)(splitmix64(i) % 5000000);        // 0.00 .. 49,999.99
+        snprintf(buf, sizeof(buf), "%u.%02u", c / 100, c % 100);
+        text[i] = buf;
+    }
+    cout << "bench money: " << n << " amounts, parse and format\n";
+
+    bool pass = true;
+    pass &= check_parse("1500.5", 150050);
+    pass &= check_parse("1,500.50", 150050);
+    pass &= check_parse("12,345,678", 1234567800);
+    pass &= check_parse("+9,999,999,999.99", 999999999999LL);
+    pass &= check_parse(",500", -1);
+    pass &= check_parse("1,", -1);
+    pass &= check_parse("1,5", -1);
+    pass &= check_parse("12,34,5", -1);
+    pass &= check_parse("1234,567", -1);
+    pass &= check_parse("1,5000", -1);
+    pass &= check_parse("1,,500", -1);
+    pass &= check_parse("12345678901", -1);                       // 11 digits
+    pass &= check_parse("99999999999999999999999", -1);           // would overflow int64
+    pass &= check_parse("1.005", -1);
+
+    volatile double dsink = 0;
+    volatile int64_t csink = 0;
+    reset_heap_stats();
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) dsink = dsink + legacy_parse_amount(text[i & 1023]);
+    print_money_row("istringstream >> double", now_ns() - t0, n);
+
+    reset_heap_stats();
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        Money m;
+        Money::parse(text[i & 1023], m);
+        csink = csink + m.cents();
+    }
+    print_money_row("Money::parse", now_ns() - t0, n);
+
+    volatile size_t len = 0;
+    reset_heap_stats();
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) len = len + legacy_format_amount((double)(i % 5000000) / 100.0).size();
+    print_money_row("ostringstream fixed(2)", now_ns() - t0, n);
+
+    reset_heap_stats();
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        char buf[32];
+        len = len + (size_t)snprintf(buf, sizeof(buf), "%.2f", (double)(i % 5000000) / 100.0);
+    }
+    print_money_row("snprintf %.2f", now_ns() - t0, n);
+
+    reset_heap_stats();
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        char buf[Money::TEXT_SIZE];
+        len = len + Money::from_cents(i % 5000000).format(buf);
+    }
+    print_money_row("Money::format", now_ns() - t0, n);
+
+    // Reconciling a bulk run: the same amounts totalled both ways. A
+    // running double total stops being a whole number of cents almost at
+    // once; comparing it against the server's ledger then needs rounding.
+    double dtotal = 0;
+    Money total;
+    int inexact = 0;
+    for (int i = 0; i < n; i++) {
+        Money m;
+        Money::parse(text[i & 1023], m);
+        total += m;
+        dtotal += legacy_parse_amount(text[i & 1023]);
+        if (dtotal * 100.0 != (double)total.cents()) inexact++;
+    }
+    cout << "  running totals, double:  " << inexact << " of " << n << " not a whole cent, final off by "
+         << setprecision(6) << fabs(dtotal * 100.0 - (double)total.cents()) << " cents\n"
+         << "  running totals, Money:   exact, final " << total << "\n";
+    cout << (pass ? "  PASS\n" : "  FAILED\n");
+    return pass ? 0 : 1;
+}
+
+// --- bench body ---------------------------------------------------------------
+// The request path before json_writer.h: the body concatenated into an
+// std::string, then the whole request copied into another one.
+string legacy_txn_body(const TxnRequest& req) {
+    string b = "{\"recipient_phone\":\"" + req.recipient_phone + "\",\"amount\":" + req.amount.str();
+    b += ",\"pin\":\"" + req.pin + "\",\"description\":\"" + req.description + "\"";
+    b += ",\"idempotency_key\":\"" + req.idempotency_key + "\"}";
+    return b;
+}
+
+string legacy_request(const string& host, unsigned short port, const string& method,
+                      const string& path, const string& body, const string& token) {
+    char port_buf[8];
+    snprintf(port_buf, sizeof(port_buf), "%u", (unsigned)port);
+    char len_buf[24];
+    snprintf(len_buf, sizeof(len_buf), "%lu", (unsigned long)body.size());
+    string req;
+    req.reserve(160 + path.size() + token.size() + body.size());
+    req += method; req += ' '; req += path; req += " HTTP/1.1\r\n";
+    req += "Host: "; req += host; req += ':'; req += port_buf; req += "\r\n";
+    req += "User-Agent: MPesaClient/1.0\r\nConnection: keep-alive\r\n";
+    req += "Content-Type: application/json\r\n";
+    req += "Authorization: Bearer "; req += token; req += "\r\n";
+    req += "Content-Length: "; req += len_buf; req += "\r\n\r\n";
+    req += body;
+    return req;
+}
+
+bool check_escape(const string& in, const string& want) {
+    JsonBody<64> w;
+    w.value(in);
+    string got = w.str();
+    if (got == want) return true;
+    cout << "  FAIL escape: got " << got << ", want " << want << "\n";
+    return false;
+}
+
+// Exit status 1 if a warm request build touches the heap or escaping is wrong
+int bench_body() {
+    const int n = 1000000;
+    bool pass = true;
+    cout << "bench body: send-money request, body + request line + headers\n";
+
+    pass &= check_escape("plain", "\"plain\"");
+    pass &= check_escape("say \"hi\"\\", "\"say \\\"hi\\\"\\\\\"");
+    pass &= check_escape(string("a\nb\tc\r\x01\x1f", 8), "\"a\\nb\\tc\\r\\u0001\\u001f\"");
+    pass &= check_escape("Ksh \xe2\x82\xac ok", "\"Ksh \xe2\x82\xac ok\"");
+    {
+        JsonBody<8> w;                       // outgrows its buffer
+        w.begin_object(); w.field("k", string(100, 'x')); w.field("n", 7); w.end_object();
+        string text = w.str();
+        JsonIndex j(text);
+        if (!w.spilled() || !j.ok() || j.get("k").size() != 100 || j.get("n") != "7") {
+            cout << "  FAIL spill to heap\n";
+            pass = false;
+        }
+    }
+
+    TxnRequest req;
+    req.type = TXN_SEND;
+    req.recipient_phone = "0722000001";
+    req.amount = Money::from_cents(150050);
+    req.pin = "1234";
+    req.description = "March wages";
+    req.idempotency_key = new_idempotency_key();
+    string token(205, 'a');                  // typical SimpleJWT access token length
+    const string host = "127.0.0.1";
+    const HttpRoute& route = txn_route(TXN_SEND);
+    string head = "Host: 127.0.0.1:8000\r\nUser-Agent: MPesaClient/1.0\r\n"
+                  "Connection: keep-alive\r\nContent-Type: application/json\r\n";
+
+    volatile size_t sink = 0;
+    reset_heap_stats();
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        string body = legacy_txn_body(req);
+        sink = sink + legacy_request(host, 8000, "POST", "/api/send/", body, token).size();
+    }
+    double legacy_ns = (double)(now_ns() - t0) / n;
+    double legacy_allocs = (double)g_allocs.load() / n;
+
+    ByteBuffer out;
+    {                                        // warm-up: the connection buffer grows once
+        JsonBody<512> body;
+        txn_body(req, req.idempotency_key.c_str(), body);
+        format_http_request(out, head, route, body.data(), body.size(), token);
+    }
+    reset_heap_stats();
+    t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        JsonBody<512> body;
+        txn_body(req, req.idempotency_key.c_str(), body);
+        format_http_request(out, head, route, body.data(), body.size(), token);
+        sink = sink + out.size();
+    }
+    double writer_ns = (double)(now_ns() - t0) / n;
+    unsigned long long writer_allocs = g_allocs.load();
+
+    cout << "  " << left << setw(22) << "string concat" << right << setw(8) << fixed << setprecision(1)
+         << legacy_ns << " ns/request" << setw(8) << setprecision(2) << legacy_allocs << " allocs/request\n"
+         << "  " << left << setw(22) << "JsonWriter + route" << right << setw(8) << setprecision(1)
+         << writer_ns << " ns/request" << setw(8) << setprecision(2) << (double)writer_allocs / n
+         << " allocs/request\n";
+
+    string wire(out.data(), out.size());
+    string sent = wire.substr(wire.find("\r\n\r\n") + 4);
+    JsonIndex j(sent);
+    if (j.get("amount") != "1500.50" || j.get("idempotency_key") != req.idempotency_key) {
+        cout << "  FAIL body does not round-trip\n";
+        pass = false;
+    }
+    if (writer_allocs != 0) {
+        cout << "  FAIL " << writer_allocs << " heap allocations on the warm path\n";
+        pass = false;
+    }
+    cout << (pass ? "  PASS\n" : "  FAILED\n");
+    return pass ? 0 : 1;
+}
+
+// --- bench term ---------------------------------------------------------------
+// The client's screens drawn two ways. Legacy: system("cls"), then one
+// console call per SetConsoleTextAttribute and per cout write. Screen:
+// a back buffer and one write per frame with only the changed cells.
+class CallCounter : public std::streambuf {
+public:
+    CallCounter() : calls(0), bytes(0) {}
+    unsigned long calls, bytes;
+protected:
+    int overflow(int c) { calls++; bytes++; return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) { calls++; bytes += (unsigned long)n; return n; }
+};
+
+struct LegacyPainter {
+    CallCounter calls;
+    ostream     out;
+    LegacyPainter() : out(&calls) {}
+    void color(int) { calls.calls++; }
+    void clear()    {}                       // system("cls"): a shell process, counted apart
+};
+
+struct ScreenPainter {
+    Screen& screen;
+    ostream out;
+    explicit ScreenPainter(Screen& s) : screen(s), out(&s) {}
+    void color(int c) { screen.set_color(c); }
+    void clear()      { screen.clear(); }
+};
+
+template <class P> void draw_header(P& p) {
+    p.clear();
+    p.color(11);
+    p.out << "\n  +==========================================+\n"
+          << "  |         M-PESA TERMINAL  v1.0            |\n"
+          << "  |           Powered by Django API          |\n"
+          << "  +==========================================+\n";
+    p.color(7);
+}
+
+template <class P> void draw_menu(P& p) {
+    draw_header(p);
+    p.color(11); p.out << "\n  Logged in: ";
+    p.color(15); p.out << "Jane Wanjiku" << "  [" << "0712345678" << "]\n\n";
+    p.color(7);
+    p.color(15); p.out << "  MAIN MENU\n"; p.color(7);
+    p.color(11); p.out << "  ------------------------------------------\n"; p.color(7);
+    static const char* items[] = { "Check Balance", "Send Money", "Deposit", "Withdraw",
+                                   "Transaction History", "Export Metrics", "Logout" };
+    for (int i = 0; i < 7; i++) p.out << "  [" << i + 1 << "]  " << items[i] << "\n";
+    p.color(11); p.out << "  ------------------------------------------\n"; p.color(7);
+    p.color(14); p.out << "  Select option (1-7): "; p.color(15);
+}
+
+template <class P> void draw_history(P& p, int page) {
+    draw_header(p);
+    p.color(15); p.out << "\n  === TRANSACTION HISTORY (Page " << page + 1 << ") ===\n\n"; p.color(7);
+    p.color(11); p.out << "  ------------------------------------------\n"; p.color(7);
+    p.color(11); p.out << "  Total: "; p.color(15); p.out << 1000 << " transactions\n\n";
+    p.color(14);
+    p.out << "  " << left << setw(10) << "TYPE" << setw(14) << "AMOUNT(KES)" << setw(14) << "BAL AFTER"
+          << "TRANSACTION ID\n";
+    p.color(11); p.out << "  " << string(58, '-') << "\n"; p.color(7);
+    for (int i = 0; i < 10; i++) {
+        int k = page * 10 + i;
+        bool debit = k % 3 != 0;
+        p.color(debit ? 12 : 10);
+        char amount[16], bal[16], id[24];
+        snprintf(amount, sizeof(amount), "%d.00", 100 + (k * 37) % 900);
+        snprintf(bal, sizeof(bal), "%d.50", 20000 - k * 13);
+        snprintf(id, sizeof(id), "TXN%012d", 900000 + k);
+        p.out << "  " << left << setw(10) << (debit ? "SEND" : "DEPOSIT") << setw(14) << amount
+              << setw(14) << bal << id << "\n";
+        p.color(7);
+    }
+    p.out << "\n";
+    p.color(11); p.out << "  ------------------------------------------\n"; p.color(7);
+    p.out << "  [N]  Next page\n  [P]  Previous page\n  [Enter]  Back to menu\n";
+    p.color(14); p.out << "  Select option: "; p.color(15);
+}
+
+void print_term_row(const char* label, unsigned long bytes, unsigned long calls, const char* note) {
+    cout << "  " << left << setw(34) << label << right << setw(8) << bytes << " bytes"
+         << setw(6) << calls << " calls  " << note << "\n";
+}
+
+int bench_term() {
+    cout << "bench term: bytes and console calls per screen (80x25)\n";
+    struct Case { const char* name; int kind; };
+    const Case cases[] = { { "main menu", 0 }, { "history page", 1 } };
+    for (int i = 0; i < 2; i++) {
+        LegacyPainter legacy;
+        if (cases[i].kind == 0) draw_menu(legacy); else draw_history(legacy, 0);
+        string label = string(cases[i].name) + ", legacy";
+        print_term_row(label.c_str(), legacy.calls.bytes, legacy.calls.calls, "+ cls process");
+
+        HeadlessTerminal term(25, 80);
+        Screen screen(term);
+        ScreenPainter painter(screen);
+        if (cases[i].kind == 0) draw_menu(painter); else draw_history(painter, 0);
+        screen.present();
+        FrameStats first = screen.stats();
+        label = string(cases[i].name) + ", first frame";
+        print_term_row(label.c_str(), (unsigned long)first.bytes, (unsigned long)first.syscalls, "");
+
+        if (cases[i].kind == 0) draw_menu(painter); else draw_history(painter, 1);
+        screen.present();
+        FrameStats again = screen.stats();
+        label = string(cases[i].name) + (cases[i].kind == 0 ? ", redrawn" : ", next page");
+        print_term_row(label.c_str(), (unsigned long)(again.bytes - first.bytes),
+                       (unsigned long)(again.syscalls - first.syscalls), "");
+    }
+
+    // Typing a 4-digit PIN at the prompt: one small frame per key
+    HeadlessTerminal term(25, 80, "1234\n");
+    Screen screen(term);
+    ScreenPainter painter(screen);
+    draw_menu(painter);
+    screen.present();
+    FrameStats before = screen.stats();
+    read_line(screen, "*");
+    screen.present();
+    FrameStats after = screen.stats();
+    unsigned long frames = (unsigned long)(after.frames - before.frames);
+    cout << "  PIN entry: " << frames << " frames, "
+         << setprecision(1) << fixed << (double)(after.bytes - before.bytes) / (frames ? frames : 1)
+         << " bytes/frame, 1 call each\n";
+    return 0;
+}
+
+// --- bench sessions -----------------------------------------------------------
+struct SessionLoad {
+    SessionManager*                   sessions;
+    const vector<SessionManager::Id>* ids;
+    volatile bool*                    stop;
+    uint32_t                          seed;
+    unsigned long                     ok, failed;
+};
+
+void run_session_load(void* arg) {
+    SessionLoad* l = (SessionLoad*)arg;
+    static const HttpRoute route("GET", "/api/balance/");
+    while (!*l->stop) {
+        SessionManager::Id id = (*l->ids)[xorshift(l->seed) % l->ids->size()];
+        HttpResponse r = l->sessions->request(id, route, NULL, 0);
+        if (r.status_code == 200) l->ok++; else l->failed++;
+    }
+}
+
+struct SameToken {
+    SessionManager*    sessions;
+    SessionManager::Id id;
+    bool               ok;
+};
+
+void run_same_token(void* arg) {
+    SameToken* t = (SameToken*)arg;
+    static const HttpRoute route("GET", "/api/balance/");
+    t->ok = t->sessions->request(t->id, route, NULL, 0).status_code == 200;
+}
+
+// Answers as views.py and simplejwt do: a token other than the last one
+// handed out is 401 token_not_valid, a withdrawal (always the wrong PIN
+// here) is 401 "Invalid PIN"
+struct PinServer : HttpTransport {
+    string access;
+    int    refreshes;
+
+    PinServer() : refreshes(0) {}
+
+    HttpResponse exchange(const HttpRoute& route, const char*, size_t, const string& auth_token,
+                          BodySink*, CancelToken*, const Validators*) {
+        HttpResponse r;
+        r.status_code = 200;
+        if (route.path == "/api/auth/refresh/") {
+            access = "access-" + to_string(++refreshes);
+            r.body = "{\"access\":\"" + access + "\"}";
+        } else if (auth_token != access) {
+            r.status_code = 401;
+            r.body = "{\"detail\":\"Given token not valid for any token type\",\"code\":\"token_not_valid\"}";
+        } else if (route.path == "/api/withdraw/") {
+            r.status_code = 401;
+            r.body = "{\"error\":\"Invalid PIN\"}";
+        } else {
+            r.body = "{\"balance\":\"1.00\"}";
+        }
+        return r;
+    }
+};
+
+// A stale token is refreshed once; a wrong PIN is the answer, not a reason
+// to refresh. Through TokenManager and SessionManager alike.
+bool check_pin_rejection() {
+    PinServer server;
+    HttpPool http("127.0.0.1", 9);          // never dialled: server answers
+    http.set_transport(&server);
+    static const HttpRoute balance("GET", "/api/balance/"), withdraw("POST", "/api/withdraw/");
+
+    TokenManager auth(http);
+    auth.set("stale", "refresh");
+    int b1 = auth.request(balance, NULL, 0).status_code;
+    int w1 = auth.request(withdraw, NULL, 0).status_code;
+    int after_manager = server.refreshes;
+
+    AsyncClient async(http, 1);
+    SessionManager sessions(http, async);
+    SessionManager::Id id = sessions.add("pin", "", "", "stale", "refresh");
+    int b2 = sessions.request(id, balance, NULL, 0).status_code;
+    int w2 = sessions.request(id, withdraw, NULL, 0).status_code;
+    auth.clear();
+
+    bool ok = b1 == 200 && w1 == 401 && after_manager == 1 && b2 == 200 && w2 == 401 && server.refreshes == 2;
+    cout << "  wrong PIN (401)         " << server.refreshes << " refreshes for 2 stale tokens and 2 wrong PINs"
+         << (ok ? "" : "   <-- expected 2") << "\n";
+    return ok;
+}
+
+bool login_sessions(HttpPool& http, SessionManager& sessions, int n, vector<SessionManager::Id>& ids) {
+    static const HttpRoute route("POST", "/api/auth/login/");
+    for (int i = 0; i < n; i++) {
+        JsonBody<128> body;
+        string user = "customer" + to_string(i);
+        body.begin_object();
+        body.field("username", user);
+        body.field("password", "password123");
+        body.end_object();
+        HttpResponse r = http.request(route, body.data(), body.size(), "");
+        if (r.status_code != 200) return false;
+        JsonIndex j(r.body);
+        uint32_t u = j.find(j.root(), "user");
+        ids.push_back(sessions.add(user, j.get(u, "full_name"), j.get(u, "phone_number"),
+                                   j.get("access"), j.get("refresh")));
+    }
+    return true;
+}
+
+int bench_sessions(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int n = argc > 4 ? atoi(argv[4]) : 500;
+    double secs = argc > 5 ? atof(argv[5]) : 5.0;
+    int failures = 0;
+
+    cout << "bench sessions: " << n << " customers on " << host << ":" << port << "\n";
+    HttpPool http(host, port);
+    AsyncClient async(http, 4);
+    {
+        SessionManager sessions(http, async);
+        sessions.tune(3600 * 1000ULL, 3600 * 1000ULL);      // nothing in the background yet
+        vector<SessionManager::Id> ids;
+        ids.reserve(n);
+        long long base = g_live_bytes;
+        if (!login_sessions(http, sessions, n, ids)) { cerr << "login failed: is the server up?\n"; return 1; }
+        long long active = g_live_bytes - base;
+        sessions.tune(0, 3600 * 1000ULL);                    // everyone idles out now
+        sessions.run_due();
+        long long idle = g_live_bytes - base;
+        cout << "  heap per session        active " << active / n << " bytes, idle "
+             << idle / n << " bytes\n";
+
+        const int SWITCHES = 1000000;
+        uint64_t t0 = now_ns();
+        for (int i = 0; i < SWITCHES; i++) sessions.select(ids[(size_t)i % ids.size()]);
+        uint64_t sel = now_ns() - t0;
+
+        TxnCache cache;
+        const int REMAPS = 2000;
+        t0 = now_ns();
+        for (int i = 0; i < REMAPS; i++) {
+            cache.close();
+            sessions.select(ids[(size_t)i % 2]);
+            cache.open(i % 2 ? "bench_sessions_b.dat" : "bench_sessions_a.dat");
+        }
+        uint64_t remap = now_ns() - t0;
+        cache.close();
+        remove("bench_sessions_a.dat");
+        remove("bench_sessions_b.dat");
+        cout << "  switch                  select " << fixed << setprecision(0) << (double)sel / SWITCHES
+             << " ns, + history cache remap " << setprecision(1) << (double)remap / REMAPS / 1000.0 << " us\n";
+    }
+
+    // Live: tokens renew and balances poll for every session while 8
+    // "UI" threads act for random customers
+    SessionManager sessions(http, async);
+    sessions.tune(3600 * 1000ULL, 1000);
+    vector<SessionManager::Id> ids;
+    if (!login_sessions(http, sessions, n, ids)) { cerr << "login failed\n"; return 1; }
+    volatile bool stop = false;
+    SessionLoad loads[8];
+    Thread threads[8];
+    for (int i = 0; i < 8; i++) {
+        SessionLoad l = { &sessions, &ids, &stop, (unsigned)i + 1, 0, 0 };
+        loads[i] = l;
+        threads[i].start(run_session_load, &loads[i]);
+    }
+    sleep_ms((unsigned)(secs * 1000));
+    stop = true;
+    unsigned long ok = 0, failed = 0;
+    for (int i = 0; i < 8; i++) { threads[i].join(); ok += loads[i].ok; failed += loads[i].failed; }
+    cout << "  " << setprecision(0) << secs << " s, 8 threads       " << ok << " ok, " << failed << " failed, "
+         << sessions.refreshes() << " background/inline refreshes, " << sessions.polls() << " balance polls\n";
+    failures += failed != 0;
+
+    // 8 threads meet the same rejected token: one refresh between them. On a
+    // manager of its own, so renewals of the others do not count.
+    SessionManager lone(http, async);
+    SessionManager::Id dead = lone.add("stale", "", "", "not-a-jwt", sessions.refresh_token(ids[0]));
+    uint64_t before = lone.refreshes();
+    SameToken same[8];
+    for (int i = 0; i < 8; i++) {
+        SameToken t = { &lone, dead, false };
+        same[i] = t;
+        threads[i].start(run_same_token, &same[i]);
+    }
+    int same_ok = 0;
+    for (int i = 0; i < 8; i++) { threads[i].join(); same_ok += same[i].ok; }
+    uint64_t flights = lone.refreshes() - before;
+    cout << "  same stale token        8 threads, " << flights << " refresh, " << same_ok << "/8 ok\n";
+    failures += flights > 1 || same_ok != 8;
+    failures += !check_pin_rejection();
+    return failures ? 1 : 0;
+}
+
+// --- bench deadline -----------------------------------------------------------
+// Completes the TCP handshake (the kernel does) and then never says a word.
+// POSIX only; -1 skips the checks that need it.
+#ifdef _WIN32
+int  black_hole(unsigned short&) { return -1; }
+void close_hole(int) {}
+#else
+void close_hole(int fd) { close(fd); }
+
+int black_hole(unsigned short& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family      = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(a);
+    if (fd < 0 || bind(fd, (sockaddr*)&a, sizeof(a)) != 0 || listen(fd, 64) != 0 ||
+        getsockname(fd, (sockaddr*)&a, &len) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    port = ntohs(a.sin_port);
+    return fd;
+}
+#endif
+
+struct LateCancel {
+    CancelToken* token;
+    unsigned     after_ms;
+};
+
+void run_late_cancel(void* arg) {
+    LateCancel* c = (LateCancel*)arg;
+    sleep_ms(c->after_ms);
+    c->token->cancel();
+}
+
+// One call; true if it failed the expected way within [lo_ms, hi_ms]
+bool check_deadline(const char* label, HttpPool& http, const HttpRoute& route, CancelToken* cancel,
+                    HttpFailure want, HttpPhase phase, unsigned lo_ms, unsigned hi_ms) {
+    uint64_t t0 = now_ns();
+    HttpResponse r = http.request(route, NULL, 0, "", NULL, cancel);
+    double ms = (double)(now_ns() - t0) / 1e6;
+    bool ok = r.failure == want && (phase == HTTP_PHASE_NONE || r.phase == phase) &&
+              ms >= lo_ms && ms <= hi_ms;
+    cout << "  " << left << setw(30) << label << right << fixed << setprecision(0) << setw(6) << ms
+         << " ms  " << http_failure_body(r.failure, r.phase)
+         << (ok ? "" : "   <-- expected ") << (ok ? "" : http_failure_body(want, phase)) << "\n";
+    return ok;
+}
+
+int bench_deadline(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int n = argc > 4 ? atoi(argv[4]) : 200;
+    const unsigned SLACK_MS = 100;          // scheduling noise allowed past a deadline
+    int failures = 0;
+
+    unsigned short hole_port = 0;
+    int hole = black_hole(hole_port);
+    if (hole < 0) cout << "bench deadline: no black-hole listener here, skipping to the server checks\n";
+    else {
+        cout << "bench deadline: black hole on 127.0.0.1:" << hole_port << "\n";
+        HttpTimeouts def;
+        def.receive_ms = 600;
+        def.total_ms   = 2000;
+        HttpTimeouts quick = def;
+        quick.receive_ms = 200;
+        HttpTimeouts no_phase = def;
+        no_phase.receive_ms = 0;            // only total_ms bounds it
+        no_phase.total_ms   = 400;
+        HttpTimeouts patient = def;
+        patient.receive_ms = 10000;
+        patient.total_ms   = 10000;
+        TimeoutTable t;
+        t.defaults() = def;
+        t.set("/api/balance/", quick);
+        t.set("/api/total/", no_phase);
+        t.set("/api/patient/", patient);
+        HttpPool http("127.0.0.1", hole_port);
+        http.set_timeouts(t);
+
+        failures += !check_deadline("receive_ms (default 600)", http, HttpRoute("GET", "/api/transactions/"),
+                                    NULL, HTTP_FAIL_TIMEOUT, HTTP_PHASE_RECEIVE, 600, 600 + SLACK_MS);
+        failures += !check_deadline("receive_ms (/api/balance/ 200)", http, HttpRoute("GET", "/api/balance/"),
+                                    NULL, HTTP_FAIL_TIMEOUT, HTTP_PHASE_RECEIVE, 200, 200 + SLACK_MS);
+        failures += !check_deadline("total_ms only (400)", http, HttpRoute("GET", "/api/total/"),
+                                    NULL, HTTP_FAIL_TIMEOUT, HTTP_PHASE_NONE, 400, 400 + SLACK_MS);
+
+        CancelToken cancel;
+        LateCancel late = { &cancel, 100 };
+        Thread canceller;
+        canceller.start(run_late_cancel, &late);
+        failures += !check_deadline("cancel() after 100 ms", http, HttpRoute("GET", "/api/patient/"),
+                                    &cancel, HTTP_FAIL_CANCELLED, HTTP_PHASE_NONE,
+                                    100, 100 + CancelToken::CANCEL_POLL_MS + SLACK_MS);
+        canceller.join();
+        failures += !check_deadline("already cancelled", http, HttpRoute("GET", "/api/patient/"),
+                                    &cancel, HTTP_FAIL_CANCELLED, HTTP_PHASE_NONE, 0, 5);
+        close_hole(hole);
+    }
+
+    // A faulty server: every call ends by total_ms, failures typed
+    HttpTimeouts def;
+    def.receive_ms = 300;
+    def.total_ms   = 500;
+    TimeoutTable t;
+    t.defaults() = def;
+    HttpPool http(host, port);
+    http.set_timeouts(t);
+    static const HttpRoute route("GET", "/api/balance/");
+    vector<uint64_t> ns;
+    ns.reserve(n);
+    unsigned long ok = 0, timed_out = 0, other = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t t0 = now_ns();
+        HttpResponse r = http.request(route, NULL, 0, "");
+        ns.push_back(now_ns() - t0);
+        if (r.status_code == 200) ok++;
+        else if (r.timed_out())   timed_out++;
+        else                      other++;
+    }
+    if (!ok && !timed_out) { cerr << "no replies from " << host << ":" << port << ": is the server up?\n"; return 1; }
+    double worst = percentile_us(ns, 1.0) / 1000.0;
+    cout << "  " << n << " calls to " << host << ":" << port << " (receive 300 ms, total 500 ms)\n"
+         << "    " << ok << " ok, " << timed_out << " timed out, " << other << " other failures\n"
+         << "    p50 " << setprecision(1) << percentile_us(ns, 0.50) / 1000.0
+         << " ms, p99 " << percentile_us(ns, 0.99) / 1000.0 << " ms, max " << worst << " ms\n";
+    if (worst > def.total_ms + SLACK_MS) {
+        cout << "    <-- a call outlived total_ms\n";
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
+
+// --- bench balance ------------------------------------------------------------
+// A port nothing listens on: connects are refused at once
+unsigned short refused_port() {
+    unsigned short port = 0;
+    int fd = black_hole(port);
+    close_hole(fd);
+    return fd < 0 ? 0 : port;
+}
+
+#ifndef _WIN32
+// Stand-in server: accepts on `fd` and answers every request with 200
+struct TinyServer {
+    int           fd;
+    volatile bool stop;
+};
+
+void tiny_conn(void* arg) {
+    int fd = (int)(long)arg;
+    string buf;
+    char chunk[4096];
+    for (;;) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == string::npos) {
+            ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+            if (r <= 0) { close(fd); return; }
+            buf.append(chunk, (size_t)r);
+        }
+        buf.erase(0, end + 4);                          // the probes and GETs have no body
+        static const char REPLY[] = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                                    "Content-Length: 18\r\n\r\n{\"balance\":\"0.00\"}";
+        if (send(fd, REPLY, sizeof(REPLY) - 1, MSG_NOSIGNAL) <= 0) { close(fd); return; }
+    }
+}
+
+void tiny_accept(void* arg) {
+    TinyServer* t = (TinyServer*)arg;
+    vector<Thread*> conns;
+    while (!t->stop) {
+        int c = accept(t->fd, NULL, NULL);
+        if (c < 0) break;
+        conns.push_back(new Thread());
+        if (!conns.back()->start(tiny_conn, (void*)(long)c)) close(c);
+    }
+    for (size_t i = 0; i < conns.size(); i++) { conns[i]->join(); delete conns[i]; }
+}
+
+int tiny_listen(unsigned short port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family      = AF_INET;
+    a.sin_port        = htons(port);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr*)&a, sizeof(a)) != 0 || listen(fd, 64) != 0) { close(fd); return -1; }
+    return fd;
+}
+#endif
+
+struct BalanceLoad {
+    HttpPool*     http;
+    volatile bool* stop;
+    unsigned long ok, failed;
+};
+
+void run_balance_load(void* arg) {
+    BalanceLoad* l = (BalanceLoad*)arg;
+    static const HttpRoute route("GET", "/api/balance/");
+    while (!*l->stop) {
+        if (l->http->request(route, NULL, 0, "").status_code == 200) l->ok++;
+        else l->failed++;
+    }
+}
+
+void print_servers(HttpPool& http) {
+    vector<ServerStatus> st;
+    http.servers(st);
+    for (size_t i = 0; i < st.size(); i++)
+        cout << "    " << left << setw(18) << st[i].name << right << setw(8) << st[i].requests
+             << " requests " << setw(6) << st[i].failures << " failed " << setw(3) << st[i].ejections
+             << " ejections" << (st[i].ejected ? "  (out)" : "") << "\n";
+}
+
+// 8 threads for `secs`; ok / failed summed
+void balance_round(HttpPool& http, double secs, unsigned long& ok, unsigned long& failed) {
+    volatile bool stop = false;
+    BalanceLoad loads[8];
+    Thread threads[8];
+    for (int i = 0; i < 8; i++) {
+        BalanceLoad l = { &http, &stop, 0, 0 };
+        loads[i] = l;
+        threads[i].start(run_balance_load, &loads[i]);
+    }
+    sleep_ms((unsigned)(secs * 1000));
+    stop = true;
+    ok = failed = 0;
+    for (int i = 0; i < 8; i++) { threads[i].join(); ok += loads[i].ok; failed += loads[i].failed; }
+}
+
+int bench_balance(int argc, char** argv) {
+#ifdef _WIN32
+    (void)argc; (void)argv;
+    cerr << "bench balance needs POSIX sockets for its stand-in servers\n";
+    return 2;
+#else
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    string ports = argc > 3 ? argv[3] : "8000";
+    double secs = argc > 4 ? atof(argv[4]) : 5.0;
+    int failures = 0;
+
+    vector<ServerAddr> servers;
+    for (size_t a = 0; a <= ports.size();) {
+        size_t b = ports.find(',', a);
+        if (b == string::npos) b = ports.size();
+        servers.push_back(ServerAddr(host, (unsigned short)atoi(ports.substr(a, b - a).c_str())));
+        a = b + 1;
+    }
+    unsigned short down = refused_port();
+    unsigned short hole_port = 0;
+    int hole = black_hole(hole_port);
+    if (!down || hole < 0) { cerr << "cannot open local listeners\n"; return 1; }
+    servers.push_back(ServerAddr("127.0.0.1", down));
+    servers.push_back(ServerAddr("127.0.0.1", hole_port));
+
+    BalancerConfig b;
+    b.health_ms = 500;
+    b.eject_ms  = 1000;
+    TimeoutTable t;
+    t.defaults().receive_ms = 300;
+    t.defaults().total_ms   = 500;
+    HttpPool http(servers[0].host, servers[0].port);
+    http.set_timeouts(t);
+    http.set_servers(servers, b);
+
+    cout << "bench balance: " << servers.size() << " servers (" << servers.size() - 2
+         << " mock, 127.0.0.1:" << down << " refused, 127.0.0.1:" << hole_port << " silent)\n";
+    unsigned long ok, failed;
+    balance_round(http, secs, ok, failed);
+    double rate = 100.0 * (double)ok / (double)(ok + failed ? ok + failed : 1);
+    cout << "  " << fixed << setprecision(0) << secs << " s, 8 threads    " << ok << " ok, " << failed
+         << " failed (" << setprecision(2) << rate << "% ok)\n";
+    print_servers(http);
+    failures += rate < 99.0;
+
+    // Bring the refused server up: the checker must put it back
+    TinyServer tiny = { tiny_listen(down), false };
+    if (tiny.fd < 0) { cerr << "cannot listen on " << down << "\n"; close_hole(hole); return 1; }
+    Thread acceptor;
+    acceptor.start(tiny_accept, &tiny);
+    uint64_t t0 = now_ms();
+    bool back = false;
+    vector<ServerStatus> st;
+    while (!back && now_ms() - t0 < 10000) {
+        sleep_ms(50);
+        http.servers(st);
+        back = !st[servers.size() - 2].ejected;
+    }
+    unsigned long before = st[servers.size() - 2].requests;
+    balance_round(http, 1.0, ok, failed);
+    http.servers(st);
+    unsigned long served = st[servers.size() - 2].requests - before;
+    cout << "  127.0.0.1:" << down << " up: back in rotation after " << now_ms() - t0 - 1000
+         << " ms, then served " << served << " of " << ok + failed << " requests in 1 s\n";
+    failures += !back || !served;
+
+    tiny.stop = true;
+    shutdown(tiny.fd, SHUT_RDWR);
+    http.close_idle();
+    close(tiny.fd);
+    acceptor.join();
+    close_hole(hole);
+    return failures ? 1 : 0;
+#endif
+}
+
+// --- bench wire ---------------------------------------------------------------
+// Wire bytes and requests per route (path up to the query string)
+struct WireCounter : RequestObserver {
+    struct Route { unsigned long requests, not_modified; uint64_t in, out; };
+    Mutex mu;
+    map<string, Route> routes;
+
+    void on_request(const string&, const string& path, const RequestTiming& t) {
+        LockGuard lock(mu);
+        Route& r = routes[path.substr(0, path.find('?'))];
+        r.requests++;
+        r.not_modified += t.status_code == 304;
+        r.in  += t.bytes_in;
+        r.out += t.bytes_out;
+    }
+    Route total() {
+        LockGuard lock(mu);
+        Route t = { 0, 0, 0, 0 };
+        for (map<string, Route>::iterator i = routes.begin(); i != routes.end(); ++i) {
+            t.requests += i->second.requests;
+            t.not_modified += i->second.not_modified;
+            t.in += i->second.in;
+            t.out += i->second.out;
+        }
+        return t;
+    }
+};
+
+// One terminal user, start to finish. False if any step failed.
+bool wire_session(HttpPool& http, int n) {
+    HttpResponse login = http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    bool ok = login.status_code == 200;
+
+    HistoryPage page;
+    fetch_history_page(http, token, "", 500, page);           // first sync of the local cache
+    ok &= page.status_code == 200 && !page.rows.empty();
+    string newest = page.rows.empty() ? "" : page.rows[0].created_at;
+    for (int i = 0; i < 12; i++)                               // the menu polls the balance
+        ok &= http.request("GET", "/api/balance/", "", token).status_code == 200;
+    fetch_history_page(http, token, "", 10, page);             // history screen: two pages, back
+    string next = page.next_cursor;
+    fetch_history_page(http, token, next, 10, page);
+    fetch_history_page(http, token, "", 10, page);
+    ok &= page.status_code == 200 && page.rows.size() == 10;
+
+    TxnRequest send;
+    send.type = TXN_SEND;
+    send.recipient_phone = "0722345678";
+    send.amount = Money::from_cents(1000 + n);
+    send.pin = "1234";
+    ok &= post_txn(http, token, send).status_code == 200;
+    ok &= http.request("GET", "/api/balance/", "", token).status_code == 200;
+    fetch_history_page(http, token, "", 10, page);             // now one row newer
+    ok &= page.status_code == 200;
+    fetch_history_page(http, token, "", 500, page, newest);    // sync: just what is new
+    ok &= page.status_code == 200;
+
+    HttpResponse bal;
+    HistoryPage recent;
+    RequestBatch dash(token);                                  // dashboard in one round-trip
+    dash.add("GET", "/api/balance/", "", &bal);
+    dash.add_history("", 50, &recent);
+    dash.send(http);
+    ok &= bal.status_code == 200 && recent.rows.size() == 50;
+    for (int i = 0; i < 6; i++)
+        ok &= http.request("GET", "/api/balance/", "", token).status_code == 200;
+
+    JsonBody<1024> out;
+    out.begin_object();
+    out.field("refresh", json_get(login.body, "refresh"));
+    out.end_object();
+    ok &= http.request("POST", "/api/auth/logout/", string(out.data(), out.size()), token).status_code == 200;
+    return ok;
+}
+
+void print_wire(const char* label, WireCounter& w, int sessions) {
+    WireCounter::Route t = w.total();
+    cout << "  " << left << setw(24) << label << right << setw(9) << fixed << setprecision(1)
+         << (double)t.requests / sessions << setw(9) << (double)t.not_modified / sessions
+         << setw(13) << setprecision(0) << (double)t.in / sessions
+         << setw(12) << (double)t.out / sessions << "\n";
+    for (map<string, WireCounter::Route>::iterator i = w.routes.begin(); i != w.routes.end(); ++i)
+        cout << "    " << left << setw(22) << i->first << right << setw(9) << setprecision(1)
+             << (double)i->second.requests / sessions << setw(9)
+             << (double)i->second.not_modified / sessions << setw(13) << setprecision(0)
+             << (double)i->second.in / sessions << setw(12) << (double)i->second.out / sessions << "\n";
+}
+
+int bench_wire(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int sessions = argc > 4 ? atoi(argv[4]) : 20;
+    if (sessions < 1) sessions = 1;
+
+    PoolConfig plain_cfg;
+    plain_cfg.accept_encoding = false;
+    HttpPool plain(host, port, plain_cfg);
+    HttpPool packed(host, port);
+    ResponseCache cache;
+    packed.set_cache(&cache);
+
+    // Same bytes whichever way they travel
+    HttpResponse login = plain.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    string path = history_path("", 500);
+    HttpResponse a = plain.request("GET", path, "", token);
+    HttpResponse b = packed.request("GET", path, "", token);
+    HttpResponse c = packed.request("GET", path, "", token);
+    string streamed;
+    StringSink sink(streamed);
+    HttpResponse d = packed.request(HttpRoute("GET", path), NULL, 0, token, &sink);
+    bool same = a.status_code == 200 && b.status_code == 200 && c.status_code == 200 &&
+                d.status_code == 200 && !a.body.empty() && a.body == b.body && a.body == c.body &&
+                a.body == streamed && c.from_cache && d.from_cache && !b.from_cache;
+    cout << "bench wire: " << a.body.size() << "-byte history page plain, gzipped, and replayed "
+         << "after a 304 (buffered and streamed): " << (same ? "identical" : "MISMATCH") << "\n";
+
+    cout << "  " << sessions << " user sessions each way, per session:\n"
+         << "  " << left << setw(24) << "" << right << setw(9) << "requests" << setw(9) << "304s"
+         << setw(13) << "bytes in" << setw(12) << "bytes out" << "\n";
+    int failed = 0;
+    WireCounter before, after;
+    plain.set_observer(&before);
+    packed.set_observer(&after);
+    for (int i = 0; i < sessions; i++) failed += !wire_session(plain, i);
+    print_wire("identity, no validators", before, sessions);
+    for (int i = 0; i < sessions; i++) failed += !wire_session(packed, i);
+    print_wire("gzip + conditional GETs", after, sessions);
+
+    WireCounter::Route x = before.total(), y = after.total();
+    CacheStats cs = cache.stats();
+    cout << "  bytes in per session: " << setprecision(1)
+         << 100.0 * (1.0 - (double)y.in / (double)(x.in ? x.in : 1)) << "% fewer ("
+         << setprecision(1) << (double)x.in / (double)(y.in ? y.in : 1) << "x); cache "
+         << cs.hits << " hits of " << cs.lookups << " conditional GETs, " << cs.bytes
+         << " bytes held\n";
+    if (failed) cout << "  " << failed << " sessions had a failed step\n";
+    return same && !failed ? 0 : 1;
+}
+
+// --- bench outbox -------------------------------------------------------------
+// One token for the whole run; the mock server's do not expire by default
+struct FixedAuth : TokenSource {
+    string tok;
+    string token()                { return tok; }
+    bool   refresh(const string&) { return false; }
+};
+
+// Deposit i of this run: its amount is how the server's copy is found again
+TxnRequest outbox_deposit(const string& run, int i) {
+    TxnRequest req;
+    req.type = TXN_DEPOSIT;
+    req.amount = Money::from_cents(100 + i);
+    req.reference = "outbox bench";
+    req.idempotency_key = run + "-" + to_string(i);     // the same if queued twice
+    return req;
+}
+
+struct EnqueueLoad {
+    Outbox*       box;
+    string        run;
+    int           first, count;
+};
+
+void run_enqueue_load(void* arg) {
+    EnqueueLoad* e = (EnqueueLoad*)arg;
+    for (int i = e->first; i < e->first + e->count; i++) {
+        TxnRequest req = outbox_deposit(e->run, i);
+        e->box->enqueue(req);
+    }
+}
+
+bool wait_drained(Outbox& box, unsigned ms) {
+    uint64_t t0 = now_ms();
+    while (box.pending() && now_ms() - t0 < ms) sleep_ms(5);
+    return !box.pending();
+}
+
+// A batch endpoint in the process: deposits and withdrawals against one
+// balance, replayed by idempotency key. The first time it sees `busy_key`
+// it answers that call 503, and runs the rest of the batch regardless.
+struct ScriptedBatch : HttpTransport {
+    Money              balance;
+    string             busy_key;
+    map<string, Money> applied;             // key -> the balance it left
+    int                calls;
+
+    ScriptedBatch() : calls(0) {}
+
+    HttpResponse exchange(const HttpRoute& route, const char* body, size_t body_len,
+                          const string&, BodySink*, CancelToken*, const Validators*) {
+        HttpResponse out;
+        out.status_code = 404;
+        if (route.path != "/api/batch/") return out;
+        string text(body, body_len);
+        JsonIndex j(text);
+        uint32_t arr = j.find(j.root(), "requests");
+        out.status_code = 200;
+        out.body = "{\"responses\":[";
+        for (uint32_t e = j.first_child(arr); e != JsonIndex::NONE; e = j.next_sibling(e)) {
+            uint32_t b = j.find(e, "body");
+            string path = j.str(j.find(e, "path"));
+            string key = j.str(j.find(b, "idempotency_key"));
+            Money amount;
+            Money::parse(j.str(j.find(b, "amount")), amount);
+            calls++;
+            if (e != j.first_child(arr)) out.body += ",";
+            map<string, Money>::iterator seen = applied.find(key);
+            if (seen != applied.end()) {
+                out.body += "{\"status\":200,\"body\":{\"transaction_id\":\"" + key + "\",\"new_balance\":\""
+                          + seen->second.str() + "\",\"replayed\":true}}";
+            } else if (key == busy_key) {
+                busy_key.clear();
+                out.body += "{\"status\":503,\"body\":{\"error\":\"Service unavailable\"}}";
+            } else if (path == "/api/withdraw/" && balance < amount) {
+                out.body += "{\"status\":400,\"body\":{\"error\":\"Insufficient balance\"}}";
+            } else {
+                balance += path == "/api/withdraw/" ? -amount : amount;
+                applied[key] = balance;
+                out.body += "{\"status\":200,\"body\":{\"transaction_id\":\"" + key + "\",\"new_balance\":\""
+                          + balance.str() + "\"}}";
+            }
+        }
+        out.body += "]}";
+        return out;
+    }
+};
+
+#ifndef _WIN32
+// Child: recover the log, queue entries from `next` on, flush until empty.
+// Each index is written to `acks` once enqueue() says it is on disk.
+void outbox_child(const string& host, unsigned short port, const string& path, const string& token,
+                  const string& run, int next, int entries, int acks) {
+    HttpPool http(host, port);
+    Outbox box(http);
+    string err;
+    if (!box.open(path, err)) _exit(3);
+    FixedAuth auth;
+    auth.tok = token;
+    box.set_group(5);                       // more groups, more places to die
+    box.start(&auth);
+    for (int i = next; i < entries; i++) {
+        TxnRequest req = outbox_deposit(run, i);
+        if (!box.enqueue(req)) _exit(4);
+        if (write(acks, &i, sizeof(i)) != (ssize_t)sizeof(i)) _exit(5);
+    }
+    _exit(wait_drained(box, 30000) ? 0 : 6);
+}
+#endif
+
+int bench_outbox(int argc, char** argv) {
+#ifdef _WIN32
+    (void)argc; (void)argv;
+    cerr << "bench outbox needs fork() and SIGKILL for its crash test\n";
+    return 2;
+#else
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int entries = argc > 4 ? atoi(argv[4]) : 200;
+    int kills = argc > 5 ? atoi(argv[5]) : 30;
+    if (entries < 1) entries = 1;
+    int failures = 0;
+    string path = "bench_outbox.wal";
+    string run = "outbox-" + to_string(process_id()) + "-" + to_string(now_ms());
+    string err;
+    HttpPool offline("127.0.0.1", refused_port());
+
+    // 1. A record cut short by a crash is dropped on open, the rest kept
+    remove(path.c_str());
+    {
+        Outbox box(offline);
+        box.open(path, err);
+        for (int i = 0; i < 3; i++) { TxnRequest req = outbox_deposit(run + "-torn", i); box.enqueue(req); }
+    }
+    const char* torn = "1c291ca3 {\"op\":\"queue\",\"seq\":4,\"type\":\"DEP";
+    FILE* f = fopen(path.c_str(), "ab");
+    fputs(torn, f);
+    fclose(f);
+    {
+        Outbox box(offline);
+        bool opened = box.open(path, err);
+        OutboxStats st = box.stats();
+        bool ok = opened && st.recovered == 3 && st.torn_bytes == strlen(torn);
+        cout << "bench outbox: torn last record: " << st.recovered << " entries recovered, "
+             << st.torn_bytes << " bytes cut off" << (ok ? "" : "   <-- expected 3 and all of it") << "\n";
+        failures += !ok;
+    }
+    remove(path.c_str());
+
+    // 2. Group commit: concurrent enqueues share fsyncs
+    {
+        Outbox box(offline);
+        box.open(path, err);
+        EnqueueLoad load[8];
+        Thread threads[8];
+        uint64_t t0 = now_ns();
+        for (int t = 0; t < 8; t++) {
+            load[t].box = &box; load[t].run = run + "-group"; load[t].first = t * 50; load[t].count = 50;
+            threads[t].start(run_enqueue_load, &load[t]);
+        }
+        for (int t = 0; t < 8; t++) threads[t].join();
+        double ms = (double)(now_ns() - t0) / 1e6;
+        OutboxStats st = box.stats();
+        cout << "  8 threads x 50 enqueues: " << st.queued << " durable in " << fixed << setprecision(1)
+             << ms << " ms, " << st.syncs << " fsyncs (" << setprecision(2)
+             << (double)st.queued / (double)(st.syncs ? st.syncs : 1) << " entries each)\n";
+        failures += st.queued != 400 || box.pending() != 400;
+    }
+    remove(path.c_str());
+
+    // 3. A 503 mid-group: nothing behind it is settled, nothing overtakes it.
+    //    Deposit 50, withdraw 30, deposit 1 into an empty account; the first
+    //    deposit is busy once, so the withdrawal is short of funds and the
+    //    last deposit goes through. Then a restart, and the lot again.
+    {
+        ScriptedBatch server;
+        HttpPool scripted("127.0.0.1", refused_port());
+        scripted.set_transport(&server);
+        FixedAuth auth;
+        TxnRequest dep = outbox_deposit(run + "-order", 0), wd, last = outbox_deposit(run + "-order", 2);
+        dep.amount = Money::from_cents(5000);
+        last.amount = Money::from_cents(100);
+        wd.type = TXN_WITHDRAW;
+        wd.amount = Money::from_cents(3000);
+        wd.pin = "1234";
+        wd.idempotency_key = run + "-order-1";
+        server.busy_key = dep.idempotency_key;
+
+        Outbox box(scripted);
+        box.open(path, err);
+        box.enqueue(dep); box.enqueue(wd); box.enqueue(last);
+        box.flush(auth);
+        size_t held = box.pending();
+        box.close();                        // the crash: only the log is left
+
+        box.open(path, err);
+        size_t recovered = box.stats().recovered;
+        box.supply_pin("1234");
+        box.flush(auth);
+        vector<OutboxOutcome> outcomes;
+        box.take_outcomes(outcomes);
+        bool in_order = outcomes.size() == 3;
+        for (size_t i = 0; in_order && i < 3; i++)
+            in_order = outcomes[i].result.ok() && outcomes[i].result.replayed == (i == 2);
+        bool ok = held == 3 && recovered == 3 && in_order && !box.pending() && server.applied.size() == 3
+                  && server.balance == Money::from_cents(2100);
+        cout << "  503 mid-group: " << held << " of 3 left queued, " << recovered << " recovered, "
+             << outcomes.size() << " settled in order, balance " << server.balance << " after "
+             << server.calls << " calls" << (ok ? "" : "   <-- expected 3, 3, 3 and 21.00") << "\n";
+        failures += !ok;
+    }
+    remove(path.c_str());
+
+    // 4. Kill the flushing process over and over
+    HttpPool http(host, port);
+    HttpResponse login = http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    if (login.status_code != 200) { cerr << "cannot log in to " << host << ":" << port << ": is the server up?\n"; return 1; }
+    HistoryPage top;
+    fetch_history_page(http, token, "", 1, top);
+    string baseline = top.rows.empty() ? "" : top.rows[0].transaction_id;
+
+    int next = 0, killed = 0, finished = 0;
+    unsigned long recovered = 0;
+    uint64_t rng = now_ns();
+    http.close_idle();                      // no sockets shared with the children
+    for (int round = 0; round <= kills && !finished; round++) {
+        int fds[2];
+        if (pipe(fds) != 0) { cerr << "pipe failed\n"; return 1; }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            outbox_child(host, port, path, token, run, next, entries, fds[1]);
+        }
+        close(fds[1]);
+        int status = 0;
+        if (round < kills) {
+            rng = splitmix64(rng);
+            sleep_ms(5 + (unsigned)(rng % 40));
+            if (waitpid(pid, &status, WNOHANG) == 0) { kill(pid, SIGKILL); killed++; }
+        }
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) finished = 1;
+        else if (WIFEXITED(status)) { cerr << "child failed with " << WEXITSTATUS(status) << "\n"; return 1; }
+        int i;
+        while (read(fds[0], &i, sizeof(i)) == (ssize_t)sizeof(i)) if (i + 1 > next) next = i + 1;
+        close(fds[0]);
+
+        Outbox box(offline);                // what a restart finds
+        if (!box.open(path, err)) { cerr << err << "\n"; return 1; }
+        recovered += box.stats().recovered;
+    }
+    cout << "  " << entries << " deposits, flushing child killed " << killed << " times: "
+         << recovered << " entries recovered across restarts, "
+         << (finished ? "drained" : "NOT drained") << "\n";
+    failures += !finished || next != entries;
+
+    // 5. Queued while offline, then sent in groups
+    OutboxStats st;
+    double flush_ms = 0;
+    {
+        Outbox box(http);
+        box.open(path, err);
+        for (int i = entries; i < 2 * entries; i++) { TxnRequest req = outbox_deposit(run, i); box.enqueue(req); }
+        FixedAuth auth;
+        auth.tok = token;
+        uint64_t t0 = now_ns();
+        box.start(&auth);
+        failures += !wait_drained(box, 30000);
+        flush_ms = (double)(now_ns() - t0) / 1e6;
+        st = box.stats();
+    }
+    cout << "  " << entries << " queued offline: sent in " << st.round_trips << " round trips, "
+         << setprecision(1) << flush_ms << " ms\n";
+    remove(path.c_str());
+
+    // 6. The server's copy: every deposit of this run, each exactly once
+    map<int64_t, int> seen;
+    string cursor;
+    bool reached = false;                   // the newest row from before the run
+    do {
+        HistoryPage page;
+        fetch_history_page(http, token, cursor, 500, page);
+        if (page.status_code != 200) { cerr << "history failed: " << page.error << "\n"; return 1; }
+        for (size_t r = 0; r < page.rows.size() && !reached; r++) {
+            if (!baseline.empty() && page.rows[r].transaction_id == baseline) { reached = true; break; }
+            Money m;
+            Money::parse(page.rows[r].amount, m);
+            seen[m.cents()]++;
+        }
+        cursor = page.next_cursor;
+    } while (!reached && !cursor.empty());
+    int lost = 0, twice = 0;
+    for (int i = 0; i < 2 * entries; i++) {
+        int n = seen[100 + i];
+        lost += n == 0;
+        twice += n > 1;
+    }
+    cout << "  server: " << 2 * entries - lost << " of " << 2 * entries << " deposits present, "
+         << lost << " lost, " << twice << " applied twice\n";
+    failures += lost + twice;
+    return failures ? 1 : 0;
+#endif
+}
+
+// --- bench events -------------------------------------------------------------
+// When each deposit went out, looked up by what a terminal sees of it
+struct DepositClock {
+    Mutex                 mu;
+    map<string, uint64_t> by_txn;                 // transaction_id -> now_ns() sent
+    vector<string>        txns;                   // in order
+    vector<int64_t>       balances;               // ... the balance each left, in cents
+    vector<uint64_t>      times;                  // ... and when it was sent
+    uint64_t              in_flight;              // sent, no reply yet: 0 if none
+
+    DepositClock() : in_flight(0) {}
+
+    void sending() { LockGuard lock(mu); in_flight = now_ns(); }
+    void sent(const string& txn, const string& balance) {
+        Money m;
+        Money::parse(balance, m);
+        LockGuard lock(mu);
+        by_txn[txn] = in_flight;
+        txns.push_back(txn);
+        balances.push_back(m.cents());
+        times.push_back(in_flight);
+        in_flight = 0;
+    }
+    // An event can beat the reply to the deposit that caused it
+    bool sent_at(const string& txn, uint64_t& t) {
+        LockGuard lock(mu);
+        map<string, uint64_t>::const_iterator it = by_txn.find(txn);
+        t = it != by_txn.end() ? it->second : in_flight;
+        return t != 0;
+    }
+    // A terminal shows `balance`: every deposit up to it, from `next` on, has
+    // reached it. Their latencies go into lat.
+    void reached(int64_t balance, size_t& next, vector<uint64_t>& lat) {
+        uint64_t now = now_ns();
+        LockGuard lock(mu);
+        for (; next < balances.size() && balances[next] <= balance; next++) lat.push_back(now - times[next]);
+    }
+};
+
+struct DepositDriver {
+    HttpPool*     http;
+    string        token;
+    DepositClock* clock;
+    volatile bool stop;
+    unsigned      every_ms;
+    int           failed;
+};
+
+void run_deposit_driver(void* arg) {
+    DepositDriver* d = (DepositDriver*)arg;
+    const HttpRoute route("POST", "/api/deposit/");
+    const char* body = "{\"amount\":\"1.00\",\"reference\":\"events bench\"}";
+    while (!d->stop) {
+        d->clock->sending();
+        HttpResponse r = d->http->request(route, body, strlen(body), d->token);
+        if (r.status_code == 200) d->clock->sent(json_get(r.body, "transaction_id"), json_get(r.body, "new_balance"));
+        else                      d->failed++;
+        sleep_ms(d->every_ms);
+    }
+}
+
+// A terminal polling the balance, as SessionManager does without a stream
+struct PollTerminal {
+    HttpPool*        http;
+    string           token;
+    DepositClock*    clock;
+    volatile bool*   stop;
+    unsigned         every_ms;
+    vector<uint64_t> lat;
+};
+
+void run_poll_terminal(void* arg) {
+    PollTerminal* p = (PollTerminal*)arg;
+    const HttpRoute route("GET", "/api/balance/");
+    size_t next = 0;
+    while (!*p->stop) {
+        HttpResponse r = p->http->request(route, NULL, 0, p->token);
+        Money balance;
+        if (r.status_code == 200 && Money::parse(json_get(r.body, "balance"), balance))
+            p->clock->reached(balance.cents(), next, p->lat);
+        sleep_ms(p->every_ms);
+    }
+}
+
+// A terminal following the stream: every deposit once, in order
+struct StreamTerminal : EventListener {
+    DepositClock*    clock;
+    Mutex            mu;
+    vector<string>   txns;
+    vector<uint64_t> lat;
+    long             last_id;
+    unsigned long    repeats;
+
+    StreamTerminal() : clock(NULL), last_id(0), repeats(0) {}
+
+    void on_event(const SseEvent& e) {
+        if (e.type != "txn") return;
+        JsonIndex j(e.data);
+        long id = atol(j.get("id").c_str());
+        string txn = j.get("transaction_id");
+        uint64_t t;
+        bool timed = clock->sent_at(txn, t);
+        LockGuard lock(mu);
+        if (id <= last_id) { repeats++; return; }
+        last_id = id;
+        txns.push_back(txn);
+        if (timed) lat.push_back(now_ns() - t);
+    }
+
+    size_t seen() { LockGuard lock(mu); return txns.size(); }
+};
+
+void print_events_row(const string& label, WireCounter& w, size_t updates, size_t deposits,
+                      vector<uint64_t>& lat) {
+    WireCounter::Route t = w.total();
+    cout << "  " << left << setw(26) << label << right << setw(9) << t.requests << setw(12) << t.in
+         << setw(11) << t.out << setw(8) << updates << "/" << left << setw(6) << deposits << right
+         << fixed << setprecision(0) << setw(8) << percentile_us(lat, 0.50) / 1000.0
+         << setw(9) << percentile_us(lat, 0.99) / 1000.0 << "\n";
+}
+
+int bench_events(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int n = argc > 4 ? atoi(argv[4]) : 50;
+    double secs = argc > 5 ? atof(argv[5]) : 10.0;
+    if (n < 1) n = 1;
+    const unsigned POLL_MS = 1000, DEPOSIT_MS = 200;
+
+    HttpPool driver_http(host, port);
+    HttpResponse login = driver_http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    if (login.status_code != 200) { cerr << "login failed: is the server up?\n"; return 1; }
+    cout << "bench events: " << n << " terminals, " << setprecision(0) << fixed << secs
+         << " s each way, a deposit every " << DEPOSIT_MS << " ms\n"
+         << "  " << left << setw(26) << "" << right << setw(9) << "requests" << setw(12) << "bytes in"
+         << setw(11) << "bytes out" << setw(15) << "seen/deposits" << setw(8) << "p50 ms"
+         << setw(9) << "p99 ms" << "\n";
+    int failures = 0;
+
+    // 1. Every terminal polls the balance
+    {
+        HttpPool http(host, port);
+        ResponseCache cache;
+        http.set_cache(&cache);
+        WireCounter wire;
+        http.set_observer(&wire);
+        DepositClock clock;
+        DepositDriver driver = { &driver_http, token, &clock, false, DEPOSIT_MS, 0 };
+        volatile bool stop = false;
+        vector<PollTerminal> terms(n);
+        vector<Thread> threads(n);
+        for (int i = 0; i < n; i++) {
+            PollTerminal& p = terms[i];
+            p.http = &http; p.token = token; p.clock = &clock; p.stop = &stop; p.every_ms = POLL_MS;
+            threads[i].start(run_poll_terminal, &p);
+            sleep_ms(POLL_MS / n);                          // spread, as real terminals are
+        }
+        Thread d;
+        d.start(run_deposit_driver, &driver);
+        sleep_ms((unsigned)(secs * 1000));
+        driver.stop = true;
+        d.join();
+        sleep_ms(POLL_MS);                                  // the last one reaches everyone
+        stop = true;
+        vector<uint64_t> lat;
+        for (int i = 0; i < n; i++) {
+            threads[i].join();
+            lat.insert(lat.end(), terms[i].lat.begin(), terms[i].lat.end());
+        }
+        ostringstream label;
+        label << "balance poll every " << POLL_MS << " ms";
+        print_events_row(label.str(), wire, lat.size(), clock.txns.size() * n, lat);
+        failures += driver.failed;
+    }
+
+    // 2. Every terminal follows an event stream, from now on
+    {
+        HttpPool http(host, port);
+        TimeoutTable t;
+        t.defaults().receive_ms = t.defaults().total_ms = 0;
+        http.set_timeouts(t);
+        WireCounter wire;
+        http.set_observer(&wire);
+        DepositClock clock;
+        DepositDriver driver = { &driver_http, token, &clock, false, DEPOSIT_MS, 0 };
+        FixedAuth auth;
+        auth.tok = token;
+        vector<StreamTerminal> terms(n);
+        vector<EventStream*> streams(n);
+        for (int i = 0; i < n; i++) {
+            terms[i].clock = &clock;
+            streams[i] = new EventStream(http);
+            streams[i]->start(&auth, &terms[i], "");
+        }
+        uint64_t t0 = now_ms();
+        for (int i = 0; i < n && now_ms() - t0 < 5000; )
+            if (streams[i]->connected()) i++; else sleep_ms(5);
+        Thread d;
+        d.start(run_deposit_driver, &driver);
+        sleep_ms((unsigned)(secs * 1000));
+        driver.stop = true;
+        d.join();
+        t0 = now_ms();
+        for (int i = 0; i < n && now_ms() - t0 < 5000; )
+            if (terms[i].seen() == clock.txns.size()) i++; else sleep_ms(5);
+
+        vector<uint64_t> lat;
+        size_t seen = 0;
+        unsigned long opened = 0, stalls = 0, repeats = 0, missed = 0, unsupported = 0;
+        for (int i = 0; i < n; i++) {
+            streams[i]->stop();
+            EventStats st = streams[i]->stats();
+            opened += st.connects;
+            stalls += st.stalls;
+            unsupported += streams[i]->unsupported();
+            delete streams[i];
+            StreamTerminal& s = terms[i];
+            lat.insert(lat.end(), s.lat.begin(), s.lat.end());
+            seen += s.txns.size();
+            repeats += s.repeats;
+            missed += s.txns != clock.txns;
+        }
+        print_events_row("event stream", wire, seen, clock.txns.size() * n, lat);
+        cout << "  streams: " << opened << " opened for " << n << " terminals (each reopened from its last id), "
+             << stalls << " stalled, " << missed << " missed or reordered a deposit, " << repeats << " repeats\n";
+        if (unsupported) cout << "  the server has no /api/events/ (" << unsupported << " streams refused)\n";
+        failures += driver.failed + (int)missed + (int)repeats + (int)unsupported + (seen == 0);
+    }
+    return failures ? 1 : 0;
+}
+
+// --- bench trace --------------------------------------------------------------
+void note_page(ostream& o, const char* what, const HistoryPage& p) {
+    o << what << ' ' << p.status_code << " count=" << p.count << " next=" << p.next_cursor
+      << " rows=" << p.rows.size();
+    if (!p.rows.empty()) {
+        const TxnRow& a = p.rows.front();
+        const TxnRow& z = p.rows.back();
+        o << ' ' << a.id << ':' << a.transaction_type << ':' << a.amount << ':' << a.balance_after
+          << " .. " << z.id << ':' << z.amount << ':' << z.balance_after;
+    }
+    o << '\n';
+}
+
+void note_balance(ostream& o, const HttpResponse& r) {
+    o << "balance " << r.status_code << ' ' << json_get(r.body, "balance") << '\n';
+}
+
+// wire_session's steps, with what the client made of each answer written
+// down: a replay must write the same
+void trace_session(HttpPool& http, int n, string& out) {
+    ostringstream o;
+    HttpResponse login = http.request("POST", "/api/auth/login/", FLOW_LOGIN, "");
+    string token = json_get(login.body, "access");
+    o << "login " << login.status_code << (token.empty() ? " no token" : "") << '\n';
+
+    HistoryPage page;
+    fetch_history_page(http, token, "", 500, page);
+    note_page(o, "sync", page);
+    string newest = page.rows.empty() ? "" : page.rows[0].created_at;
+    for (int i = 0; i < 12; i++) note_balance(o, http.request("GET", "/api/balance/", "", token));
+    fetch_history_page(http, token, "", 10, page);
+    note_page(o, "page", page);
+    fetch_history_page(http, token, page.next_cursor, 10, page);
+    note_page(o, "next", page);
+    fetch_history_page(http, token, "", 10, page);
+    note_page(o, "back", page);
+
+    TxnRequest send;
+    send.type = TXN_SEND;
+    send.recipient_phone = "0722345678";
+    send.amount = Money::from_cents(1000 + n);
+    send.pin = "1234";
+    TxnResult sent = post_txn(http, token, send);
+    o << "send " << sent.status_code << ' ' << sent.transaction_id << ' ' << sent.new_balance.str()
+      << ' ' << sent.error << '\n';
+    note_balance(o, http.request("GET", "/api/balance/", "", token));
+    fetch_history_page(http, token, "", 10, page);
+    note_page(o, "page", page);
+    fetch_history_page(http, token, "", 500, page, newest);
+    note_page(o, "sync", page);
+
+    HttpResponse bal;
+    HistoryPage recent;
+    RequestBatch dash(token);
+    dash.add("GET", "/api/balance/", "", &bal);
+    dash.add_history("", 50, &recent);
+    dash.send(http);
+    note_balance(o, bal);
+    note_page(o, "dash", recent);
+    for (int i = 0; i < 6; i++) note_balance(o, http.request("GET", "/api/balance/", "", token));
+
+    JsonBody<1024> body;
+    body.begin_object();
+    body.field("refresh", json_get(login.body, "refresh"));
+    body.end_object();
+    o << "logout " << http.request("POST", "/api/auth/logout/", string(body.data(), body.size()),
+                                   token).status_code << '\n';
+    out = o.str();
+}
+
+uint64_t file_size(const string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n > 0 ? (uint64_t)n : 0;
+}
+
+// One replay of a trace: how long, how much heap at most, how many sessions
+// came out differently from the recording
+struct ReplayRun {
+    uint64_t      ns;
+    long long     peak_heap;
+    unsigned long differ;
+    ReplayStats   stats;
+    unsigned long unused;
+};
+
+// The recorded sessions `rounds` times over, with no server behind the pool
+bool replay_sessions(const string& path, TracePace pace, const vector<string>& live, size_t rounds,
+                     ReplayRun& run, string& err) {
+    HttpPool http("127.0.0.1", refused_port());         // nothing there: every answer is the trace's
+    ResponseCache cache;
+    http.set_cache(&cache);
+    TraceReplayer rep;
+    if (!rep.open(path, err)) return false;
+    rep.set_pace(pace);
+    http.set_transport(&rep);
+    reset_heap_stats();
+    long long base = g_live_bytes.load();
+    run.differ = 0;
+    string out;
+    uint64_t t0 = now_ns();
+    for (size_t r = 0; r < rounds; r++)
+        for (size_t i = 0; i < live.size(); i++) {
+            trace_session(http, (int)i, out);
+            run.differ += out != live[i];
+        }
+    run.ns = now_ns() - t0;
+    run.peak_heap = g_peak_bytes.load() - base;
+    run.stats = rep.stats();
+    run.unused = rep.finish();
+    return true;
+}
+
+int bench_trace(int argc, char** argv) {
+    string host = argc > 2 ? argv[2] : "127.0.0.1";
+    unsigned short port = (unsigned short)(argc > 3 ? atoi(argv[3]) : 8000);
+    int sessions = argc > 4 ? atoi(argv[4]) : 20;
+    long calls = argc > 5 ? atol(argv[5]) : 1000000;
+    if (sessions < 1) sessions = 1;
+    const string path = "bench_trace.mptr", big = "bench_trace_big.mptr";
+    string err;
+    int failures = 0;
+
+    // 1. Record user sessions against the server
+    vector<string> live(sessions);
+    uint64_t rec_ms;
+    {
+        HttpPool http(host, port);
+        ResponseCache cache;
+        http.set_cache(&cache);
+        TraceRecorder rec(http.network());
+        if (!rec.open(path, err)) { cerr << err << "\n"; return 1; }
+        http.set_transport(&rec);
+        uint64_t t0 = now_ms();
+        for (int i = 0; i < sessions; i++) trace_session(http, i, live[i]);
+        rec_ms = now_ms() - t0;
+        if (!rec.close()) { cerr << "cannot write " << path << "\n"; return 1; }
+    }
+    if (live[0].compare(0, 9, "login 200") != 0) { cerr << "login failed: is the server up?\n"; return 1; }
+
+    // What went into the file
+    unsigned long records = 0, secrets = 0, not_modified = 0;
+    uint64_t raw = 0, took_us = 0;
+    int64_t span_us = 0;
+    {
+        TraceReader in;
+        TraceRecord r;
+        if (!in.open(path, err)) { cerr << err << "\n"; return 1; }
+        while (in.next(r)) {
+            records++;
+            raw += r.method.size() + r.path.size() + r.request.size() + r.response.size() +
+                   r.validators.etag.size() + r.validators.last_modified.size();
+            took_us += r.took_us;
+            not_modified += r.status == 304;
+            if (r.at_us + r.took_us > span_us) span_us = r.at_us + r.took_us;
+            string a = r.request, b = r.response;              // redacting again changes nothing
+            trace_redact(a);
+            trace_redact(b);
+            secrets += a != r.request || b != r.response;
+        }
+        if (in.damaged()) { cerr << path << " is damaged\n"; return 1; }
+    }
+    uint64_t file_bytes = file_size(path);
+    cout << "bench trace: " << sessions << " sessions recorded, " << records << " calls ("
+         << not_modified << " answered 304) in " << rec_ms << " ms\n"
+         << "  file " << file_bytes << " bytes, " << fixed << setprecision(0)
+         << (double)file_bytes / records << " per call; " << raw << " bytes of requests and bodies ("
+         << setprecision(1) << (double)raw / (double)(file_bytes ? file_bytes : 1) << "x)\n"
+         << "  secrets left in the file: " << secrets << "\n";
+    failures += secrets != 0;
+
+    // 2. Replayed with no server, at full speed and at the recorded pace
+    cout << "  " << left << setw(30) << "" << right << setw(10) << "calls" << setw(10) << "ms"
+         << setw(12) << "calls/s" << setw(10) << "differ" << setw(11) << "unmatched"
+         << setw(8) << "unused" << setw(12) << "peak heap" << "\n";
+    ReplayRun fast, paced, scaled;
+    if (!replay_sessions(path, TRACE_FULL_SPEED, live, 1, fast, err) ||
+        !replay_sessions(path, TRACE_RECORDED, live, 1, paced, err)) {
+        cerr << err << "\n";
+        return 1;
+    }
+
+    // 3. The same trace repeated to `calls` calls, read as it streams
+    size_t rounds = (size_t)((calls + (long)records - 1) / (long)records);
+    if (rounds < 1) rounds = 1;
+    {
+        TraceWriter out;
+        if (!out.open(big, err)) { cerr << err << "\n"; return 1; }
+        TraceRecord r;
+        for (size_t k = 0; k < rounds; k++) {
+            TraceReader in;
+            in.open(path, err);
+            while (in.next(r)) {
+                r.at_us += (int64_t)k * span_us;
+                out.write(r);
+            }
+        }
+        if (!out.close()) { cerr << "cannot write " << big << "\n"; return 1; }
+    }
+    if (!replay_sessions(big, TRACE_FULL_SPEED, live, rounds, scaled, err)) {
+        cerr << err << "\n";
+        return 1;
+    }
+    uint64_t big_bytes = file_size(big);
+
+    const char* labels[] = { "full speed", "recorded pace", "" };
+    ostringstream scaled_label;
+    scaled_label << "full speed, " << rounds << "x (" << big_bytes / (1024 * 1024) << " MB)";
+    ReplayRun* runs[] = { &fast, &paced, &scaled };
+    for (int i = 0; i < 3; i++) {
+        ReplayRun& r = *runs[i];
+        double ms = (double)r.ns / 1e6;
+        cout << "  " << left << setw(30) << (i == 2 ? scaled_label.str().c_str() : labels[i]) << right
+             << setw(10) << r.stats.replayed << setw(10) << setprecision(0) << ms << setw(12)
+             << (double)r.stats.replayed / (ms > 0 ? ms / 1000.0 : 1) << setw(10) << r.differ
+             << setw(11) << r.stats.unmatched << setw(8) << r.unused << setw(9) << r.peak_heap / 1024
+             << " KB\n";
+        failures += r.differ != 0 || r.stats.unmatched != 0 || r.unused != 0;
+    }
+    double paced_ms = (double)paced.ns / 1e6, server_ms = (double)took_us / 1000.0;
+    cout << "  recorded pace: " << setprecision(0) << paced_ms << " ms against " << server_ms
+         << " ms the server took and " << rec_ms << " ms recording\n";
+    failures += paced_ms < server_ms * 0.95 || paced_ms > (double)rec_ms * 1.5 + 50;
+    bool flat = scaled.peak_heap <= fast.peak_heap * 2 + 256 * 1024;
+    cout << "  peak heap " << (flat ? "flat" : "GREW") << " from " << records << " to "
+         << scaled.stats.replayed << " calls\n";
+    failures += !flat;
+
+    // 4. A recording cut off mid-write keeps every whole record
+    {
+        FILE* f = fopen(path.c_str(), "rb");
+        string bytes;
+        char buf[65536];
+        size_t n;
+        while (f && (n = fread(buf, 1, sizeof(buf), f)) > 0) bytes.append(buf, n);
+        if (f) fclose(f);
+        f = fopen(big.c_str(), "wb");
+        if (f) { fwrite(bytes.data(), 1, bytes.size() - 3, f); fclose(f); }
+        TraceReader in;
+        TraceRecord r;
+        unsigned long kept = 0;
+        if (in.open(big, err)) while (in.next(r)) kept++;
+        bool ok = kept == records - 1 && in.damaged();
+        cout << "  cut 3 bytes short: " << kept << " of " << records << " records read, "
+             << (in.damaged() ? "damage reported" : "NO DAMAGE REPORTED") << "\n";
+        failures += !ok;
+    }
+    remove(path.c_str());
+    remove(big.c_str());
+    return failures ? 1 : 0;
+}
+
+// --- bench endpoints ----------------------------------------------------------
+// What the screens read from each reply, whichever way it was decoded
+struct DecodedReply {
+    string a, b, c, error;
+    Money  money;
+    bool   flag;
+
+    DecodedReply() : flag(false) {}
+    bool operator==(const DecodedReply& o) const {
+        return a == o.a && b == o.b && c == o.c && error == o.error && money == o.money && flag == o.flag;
+    }
+};
+
+enum ReplyKind { REPLY_BALANCE, REPLY_LOGIN, REPLY_SEND };
+
+// Before endpoints.h: a whole-body scan and a string per field
+void legacy_decode(ReplyKind k, const string& body, DecodedReply& d) {
+    switch (k) {
+    case REPLY_BALANCE:
+        Money::parse(json_get(body, "balance"), d.money);
+        d.a = json_get(body, "phone_number");
+        d.b = json_get(body, "account_holder");
+        break;
+    case REPLY_LOGIN:
+        d.a = json_get(body, "access");
+        d.b = json_get(body, "refresh");
+        d.c = json_get(body, "full_name");
+        break;
+    case REPLY_SEND:
+        d.a = json_get(body, "transaction_id");
+        Money::parse(json_get(body, "new_balance"), d.money);
+        d.flag = json_get(body, "replayed") == "true";
+        break;
+    }
+    d.error = json_get(body, "error");
+}
+
+// One JsonIndex reused across responses, looked up by key name
+void index_decode(JsonIndex& j, ReplyKind k, const string& body, DecodedReply& d) {
+    j.parse(body);
+    uint32_t root = j.root();
+    switch (k) {
+    case REPLY_BALANCE:
+        Money::parse(j.get(root, "balance"), d.money);
+        d.a = j.get(root, "phone_number");
+        d.b = j.get(root, "account_holder");
+        break;
+    case REPLY_LOGIN:
+        d.a = j.get(root, "access");
+        d.b = j.get(root, "refresh");
+        d.c = j.get(j.find(root, "user"), "full_name");
+        break;
+    case REPLY_SEND:
+        d.a = j.get(root, "transaction_id");
+        Money::parse(j.get(root, "new_balance"), d.money);
+        d.flag = j.equals(j.find(root, "replayed"), "true");
+        break;
+    }
+    d.error = j.get(root, "error");
+}
+
+// Reply structs reused across responses, as a screen or poller would
+struct TypedReplies {
+    BalanceReply balance;
+    LoginReply   login;
+    TxnReply     send;
+};
+
+void typed_decode(TypedReplies& t, ReplyKind k, const string& body) {
+    switch (k) {
+    case REPLY_BALANCE: json_decode(body, t.balance); break;
+    case REPLY_LOGIN:   json_decode(body, t.login);   break;
+    case REPLY_SEND:    json_decode(body, t.send);    break;
+    }
+}
+
+void typed_fields(const TypedReplies& t, ReplyKind k, DecodedReply& d) {
+    switch (k) {
+    case REPLY_BALANCE:
+        d.money = t.balance.balance;
+        d.a = t.balance.phone_number;
+        d.b = t.balance.account_holder;
+        d.error = t.balance.error;
+        break;
+    case REPLY_LOGIN:
+        d.a = t.login.access;
+        d.b = t.login.refresh;
+        d.c = t.login.user.full_name;
+        d.error = t.login.error;
+        break;
+    case REPLY_SEND:
+        d.a = t.send.transaction_id;
+        d.money = t.send.new_balance;
+        d.flag = t.send.replayed;
+        d.error = t.send.error;
+        break;
+    }
+}
+
+string fake_jwt(char fill) {
+    return "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9." + string(180, fill) + "." + string(43, fill);
+}
+
+int bench_endpoints() {
+    struct Case {
+        const char* label;
+        ReplyKind   kind;
+        string      body;
+    };
+    // As views.py words them
+    Case cases[] = {
+        { "balance", REPLY_BALANCE,
+          "{\"phone_number\": \"0712345678\", \"balance\": \"15000.00\", \"currency\": \"KES\", "
+          "\"account_holder\": \"John Doe\"}" },
+        { "login", REPLY_LOGIN,
+          "{\"message\": \"Login successful\", \"access\": \"" + fake_jwt('a') + "\", \"refresh\": \"" +
+          fake_jwt('r') + "\", \"user\": {\"id\": 1, \"username\": \"john\", \"full_name\": \"John Doe\", "
+          "\"email\": \"john@example.com\", \"phone_number\": \"0712345678\"}}" },
+        { "send", REPLY_SEND,
+          "{\"message\": \"Already processed\", \"transaction_id\": \"TXN8F3A2C91D04E\", \"amount\": \"100.00\", "
+          "\"new_balance\": \"14900.00\", \"currency\": \"KES\", \"replayed\": true}" },
+        { "send refused", REPLY_SEND, "{\"error\": \"Insufficient balance\"}" },
+    };
+    const int n = 1000000;
+    int failures = 0;
+    cout << "bench endpoints: reply bodies decoded into what the screens read, " << n << " each\n";
+    JsonIndex j;
+    TypedReplies typed;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const Case& k = cases[c];
+        DecodedReply want, got;
+        legacy_decode(k.kind, k.body, want);
+        index_decode(j, k.kind, k.body, got);
+        failures += !(got == want);
+        typed_decode(typed, k.kind, k.body);
+        got = DecodedReply();
+        typed_fields(typed, k.kind, got);
+        if (!(got == want)) {
+            cout << "  FAIL " << k.label << ": typed decode differs\n";
+            failures++;
+        }
+
+        cout << "  " << k.label << " (" << k.body.size() << " bytes)\n";
+        volatile size_t sink = 0;
+        for (int impl = 0; impl < 3; impl++) {
+            DecodedReply d;
+            reset_heap_stats();
+            uint64_t t0 = now_ns();
+            for (int i = 0; i < n; i++) {
+                if (impl == 0)      legacy_decode(k.kind, k.body, d);
+                else if (impl == 1) index_decode(j, k.kind, k.body, d);
+                else                typed_decode(typed, k.kind, k.body);
+                sink = sink + d.a.size();
+            }
+            uint64_t ns = now_ns() - t0;
+            static const char* const names[] = { "json_get per field", "JsonIndex, reused", "json_decode" };
+            cout << "    " << left << setw(22) << names[impl] << right << setw(9) << fixed << setprecision(1)
+                 << (double)ns / n << " ns/response" << setw(8) << setprecision(2)
+                 << (double)g_allocs.load() / n << " allocs/response\n";
+        }
+    }
+    cout << (failures ? "  FAIL\n" : "  PASS\n");
+    return failures ? 1 : 0;
+}
+
+// --- bench ledger -------------------------------------------------------------
+const Money LEDGER_OPENING = Money::from_cents(100000);        // KES 1,000 each
+
+// user1..userN, the same every time so a log replays onto them
+void ledger_accounts(Ledger& book, int n) {
+    for (int i = 1; i <= n; i++) {
+        char user[32], phone[16];
+        snprintf(user, sizeof(user), "user%d", i);
+        snprintf(phone, sizeof(phone), "07%08d", 90000000 + i);
+        book.add_account(user, "password123", "", "", phone, "1234", LEDGER_OPENING);
+    }
+}
+
+struct LedgerLoad {
+    Ledger*  book;
+    int      accounts;             // from and to picked from 1..accounts
+    int      ops;
+    uint64_t seed;
+    int64_t  deposited, withdrawn; // cents, applied
+    uint64_t sends;
+    uint64_t bad;                  // answers the rules do not allow
+    Thread   thread;
+};
+
+// 70% sends, 10% deposits, 10% withdrawals, 10% balance + history page
+void run_ledger_load(void* arg) {
+    LedgerLoad& w = *(LedgerLoad*)arg;
+    uint64_t rng = w.seed;
+    char phone[16];
+    vector<LedgerRow> page;
+    for (int i = 0; i < w.ops; i++) {
+        rng = splitmix64(rng);
+        uint32_t from = 1 + (uint32_t)(rng % (uint64_t)w.accounts);
+        uint32_t to   = 1 + (uint32_t)((rng >> 20) % (uint64_t)w.accounts);
+        Money amount  = Money::from_cents(100 * (int64_t)(1 + (rng >> 40) % 50));
+        int pick = (int)((rng >> 56) % 10);
+        LedgerReceipt r;
+        if (pick < 7) {
+            snprintf(phone, sizeof(phone), "07%08d", 90000000 + (int)to);
+            LedgerStatus s = w.book->send(from, phone, amount, "1234", "bench", "", r);
+            if (s == LEDGER_OK) w.sends++;
+            else if (s != LEDGER_INSUFFICIENT && !(s == LEDGER_SELF && from == to)) w.bad++;
+        } else if (pick == 7) {
+            if (w.book->deposit(from, amount, "bench", "", r) == LEDGER_OK) w.deposited += amount.cents();
+            else w.bad++;
+        } else if (pick == 8) {
+            LedgerStatus s = w.book->withdraw(from, amount, "1234", "", "", r);
+            if (s == LEDGER_OK) w.withdrawn += amount.cents();
+            else if (s != LEDGER_INSUFFICIENT) w.bad++;
+        } else {
+            uint64_t next;
+            w.book->history(from, 10, 0, 0, 0, page, next);
+            if (w.book->balance(from) < Money()) w.bad++;
+        }
+    }
+}
+
+// Money conserved, each account's rows chained from its opening balance to
+// its balance, every SEND matched by a RECEIVE. The violations found.
+int check_ledger(Ledger& book, Money expected_total, uint64_t sends) {
+    int bad = book.total() != expected_total;
+    uint64_t send_rows = 0, receive_rows = 0;
+    vector<LedgerRow> rows;
+    for (uint32_t id = 1; id <= book.size(); id++) {
+        uint64_t next, last = 0;
+        book.history(id, (size_t)-1, 0, 0, 0, rows, next);
+        Money bal = LEDGER_OPENING;
+        for (size_t i = rows.size(); i-- > 0;) {            // oldest first
+            const LedgerRow& r = rows[i];
+            bool credit = r.kind == LEDGER_DEPOSIT || r.kind == LEDGER_RECEIVE;
+            Money after = credit ? bal + r.amount : bal - r.amount;
+            if (r.id <= last || r.balance_before != bal || r.balance_after != after || after < Money()) bad++;
+            bal = r.balance_after;
+            last = r.id;
+            send_rows += r.kind == LEDGER_SEND;
+            receive_rows += r.kind == LEDGER_RECEIVE;
+        }
+        if (bal != book.balance(id)) bad++;
+    }
+    if (send_rows != sends || receive_rows != sends) bad++;
+    return bad;
+}
+
+// The same balances and rows, account by account
+bool same_ledger(Ledger& a, Ledger& b) {
+    if (a.size() != b.size() || a.total() != b.total()) return false;
+    vector<LedgerRow> ra, rb;
+    uint64_t next;
+    for (uint32_t id = 1; id <= a.size(); id++) {
+        if (a.balance(id) != b.balance(id)) return false;
+        a.history(id, (size_t)-1, 0, 0, 0, ra, next);
+        b.history(id, (size_t)-1, 0, 0, 0, rb, next);
+        if (ra.size() != rb.size()) return false;
+        for (size_t i = 0; i < ra.size(); i++)
+            if (ra[i].id != rb[i].id || ra[i].balance_after != rb[i].balance_after ||
+                strcmp(ra[i].transaction_id, rb[i].transaction_id) != 0)
+                return false;
+    }
+    return true;
+}
+
+struct LedgerDup {
+    Ledger*       book;
+    LedgerReceipt r;
+    uint64_t      start_ns, done_ns;
+    Thread        thread;
+};
+
+void run_ledger_dup(void* arg) {
+    LedgerDup& d = *(LedgerDup*)arg;
+    d.book->send(1, "0790000002", Money::from_cents(2500), "1234", "retry", "bench-ledger-dup", d.r);
+}
+
+void run_ledger_slow_deposit(void* arg) {
+    LedgerDup& d = *(LedgerDup*)arg;
+    d.start_ns = now_ns();
+    d.book->deposit(1, Money::from_cents(2500), "", "bench-ledger-slow", d.r);
+    d.done_ns = now_ns();
+}
+
+int bench_ledger(int argc, char** argv) {
+    int accounts = argc > 2 ? atoi(argv[2]) : 10000;
+    int ops = argc > 3 ? atoi(argv[3]) : 400000;
+    const int threads = 8;
+    if (accounts < 2) accounts = 2;
+    if (ops < threads) ops = threads;
+    int failures = 0;
+    string path = "bench_ledger.wal";
+    string err;
+
+    struct Run {
+        const char* label;
+        int         accounts;
+        size_t      stripes;
+        bool        log;
+    };
+    Run runs[] = {
+        { "1 stripe (global lock)", accounts, 1, false },
+        { "256 stripes", accounts, 256, false },
+        { "256 stripes, 2 accounts", 2, 256, false },
+        { "256 stripes, logged", accounts, 256, true },
+    };
+    cout << "bench ledger: " << threads << " threads, 70% send / 10% deposit / 10% withdraw / 10% read, "
+         << accounts << " accounts\n\n"
+         << "  " << left << setw(26) << "run" << right << setw(9) << "ops" << setw(11) << "ops/s"
+         << setw(10) << "sends" << setw(9) << "fsyncs" << setw(13) << "commits/sync" << "  check\n";
+    for (size_t k = 0; k < sizeof(runs) / sizeof(runs[0]); k++) {
+        const Run& run = runs[k];
+        int n = run.log ? ops / 10 : ops;                   // fsync bound
+        Ledger book(run.accounts, run.stripes);
+        ledger_accounts(book, run.accounts);
+        if (run.log) {
+            remove(path.c_str());
+            if (!book.open_log(path, err)) { cerr << err << "\n"; return 1; }
+        }
+        LedgerLoad load[threads];
+        uint64_t t0 = now_ns();
+        for (int t = 0; t < threads; t++) {
+            LedgerLoad& w = load[t];
+            w.book = &book; w.accounts = run.accounts; w.ops = n / threads;
+            w.seed = 0x5EED0000ULL + (uint64_t)t * 7919 + k;
+            w.deposited = w.withdrawn = 0; w.sends = w.bad = 0;
+            w.thread.start(run_ledger_load, &w);
+        }
+        int64_t delta = 0;
+        uint64_t sends = 0, bad = 0;
+        for (int t = 0; t < threads; t++) {
+            load[t].thread.join();
+            delta += load[t].deposited - load[t].withdrawn;
+            sends += load[t].sends;
+            bad += load[t].bad;
+        }
+        double secs = (double)(now_ns() - t0) / 1e9;
+        LedgerStats st = book.stats();
+        int violations = (int)bad + check_ledger(book, LEDGER_OPENING * (long long)run.accounts +
+                                                       Money::from_cents(delta), sends);
+        cout << "  " << left << setw(26) << run.label << right << setw(9) << n / threads * threads
+             << setw(11) << fixed << setprecision(0) << (double)(n / threads * threads) / secs
+             << setw(10) << sends << setw(9) << st.syncs << setw(13) << setprecision(1)
+             << (st.syncs ? (double)st.commits / (double)st.syncs : 0.0)
+             << "  " << (violations ? "FAIL" : "ok") << "\n";
+        failures += violations;
+        if (!run.log) continue;
+
+        // The log rebuilds the same ledger, and a torn tail is cut off
+        book.close_log();
+        const char* torn = "0badf00d {\"op\":\"send\",\"id\":";
+        FILE* f = fopen(path.c_str(), "ab");
+        fputs(torn, f);
+        fclose(f);
+        Ledger again(run.accounts, run.stripes);
+        ledger_accounts(again, run.accounts);
+        t0 = now_ns();
+        bool opened = again.open_log(path, err);
+        double ms = (double)(now_ns() - t0) / 1e6;
+        LedgerStats rs = again.stats();
+        bool same = opened && rs.recovered == st.records && rs.torn_bytes == strlen(torn) && same_ledger(book, again);
+        cout << "\n  replayed " << rs.recovered << " records in " << setprecision(1) << ms << " ms, "
+             << rs.torn_bytes << " torn bytes cut off: " << (same ? "same balances and rows" : "DIFFERENT") << "\n";
+        failures += !same;
+    }
+    remove(path.c_str());
+
+    // One idempotency key, 8 concurrent retries: one send, 7 replays of it;
+    // the key again with another amount or recipient is refused
+    Ledger book(3);
+    ledger_accounts(book, 3);
+    LedgerDup dup[threads];
+    for (int t = 0; t < threads; t++) { dup[t].book = &book; dup[t].thread.start(run_ledger_dup, &dup[t]); }
+    int applied = 0, replayed = 0;
+    for (int t = 0; t < threads; t++) {
+        dup[t].thread.join();
+        if (dup[t].r.status != LEDGER_OK || strcmp(dup[t].r.transaction_id, dup[0].r.transaction_id) != 0) continue;
+        if (dup[t].r.replayed) replayed++; else applied++;
+    }
+    LedgerReceipt other, elsewhere;
+    book.send(1, "0790000002", Money::from_cents(9900), "1234", "", "bench-ledger-dup", other);
+    book.send(1, "0790000003", Money::from_cents(2500), "1234", "", "bench-ledger-dup", elsewhere);
+    bool once = applied == 1 && replayed == threads - 1 && other.status == LEDGER_KEY_REUSED &&
+                elsewhere.status == LEDGER_KEY_REUSED && book.balance(3) == LEDGER_OPENING &&
+                book.balance(1) == LEDGER_OPENING - Money::from_cents(2500);
+    cout << "  " << threads << " retries of one key: " << applied << " applied, " << replayed
+         << " replayed, other amount " << (other.status == LEDGER_KEY_REUSED ? "refused (409)" : "ACCEPTED")
+         << ", other recipient " << (elsewhere.status == LEDGER_KEY_REUSED ? "refused (409)" : "ACCEPTED") << "\n";
+    failures += !once;
+
+    // A retry that arrives while the original's fsync is still running
+    // waits for it, with its stripe released: on one stripe, a read of the
+    // other account meanwhile would stall behind any stripe held
+    const unsigned SYNC_MS = 300, SLACK_MS = 100;
+    remove(path.c_str());
+    Ledger slow(2, 1);
+    ledger_accounts(slow, 2);
+    if (!slow.open_log(path, err)) { cerr << err << "\n"; return 1; }
+    slow.set_sync_delay_ms(SYNC_MS);
+    LedgerDup original, retry;
+    original.book = retry.book = &slow;
+    original.thread.start(run_ledger_slow_deposit, &original);
+    sleep_ms(50);
+    retry.thread.start(run_ledger_slow_deposit, &retry);
+    sleep_ms(50);
+    uint64_t t0 = now_ns();
+    slow.balance(2);
+    double read_ms = (double)(now_ns() - t0) / 1e6;
+    original.thread.join();
+    retry.thread.join();
+    double wait_ms = (double)(retry.done_ns - retry.start_ns) / 1e6;
+    bool waited = original.r.status == LEDGER_OK && !original.r.replayed &&
+                  retry.r.status == LEDGER_OK && retry.r.replayed &&
+                  strcmp(retry.r.transaction_id, original.r.transaction_id) == 0 &&
+                  retry.done_ns + 1000000 >= original.start_ns + SYNC_MS * 1000000ULL &&
+                  read_ms < SLACK_MS;
+    cout << "  retry during a " << SYNC_MS << " ms fsync: replayed after " << setprecision(0) << wait_ms
+         << " ms, other account read meanwhile in " << setprecision(1) << read_ms << " ms"
+         << (waited ? "" : "  <-- answered early or held the stripe") << "\n";
+    failures += !waited;
+    slow.close_log();
+    remove(path.c_str());
+
+    cout << (failures ? "  FAIL\n" : "  PASS\n");
+    return failures ? 1 : 0;
+}
+
+// --- Entry point --------------------------------------------------------------
+int main(int argc, char** argv) {
+    string mode = argc > 1 ? argv[1] : "";
+    if (mode == "pool")   return bench_pool(argc, argv);
+    if (mode == "reader") return bench_reader();
+    if (mode == "json")   return bench_json();
+    if (mode == "flow")   return bench_flow(argc, argv);
+    if (mode == "load")   return bench_load(argc, argv);
+    if (mode == "metrics") return bench_metrics();
+    if (mode == "money")  return bench_money();
+    if (mode == "body")   return bench_body();
+    if (mode == "term")   return bench_term();
+    if (mode == "sessions") return bench_sessions(argc, argv);
+    if (mode == "deadline") return bench_deadline(argc, argv);
+    if (mode == "balance")  return bench_balance(argc, argv);
+    if (mode == "wire")     return bench_wire(argc, argv);
+    if (mode == "outbox")   return bench_outbox(argc, argv);
+    if (mode == "events")   return bench_events(argc, argv);
+    if (mode == "trace")    return bench_trace(argc, argv);
+    if (mode == "endpoints") return bench_endpoints();
+    if (mode == "ledger")   return bench_ledger(argc, argv);
+
+    cerr << "usage: bench pool [host] [port] [requests]\n"
+            "       bench reader\n"
+            "       bench json\n"
+            "       bench flow [host] [port] [flows]\n"
+            "       bench load [host] [port] [--terminals N] [--duration S] [--mix op=w,...]\n"
+            "                  [--users a,b] [--password PW] [--pin PIN] [--recipients p,q] [--hdr]\n"
+            "       bench metrics\n"
+            "       bench money\n"
+            "       bench body\n"
+            "       bench term\n"
+            "       bench sessions [host] [port] [sessions] [seconds]\n"
+            "       bench deadline [host] [port] [requests]\n"
+            "       bench balance [host] [port,port,...] [seconds]\n"
+            "       bench wire [host] [port] [sessions]\n"
+            "       bench outbox [host] [port] [entries] [kills]\n"
+            "       bench events [host] [port] [terminals] [seconds]\n"
+            "       bench trace [host] [port] [sessions] [calls]\n"
+            "       bench endpoints\n"
+            "       bench ledger [accounts] [ops]\n";
+    return 2;
+}
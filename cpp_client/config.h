@@ -0,0 +1,227 @@
+/**
+ * ============================================
+ *   config.h - mpesa_client.conf
+ * ============================================
+ *
+ *  Optional settings, read once at start-up from
+ *  the working directory. Plain INI:
+ *
+ *      # every request
+ *      [timeouts]
+ *      resolve_ms = 2000
+ *      connect_ms = 3000
+ *      send_ms    = 5000
+ *      receive_ms = 15000
+ *      total_ms   = 20000
+ *
+ *      # requests whose path starts with /api/transactions/;
+ *      # keys left out come from [timeouts]
+ *      [timeouts /api/transactions/]
+ *      receive_ms = 30000
+ *      total_ms   = 35000
+ *
+ *  /api/events/ (events.h) stays open for minutes:
+ *  unless it has a section of its own, only its
+ *  resolve, connect and send are bounded.
+ *
+ *      # several backends, balanced (http_pool.h)
+ *      [server]
+ *      endpoints   = 10.0.0.5:8000, 10.0.0.6:8000
+ *      health_path = /api/health/
+ *      health_ms   = 5000
+ *      eject_after = 3
+ *      eject_ms    = 5000
+ *
+ *  MPESA_SERVERS in the environment, in the same
+ *  host:port,host:port form, replaces the endpoints.
+ *
+ *  A missing file means the built-in defaults
+ *  (deadline.h, and the single compiled-in server).
+ *  A malformed one is an error naming the line, so a
+ *  typo never silently means "wait forever".
+ * ============================================
+ */
+#ifndef MPESA_CONFIG_H
+#define MPESA_CONFIG_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "deadline.h"
+#include "http_pool.h"
+
+struct ClientConfig {
+    TimeoutTable            timeouts;
+    std::vector<ServerAddr> servers;        // empty = the compiled-in one
+    BalancerConfig          balancer;
+};
+
+// --- Parsing helpers ----------------------------------------------------------
+inline std::string config_trim(const std::string& s) {
+    size_t a = s.find_first_not_of(" \t\r\n");
+    if (a == std::string::npos) return "";
+    size_t b = s.find_last_not_of(" \t\r\n");
+    return s.substr(a, b - a + 1);
+}
+
+inline bool config_uint(const std::string& v, unsigned& out) {
+    if (v.empty() || v.size() > 9) return false;
+    unsigned n = 0;
+    for (size_t i = 0; i < v.size(); i++) {
+        if (v[i] < '0' || v[i] > '9') return false;
+        n = n * 10 + (unsigned)(v[i] - '0');
+    }
+    out = n;
+    return true;
+}
+
+// "host:port, host:port" -> out; false with a message on a bad entry
+inline bool config_servers(const std::string& v, std::vector<ServerAddr>& out, std::string& error) {
+    out.clear();
+    size_t start = 0;
+    while (start <= v.size()) {
+        size_t comma = v.find(',', start);
+        if (comma == std::string::npos) comma = v.size();
+        std::string item = config_trim(v.substr(start, comma - start));
+        start = comma + 1;
+        if (item.empty()) continue;
+        size_t colon = item.rfind(':');
+        unsigned port = 0;
+        if (colon == std::string::npos || colon == 0 ||
+            !config_uint(item.substr(colon + 1), port) || port == 0 || port > 65535) {
+            error = "expected host:port, got " + item;
+            return false;
+        }
+        out.push_back(ServerAddr(item.substr(0, colon), (unsigned short)port));
+    }
+    if (out.empty()) error = "no servers listed";
+    return !out.empty();
+}
+
+// One [timeouts ...] section as read; merged with [timeouts] at the end,
+// so the defaults may come after the routes
+struct TimeoutSection {
+    enum { F_RESOLVE = 1, F_CONNECT = 2, F_SEND = 4, F_RECEIVE = 8, F_TOTAL = 16 };
+
+    std::string  prefix;            // "" = [timeouts]
+    HttpTimeouts t;
+    int          set;               // F_* keys given
+
+    TimeoutSection() : set(0) {}
+
+    HttpTimeouts over(const HttpTimeouts& base) const {
+        HttpTimeouts r = base;
+        if (set & F_RESOLVE) r.resolve_ms = t.resolve_ms;
+        if (set & F_CONNECT) r.connect_ms = t.connect_ms;
+        if (set & F_SEND)    r.send_ms    = t.send_ms;
+        if (set & F_RECEIVE) r.receive_ms = t.receive_ms;
+        if (set & F_TOTAL)   r.total_ms   = t.total_ms;
+        return r;
+    }
+};
+
+// --- Loader -------------------------------------------------------------------
+// [server] key = value; false with a message
+inline bool config_server_key(const std::string& key, const std::string& v, ClientConfig& cfg,
+                              std::string& error) {
+    BalancerConfig& b = cfg.balancer;
+    if (key == "endpoints") return config_servers(v, cfg.servers, error);
+    if (key == "health_path") {
+        if (!v.empty() && v[0] != '/') { error = "health_path must start with /"; return false; }
+        b.health_path = v;                  // empty turns the probes off
+        return true;
+    }
+    unsigned* field = key == "health_ms"    ? &b.health_ms
+                    : key == "eject_after"  ? &b.eject_after
+                    : key == "eject_ms"     ? &b.eject_ms
+                    : key == "max_eject_ms" ? &b.max_eject_ms : NULL;
+    if (!field) { error = "unknown key " + key; return false; }
+    if (!config_uint(v, *field)) { error = key + " must be a whole number"; return false; }
+    return true;
+}
+
+// True if the file is absent or valid; otherwise false with "PATH line N: ..."
+inline bool load_config(const std::string& path, ClientConfig& cfg, std::string& error) {
+    error.clear();
+    FILE* f = fopen(path.c_str(), "r");
+    std::vector<TimeoutSection> sections;
+    TimeoutSection* cur = NULL;             // into sections; reset after push_back
+    bool in_server = false;
+    char line[512];
+    int no = 0;
+
+    while (f && error.empty() && fgets(line, sizeof(line), f)) {
+        no++;
+        std::string s = config_trim(line);
+        if (s.empty() || s[0] == '#' || s[0] == ';') continue;
+        char where[300];
+        snprintf(where, sizeof(where), "%s line %d: ", path.c_str(), no);
+
+        if (s[0] == '[') {
+            if (s[s.size() - 1] != ']') { error = std::string(where) + "unterminated section"; break; }
+            std::string name = config_trim(s.substr(1, s.size() - 2));
+            cur = NULL;
+            in_server = name == "server";
+            if (in_server) continue;
+            if (name.compare(0, 8, "timeouts") != 0 || (name.size() > 8 && name[8] != ' ')) {
+                error = std::string(where) + "unknown section [" + name + "]";
+                break;
+            }
+            std::string prefix = config_trim(name.substr(8));
+            if (!prefix.empty() && prefix[0] != '/') { error = std::string(where) + "path must start with /"; break; }
+            size_t i = 0;
+            while (i < sections.size() && sections[i].prefix != prefix) i++;
+            if (i == sections.size()) {
+                sections.push_back(TimeoutSection());
+                sections.back().prefix = prefix;
+            }
+            cur = &sections[i];
+            continue;
+        }
+
+        size_t eq = s.find('=');
+        if (eq == std::string::npos) { error = std::string(where) + "expected key = value"; break; }
+        if (!cur && !in_server) { error = std::string(where) + "setting outside a section"; break; }
+        std::string key = config_trim(s.substr(0, eq));
+        std::string val = config_trim(s.substr(eq + 1));
+        if (in_server) {
+            std::string why;
+            if (!config_server_key(key, val, cfg, why)) error = std::string(where) + why;
+            continue;
+        }
+        unsigned v;
+        if (!config_uint(val, v)) {
+            error = std::string(where) + key + " must be a whole number of milliseconds";
+            break;
+        }
+        if      (key == "resolve_ms") { cur->t.resolve_ms = v; cur->set |= TimeoutSection::F_RESOLVE; }
+        else if (key == "connect_ms") { cur->t.connect_ms = v; cur->set |= TimeoutSection::F_CONNECT; }
+        else if (key == "send_ms")    { cur->t.send_ms    = v; cur->set |= TimeoutSection::F_SEND; }
+        else if (key == "receive_ms") { cur->t.receive_ms = v; cur->set |= TimeoutSection::F_RECEIVE; }
+        else if (key == "total_ms")   { cur->t.total_ms   = v; cur->set |= TimeoutSection::F_TOTAL; }
+        else error = std::string(where) + "unknown key " + key;
+    }
+    if (f) fclose(f);
+    if (!error.empty()) return false;
+
+    const char* env = getenv("MPESA_SERVERS");
+    if (env && *env && !config_servers(env, cfg.servers, error)) {
+        error = "MPESA_SERVERS: " + error;
+        return false;
+    }
+
+    HttpTimeouts& base = cfg.timeouts.defaults();
+    for (size_t i = 0; i < sections.size(); i++)
+        if (sections[i].prefix.empty()) base = sections[i].over(base);
+    for (size_t i = 0; i < sections.size(); i++)
+        if (!sections[i].prefix.empty()) cfg.timeouts.set(sections[i].prefix, sections[i].over(base));
+    if (!cfg.timeouts.has("/api/events/")) {
+        HttpTimeouts stream = base;         // silence is caught by EventStream's watchdog
+        stream.receive_ms = stream.total_ms = 0;
+        cfg.timeouts.set("/api/events/", stream);
+    }
+    return true;
+}
+
+#endif // MPESA_CONFIG_H
@@ -0,0 +1,162 @@
+/**
+ * ============================================
+ *   deadline.h - request timeouts + cancellation
+ * ============================================
+ *
+ *  HttpTimeouts bounds each phase of one request
+ *  (resolve, connect, send, receive) and the whole
+ *  call, retry of a stale socket included. A
+ *  TimeoutTable picks them per endpoint by the
+ *  longest matching path prefix, normally filled
+ *  from mpesa_client.conf (config.h):
+ *
+ *      TimeoutTable t;
+ *      t.set("/api/transactions/", slow_history);
+ *      g_http.set_timeouts(t);
+ *
+ *  CancelToken is cooperative: cancel() from any
+ *  thread (the UI, on Esc) flags the request, and
+ *  the pool notices at its next wait, within
+ *  CANCEL_POLL_MS. A blocking call that cannot poll
+ *  (WinHTTP) is attached so cancel() can abort it.
+ * ============================================
+ */
+#ifndef MPESA_DEADLINE_H
+#define MPESA_DEADLINE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "platform.h"
+
+// --- Timeouts -----------------------------------------------------------------
+// Milliseconds; 0 leaves a phase bounded by total_ms alone
+struct HttpTimeouts {
+    unsigned resolve_ms;        // host name lookup
+    unsigned connect_ms;        // TCP handshake
+    unsigned send_ms;           // writing the request
+    unsigned receive_ms;        // request written -> last byte of the response
+    unsigned total_ms;          // the whole call; 0 = no overall limit
+
+    HttpTimeouts()
+        : resolve_ms(2000), connect_ms(3000), send_ms(5000), receive_ms(15000), total_ms(20000) {}
+};
+
+class TimeoutTable {
+public:
+    HttpTimeouts&       defaults()       { return default_; }
+    const HttpTimeouts& defaults() const { return default_; }
+
+    // Timeouts for paths starting with `prefix`, replacing any earlier entry
+    void set(const std::string& prefix, const HttpTimeouts& t) {
+        for (size_t i = 0; i < routes_.size(); i++)
+            if (routes_[i].prefix == prefix) { routes_[i].t = t; return; }
+        Route r;
+        r.prefix = prefix;
+        r.t = t;
+        routes_.push_back(r);
+    }
+
+    // Longest matching prefix, else the defaults. A handful of entries:
+    // a scan is cheaper than anything cleverer.
+    const HttpTimeouts& lookup(const std::string& path) const {
+        const HttpTimeouts* best = &default_;
+        size_t best_len = 0;
+        for (size_t i = 0; i < routes_.size(); i++) {
+            const std::string& p = routes_[i].prefix;
+            if (p.size() > best_len && path.compare(0, p.size(), p) == 0) {
+                best = &routes_[i].t;
+                best_len = p.size();
+            }
+        }
+        return *best;
+    }
+
+    bool has(const std::string& prefix) const {
+        for (size_t i = 0; i < routes_.size(); i++)
+            if (routes_[i].prefix == prefix) return true;
+        return false;
+    }
+
+    size_t routes() const { return routes_.size(); }
+
+private:
+    struct Route {
+        std::string  prefix;
+        HttpTimeouts t;
+    };
+
+    HttpTimeouts       default_;
+    std::vector<Route> routes_;
+};
+
+// When a phase allowed `ms` from now must end, capped by the call's end_ns
+inline uint64_t phase_deadline(unsigned ms, uint64_t end_ns) {
+    if (!ms) return end_ns;
+    uint64_t d = now_ns() + (uint64_t)ms * 1000000ULL;
+    return d < end_ns ? d : end_ns;
+}
+
+// --- Cancellation -------------------------------------------------------------
+class CancelToken {
+public:
+    typedef void (*AbortFn)(void* handle);
+
+    enum { CANCEL_POLL_MS = 50 };           // longest a waiting request sleeps unchecked
+
+    CancelToken() : cancelled_(false), abort_(NULL), handle_(NULL), aborted_(false) {}
+
+    // Any thread. Aborts an attached blocking call.
+    void cancel() {
+        LockGuard lock(mu_);
+        cancelled_ = true;
+        if (abort_) {
+            abort_(handle_);
+            abort_ = NULL;
+            aborted_ = true;
+        }
+    }
+
+    bool cancelled() const { return cancelled_; }
+
+    // Before reusing the token for another call
+    void reset() {
+        LockGuard lock(mu_);
+        cancelled_ = aborted_ = false;
+        abort_ = NULL;
+        handle_ = NULL;
+    }
+
+    // A blocking call cancel() may abort with fn(handle). False if the
+    // token is already cancelled: don't start the call.
+    bool attach(AbortFn fn, void* handle) {
+        LockGuard lock(mu_);
+        if (cancelled_) return false;
+        abort_ = fn;
+        handle_ = handle;
+        aborted_ = false;
+        return true;
+    }
+
+    // The call is over. False if cancel() already disposed of the handle.
+    bool detach() {
+        LockGuard lock(mu_);
+        abort_ = NULL;
+        handle_ = NULL;
+        bool mine = !aborted_;
+        aborted_ = false;
+        return mine;
+    }
+
+private:
+    CancelToken(const CancelToken&);
+    CancelToken& operator=(const CancelToken&);
+
+    Mutex         mu_;
+    volatile bool cancelled_;
+    AbortFn       abort_;
+    void*         handle_;
+    bool          aborted_;
+};
+
+#endif // MPESA_DEADLINE_H
@@ -0,0 +1,452 @@
+/**
+ * ============================================
+ *   endpoints.h - typed endpoint table
+ * ============================================
+ *
+ *  Every JSON endpoint the client calls is one
+ *  struct naming its method, path, request type and
+ *  reply type. Each of those types lists its fields
+ *  once, as a JsonSchema: name, member and flags.
+ *  The member pointers are template arguments, so
+ *  each field's reader and writer is an ordinary
+ *  function fixed at compile time and the tables are
+ *  constant data, not built at startup.
+ *
+ *      BalanceReply bal;
+ *      if (endpoint_call<BalanceEndpoint>(http, token, NoBody(), bal))
+ *          show(bal.balance);
+ *
+ *      JsonBody<256> w;
+ *      json_encode(w, login);              // LoginRequest -> {"username":...}
+ *
+ *  json_decode() reads a reply in one pass straight
+ *  into the struct: each key is matched against the
+ *  schema and its value parsed into the member, with
+ *  no token tape, no key hash and no std::string per
+ *  lookup. Unknown keys are skipped, nested objects
+ *  decode into nested structs, and a reused reply
+ *  keeps its strings' capacity. It returns false if
+ *  the body is not JSON or a FIELD_REQUIRED field is
+ *  missing or malformed.
+ *
+ *  Requests hold JsonText: views of the caller's
+ *  strings, so filling one and encoding it copies
+ *  nothing and stays off the heap (bench body).
+ *
+ *  Only top-level keys (and those of nested structs)
+ *  are read, unlike json_get(), which takes the first
+ *  match at any depth.
+ *
+ *  History pages, batches and the event stream are
+ *  endpoints too, but their bodies are read as they
+ *  stream in (history.h, api_batch.h, events.h), so
+ *  their structs name the route only and
+ *  endpoint_call() does not compile for them.
+ * ============================================
+ */
+#ifndef MPESA_ENDPOINTS_H
+#define MPESA_ENDPOINTS_H
+
+#include <string>
+#include <string.h>
+#include <stdint.h>
+#include "json.h"
+#include "json_writer.h"
+#include "money.h"
+#include "http_pool.h"
+
+// --- Scanner ------------------------------------------------------------------
+// Forward-only reads over one JSON body. A structural error sets !ok() and
+// every later read fails.
+class JsonScan {
+public:
+    JsonScan(const char* p, size_t n) : p_(p), end_(p + n), ok_(true) {}
+
+    bool ok() const { return ok_; }
+    bool fail()     { ok_ = false; return false; }
+
+    // Skips whitespace; true (and consumed) if c is next
+    bool take(char c) {
+        ws();
+        if (!ok_ || p_ == end_ || *p_ != c) return false;
+        p_++;
+        return true;
+    }
+    bool next_is(char c) {
+        ws();
+        return ok_ && p_ != end_ && *p_ == c;
+    }
+
+    // The bytes between a string's quotes, escapes unresolved
+    bool string(const char*& s, const char*& e) {
+        if (!take('"')) return fail();
+        const char* q = json_scan_string(p_, end_);
+        if (!q) return fail();
+        s = p_;
+        e = q;
+        p_ = q + 1;
+        return true;
+    }
+
+    // A number, true, false or null
+    bool primitive(const char*& s, const char*& e) {
+        ws();
+        s = p_;
+        while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ']' && !is_ws(*p_)) p_++;
+        e = p_;
+        return e > s || fail();
+    }
+
+    // Whatever value comes next, nested ones whole
+    bool skip() {
+        const char *s, *e;
+        if (next_is('"')) return string(s, e);
+        if (!next_is('{') && !next_is('[')) return primitive(s, e);
+        int depth = 0;
+        while (p_ < end_) {
+            char c = *p_++;
+            if (c == '"') {
+                const char* q = json_scan_string(p_, end_);
+                if (!q) return fail();
+                p_ = q + 1;
+            } else if (c == '{' || c == '[') {
+                depth++;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return true;
+            }
+        }
+        return fail();
+    }
+
+private:
+    static bool is_ws(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+    void ws() { while (p_ < end_ && is_ws(*p_)) p_++; }
+
+    const char* p_;
+    const char* end_;
+    bool        ok_;
+};
+
+// --- Fields -------------------------------------------------------------------
+enum {
+    FIELD_REQUIRED   = 1,       // json_decode() fails without it
+    FIELD_OMIT_EMPTY = 2        // json_encode() leaves out an empty string
+};
+
+// One member of a request or reply struct. obj points at the struct.
+struct JsonField {
+    const char* name;
+    size_t      len;
+    unsigned    flags;
+    bool (*read)(JsonScan& in, void* obj);      // false if the value was unusable
+    void (*write)(JsonWriter& out, const char* name, unsigned flags, const void* obj);
+    void (*clear)(void* obj);
+};
+
+// A request field: borrowed, so filling a request copies nothing. What it
+// points at must outlive the encode.
+struct JsonText {
+    const char* p;
+    size_t      n;
+
+    JsonText() : p(""), n(0) {}
+    JsonText(const char* s) : p(s), n(strlen(s)) {}
+    JsonText(const std::string& s) : p(s.data()), n(s.size()) {}
+};
+
+// Specialised for each struct below: its fields, in the order they are sent.
+// At most 32 per struct.
+template <class T> struct JsonSchema;
+
+template <class T> bool json_decode_object(JsonScan& in, T& out);
+template <class T> void json_encode(JsonWriter& out, const T& v);
+template <class T> void json_clear(T& v);
+
+// Strings take a JSON string unescaped, or the literal text of a number
+inline bool json_read(JsonScan& in, std::string& out) {
+    const char *s, *e;
+    if (in.next_is('"')) {
+        if (!in.string(s, e)) return false;
+        json_unescape_into(s, e, out);
+        return true;
+    }
+    if (in.next_is('{') || in.next_is('[')) { out.clear(); in.skip(); return false; }
+    if (!in.primitive(s, e)) return false;
+    if (e - s == 4 && memcmp(s, "null", 4) == 0) { out.clear(); return false; }
+    out.assign(s, e);
+    return true;
+}
+
+// DecimalField arrives as "1500.00"; a bare number is taken too
+inline bool json_read(JsonScan& in, Money& out) {
+    const char *s, *e;
+    if (in.next_is('"') ? !in.string(s, e) : !in.primitive(s, e)) return false;
+    return Money::parse(s, (size_t)(e - s), out);
+}
+
+inline bool json_read(JsonScan& in, bool& out) {
+    const char *s, *e;
+    if (in.next_is('"') || in.next_is('{') || in.next_is('[')) { in.skip(); return false; }
+    if (!in.primitive(s, e)) return false;
+    out = e - s == 4 && memcmp(s, "true", 4) == 0;
+    return out || (e - s == 5 && memcmp(s, "false", 5) == 0);
+}
+
+// Requests are only ever sent
+inline bool json_read(JsonScan& in, JsonText&) { in.skip(); return false; }
+
+// A nested object, into a struct with its own schema
+template <class T> bool json_read(JsonScan& in, T& out) { return json_decode_object(in, out); }
+
+inline void json_write(JsonWriter& w, const char* name, unsigned flags, const std::string& v) {
+    if ((flags & FIELD_OMIT_EMPTY) && v.empty()) return;
+    w.field(name, v);
+}
+inline void json_write(JsonWriter& w, const char* name, unsigned flags, JsonText v) {
+    if ((flags & FIELD_OMIT_EMPTY) && !v.n) return;
+    w.key(name);
+    w.value(v.p, v.n);
+}
+inline void json_write(JsonWriter& w, const char* name, unsigned, Money v) { w.field(name, v); }
+inline void json_write(JsonWriter& w, const char* name, unsigned, bool v)  { w.field(name, v); }
+template <class T> void json_write(JsonWriter& w, const char* name, unsigned, const T& v) {
+    w.key(name);
+    json_encode(w, v);
+}
+
+inline void json_clear(std::string& v) { v.clear(); }       // keeps the capacity
+inline void json_clear(Money& v)       { v = Money(); }
+inline void json_clear(bool& v)        { v = false; }
+inline void json_clear(JsonText& v)    { v = JsonText(); }
+
+// The functions behind one JsonField, for member P of S
+template <class S, class M, M S::*P>
+struct JsonMember {
+    static bool read(JsonScan& in, void* obj) { return json_read(in, static_cast<S*>(obj)->*P); }
+    static void write(JsonWriter& w, const char* name, unsigned flags, const void* obj) {
+        json_write(w, name, flags, static_cast<const S*>(obj)->*P);
+    }
+    static void clear(void* obj) { json_clear(static_cast<S*>(obj)->*P); }
+};
+
+// JSON_FIELD(BalanceReply, Money, balance, FIELD_REQUIRED): the key is the member's name
+#define JSON_FIELD(S, M, member, flags)                                         \
+    { #member, sizeof(#member) - 1, (flags), &JsonMember<S, M, &S::member>::read, \
+      &JsonMember<S, M, &S::member>::write, &JsonMember<S, M, &S::member>::clear }
+
+#define JSON_SCHEMA(S, ...)                                                     \
+    template <> struct JsonSchema<S> {                                          \
+        static const JsonField* fields(size_t& n) {                             \
+            static const JsonField f[] = { __VA_ARGS__ };                       \
+            n = sizeof(f) / sizeof(f[0]);                                       \
+            return f;                                                           \
+        }                                                                       \
+    }
+
+// --- Decode / encode ----------------------------------------------------------
+template <class T> void json_clear(T& v) {
+    size_t n;
+    const JsonField* f = JsonSchema<T>::fields(n);
+    for (size_t i = 0; i < n; i++) f[i].clear(&v);
+}
+
+template <class T> bool json_decode_object(JsonScan& in, T& out) {
+    size_t n;
+    const JsonField* f = JsonSchema<T>::fields(n);
+    uint32_t required = 0, seen = 0;
+    for (size_t i = 0; i < n; i++) {
+        f[i].clear(&out);
+        if (f[i].flags & FIELD_REQUIRED) required |= 1u << i;
+    }
+    if (!in.take('{')) return in.fail();
+    if (in.take('}')) return required == 0;
+    do {
+        const char *k, *ke;
+        if (!in.string(k, ke) || !in.take(':')) return in.fail();
+        size_t len = (size_t)(ke - k), i = 0;
+        while (i < n && (f[i].len != len || memcmp(f[i].name, k, len) != 0)) i++;
+        if (i == n)                 in.skip();
+        else if (f[i].read(in, &out)) seen |= 1u << i;
+        if (!in.ok()) return false;
+    } while (in.take(','));
+    if (!in.take('}')) return in.fail();
+    return (seen & required) == required;
+}
+
+// One reply body into out. Fields the body lacks are left cleared.
+template <class T> bool json_decode(const char* p, size_t n, T& out) {
+    JsonScan in(p, n);
+    return json_decode_object(in, out) && in.ok();
+}
+template <class T> bool json_decode(const std::string& body, T& out) {
+    return json_decode(body.data(), body.size(), out);
+}
+
+template <class T> void json_encode(JsonWriter& w, const T& v) {
+    size_t n;
+    const JsonField* f = JsonSchema<T>::fields(n);
+    w.begin_object();
+    for (size_t i = 0; i < n; i++) f[i].write(w, f[i].name, f[i].flags, &v);
+    w.end_object();
+}
+
+// --- Requests and replies -----------------------------------------------------
+// A GET: nothing is sent
+struct NoBody {};
+inline void json_encode(JsonWriter&, const NoBody&) {}
+
+struct LoginRequest {
+    JsonText username, password;
+};
+JSON_SCHEMA(LoginRequest,
+    JSON_FIELD(LoginRequest, JsonText, username, 0),
+    JSON_FIELD(LoginRequest, JsonText, password, 0));
+
+struct LoginUser {
+    std::string username, full_name, phone_number;
+};
+JSON_SCHEMA(LoginUser,
+    JSON_FIELD(LoginUser, std::string, username, 0),
+    JSON_FIELD(LoginUser, std::string, full_name, 0),
+    JSON_FIELD(LoginUser, std::string, phone_number, 0));
+
+struct LoginReply {
+    std::string access, refresh;
+    LoginUser   user;
+    std::string error;
+};
+JSON_SCHEMA(LoginReply,
+    JSON_FIELD(LoginReply, std::string, access, FIELD_REQUIRED),
+    JSON_FIELD(LoginReply, std::string, refresh, 0),
+    JSON_FIELD(LoginReply, LoginUser, user, 0),
+    JSON_FIELD(LoginReply, std::string, error, 0));
+
+// Logout and refresh both send the refresh token
+struct RefreshRequest {
+    JsonText refresh;
+};
+JSON_SCHEMA(RefreshRequest,
+    JSON_FIELD(RefreshRequest, JsonText, refresh, 0));
+
+struct RefreshReply {
+    std::string access, refresh;                // refresh only with ROTATE_REFRESH_TOKENS
+    std::string detail;
+};
+JSON_SCHEMA(RefreshReply,
+    JSON_FIELD(RefreshReply, std::string, access, FIELD_REQUIRED),
+    JSON_FIELD(RefreshReply, std::string, refresh, 0),
+    JSON_FIELD(RefreshReply, std::string, detail, 0));
+
+struct MessageReply {
+    std::string message, error, detail;
+};
+JSON_SCHEMA(MessageReply,
+    JSON_FIELD(MessageReply, std::string, message, 0),
+    JSON_FIELD(MessageReply, std::string, error, 0),
+    JSON_FIELD(MessageReply, std::string, detail, 0));
+
+struct BalanceReply {
+    std::string phone_number;
+    Money       balance;
+    std::string account_holder;
+    std::string error, detail;
+};
+JSON_SCHEMA(BalanceReply,
+    JSON_FIELD(BalanceReply, std::string, phone_number, 0),
+    JSON_FIELD(BalanceReply, Money, balance, FIELD_REQUIRED),
+    JSON_FIELD(BalanceReply, std::string, account_holder, 0),
+    JSON_FIELD(BalanceReply, std::string, error, 0),
+    JSON_FIELD(BalanceReply, std::string, detail, 0));
+
+struct SendRequest {
+    JsonText recipient_phone;
+    Money    amount;
+    JsonText pin, description, idempotency_key;
+};
+JSON_SCHEMA(SendRequest,
+    JSON_FIELD(SendRequest, JsonText, recipient_phone, 0),
+    JSON_FIELD(SendRequest, Money, amount, 0),
+    JSON_FIELD(SendRequest, JsonText, pin, 0),
+    JSON_FIELD(SendRequest, JsonText, description, 0),
+    JSON_FIELD(SendRequest, JsonText, idempotency_key, FIELD_OMIT_EMPTY));
+
+struct DepositRequest {
+    Money    amount;
+    JsonText reference, idempotency_key;
+};
+JSON_SCHEMA(DepositRequest,
+    JSON_FIELD(DepositRequest, Money, amount, 0),
+    JSON_FIELD(DepositRequest, JsonText, reference, 0),
+    JSON_FIELD(DepositRequest, JsonText, idempotency_key, FIELD_OMIT_EMPTY));
+
+struct WithdrawRequest {
+    Money    amount;
+    JsonText pin, description, idempotency_key;
+};
+JSON_SCHEMA(WithdrawRequest,
+    JSON_FIELD(WithdrawRequest, Money, amount, 0),
+    JSON_FIELD(WithdrawRequest, JsonText, pin, 0),
+    JSON_FIELD(WithdrawRequest, JsonText, description, 0),
+    JSON_FIELD(WithdrawRequest, JsonText, idempotency_key, FIELD_OMIT_EMPTY));
+
+// Send, deposit and withdraw all answer with this
+struct TxnReply {
+    std::string transaction_id;
+    Money       new_balance;
+    bool        replayed;                       // find_replay() answered
+    std::string error, detail;
+
+    TxnReply() : replayed(false) {}
+};
+JSON_SCHEMA(TxnReply,
+    JSON_FIELD(TxnReply, std::string, transaction_id, FIELD_REQUIRED),
+    JSON_FIELD(TxnReply, Money, new_balance, FIELD_REQUIRED),
+    JSON_FIELD(TxnReply, bool, replayed, 0),
+    JSON_FIELD(TxnReply, std::string, error, 0),
+    JSON_FIELD(TxnReply, std::string, detail, 0));
+
+// Bodies built or read by their own code, not through a schema
+struct RawBody {};
+struct StreamedReply {};
+
+// --- Endpoints ----------------------------------------------------------------
+#define ENDPOINT(E, M, P, Req, Rep)                                             \
+    struct E {                                                                  \
+        typedef Req Request;                                                    \
+        typedef Rep Reply;                                                      \
+        static const char* method() { return M; }                               \
+        static const char* path()   { return P; }                               \
+    }
+
+ENDPOINT(LoginEndpoint,    "POST", "/api/auth/login/",   LoginRequest,    LoginReply);
+ENDPOINT(LogoutEndpoint,   "POST", "/api/auth/logout/",  RefreshRequest,  MessageReply);
+ENDPOINT(RefreshEndpoint,  "POST", "/api/auth/refresh/", RefreshRequest,  RefreshReply);
+ENDPOINT(BalanceEndpoint,  "GET",  "/api/balance/",      NoBody,          BalanceReply);
+ENDPOINT(SendEndpoint,     "POST", "/api/send/",         SendRequest,     TxnReply);
+ENDPOINT(DepositEndpoint,  "POST", "/api/deposit/",      DepositRequest,  TxnReply);
+ENDPOINT(WithdrawEndpoint, "POST", "/api/withdraw/",     WithdrawRequest, TxnReply);
+ENDPOINT(HistoryEndpoint,  "GET",  "/api/transactions/", NoBody,          StreamedReply);  // + query
+ENDPOINT(BatchEndpoint,    "POST", "/api/batch/",        RawBody,         StreamedReply);
+ENDPOINT(EventsEndpoint,   "GET",  "/api/events/",       NoBody,          StreamedReply);
+
+// Converted for WinHTTP once per endpoint
+template <class E> const HttpRoute& endpoint_route() {
+    static const HttpRoute route(E::method(), E::path());
+    return route;
+}
+
+// The request, the reply decoded into out. True if the server answered 200
+// with every required field.
+template <class E>
+bool endpoint_call(HttpPool& http, const std::string& token, const typename E::Request& req,
+                   typename E::Reply& out, HttpResponse* raw = NULL, CancelToken* cancel = NULL) {
+    JsonBody<512> body;
+    json_encode(body, req);
+    HttpResponse r = http.request(endpoint_route<E>(), body.size() ? body.data() : NULL,
+                                  body.size(), token, NULL, cancel);
+    bool ok = json_decode(r.body, out) && r.status_code == 200;
+    if (raw) *raw = r;
+    return ok;
+}
+
+#endif // MPESA_ENDPOINTS_H
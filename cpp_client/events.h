@@ -0,0 +1,359 @@
+/**
+ * ============================================
+ *   events.h - balance and transactions pushed
+ * ============================================
+ *
+ *  EventStream keeps one GET /api/events/ open on
+ *  a background thread and hands each Server-Sent
+ *  Event to an EventListener as it arrives, so a
+ *  customer's balance no longer has to be polled:
+ *
+ *      EventStream events(g_http);
+ *      events.start(&auth, &listener, "1234");   // rows after id 1234
+ *      ...
+ *      events.stop();
+ *
+ *  The server (EventStreamView in views.py) sends
+ *
+ *      id: 1235
+ *      event: txn
+ *      data: {"id":1235,"transaction_type":"RECEIVE",...}
+ *
+ *      id: 1235
+ *      event: balance
+ *      data: {"balance":"5120.00","currency":"KES"}
+ *
+ *  one "txn" per new history row, oldest first, and
+ *  the balance after them. When a stream ends - the
+ *  server closes each after a few minutes - or
+ *  breaks, it is reopened with ?after=<last id>:
+ *  nothing is missed and nothing comes twice.
+ *
+ *  A quiet server sends a comment every 15 s, so a
+ *  stream silent for stale_ms (a NAT or proxy
+ *  dropped it without a word) is cancelled and
+ *  reopened. Failed attempts back off from
+ *  RETRY_MIN_MS to RETRY_MAX_MS. A server without
+ *  the endpoint (404 / 405) ends it for good;
+ *  unsupported() then tells the caller to poll.
+ *
+ *  Listener calls come from the stream's thread.
+ * ============================================
+ */
+#ifndef MPESA_EVENTS_H
+#define MPESA_EVENTS_H
+
+#include <string>
+#include <stdlib.h>
+#include <stdint.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "http_reader.h"
+#include "deadline.h"
+#include "auth.h"
+#include "endpoints.h"
+
+// --- Events -------------------------------------------------------------------
+struct SseEvent {
+    std::string id;             // "" if the event carried none
+    std::string type;           // "message" unless named
+    std::string data;           // data: lines joined with '\n'
+};
+
+class EventListener {
+public:
+    virtual ~EventListener() {}
+    virtual void on_event(const SseEvent& e) = 0;
+    virtual void on_state(bool /*connected*/) {}
+};
+
+// --- Parser -------------------------------------------------------------------
+// text/event-stream as it streams in: lines may be split across chunks and
+// end in \n, \r\n or \r. A blank line dispatches the event built so far.
+class SseParser : public BodySink {
+public:
+    enum { MAX_LINE = 64 * 1024 };
+
+    SseParser() : status_(0), retry_ms_(0), cr_(false), has_data_(false), failed_(false) {}
+    virtual ~SseParser() {}
+
+    void on_status(int code) { status_ = code; }
+
+    bool on_data(const char* p, size_t n) {
+        if (status_ != 200) return true;           // an error body: not events
+        for (size_t i = 0; i < n; i++) {
+            char c = p[i];
+            if (cr_ && c == '\n') { cr_ = false; continue; }
+            cr_ = c == '\r';
+            if (c == '\r' || c == '\n') { line(); continue; }
+            if (line_.size() == MAX_LINE) { failed_ = true; return false; }
+            line_ += c;
+        }
+        return true;
+    }
+
+    int      status() const   { return status_; }
+    unsigned retry_ms() const { return retry_ms_; }     // the server's retry:, 0 if none
+    bool     failed() const   { return failed_; }       // a line over MAX_LINE
+
+protected:
+    virtual void dispatch(const SseEvent& e) = 0;
+
+private:
+    void line() {
+        if (line_.empty()) {
+            if (has_data_) {
+                if (event_.type.empty()) event_.type = "message";
+                dispatch(event_);
+            }
+            event_.type.clear();
+            event_.data.clear();
+            has_data_ = false;
+            return;
+        }
+        if (line_[0] == ':') { line_.clear(); return; }   // comment / keep-alive
+        size_t colon = line_.find(':');
+        std::string field = line_.substr(0, colon), value;
+        if (colon != std::string::npos) {
+            size_t v = colon + 1;
+            if (v < line_.size() && line_[v] == ' ') v++;
+            value = line_.substr(v);
+        }
+        line_.clear();
+
+        if (field == "data") {
+            if (has_data_) event_.data += '\n';
+            event_.data += value;
+            has_data_ = true;
+        } else if (field == "event") {
+            event_.type = value;
+        } else if (field == "id") {
+            event_.id = value;                      // kept for the next events too
+        } else if (field == "retry") {
+            retry_ms_ = (unsigned)strtoul(value.c_str(), NULL, 10);
+        }
+    }
+
+    int         status_;
+    unsigned    retry_ms_;
+    bool        cr_, has_data_, failed_;
+    std::string line_;
+    SseEvent    event_;
+};
+
+// --- Stream -------------------------------------------------------------------
+struct EventStats {
+    unsigned long connects;     // streams answered 200
+    unsigned long drops;        // ... that broke or failed to open
+    unsigned long stalls;       // ... cancelled after stale_ms of silence
+    unsigned long events;       // delivered to the listener
+    uint64_t      bytes;        // stream bytes received
+
+    EventStats() : connects(0), drops(0), stalls(0), events(0), bytes(0) {}
+};
+
+class EventStream {
+public:
+    enum {
+        RETRY_MIN_MS = 1000,
+        RETRY_MAX_MS = 30000,
+        STALE_MS     = 45000,   // three missed keep-alives
+        WATCH_MS     = 1000
+    };
+
+    explicit EventStream(HttpPool& http, const std::string& path = EventsEndpoint::path())
+        : http_(http), path_(path), auth_(NULL), listener_(NULL), stale_ms_(STALE_MS),
+          stopping_(false), unsupported_(false), active_(false), connected_(false),
+          last_byte_ms_(0), refreshed_(false), seed_((uint32_t)now_ns() | 1) {}
+    ~EventStream() { stop(); }
+
+    // Follow events after `after` (a transaction id; "" = from now on)
+    void start(TokenSource* auth, EventListener* listener, const std::string& after) {
+        stop();
+        auth_ = auth;
+        listener_ = listener;
+        {
+            LockGuard lock(mu_);
+            last_id_ = after;
+            unsupported_ = false;
+        }
+        stopping_ = false;
+        refreshed_ = false;
+        wake_.reset();
+        if (!reader_.start(run_loop, this)) return;     // no thread: the caller keeps polling
+        watchdog_.start(watch_loop, this);
+    }
+
+    // Closes the stream; the listener hears on_state(false) if it was open
+    void stop() {
+        if (!reader_.running()) return;
+        stopping_ = true;
+        cancel_.cancel();
+        wake_.set();
+        reader_.join();
+        watchdog_.join();
+    }
+
+    bool connected() {
+        LockGuard lock(mu_);
+        return connected_;
+    }
+
+    // The server has no event stream: poll instead
+    bool unsupported() {
+        LockGuard lock(mu_);
+        return unsupported_;
+    }
+
+    std::string last_id() {
+        LockGuard lock(mu_);
+        return last_id_;
+    }
+
+    EventStats stats() {
+        LockGuard lock(mu_);
+        return stats_;
+    }
+
+    // Not synchronised: set once before start()
+    void set_stale_ms(unsigned ms) { stale_ms_ = ms; }
+
+private:
+    // One open stream: notes every byte for the watchdog, the id of every event
+    class Reader : public SseParser {
+    public:
+        explicit Reader(EventStream& s) : s_(s) {}
+
+        void on_status(int code) {
+            SseParser::on_status(code);
+            if (code == 200) s_.opened();
+        }
+        bool on_data(const char* p, size_t n) {
+            s_.received(n);
+            return SseParser::on_data(p, n) && !s_.stopping_;
+        }
+
+    protected:
+        void dispatch(const SseEvent& e) { s_.deliver(e); }
+
+    private:
+        EventStream& s_;
+    };
+
+    void opened() {
+        {
+            LockGuard lock(mu_);
+            connected_ = true;
+            stats_.connects++;
+        }
+        listener_->on_state(true);
+    }
+
+    void received(size_t n) {
+        LockGuard lock(mu_);
+        last_byte_ms_ = now_ms();
+        stats_.bytes += n;
+    }
+
+    void deliver(const SseEvent& e) {
+        {
+            LockGuard lock(mu_);
+            if (!e.id.empty()) last_id_ = e.id;
+            stats_.events++;
+        }
+        listener_->on_event(e);
+    }
+
+    // One stream, start to end. Returns ms to wait before the next one.
+    unsigned run_once(unsigned& backoff) {
+        std::string tok = auth_->token();
+        if (tok.empty()) return RETRY_MAX_MS;           // session idle: wait for it to wake
+        std::string path = path_;
+        {
+            LockGuard lock(mu_);
+            if (!last_id_.empty()) path += "?after=" + last_id_;
+            last_byte_ms_ = now_ms();
+            active_ = true;
+        }
+        uint64_t began = now_ms();
+        Reader reader(*this);
+        HttpResponse r = http_.request(HttpRoute(EventsEndpoint::method(), path), NULL, 0, tok, &reader, &cancel_);
+        bool was_open;
+        {
+            LockGuard lock(mu_);
+            active_ = false;
+            was_open = connected_;
+            connected_ = false;
+            if (reader.status() == 404 || reader.status() == 405) unsupported_ = true;
+            else if (!stopping_ && (reader.status() != 200 || r.status_code != 200)) stats_.drops++;
+        }
+        if (was_open) listener_->on_state(false);
+        if (stopping_) return 0;
+        if (unsupported()) {
+            stopping_ = true;
+            wake_.set();                        // the watchdog too
+            return 0;
+        }
+
+        // One refresh per rejected token; a second 401 backs off like a failure
+        bool retry = token_rejected(r) && !refreshed_ && auth_->refresh(tok);
+        refreshed_ = retry;
+        if (retry) return 0;
+        // A stream the server ended after a good while: straight back
+        if (r.status_code == 200 && !reader.failed() && now_ms() - began >= RETRY_MIN_MS) {
+            backoff = 0;
+            return 0;
+        }
+        unsigned floor = reader.retry_ms() > RETRY_MIN_MS ? reader.retry_ms() : (unsigned)RETRY_MIN_MS;
+        backoff = backoff ? backoff * 2 : floor;
+        if (backoff > (unsigned)RETRY_MAX_MS) backoff = RETRY_MAX_MS;
+        seed_ = seed_ * 1103515245u + 12345u;
+        return backoff + (seed_ >> 8) % (backoff / 4 + 1);     // spread the herd after an outage
+    }
+
+    static void run_loop(void* self) {
+        EventStream* s = (EventStream*)self;
+        unsigned backoff = 0;
+        for (;;) {
+            s->cancel_.reset();                 // after a stall; stop() sets stopping_ first
+            if (s->stopping_) return;
+            unsigned wait = s->run_once(backoff);
+            if (s->stopping_) return;
+            if (wait && s->wake_.wait_ms(wait)) return;
+        }
+    }
+
+    static void watch_loop(void* self) {
+        EventStream* s = (EventStream*)self;
+        while (!s->wake_.wait_ms(WATCH_MS)) {
+            LockGuard lock(s->mu_);
+            if (!s->active_ || now_ms() - s->last_byte_ms_ < s->stale_ms_) continue;
+            s->stats_.stalls++;
+            s->active_ = false;
+            s->cancel_.cancel();
+        }
+    }
+
+    EventStream(const EventStream&);
+    EventStream& operator=(const EventStream&);
+
+    HttpPool&      http_;
+    std::string    path_;
+    TokenSource*   auth_;
+    EventListener* listener_;
+    unsigned       stale_ms_;
+    volatile bool  stopping_;
+    bool           unsupported_, active_, connected_;     // mu_
+    uint64_t       last_byte_ms_;                          // mu_
+    std::string    last_id_;                               // mu_
+    EventStats     stats_;                                 // mu_
+    bool           refreshed_;                             // reader thread
+    uint32_t       seed_;                                  // ...
+    CancelToken    cancel_;
+    Event          wake_;
+    Mutex          mu_;
+    Thread         reader_;
+    Thread         watchdog_;
+};
+
+#endif // MPESA_EVENTS_H
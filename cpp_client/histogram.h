@@ -0,0 +1,194 @@
+/**
+ * ============================================
+ *   histogram.h - HDR-style latency histogram
+ * ============================================
+ *
+ *  Log-linear buckets in the style of HdrHistogram:
+ *  every power-of-two range is split into 128 equal
+ *  sub-buckets, so any recorded value is reported
+ *  within 1/128 (< 0.8%) of itself, from 1 us up to
+ *  ~19 hours, in a fixed 32 KB array. Recording is
+ *  two shifts and an increment; histograms merge by
+ *  adding counts, so each thread keeps its own and
+ *  they are combined at the end.
+ *
+ *  ConcurrentHistogram is the shared, lock-free
+ *  variant for hot paths: one atomic add per record,
+ *  with count / sum / min / max derived from the
+ *  buckets when a snapshot is taken.
+ *
+ *  Values are microseconds.
+ * ============================================
+ */
+#ifndef MPESA_HISTOGRAM_H
+#define MPESA_HISTOGRAM_H
+
+#include <ostream>
+#include <iomanip>
+#include <string.h>
+#include <stdint.h>
+#include "platform.h"
+
+class LatencyHistogram {
+public:
+    enum {
+        SUB_BITS    = 7,
+        SUB_HALF    = 1 << SUB_BITS,                       // 128
+        MAX_BITS    = 36,                                   // 2^36 us ~ 19 h
+        BUCKETS     = (MAX_BITS - SUB_BITS) * SUB_HALF + 2 * SUB_HALF
+    };
+
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+        memset(counts_, 0, sizeof(counts_));
+        total_ = 0; sum_ = 0; min_ = 0; max_ = 0;
+    }
+
+    void record(uint64_t us) {
+        if (us >= ((uint64_t)1 << MAX_BITS)) us = ((uint64_t)1 << MAX_BITS) - 1;
+        counts_[index_of(us)]++;
+        if (total_ == 0 || us < min_) min_ = us;
+        if (us > max_) max_ = us;
+        total_++;
+        sum_ += us;
+    }
+
+    void merge(const LatencyHistogram& o) {
+        if (!o.total_) return;
+        for (int i = 0; i < BUCKETS; i++) counts_[i] += o.counts_[i];
+        if (total_ == 0 || o.min_ < min_) min_ = o.min_;
+        if (o.max_ > max_) max_ = o.max_;
+        total_ += o.total_;
+        sum_   += o.sum_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min()   const { return min_; }
+    uint64_t max()   const { return max_; }
+    uint64_t sum()   const { return sum_; }
+    double   mean()  const { return total_ ? (double)sum_ / (double)total_ : 0.0; }
+
+    // Highest value equivalent to the bucket holding the p-th percentile
+    // (p in 0..100), clamped to the recorded max like HdrHistogram.
+    uint64_t percentile(double p) const {
+        if (!total_) return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * (double)total_ + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > total_) rank = total_;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint64_t v = highest_equivalent(i);
+                return v < max_ ? v : max_;
+            }
+        }
+        return max_;
+    }
+
+    // HdrHistogram-style percentile distribution (values in ms), with
+    // ticks halving the remaining distance to 100% each step.
+    void print_distribution(std::ostream& out) const {
+        out << "       Value(ms)   Percentile   TotalCount 1/(1-Percentile)\n";
+        double p = 0.0;
+        for (int step = 0; step < 40; step++) {
+            uint64_t v = percentile(p);
+            uint64_t n = count_at_or_below(v);
+            out << std::fixed << std::setw(16) << std::setprecision(3) << (double)v / 1000.0
+                << std::setw(13) << std::setprecision(6) << p / 100.0
+                << std::setw(13) << n;
+            if (p < 100.0) out << std::setw(17) << std::setprecision(2) << 100.0 / (100.0 - p);
+            out << "\n";
+            if (p >= 100.0 || n >= total_) break;
+            p = 100.0 - (100.0 - p) / 2.0;
+            if (100.0 - p < 100.0 / (double)total_) p = 100.0;
+        }
+        out << "#[Mean = " << std::setprecision(3) << mean() / 1000.0
+            << " ms, Max = " << (double)max_ / 1000.0
+            << " ms, Total count = " << total_ << "]\n";
+    }
+
+private:
+    friend class ConcurrentHistogram;
+
+    static int msb(uint64_t v) {
+#ifdef __GNUC__
+        return 63 - __builtin_clzll(v);                     // v > 0 here
+#else
+        int n = 0;
+        while (v >>= 1) n++;
+        return n;
+#endif
+    }
+
+    // v < 256 maps 1:1; above that, the top 8 significant bits pick the slot
+    static int index_of(uint64_t v) {
+        if (v < 2 * SUB_HALF) return (int)v;
+        int shift = msb(v) - SUB_BITS;                       // >= 1
+        return shift * SUB_HALF + (int)(v >> shift);
+    }
+
+    static uint64_t lowest_equivalent(int i) {
+        if (i < 2 * SUB_HALF) return (uint64_t)i;
+        int shift = i / SUB_HALF - 1;
+        return (uint64_t)(i % SUB_HALF + SUB_HALF) << shift;
+    }
+
+    static uint64_t highest_equivalent(int i) {
+        if (i < 2 * SUB_HALF) return (uint64_t)i;
+        int shift = i / SUB_HALF - 1;
+        uint64_t m = (uint64_t)(i % SUB_HALF + SUB_HALF);
+        return ((m + 1) << shift) - 1;
+    }
+
+    uint64_t count_at_or_below(uint64_t v) const {
+        uint64_t n = 0;
+        int last = index_of(v);
+        for (int i = 0; i <= last && i < BUCKETS; i++) n += counts_[i];
+        return n;
+    }
+
+    // n values known only by bucket: min/max/sum from the bucket's range
+    void add_bucket(int i, uint64_t n) {
+        uint64_t lo = lowest_equivalent(i), hi = highest_equivalent(i);
+        counts_[i] += n;
+        if (total_ == 0 || lo < min_) min_ = lo;
+        if (hi > max_) max_ = hi;
+        total_ += n;
+        sum_   += n * (lo + (hi - lo) / 2);
+    }
+
+    uint64_t counts_[BUCKETS];
+    uint64_t total_, sum_, min_, max_;
+};
+
+// Shared by many threads; record() is a single atomic increment
+class ConcurrentHistogram {
+public:
+    ConcurrentHistogram() { memset((void*)counts_, 0, sizeof(counts_)); }
+
+    void record(uint64_t us) {
+        if (us >= ((uint64_t)1 << LatencyHistogram::MAX_BITS))
+            us = ((uint64_t)1 << LatencyHistogram::MAX_BITS) - 1;
+        atomic_add(&counts_[LatencyHistogram::index_of(us)], 1);
+    }
+
+    // Copy into a plain histogram for reporting. Concurrent records may or
+    // may not be included; each bucket is read once.
+    void snapshot(LatencyHistogram& out) const {
+        out.reset();
+        for (int i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            uint64_t n = counts_[i];
+            if (n) out.add_bucket(i, n);
+        }
+    }
+
+private:
+    ConcurrentHistogram(const ConcurrentHistogram&);
+    ConcurrentHistogram& operator=(const ConcurrentHistogram&);
+
+    volatile uint64_t counts_[LatencyHistogram::BUCKETS];
+};
+
+#endif // MPESA_HISTOGRAM_H
@@ -0,0 +1,226 @@
+/**
+ * ============================================
+ *   history.h - paged, streamed transaction history
+ * ============================================
+ *
+ *  /api/transactions/ pages are fetched with
+ *  ?limit=N&cursor=<id> and parsed while they stream
+ *  in: HistoryStream is a BodySink that cuts each
+ *  element of the "transactions" array out of the byte
+ *  stream, indexes just that row and keeps nothing else
+ *  but the small top-level fields (count, next_cursor).
+ *  Memory per page is bounded by the page size, not by
+ *  how long the account history is.
+ *
+ *  HistoryPrefetch fetches the following page on a
+ *  background thread while the current one is shown.
+ * ============================================
+ */
+#ifndef MPESA_HISTORY_H
+#define MPESA_HISTORY_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "json.h"
+#include "endpoints.h"
+
+// --- Row / page ---------------------------------------------------------------
+struct TxnRow {
+    std::string id;
+    std::string transaction_type;
+    std::string amount;
+    std::string balance_after;
+    std::string transaction_id;
+    std::string created_at;
+};
+
+struct HistoryPage {
+    int                 status_code;
+    std::string         error;
+    std::string         count;         // total rows on the account
+    std::string         next_cursor;   // "" on the last page
+    std::vector<TxnRow> rows;
+
+    HistoryPage() : status_code(0) {}
+};
+
+// One TransactionSerializer object (a history row or a pushed "txn" event)
+inline void read_txn_row(const JsonIndex& j, uint32_t obj, TxnRow& row) {
+    row.id               = j.get(obj, "id");
+    row.transaction_type = j.get(obj, "transaction_type");
+    row.amount           = j.get(obj, "amount");
+    row.balance_after    = j.get(obj, "balance_after");
+    row.transaction_id   = j.get(obj, "transaction_id");
+    row.created_at       = j.get(obj, "created_at");
+}
+
+// --- Streaming splitter -------------------------------------------------------
+class HistoryStream : public BodySink {
+public:
+    explicit HistoryStream(HistoryPage& page)
+        : page_(page), depth_(0), in_str_(false), esc_(false),
+          in_rows_(false), capturing_(false) {}
+
+    void on_status(int code) { page_.status_code = code; }
+
+    bool on_data(const char* p, size_t n) {
+        size_t seg = capturing_ ? 0 : (size_t)-1;    // row bytes start in this chunk
+        for (size_t i = 0; i < n; i++) {
+            char c = p[i];
+            bool in_array = in_rows_ && depth_ >= 2;
+
+            if (in_str_) {
+                if (esc_)           esc_ = false;
+                else if (c == '\\') esc_ = true;
+                else if (c == '"')  in_str_ = false;
+                else if (depth_ == 1 && key_.size() < 32) key_ += c;
+                if (!in_array) head_ += c;
+                continue;
+            }
+
+            switch (c) {
+            case '"':
+                in_str_ = true;
+                if (depth_ == 1) key_.clear();
+                break;
+            case '{': case '[':
+                if (in_rows_ && depth_ == 2 && c == '{') { capturing_ = true; seg = i; }
+                if (depth_ == 1 && c == '[' && key_ == "transactions") in_rows_ = true;
+                depth_++;
+                break;
+            case '}': case ']':
+                depth_--;
+                if (capturing_ && depth_ == 2 && c == '}') {
+                    row_.append(p + seg, i + 1 - seg);
+                    emit_row();
+                    capturing_ = false;
+                    seg = (size_t)-1;
+                }
+                if (in_rows_ && depth_ == 1) in_rows_ = false;
+                break;
+            }
+            // Keep the array's own brackets, drop everything between them
+            if (!in_array || !(in_rows_ && depth_ >= 2)) head_ += c;
+        }
+        if (capturing_) row_.append(p + seg, n - seg);
+        return true;
+    }
+
+    // Top-level fields once the body is complete
+    void finish() {
+        JsonIndex j(head_);
+        page_.count = j.get("count");
+        page_.error = j.get("error");
+        uint32_t next = j.find(j.root(), "next_cursor");
+        page_.next_cursor = j.equals(next, "null") ? "" : j.str(next);
+    }
+
+private:
+    void emit_row() {
+        idx_.parse(row_);
+        TxnRow row;
+        read_txn_row(idx_, idx_.root(), row);
+        page_.rows.push_back(row);
+        row_.clear();
+    }
+
+    HistoryPage& page_;
+    int          depth_;
+    bool         in_str_, esc_;
+    bool         in_rows_, capturing_;
+    std::string  key_;     // last top-level key seen
+    std::string  head_;    // body minus the array elements
+    std::string  row_;     // current row's bytes
+    JsonIndex    idx_;     // reused for every row
+};
+
+// --- Fetch --------------------------------------------------------------------
+inline std::string history_path(const std::string& cursor, int limit,
+                                const std::string& since = std::string()) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s?limit=%d", HistoryEndpoint::path(), limit);
+    std::string path = buf;
+    if (!cursor.empty()) path += "&cursor=" + cursor;
+    if (!since.empty()) {
+        path += "&since=";
+        for (size_t i = 0; i < since.size(); i++) {
+            if (since[i] == '+') path += "%2B";          // "+03:00" offsets
+            else path += since[i];
+        }
+    }
+    return path;
+}
+
+inline void fetch_history_page(HttpPool& http, const std::string& token,
+                               const std::string& cursor, int limit, HistoryPage& page,
+                               const std::string& since = std::string()) {
+    page = HistoryPage();
+    page.rows.reserve((size_t)limit);
+    HistoryStream stream(page);
+    HttpResponse r = http.request(HistoryEndpoint::method(), history_path(cursor, limit, since), "", token, &stream);
+    page.status_code = r.status_code;
+    if (r.status_code == 0) {
+        // Transport failure: the pool put its JSON error in r.body
+        page.error = json_get(r.body, "error");
+        return;
+    }
+    stream.finish();
+}
+
+// A body that is already in memory (one slot of an /api/batch/ reply)
+inline void parse_history_page(int status_code, const char* body, size_t n, HistoryPage& page) {
+    page = HistoryPage();
+    if (status_code == 0) {
+        page.error = json_get(std::string(body, n), "error");
+        return;
+    }
+    HistoryStream stream(page);
+    stream.on_status(status_code);
+    stream.on_data(body, n);
+    stream.finish();
+}
+
+// --- Prefetch -----------------------------------------------------------------
+class HistoryPrefetch {
+public:
+    HistoryPrefetch() : http_(NULL), limit_(0) {}
+    ~HistoryPrefetch() { thread_.join(); }
+
+    void start(HttpPool& http, const std::string& token, const std::string& cursor, int limit) {
+        thread_.join();
+        http_ = &http; token_ = token; cursor_ = cursor; limit_ = limit;
+        if (!thread_.start(run, this)) run(this);   // no thread: fetch inline
+    }
+
+    // Page for `cursor`, waiting for the background fetch if needed
+    bool take(const std::string& cursor, HistoryPage& out) {
+        thread_.join();
+        if (!http_ || cursor != cursor_) return false;
+        out.rows.swap(page_.rows);
+        out.status_code = page_.status_code;
+        out.error = page_.error;
+        out.count = page_.count;
+        out.next_cursor = page_.next_cursor;
+        http_ = NULL;
+        return true;
+    }
+
+    void cancel() { thread_.join(); http_ = NULL; }
+
+private:
+    static void run(void* self) {
+        HistoryPrefetch* p = (HistoryPrefetch*)self;
+        fetch_history_page(*p->http_, p->token_, p->cursor_, p->limit_, p->page_);
+    }
+
+    Thread      thread_;
+    HttpPool*   http_;
+    std::string token_, cursor_;
+    int         limit_;
+    HistoryPage page_;
+};
+
+#endif // MPESA_HISTORY_H
@@ -0,0 +1,170 @@
+/**
+ * ============================================
+ *   http_cache.h - conditional GETs
+ * ============================================
+ *
+ *  ResponseCache keeps the last body of each GET
+ *  that came with an ETag or Last-Modified, keyed
+ *  by path and bearer token (one user's balance is
+ *  never another's). HttpPool sends those back as
+ *  If-None-Match / If-Modified-Since; a 304 costs a
+ *  status line instead of the body, which is then
+ *  replayed from here as a normal 200:
+ *
+ *      ResponseCache cache;
+ *      g_http.set_cache(&cache);
+ *
+ *  Nothing is served without asking the server, so
+ *  the cache can never show a stale balance; it only
+ *  saves the bytes. Bounded by entry count and total
+ *  bytes, least recently used out first.
+ * ============================================
+ */
+#ifndef MPESA_HTTP_CACHE_H
+#define MPESA_HTTP_CACHE_H
+
+#include <string>
+#include <list>
+#include <map>
+#include "platform.h"
+#include "http_reader.h"
+
+// --- Validators ---------------------------------------------------------------
+// ETag / Last-Modified of a response, sent back to make the next GET conditional
+struct Validators {
+    std::string etag;
+    std::string last_modified;
+
+    bool empty() const { return etag.empty() && last_modified.empty(); }
+};
+
+struct CacheStats {
+    unsigned long lookups;      // conditional GETs sent
+    unsigned long hits;         // ... answered 304 and replayed
+    unsigned long stores;
+    unsigned long evictions;
+    size_t        bytes;        // bodies held now
+
+    CacheStats() : lookups(0), hits(0), stores(0), evictions(0), bytes(0) {}
+};
+
+// --- Tee ----------------------------------------------------------------------
+// Passes a streamed body on and keeps a copy for the cache, up to `limit`
+class TeeSink : public BodySink {
+public:
+    TeeSink(BodySink* next, size_t limit) : next_(next), limit_(limit), over_(false) {}
+
+    void on_status(int code) { if (next_) next_->on_status(code); }
+    void expect(size_t n)    { if (next_) next_->expect(n); }
+    bool on_data(const char* p, size_t n) {
+        if (!over_) {
+            if (copy_.size() + n > limit_) { over_ = true; std::string().swap(copy_); }
+            else copy_.append(p, n);
+        }
+        return next_ ? next_->on_data(p, n) : true;
+    }
+
+    bool complete() const { return !over_; }      // copy_ holds the whole body
+    const std::string& copy() const { return copy_; }
+
+private:
+    BodySink*   next_;
+    size_t      limit_;
+    bool        over_;
+    std::string copy_;
+};
+
+// --- ResponseCache ------------------------------------------------------------
+class ResponseCache {
+public:
+    explicit ResponseCache(size_t max_entries = 64, size_t max_bytes = 1024 * 1024,
+                           size_t max_body = 256 * 1024)
+        : max_entries_(max_entries), max_bytes_(max_bytes), max_body_(max_body) {}
+
+    static std::string key(const std::string& path, const std::string& token) {
+        return token + ' ' + path;
+    }
+
+    // Validators and a copy of the body for `key`; false when not cached
+    bool lookup(const std::string& key, Validators& v, std::string& body) {
+        LockGuard lock(mu_);
+        Index::iterator it = index_.find(key);
+        if (it == index_.end()) return false;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        v = it->second->v;
+        body = it->second->body;
+        stats_.lookups++;
+        return true;
+    }
+
+    void store(const std::string& key, const Validators& v, const std::string& body) {
+        if (body.size() > max_body_) { erase(key); return; }
+        LockGuard lock(mu_);
+        Index::iterator it = index_.find(key);
+        if (it != index_.end()) drop(it);
+        lru_.push_front(Entry());
+        Entry& e = lru_.front();
+        e.key = key;
+        e.v = v;
+        e.body = body;
+        index_[key] = lru_.begin();
+        stats_.bytes += e.body.size();
+        stats_.stores++;
+        while (lru_.size() > 1 && (lru_.size() > max_entries_ || stats_.bytes > max_bytes_)) {
+            drop(index_.find(lru_.back().key));
+            stats_.evictions++;
+        }
+    }
+
+    void erase(const std::string& key) {
+        LockGuard lock(mu_);
+        Index::iterator it = index_.find(key);
+        if (it != index_.end()) drop(it);
+    }
+
+    void clear() {
+        LockGuard lock(mu_);
+        lru_.clear();
+        index_.clear();
+        stats_.bytes = 0;
+    }
+
+    void note_hit() {
+        LockGuard lock(mu_);
+        stats_.hits++;
+    }
+
+    size_t max_body() const { return max_body_; }
+
+    CacheStats stats() const {
+        LockGuard lock(mu_);
+        return stats_;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        Validators  v;
+        std::string body;
+    };
+    typedef std::list<Entry> Lru;                       // most recent first
+    typedef std::map<std::string, Lru::iterator> Index;
+
+    // mu_ held
+    void drop(Index::iterator it) {
+        stats_.bytes -= it->second->body.size();
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+
+    ResponseCache(const ResponseCache&);
+    ResponseCache& operator=(const ResponseCache&);
+
+    size_t        max_entries_, max_bytes_, max_body_;
+    Lru           lru_;
+    Index         index_;
+    CacheStats    stats_;
+    mutable Mutex mu_;
+};
+
+#endif // MPESA_HTTP_CACHE_H
@@ -0,0 +1,1364 @@
+/**
+ * ============================================
+ *   http_pool.h - keep-alive HTTP/1.1 pool
+ * ============================================
+ *
+ *  One HttpEndpoint per server (host:port). Requests
+ *  reuse warm connections instead of paying a TCP
+ *  handshake per call.
+ *
+ *  HttpPool fronts one or more of them. With several
+ *  (set_servers(), from mpesa_client.conf) each
+ *  request goes to the less busy of two servers
+ *  picked at random. A server that keeps failing is
+ *  ejected for a while, and a checker thread probes
+ *  every server's health_path to bring it back.
+ *
+ *  Backends:
+ *    Windows : WinHTTP. The session/connect handles
+ *              are kept open, so WinHTTP's own socket
+ *              cache stays warm between requests.
+ *    POSIX   : plain BSD sockets, pooled by us.
+ *
+ *  Both backends give the same guarantees:
+ *    - bounded number of idle sockets (max_idle)
+ *    - idle sockets older than idle_timeout_ms are closed
+ *    - a request that fails on a reused (stale) socket
+ *      while being sent is retried once on a fresh
+ *      connection. One that was sent in full and then
+ *      got no response is retried only if resending it
+ *      cannot apply it twice: an idempotent method, or
+ *      a body carrying an "idempotency_key"
+ *
+ *  Bodies are read into one reusable buffer per
+ *  connection (see http_reader.h). Pass a BodySink to
+ *  request() to consume a body while it streams in;
+ *  resp.body is then left empty.
+ *
+ *  set_observer() receives a RequestTiming for every
+ *  finished request (see metrics.h).
+ *
+ *  Responses may come gzip / deflate compressed
+ *  (PoolConfig::accept_encoding): WinHTTP decodes them
+ *  itself, the POSIX reader through inflate.h. With
+ *  set_cache() (http_cache.h) GETs are conditional on
+ *  the last ETag / Last-Modified, and a 304 is served
+ *  from the cache as a 200.
+ *
+ *  Below the cache, requests go through an
+ *  HttpTransport: the servers, or with
+ *  set_transport() a trace recorder / replayer
+ *  (trace.h) for tests that need no server.
+ *
+ *  Every phase has a deadline (set_timeouts(), see
+ *  deadline.h) and a request can be cancelled through
+ *  a CancelToken. A request that gets no response says
+ *  why in resp.failure / resp.phase; the body carries
+ *  the matching {"error": ...} text for the screens.
+ *
+ *  Hot paths pass a static HttpRoute (method + path,
+ *  converted for WinHTTP once) and a body built on the
+ *  stack (json_writer.h). The request line and headers
+ *  then go into a stack buffer (WinHTTP) or the
+ *  connection's reused send buffer (POSIX), so a
+ *  request on a warm connection allocates nothing
+ *  until the response arrives.
+ * ============================================
+ */
+#ifndef MPESA_HTTP_POOL_H
+#define MPESA_HTTP_POOL_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "http_reader.h"
+#include "deadline.h"
+#include "http_cache.h"
+
+#ifdef _WIN32
+#include <winhttp.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+// --- Failures -----------------------------------------------------------------
+// Why a request produced no HTTP response (status_code 0)
+enum HttpFailure {
+    HTTP_FAIL_NONE,
+    HTTP_FAIL_INIT,             // no WinHTTP session / request handle
+    HTTP_FAIL_RESOLVE,          // host name did not resolve
+    HTTP_FAIL_CONNECT,          // refused / unreachable
+    HTTP_FAIL_SEND,             // connection lost while writing
+    HTTP_FAIL_RECEIVE,          // connection lost while reading
+    HTTP_FAIL_TIMEOUT,          // a deadline passed; phase says which
+    HTTP_FAIL_CANCELLED         // CancelToken::cancel()
+};
+
+enum HttpPhase { HTTP_PHASE_NONE, HTTP_PHASE_RESOLVE, HTTP_PHASE_CONNECT, HTTP_PHASE_SEND, HTTP_PHASE_RECEIVE };
+
+inline const char* http_phase_name(HttpPhase p) {
+    static const char* const names[] = { "none", "resolve", "connect", "send", "receive" };
+    return names[p];
+}
+
+// Error bodies keep the shape the UI already understands ({"error": ...})
+inline const char* http_failure_body(HttpFailure f, HttpPhase p) {
+    switch (f) {
+    case HTTP_FAIL_NONE:      return "";
+    case HTTP_FAIL_INIT:      return "{\"error\":\"HTTP client init failed\"}";
+    case HTTP_FAIL_RESOLVE:   return "{\"error\":\"Cannot resolve the server address\"}";
+    case HTTP_FAIL_CONNECT:   return "{\"error\":\"Cannot connect - is Django running on port 8000?\"}";
+    case HTTP_FAIL_CANCELLED: return "{\"error\":\"Cancelled\"}";
+    case HTTP_FAIL_TIMEOUT:
+        switch (p) {
+        case HTTP_PHASE_RESOLVE: return "{\"error\":\"Timed out resolving the server address\"}";
+        case HTTP_PHASE_CONNECT: return "{\"error\":\"Timed out connecting to the server\"}";
+        case HTTP_PHASE_SEND:    return "{\"error\":\"Timed out sending the request\"}";
+        default:                 return "{\"error\":\"Timed out waiting for the server to reply\"}";
+        }
+    default:                  return "{\"error\":\"Request failed - make sure server is running\"}";
+    }
+}
+
+// --- HTTP response ------------------------------------------------------------
+struct HttpResponse {
+    int         status_code;
+    std::string body;
+    HttpFailure failure;        // HTTP_FAIL_NONE whenever status_code != 0
+    HttpPhase   phase;          // where a failure happened
+    Validators  validators;     // ETag / Last-Modified, if the server sent them
+    bool        from_cache;     // a 304, answered with the cached body
+
+    HttpResponse() : status_code(0), failure(HTTP_FAIL_NONE), phase(HTTP_PHASE_NONE),
+                     from_cache(false) {}
+
+    bool timed_out() const { return failure == HTTP_FAIL_TIMEOUT; }
+    bool cancelled() const { return failure == HTTP_FAIL_CANCELLED; }
+
+    void fail(HttpFailure f, HttpPhase p) {
+        status_code = 0;
+        failure = f;
+        phase = p;
+        body = http_failure_body(f, p);
+    }
+};
+
+// --- Pool config / stats ------------------------------------------------------
+struct PoolConfig {
+    size_t   max_idle;          // idle keep-alive sockets kept per backend
+    unsigned idle_timeout_ms;   // idle sockets older than this are closed
+    bool     accept_encoding;   // offer gzip / deflate responses
+
+    PoolConfig() : max_idle(4), idle_timeout_ms(30000), accept_encoding(true) {}
+};
+
+struct PoolStats {
+    unsigned long requests;     // logical requests issued
+    unsigned long connects;     // new TCP connections opened
+    unsigned long reused;       // requests served on a warm socket
+    unsigned long reconnects;   // stale sockets replaced transparently
+
+    PoolStats() : requests(0), connects(0), reused(0), reconnects(0) {}
+};
+
+// --- Request timing -----------------------------------------------------------
+// Monotonic now_ns() stamps for one request. A phase that did not happen
+// is 0: connected_ns on a reused socket, first_byte_ns when nothing came
+// back. WinHTTP connects inside WinHttpSendRequest, so on Windows the
+// connect time is part of the send phase and connected_ns stays 0.
+// bytes_in counts what came off the socket (POSIX), or the decoded body
+// (WinHTTP, which decompresses before handing anything over).
+struct RequestTiming {
+    uint64_t start_ns;
+    uint64_t connected_ns;
+    uint64_t sent_ns;
+    uint64_t first_byte_ns;
+    uint64_t done_ns;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    int      status_code;       // 0 = transport failure
+    HttpFailure failure;        // ... and why
+    bool     reused;
+
+    RequestTiming() { memset(this, 0, sizeof(*this)); }
+};
+
+// Called on the requesting thread once per logical request (after any
+// transparent retry). Must be cheap and thread-safe.
+class RequestObserver {
+public:
+    virtual ~RequestObserver() {}
+    virtual void on_request(const std::string& method, const std::string& path,
+                            const RequestTiming& t) = 0;
+};
+
+#ifdef _WIN32
+inline std::wstring to_wide(const std::string& s) {
+    if (s.empty()) return L"";
+    int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
+    std::wstring result(len, 0);
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &result[0], len);
+    result.resize(len - 1);           // drop the terminator WinAPI counted
+    return result;
+}
+#endif
+
+// --- Route --------------------------------------------------------------------
+// Method + path, with the wide copies WinHTTP wants made once. Keep the
+// fixed endpoints in function-local statics:
+//     static const HttpRoute route("GET", "/api/balance/");
+struct HttpRoute {
+    std::string  method, path;
+#ifdef _WIN32
+    std::wstring wmethod, wpath;
+#endif
+
+    HttpRoute(const std::string& m, const std::string& p) : method(m), path(p)
+#ifdef _WIN32
+        , wmethod(to_wide(m)), wpath(to_wide(p))
+#endif
+    {}
+};
+
+// Whether a request that reached the server may be sent again: the method is
+// idempotent, or the body names an idempotency_key the server dedupes on
+inline bool safe_to_resend(const HttpRoute& route, const char* body, size_t body_len) {
+    const std::string& m = route.method;
+    if (m == "GET" || m == "HEAD" || m == "PUT" || m == "DELETE" || m == "OPTIONS") return true;
+    static const char KEY[] = "\"idempotency_key\"";
+    const char* end = body + body_len;
+    return body_len && std::search(body, end, KEY, KEY + sizeof(KEY) - 1) != end;
+}
+
+#ifdef _WIN32
+// =============================================================================
+//   WinHTTP backend
+// =============================================================================
+
+// "Content-Type: ...\r\nAuthorization: Bearer <token>\r\n" into out without
+// MultiByteToWideChar: tokens are ASCII. 0 if it does not fit or is not ASCII.
+inline size_t format_wide_headers(wchar_t* out, size_t cap, const std::string& token) {
+    static const wchar_t JSON[]   = L"Content-Type: application/json\r\n";
+    static const wchar_t BEARER[] = L"Authorization: Bearer ";
+    const size_t json_len = sizeof(JSON) / sizeof(JSON[0]) - 1;
+    const size_t bearer_len = sizeof(BEARER) / sizeof(BEARER[0]) - 1;
+    size_t n = json_len + (token.empty() ? 0 : bearer_len + token.size() + 2);
+    if (n + 1 > cap) return 0;
+    wchar_t* q = out;
+    memcpy(q, JSON, json_len * sizeof(wchar_t)); q += json_len;
+    if (!token.empty()) {
+        memcpy(q, BEARER, bearer_len * sizeof(wchar_t)); q += bearer_len;
+        for (size_t i = 0; i < token.size(); i++) {
+            unsigned char c = (unsigned char)token[i];
+            if (c >= 0x80) return 0;
+            *q++ = (wchar_t)c;
+        }
+        *q++ = L'\r'; *q++ = L'\n';
+    }
+    *q = 0;
+    return n;
+}
+
+#ifndef WINHTTP_OPTION_DECOMPRESSION            // Windows 8.1 SDK and later
+#define WINHTTP_OPTION_DECOMPRESSION   118
+#define WINHTTP_DECOMPRESSION_FLAG_ALL 0x00000003     // gzip | deflate
+#endif
+
+// CancelToken abort: closing the request handle fails the blocking call
+inline void winhttp_abort(void* h) { WinHttpCloseHandle((HINTERNET)h); }
+
+class HttpEndpoint {
+public:
+    HttpEndpoint(const std::string& host, unsigned short port,
+             const PoolConfig& cfg = PoolConfig())
+        : host_(host), port_(port), cfg_(cfg),
+          session_(NULL), connect_(NULL), last_used_ms_(0), in_flight_(0), observer_(NULL) {}
+
+    ~HttpEndpoint() { close_idle(); }
+
+    HttpResponse request(const std::string& method,
+                         const std::string& path,
+                         const std::string& body,
+                         const std::string& auth_token,
+                         BodySink* sink = NULL) {
+        return request(HttpRoute(method, path), body.data(), body.size(), auth_token, sink);
+    }
+
+    HttpResponse request(const HttpRoute& route,
+                         const char* body, size_t body_len,
+                         const std::string& auth_token,
+                         BodySink* sink = NULL,
+                         CancelToken* cancel = NULL,
+                         const Validators* cond = NULL) {
+        const std::string& method = route.method;
+        const std::string& path   = route.path;
+        const HttpTimeouts& to    = timeouts_.lookup(path);
+        HttpResponse resp;
+        RequestTiming tm;
+        tm.start_ns = now_ns();
+        uint64_t end = to.total_ms ? tm.start_ns + (uint64_t)to.total_ms * 1000000ULL : ~0ULL;
+        bool reused = false;
+        HINTERNET hConnect = acquire(reused);
+        if (!hConnect) {
+            resp.fail(session_ ? HTTP_FAIL_CONNECT : HTTP_FAIL_INIT, HTTP_PHASE_CONNECT);
+            observe(method, path, tm, resp);
+            return resp;
+        }
+        tm.reused = reused;
+
+        wchar_t stack_headers[1024];
+        std::wstring heap_headers;
+        const wchar_t* headers = stack_headers;
+        size_t headers_len = format_wide_headers(stack_headers, 1024, auth_token);
+        bool conditional = cond && !cond->empty();
+        if (!headers_len || conditional) {       // oversized or non-ASCII token, validators
+            heap_headers = L"Content-Type: application/json\r\n";
+            if (!auth_token.empty())
+                heap_headers += L"Authorization: Bearer " + to_wide(auth_token) + L"\r\n";
+            if (conditional && !cond->etag.empty())
+                heap_headers += L"If-None-Match: " + to_wide(cond->etag) + L"\r\n";
+            if (conditional && !cond->last_modified.empty())
+                heap_headers += L"If-Modified-Since: " + to_wide(cond->last_modified) + L"\r\n";
+            headers = heap_headers.c_str();
+            headers_len = heap_headers.size();
+        }
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            HINTERNET hRequest = WinHttpOpenRequest(
+                hConnect, route.wmethod.c_str(), route.wpath.c_str(),
+                NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, 0);
+            if (!hRequest) {
+                resp.fail(HTTP_FAIL_INIT, HTTP_PHASE_NONE);
+                break;
+            }
+            // WinHTTP times each phase itself; the whole call is capped by
+            // giving each phase no more than what is left of total_ms
+            if (now_ns() >= end) {
+                WinHttpCloseHandle(hRequest);
+                resp.fail(HTTP_FAIL_TIMEOUT, HTTP_PHASE_CONNECT);
+                break;
+            }
+            WinHttpSetTimeouts(hRequest, phase_ms(to.resolve_ms, end), phase_ms(to.connect_ms, end),
+                               phase_ms(to.send_ms, end), phase_ms(to.receive_ms, end));
+            if (cancel && !cancel->attach(winhttp_abort, hRequest)) {
+                WinHttpCloseHandle(hRequest);
+                resp.fail(HTTP_FAIL_CANCELLED, HTTP_PHASE_NONE);
+                break;
+            }
+
+            BOOL ok = WinHttpSendRequest(
+                hRequest,
+                headers, (DWORD)headers_len,
+                body_len ? (LPVOID)body : WINHTTP_NO_REQUEST_DATA,
+                (DWORD)body_len, (DWORD)body_len, 0);
+            if (ok) {
+                tm.sent_ns = now_ns();
+                // WinHTTP does not expose the exact request line; close enough
+                tm.bytes_out = path.size() + headers_len + body_len;
+                ok = WinHttpReceiveResponse(hRequest, NULL);
+            }
+            if (ok) tm.first_byte_ns = now_ns();     // status line + headers are in
+
+            if (!ok) {
+                DWORD err = GetLastError();
+                close_request(hRequest, cancel);
+                // Server dropped a socket WinHTTP had cached: retry once fresh,
+                // unless the request went out whole and may have been applied
+                if (attempt == 0 && reused && err == ERROR_WINHTTP_CONNECTION_ERROR && now_ns() < end &&
+                    (tm.sent_ns == 0 || safe_to_resend(route, body, body_len))) {
+                    note_reconnect();
+                    continue;
+                }
+                fail(resp, err, tm.sent_ns != 0, cancel);
+                break;
+            }
+
+            // Read HTTP status code
+            DWORD status_code = 0;
+            DWORD status_size = sizeof(DWORD);
+            WinHttpQueryHeaders(
+                hRequest,
+                WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                WINHTTP_HEADER_NAME_BY_INDEX,
+                &status_code, &status_size, WINHTTP_NO_HEADER_INDEX);
+            resp.status_code = (int)status_code;
+            resp.validators.etag          = query_header(hRequest, WINHTTP_QUERY_ETAG);
+            resp.validators.last_modified = query_header(hRequest, WINHTTP_QUERY_LAST_MODIFIED);
+
+            // Read response body straight into its destination: resp.body's
+            // tail, or a fixed stack buffer handed to the sink chunk by chunk
+            DWORD content_length = 0;
+            DWORD cl_size = sizeof(DWORD);
+            if (WinHttpQueryHeaders(hRequest,
+                    WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER,
+                    WINHTTP_HEADER_NAME_BY_INDEX, &content_length, &cl_size,
+                    WINHTTP_NO_HEADER_INDEX)) {
+                if (sink) sink->expect(content_length);
+                else      resp.body.reserve(content_length);
+            }
+            if (sink) sink->on_status(resp.status_code);
+            char  stage[16384];
+            DWORD bytes_available = 0;
+            bool  body_ok = true;
+            while (body_ok) {
+                if (now_ns() >= end) { resp.fail(HTTP_FAIL_TIMEOUT, HTTP_PHASE_RECEIVE); break; }
+                if (!WinHttpQueryDataAvailable(hRequest, &bytes_available)) {
+                    fail(resp, GetLastError(), true, cancel);
+                    break;
+                }
+                if (bytes_available == 0) break;
+                DWORD bytes_read = 0;
+                if (sink) {
+                    DWORD want = bytes_available < sizeof(stage) ? bytes_available : (DWORD)sizeof(stage);
+                    WinHttpReadData(hRequest, stage, want, &bytes_read);
+                    tm.bytes_in += bytes_read;
+                    body_ok = sink->on_data(stage, bytes_read);
+                } else {
+                    size_t old = resp.body.size();
+                    if (resp.body.capacity() < old + bytes_available)
+                        resp.body.reserve(2 * (old + bytes_available));
+                    resp.body.resize(old + bytes_available);
+                    WinHttpReadData(hRequest, &resp.body[old], bytes_available, &bytes_read);
+                    tm.bytes_in += bytes_read;
+                    resp.body.resize(old + bytes_read);
+                }
+            }
+            close_request(hRequest, cancel);
+            break;
+        }
+
+        release();
+        observe(method, path, tm, resp);
+        return resp;
+    }
+
+    // Not synchronised: set once before requests start
+    void set_timeouts(const TimeoutTable& t) { timeouts_ = t; }
+    void set_observer(RequestObserver* o) { observer_ = o; }
+
+    // Drop the session; WinHTTP closes every cached socket with it
+    void close_idle() {
+        LockGuard lock(mu_);
+        if (in_flight_ > 0) return;
+        close_handles();
+    }
+
+    PoolStats stats() const {
+        LockGuard lock(mu_);
+        return stats_;
+    }
+
+private:
+    HINTERNET acquire(bool& reused) {
+        LockGuard lock(mu_);
+        stats_.requests++;
+        uint64_t now = now_ms();
+        if (session_ && in_flight_ == 0 && now - last_used_ms_ > cfg_.idle_timeout_ms)
+            close_handles();
+
+        if (!session_) {
+            session_ = WinHttpOpen(L"MPesaClient/1.0", WINHTTP_ACCESS_TYPE_NO_PROXY,
+                                   WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+            if (!session_) return NULL;
+            DWORD max_conns = (DWORD)(cfg_.max_idle > 0 ? cfg_.max_idle : 1);
+            WinHttpSetOption(session_, WINHTTP_OPTION_MAX_CONNS_PER_SERVER,
+                             &max_conns, sizeof(max_conns));
+            // WinHTTP then sends Accept-Encoding and decodes the body itself;
+            // before 8.1 the option fails and responses stay uncompressed
+            if (cfg_.accept_encoding) {
+                DWORD flags = WINHTTP_DECOMPRESSION_FLAG_ALL;
+                WinHttpSetOption(session_, WINHTTP_OPTION_DECOMPRESSION, &flags, sizeof(flags));
+            }
+        }
+        if (!connect_) {
+            std::wstring whost = to_wide(host_);
+            connect_ = WinHttpConnect(session_, whost.c_str(), port_, 0);
+            if (!connect_) return NULL;
+            stats_.connects++;
+            reused = false;
+        } else {
+            stats_.reused++;
+            reused = true;
+        }
+        in_flight_++;
+        return connect_;
+    }
+
+    void release() {
+        LockGuard lock(mu_);
+        in_flight_--;
+        last_used_ms_ = now_ms();
+        // max_idle == 0 means "no keep-alive": behave like the old client
+        if (cfg_.max_idle == 0 && in_flight_ == 0) close_handles();
+    }
+
+    void note_reconnect() {
+        LockGuard lock(mu_);
+        stats_.reconnects++;
+    }
+
+    // A phase limit for WinHttpSetTimeouts: `ms`, but no more than is left
+    static int phase_ms(unsigned ms, uint64_t end) {
+        uint64_t now = now_ns();
+        uint64_t left = end > now ? (end - now) / 1000000ULL + 1 : 1;
+        if (!ms || left < ms) return left > 0x7FFFFFFF ? 0x7FFFFFFF : (int)left;
+        return (int)ms;
+    }
+
+    // A response header as ASCII; "" when absent or too long to be a validator
+    static std::string query_header(HINTERNET h, DWORD what) {
+        wchar_t buf[256];
+        DWORD size = sizeof(buf);
+        if (!WinHttpQueryHeaders(h, what, WINHTTP_HEADER_NAME_BY_INDEX, buf, &size,
+                                 WINHTTP_NO_HEADER_INDEX))
+            return "";
+        std::string out;
+        for (DWORD i = 0; i < size / sizeof(wchar_t); i++) out += (char)buf[i];
+        return out;
+    }
+
+    static void close_request(HINTERNET h, CancelToken* cancel) {
+        if (!cancel || cancel->detach()) WinHttpCloseHandle(h);
+    }
+
+    // A WinHTTP error as a typed failure. WinHTTP resolves, connects and
+    // sends inside WinHttpSendRequest, so before `sent` a timeout is
+    // reported as the connect phase.
+    static void fail(HttpResponse& resp, DWORD err, bool sent, CancelToken* cancel) {
+        HttpPhase phase = sent ? HTTP_PHASE_RECEIVE : HTTP_PHASE_CONNECT;
+        if (cancel && cancel->cancelled())            resp.fail(HTTP_FAIL_CANCELLED, phase);
+        else if (err == ERROR_WINHTTP_TIMEOUT)        resp.fail(HTTP_FAIL_TIMEOUT, phase);
+        else if (err == ERROR_WINHTTP_NAME_NOT_RESOLVED) resp.fail(HTTP_FAIL_RESOLVE, HTTP_PHASE_RESOLVE);
+        else if (err == ERROR_WINHTTP_CANNOT_CONNECT) resp.fail(HTTP_FAIL_CONNECT, HTTP_PHASE_CONNECT);
+        else resp.fail(sent ? HTTP_FAIL_RECEIVE : HTTP_FAIL_SEND, phase);
+    }
+
+    void observe(const std::string& method, const std::string& path,
+                 RequestTiming& tm, const HttpResponse& resp) {
+        if (!observer_) return;
+        tm.done_ns = now_ns();
+        tm.status_code = resp.status_code;
+        tm.failure = resp.failure;
+        observer_->on_request(method, path, tm);
+    }
+
+    void close_handles() {
+        if (connect_) { WinHttpCloseHandle(connect_); connect_ = NULL; }
+        if (session_) { WinHttpCloseHandle(session_); session_ = NULL; }
+    }
+
+    HttpEndpoint(const HttpEndpoint&);
+    HttpEndpoint& operator=(const HttpEndpoint&);
+
+    std::string    host_;
+    unsigned short port_;
+    PoolConfig     cfg_;
+    TimeoutTable   timeouts_;
+    HINTERNET      session_;
+    HINTERNET      connect_;
+    uint64_t       last_used_ms_;
+    int            in_flight_;
+    PoolStats      stats_;
+    mutable Mutex  mu_;
+    RequestObserver* observer_;
+};
+
+#else
+// =============================================================================
+//   POSIX socket backend
+// =============================================================================
+
+// Request line, the pool's fixed headers, auth, validators, length and body
+// into out (cleared first). Allocates only while out is still growing.
+inline void format_http_request(ByteBuffer& out, const std::string& head, const HttpRoute& route,
+                                const char* body, size_t body_len, const std::string& token,
+                                const Validators* cond = NULL) {
+    static const char BEARER[] = "Authorization: Bearer ";
+    static const char MATCH[]  = "If-None-Match: ";
+    static const char SINCE[]  = "If-Modified-Since: ";
+    static const char LENGTH[] = "Content-Length: ";
+    const std::string none;
+    const std::string& etag  = cond ? cond->etag : none;
+    const std::string& since = cond ? cond->last_modified : none;
+    char len_buf[24];
+    char* q = len_buf + sizeof(len_buf);
+    size_t v = body_len;
+    do { *--q = (char)('0' + v % 10); v /= 10; } while (v);
+    size_t len_digits = (size_t)(len_buf + sizeof(len_buf) - q);
+
+    size_t n = route.method.size() + 1 + route.path.size() + 11 + head.size()
+             + (token.empty() ? 0 : sizeof(BEARER) - 1 + token.size() + 2)
+             + (etag.empty() ? 0 : sizeof(MATCH) - 1 + etag.size() + 2)
+             + (since.empty() ? 0 : sizeof(SINCE) - 1 + since.size() + 2)
+             + sizeof(LENGTH) - 1 + len_digits + 4 + body_len;
+    out.clear();
+    char* p = out.prepare(n);
+    memcpy(p, route.method.data(), route.method.size()); p += route.method.size();
+    *p++ = ' ';
+    memcpy(p, route.path.data(), route.path.size());     p += route.path.size();
+    memcpy(p, " HTTP/1.1\r\n", 11);                       p += 11;
+    memcpy(p, head.data(), head.size());                 p += head.size();
+    if (!token.empty()) {
+        memcpy(p, BEARER, sizeof(BEARER) - 1);            p += sizeof(BEARER) - 1;
+        memcpy(p, token.data(), token.size());           p += token.size();
+        *p++ = '\r'; *p++ = '\n';
+    }
+    if (!etag.empty()) {
+        memcpy(p, MATCH, sizeof(MATCH) - 1);              p += sizeof(MATCH) - 1;
+        memcpy(p, etag.data(), etag.size());             p += etag.size();
+        *p++ = '\r'; *p++ = '\n';
+    }
+    if (!since.empty()) {
+        memcpy(p, SINCE, sizeof(SINCE) - 1);              p += sizeof(SINCE) - 1;
+        memcpy(p, since.data(), since.size());           p += since.size();
+        *p++ = '\r'; *p++ = '\n';
+    }
+    memcpy(p, LENGTH, sizeof(LENGTH) - 1);                p += sizeof(LENGTH) - 1;
+    memcpy(p, q, len_digits);                            p += len_digits;
+    memcpy(p, "\r\n\r\n", 4);                            p += 4;
+    if (body_len) memcpy(p, body, body_len);
+    out.commit(n);
+}
+
+class HttpEndpoint {
+public:
+    HttpEndpoint(const std::string& host, unsigned short port,
+             const PoolConfig& cfg = PoolConfig())
+        : host_(host), port_(port), cfg_(cfg), observer_(NULL), resolving_(false) {
+        char port_buf[8];
+        snprintf(port_buf, sizeof(port_buf), "%u", (unsigned)port_);
+        head_ = "Host: " + host_ + ":" + port_buf + "\r\n"
+                "User-Agent: MPesaClient/1.0\r\n";
+        head_ += cfg_.max_idle > 0 ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        head_ += "Content-Type: application/json\r\n";
+        if (cfg_.accept_encoding) head_ += "Accept-Encoding: gzip, deflate\r\n";
+    }
+
+    ~HttpEndpoint() {
+        close_idle();
+        resolver_.join();                   // a lookup that outlived its request
+    }
+
+    HttpResponse request(const std::string& method,
+                         const std::string& path,
+                         const std::string& body,
+                         const std::string& auth_token,
+                         BodySink* sink = NULL) {
+        return request(HttpRoute(method, path), body.data(), body.size(), auth_token, sink);
+    }
+
+    HttpResponse request(const HttpRoute& route,
+                         const char* body, size_t body_len,
+                         const std::string& auth_token,
+                         BodySink* sink = NULL,
+                         CancelToken* cancel = NULL,
+                         const Validators* cond = NULL) {
+        const std::string& method = route.method;
+        const std::string& path   = route.path;
+        const HttpTimeouts& to    = timeouts_.lookup(path);
+        HttpResponse resp;
+        RequestTiming tm;
+        tm.start_ns = now_ns();
+        uint64_t end = to.total_ms ? tm.start_ns + (uint64_t)to.total_ms * 1000000ULL : ~0ULL;
+        StringSink collect(resp.body);
+        HttpFailure fail = HTTP_FAIL_NONE;
+        HttpPhase phase = HTTP_PHASE_NONE;
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            bool reused = false;
+            Conn* c = acquire(reused, to, end, cancel, fail, phase);
+            if (!c) break;
+            tm.reused = reused;
+            tm.connected_ns = reused ? 0 : now_ns();
+
+            bool got_bytes = false;
+            c->reader.reset(sink ? sink : &collect);
+            format_http_request(c->out, head_, route, body, body_len, auth_token, cond);
+            phase = HTTP_PHASE_SEND;
+            fail = send_all(c->fd, c->out.data(), c->out.size(), phase_deadline(to.send_ms, end), cancel);
+            if (!fail) {
+                tm.sent_ns = now_ns();
+                tm.bytes_out += c->out.size();
+                phase = HTTP_PHASE_RECEIVE;
+                fail = read_response(*c, got_bytes, tm, phase_deadline(to.receive_ms, end), cancel);
+            }
+            if (!fail) {
+                resp.status_code = c->reader.status();
+                resp.validators.etag          = c->reader.header("etag");
+                resp.validators.last_modified = c->reader.header("last-modified");
+                release(c, c->reader.keep_alive());
+                observe(method, path, tm, resp);
+                return resp;
+            }
+
+            destroy(c);
+            // Peer closed an idle socket under us. A failed send was not
+            // processed; a sent request may have been, so it is only resent
+            // when doing it twice is harmless
+            if (attempt == 0 && reused && !got_bytes &&
+                (fail == HTTP_FAIL_SEND ||
+                 (fail == HTTP_FAIL_RECEIVE && safe_to_resend(route, body, body_len)))) {
+                note_reconnect();
+                continue;
+            }
+            break;
+        }
+        resp = HttpResponse();
+        resp.fail(fail, phase);
+        observe(method, path, tm, resp);
+        return resp;
+    }
+
+    // Not synchronised: set once before requests start
+    void set_timeouts(const TimeoutTable& t) { timeouts_ = t; }
+    void set_observer(RequestObserver* o) { observer_ = o; }
+
+    void close_idle() {
+        LockGuard lock(mu_);
+        for (size_t i = 0; i < idle_.size(); i++) destroy(idle_[i]);
+        idle_.clear();
+    }
+
+    PoolStats stats() const {
+        LockGuard lock(mu_);
+        return stats_;
+    }
+
+private:
+    // A pooled socket and the receive buffer it keeps between requests
+    struct Conn {
+        int            fd;
+        uint64_t       last_used_ms;
+        ByteBuffer     buf;
+        ByteBuffer     out;             // request being sent; capacity kept
+        ResponseReader reader;
+
+        Conn() : fd(-1), last_used_ms(0) {}
+    };
+
+    // One resolved address of the backend
+    struct Addr {
+        struct sockaddr_storage ss;
+        socklen_t               len;
+        int                     family;
+    };
+
+    enum { READ_CHUNK = 16384, BUF_KEEP = 256 * 1024 };
+
+    Conn* acquire(bool& reused, const HttpTimeouts& to, uint64_t end, CancelToken* cancel,
+                  HttpFailure& fail, HttpPhase& phase) {
+        {
+            LockGuard lock(mu_);
+            stats_.requests++;
+            uint64_t now = now_ms();
+            // Most recently used first: the warmest socket is least likely stale
+            while (!idle_.empty()) {
+                Conn* c = idle_.back();
+                idle_.pop_back();
+                if (now - c->last_used_ms > cfg_.idle_timeout_ms || !is_alive(c->fd)) {
+                    destroy(c);
+                    continue;
+                }
+                stats_.reused++;
+                reused = true;
+                return c;
+            }
+        }
+        reused = false;
+        int fd = open_socket(to, end, cancel, fail, phase);
+        if (fd < 0) return NULL;
+        {
+            LockGuard lock(mu_);
+            stats_.connects++;
+        }
+        Conn* c = new Conn();
+        c->fd = fd;
+        return c;
+    }
+
+    void release(Conn* c, bool keep_alive) {
+        c->reader.reset(NULL);
+        // Leftover bytes after a complete response mean we lost framing
+        if (!c->buf.empty()) keep_alive = false;
+        c->buf.shrink(BUF_KEEP);
+        c->out.shrink(BUF_KEEP);
+        LockGuard lock(mu_);
+        if (!keep_alive || idle_.size() >= cfg_.max_idle) {
+            destroy(c);
+            return;
+        }
+        c->last_used_ms = now_ms();
+        idle_.push_back(c);
+    }
+
+    static void destroy(Conn* c) {
+        ::close(c->fd);
+        delete c;
+    }
+
+    void note_reconnect() {
+        LockGuard lock(mu_);
+        stats_.reconnects++;
+    }
+
+    void observe(const std::string& method, const std::string& path,
+                 RequestTiming& tm, const HttpResponse& resp) {
+        if (!observer_) return;
+        tm.done_ns = now_ns();
+        tm.status_code = resp.status_code;
+        tm.failure = resp.failure;
+        observer_->on_request(method, path, tm);
+    }
+
+    // An idle keep-alive socket must have nothing to read; EOF or stray
+    // bytes mean the server has closed (or desynced) it.
+    static bool is_alive(int fd) {
+        struct pollfd p;
+        p.fd = fd; p.events = POLLIN; p.revents = 0;
+        return poll(&p, 1, 0) == 0;
+    }
+
+    // poll() for `events` until the deadline, waking every CANCEL_POLL_MS
+    // to look at the token. NONE when ready, else TIMEOUT / CANCELLED, or
+    // `error` if poll itself fails.
+    static HttpFailure wait_fd(int fd, short events, uint64_t deadline, CancelToken* cancel,
+                               HttpFailure error) {
+        for (;;) {
+            if (cancel && cancel->cancelled()) return HTTP_FAIL_CANCELLED;
+            uint64_t now = now_ns();
+            if (now >= deadline) return HTTP_FAIL_TIMEOUT;
+            uint64_t left = (deadline - now) / 1000000ULL + 1;
+            if (cancel && left > CancelToken::CANCEL_POLL_MS) left = CancelToken::CANCEL_POLL_MS;
+            if (left > 60000) left = 60000;
+            struct pollfd p;
+            p.fd = fd; p.events = events; p.revents = 0;
+            int r = poll(&p, 1, (int)left);
+            if (r > 0) return HTTP_FAIL_NONE;
+            if (r < 0 && errno != EINTR) return error;
+        }
+    }
+
+    // getaddrinfo() has no timeout, so lookups run on resolver_ and the
+    // request waits for it only until its resolve deadline. A late answer
+    // still lands in addrs_ for the next request; the result is reused
+    // until a connect to every address fails.
+    HttpFailure resolve(std::vector<Addr>& out, uint64_t deadline, CancelToken* cancel) {
+        bool inline_lookup = false;
+        {
+            LockGuard lock(mu_);
+            if (!addrs_.empty()) { out = addrs_; return HTTP_FAIL_NONE; }
+            if (!resolving_) {
+                resolver_.join();           // the previous lookup has returned
+                resolving_ = true;
+                resolved_.reset();
+                inline_lookup = !resolver_.start(resolve_main, this);
+            }
+        }
+        if (inline_lookup) resolve_main(this);      // no thread: wait it out here
+        for (;;) {
+            if (cancel && cancel->cancelled()) return HTTP_FAIL_CANCELLED;
+            uint64_t now = now_ns();
+            if (now >= deadline) return HTTP_FAIL_TIMEOUT;
+            uint64_t left = (deadline - now) / 1000000ULL + 1;
+            if (left > CancelToken::CANCEL_POLL_MS) left = CancelToken::CANCEL_POLL_MS;
+            if (resolved_.wait_ms((unsigned)left)) break;
+        }
+        LockGuard lock(mu_);
+        if (addrs_.empty()) return HTTP_FAIL_RESOLVE;
+        out = addrs_;
+        return HTTP_FAIL_NONE;
+    }
+
+    static void resolve_main(void* self) {
+        HttpEndpoint* pool = (HttpEndpoint*)self;
+        char port_buf[8];
+        snprintf(port_buf, sizeof(port_buf), "%u", (unsigned)pool->port_);
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* res = NULL;
+        std::vector<Addr> found;
+        if (getaddrinfo(pool->host_.c_str(), port_buf, &hints, &res) == 0) {
+            for (struct addrinfo* ai = res; ai; ai = ai->ai_next) {
+                if (ai->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+                Addr a;
+                memcpy(&a.ss, ai->ai_addr, ai->ai_addrlen);
+                a.len = (socklen_t)ai->ai_addrlen;
+                a.family = ai->ai_family;
+                found.push_back(a);
+            }
+            freeaddrinfo(res);
+        }
+        LockGuard lock(pool->mu_);
+        pool->addrs_.swap(found);
+        pool->resolving_ = false;
+        pool->resolved_.set();
+    }
+
+    // Resolve, then a non-blocking connect to each address in turn, all
+    // inside the connect deadline. The socket stays non-blocking.
+    int open_socket(const HttpTimeouts& to, uint64_t end, CancelToken* cancel,
+                    HttpFailure& fail, HttpPhase& phase) {
+        std::vector<Addr> addrs;
+        phase = HTTP_PHASE_RESOLVE;
+        fail = resolve(addrs, phase_deadline(to.resolve_ms, end), cancel);
+        if (fail) return -1;
+
+        phase = HTTP_PHASE_CONNECT;
+        fail = HTTP_FAIL_CONNECT;
+        uint64_t deadline = phase_deadline(to.connect_ms, end);
+        int fd = -1;
+        for (size_t i = 0; i < addrs.size(); i++) {
+            fd = ::socket(addrs[i].family, SOCK_STREAM, 0);
+            if (fd < 0) continue;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            int r = ::connect(fd, (const struct sockaddr*)&addrs[i].ss, addrs[i].len);
+            if (r != 0 && errno == EINPROGRESS) {
+                fail = wait_fd(fd, POLLOUT, deadline, cancel, HTTP_FAIL_CONNECT);
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (!fail && (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0))
+                    fail = HTTP_FAIL_CONNECT;
+                r = fail ? -1 : 0;
+            }
+            if (r == 0) { fail = HTTP_FAIL_NONE; break; }
+            ::close(fd);
+            fd = -1;
+            if (fail == HTTP_FAIL_TIMEOUT || fail == HTTP_FAIL_CANCELLED) break;
+            fail = HTTP_FAIL_CONNECT;
+        }
+        if (fd < 0) {
+            if (fail == HTTP_FAIL_CONNECT) {     // stale address? look it up again next time
+                LockGuard lock(mu_);
+                addrs_.clear();
+            }
+            return -1;
+        }
+        int one = 1;   // small JSON requests: don't wait on Nagle
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        return fd;
+    }
+
+    static HttpFailure send_all(int fd, const char* p, size_t n, uint64_t deadline, CancelToken* cancel) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        while (n > 0) {
+            ssize_t w = ::send(fd, p, n, flags);
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                HttpFailure f = wait_fd(fd, POLLOUT, deadline, cancel, HTTP_FAIL_SEND);
+                if (f) return f;
+                continue;
+            }
+            if (w <= 0) return HTTP_FAIL_SEND;
+            p += w; n -= (size_t)w;
+        }
+        return HTTP_FAIL_NONE;
+    }
+
+    // recv() straight into the connection's buffer until the reader is done
+    static HttpFailure read_response(Conn& c, bool& got_bytes, RequestTiming& tm,
+                                     uint64_t deadline, CancelToken* cancel) {
+        c.buf.clear();
+        for (;;) {
+            if (!c.reader.parse(c.buf)) return HTTP_FAIL_RECEIVE;
+            if (c.reader.done()) return HTTP_FAIL_NONE;
+            HttpFailure f = wait_fd(c.fd, POLLIN, deadline, cancel, HTTP_FAIL_RECEIVE);
+            if (f) return f;
+            char* tail = c.buf.prepare(READ_CHUNK);
+            ssize_t r = ::recv(c.fd, tail, READ_CHUNK, 0);
+            if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            if (r < 0) return HTTP_FAIL_RECEIVE;
+            if (r == 0) return c.reader.on_eof() ? HTTP_FAIL_NONE : HTTP_FAIL_RECEIVE;
+            if (!got_bytes) tm.first_byte_ns = now_ns();
+            got_bytes = true;
+            tm.bytes_in += (uint64_t)r;
+            c.buf.commit((size_t)r);
+        }
+    }
+
+    HttpEndpoint(const HttpEndpoint&);
+    HttpEndpoint& operator=(const HttpEndpoint&);
+
+    std::string           host_;
+    unsigned short        port_;
+    PoolConfig            cfg_;
+    TimeoutTable          timeouts_;
+    std::string           head_;        // Host .. Content-Type, fixed per pool
+    std::vector<Conn*>    idle_;
+    PoolStats             stats_;
+    mutable Mutex         mu_;
+    RequestObserver*      observer_;
+    std::vector<Addr>     addrs_;       // resolved backend, empty until looked up
+    bool                  resolving_;
+    Event                 resolved_;
+    Thread                resolver_;    // last: joined before the state it writes goes
+};
+
+#endif // _WIN32
+
+// =============================================================================
+//   Several servers
+// =============================================================================
+
+struct ServerAddr {
+    std::string    host;
+    unsigned short port;
+
+    ServerAddr(const std::string& h = "", unsigned short p = 0) : host(h), port(p) {}
+
+    std::string name() const {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "%u", (unsigned)port);
+        return host + ":" + buf;
+    }
+};
+
+struct BalancerConfig {
+    std::string health_path;    // GET by the checker; "" = no probes
+    unsigned    health_ms;      // between probe rounds
+    unsigned    eject_after;    // consecutive failures that take a server out
+    unsigned    eject_ms;       // first time out; doubles while it keeps failing
+    unsigned    max_eject_ms;
+
+    BalancerConfig()
+        : health_path("/api/health/"), health_ms(5000), eject_after(3),
+          eject_ms(5000), max_eject_ms(60000) {}
+};
+
+struct ServerStatus {
+    std::string   name;         // host:port
+    int           outstanding;  // requests in flight now
+    bool          ejected;
+    unsigned long requests;
+    unsigned long failures;     // no response, or 502 / 503 / 504
+    unsigned long ejections;
+};
+
+// --- Transport ----------------------------------------------------------------
+// What HttpPool sends through below its cache: its own servers (network())
+// unless set_transport() puts something else there - a recorder wrapping
+// the network, or a replayer that needs no server at all (trace.h).
+class HttpTransport {
+public:
+    virtual ~HttpTransport() {}
+    virtual HttpResponse exchange(const HttpRoute& route, const char* body, size_t body_len,
+                                  const std::string& auth_token, BodySink* sink,
+                                  CancelToken* cancel, const Validators* cond) = 0;
+};
+
+class HttpPool {
+public:
+    HttpPool(const std::string& host, unsigned short port,
+             const PoolConfig& cfg = PoolConfig())
+        : cfg_(cfg), observer_(NULL), cache_(NULL), transport_(&network_),
+          seed_((uint32_t)now_ns() | 1) {
+        network_.pool = this;
+        servers_.push_back(new Server(ServerAddr(host, port), cfg_, bal_));
+    }
+
+    ~HttpPool() {
+        stop_checker();
+        for (size_t i = 0; i < servers_.size(); i++) delete servers_[i];
+    }
+
+    HttpResponse request(const std::string& method,
+                         const std::string& path,
+                         const std::string& body,
+                         const std::string& auth_token,
+                         BodySink* sink = NULL) {
+        return request(HttpRoute(method, path), body.data(), body.size(), auth_token, sink);
+    }
+
+    // With a cache, a GET carries the validators of the body last seen for
+    // it; a 304 is answered from the cache as that body with a 200.
+    HttpResponse request(const HttpRoute& route,
+                         const char* body, size_t body_len,
+                         const std::string& auth_token,
+                         BodySink* sink = NULL,
+                         CancelToken* cancel = NULL) {
+        if (!cache_ || route.method != "GET")
+            return transport_->exchange(route, body, body_len, auth_token, sink, cancel, NULL);
+
+        std::string key = ResponseCache::key(route.path, auth_token);
+        Validators v;
+        std::string cached;
+        bool have = cache_->lookup(key, v, cached);
+        TeeSink tee(sink, cache_->max_body());
+        HttpResponse r = transport_->exchange(route, body, body_len, auth_token,
+                                              sink ? &tee : NULL, cancel, have ? &v : NULL);
+        if (r.status_code == 304 && have) {
+            cache_->note_hit();
+            r.status_code = 200;
+            r.from_cache = true;
+            r.validators = v;
+            if (sink) {
+                sink->on_status(200);
+                sink->expect(cached.size());
+                sink->on_data(cached.data(), cached.size());
+            } else {
+                r.body.swap(cached);
+            }
+        } else if (r.status_code == 200 && !r.validators.empty() && (!sink || tee.complete())) {
+            cache_->store(key, r.validators, sink ? tee.copy() : r.body);
+        } else if (have && r.status_code != 0) {
+            cache_->erase(key);             // the server no longer vouches for it
+        }
+        return r;
+    }
+
+    // Replace the server list, health-checked and balanced if there is
+    // more than one. Not synchronised: set once before requests start.
+    void set_servers(const std::vector<ServerAddr>& list, const BalancerConfig& b = BalancerConfig()) {
+        if (list.empty()) return;
+        stop_checker();
+        for (size_t i = 0; i < servers_.size(); i++) delete servers_[i];
+        servers_.clear();
+        bal_ = b;
+        if (!bal_.eject_after) bal_.eject_after = 1;
+        for (size_t i = 0; i < list.size(); i++) {
+            Server* s = new Server(list[i], cfg_, bal_);
+            s->http.set_timeouts(with_probe(timeouts_));
+            s->http.set_observer(observer_);
+            servers_.push_back(s);
+        }
+        if (servers_.size() > 1 && !bal_.health_path.empty() && bal_.health_ms) {
+            stop_.reset();
+            checker_.start(check_loop, this);       // no thread: failures still eject passively
+        }
+    }
+
+    // Not synchronised: set once before requests start
+    void set_cache(ResponseCache* c) { cache_ = c; }
+    ResponseCache* cache() const { return cache_; }
+
+    // Not synchronised: set once before requests start
+    void set_timeouts(const TimeoutTable& t) {
+        timeouts_ = t;
+        for (size_t i = 0; i < servers_.size(); i++) servers_[i]->http.set_timeouts(with_probe(t));
+    }
+    void set_observer(RequestObserver* o) {
+        observer_ = o;
+        for (size_t i = 0; i < servers_.size(); i++) servers_[i]->http.set_observer(o);
+    }
+
+    // Requests go through t instead of straight to the servers; NULL puts
+    // the servers back. Not synchronised: set once before requests start.
+    void set_transport(HttpTransport* t) { transport_ = t ? t : &network_; }
+    HttpTransport& network() { return network_; }
+
+    void close_idle() {
+        for (size_t i = 0; i < servers_.size(); i++) servers_[i]->http.close_idle();
+    }
+
+    // Summed over the servers
+    PoolStats stats() const {
+        PoolStats t;
+        for (size_t i = 0; i < servers_.size(); i++) {
+            PoolStats s = servers_[i]->http.stats();
+            t.requests   += s.requests;
+            t.connects   += s.connects;
+            t.reused     += s.reused;
+            t.reconnects += s.reconnects;
+        }
+        return t;
+    }
+
+    void servers(std::vector<ServerStatus>& out) const {
+        out.clear();
+        LockGuard lock(mu_);
+        uint64_t now = now_ms();
+        for (size_t i = 0; i < servers_.size(); i++) {
+            const Server* s = servers_[i];
+            ServerStatus st;
+            st.name        = s->addr.name();
+            st.outstanding = s->outstanding;
+            st.ejected     = s->ejected_until_ms > now;
+            st.requests    = s->http.stats().requests;
+            st.failures    = s->failures;
+            st.ejections   = s->ejections;
+            out.push_back(st);
+        }
+    }
+
+    size_t server_count() const { return servers_.size(); }
+
+private:
+    // The servers, as a transport
+    struct Network : public HttpTransport {
+        HttpPool* pool;
+
+        Network() : pool(NULL) {}
+        HttpResponse exchange(const HttpRoute& route, const char* body, size_t body_len,
+                              const std::string& auth_token, BodySink* sink,
+                              CancelToken* cancel, const Validators* cond) {
+            return pool->send(route, body, body_len, auth_token, sink, cancel, cond);
+        }
+    };
+
+    struct Server {
+        ServerAddr    addr;
+        HttpEndpoint  http;
+        int           outstanding;
+        unsigned      fails;                // in a row
+        uint64_t      ejected_until_ms;     // 0 = in rotation
+        unsigned      eject_ms;             // length of the next ejection
+        unsigned long failures, ejections;
+
+        Server(const ServerAddr& a, const PoolConfig& cfg, const BalancerConfig& b)
+            : addr(a), http(a.host, a.port, cfg), outstanding(0), fails(0),
+              ejected_until_ms(0), eject_ms(b.eject_ms), failures(0), ejections(0) {}
+    };
+
+    // Power of two choices: of two servers in rotation picked at random,
+    // the one with fewer requests in flight. A request that reached no
+    // server (refused, unresolvable) is tried once more on another.
+    HttpResponse send(const HttpRoute& route, const char* body, size_t body_len,
+                      const std::string& auth_token, BodySink* sink, CancelToken* cancel,
+                      const Validators* cond) {
+        if (servers_.size() == 1)
+            return servers_[0]->http.request(route, body, body_len, auth_token, sink, cancel, cond);
+        Server* s = pick(NULL);
+        HttpResponse r = s->http.request(route, body, body_len, auth_token, sink, cancel, cond);
+        finish(s, r.status_code, r.failure);
+        if (r.failure != HTTP_FAIL_CONNECT && r.failure != HTTP_FAIL_RESOLVE) return r;
+        Server* other = pick(s);            // nothing reached s: safe to send again
+        if (!other) return r;
+        r = other->http.request(route, body, body_len, auth_token, sink, cancel, cond);
+        finish(other, r.status_code, r.failure);
+        return r;
+    }
+
+    // In rotation, or out but due another try
+    static bool eligible(const Server* s, uint64_t now) { return s->ejected_until_ms <= now; }
+
+    Server* pick(const Server* avoid) {
+        LockGuard lock(mu_);
+        uint64_t now = now_ms();
+        size_t k = 0;
+        for (size_t i = 0; i < servers_.size(); i++)
+            if (servers_[i] != avoid && eligible(servers_[i], now)) k++;
+        Server* s = NULL;
+        if (k == 0) {
+            // Everything is out: the one due back soonest beats failing outright
+            for (size_t i = 0; i < servers_.size(); i++)
+                if (servers_[i] != avoid && (!s || servers_[i]->ejected_until_ms < s->ejected_until_ms))
+                    s = servers_[i];
+            if (!s) return NULL;
+        } else {
+            size_t a = next_random() % k, b = a;
+            if (k > 1) b = (a + 1 + next_random() % (k - 1)) % k;
+            Server* first = NULL;
+            Server* second = NULL;
+            for (size_t i = 0, n = 0; i < servers_.size(); i++) {
+                if (servers_[i] == avoid || !eligible(servers_[i], now)) continue;
+                if (n == a) first = servers_[i];
+                if (n == b) second = servers_[i];
+                n++;
+            }
+            s = second->outstanding < first->outstanding ? second : first;
+        }
+        s->outstanding++;
+        return s;
+    }
+
+    void finish(Server* s, int status, HttpFailure failure) {
+        LockGuard lock(mu_);
+        s->outstanding--;
+        if (failure == HTTP_FAIL_CANCELLED) return;         // says nothing about the server
+        if (status == 0 || status == 502 || status == 503 || status == 504) failed(s);
+        else                                                 healthy(s);
+    }
+
+    // mu_ held
+    void failed(Server* s) {
+        s->failures++;
+        // A server on probation goes straight back out, for longer
+        if (++s->fails < bal_.eject_after && !s->ejected_until_ms) return;
+        s->ejected_until_ms = now_ms() + s->eject_ms;
+        s->eject_ms = s->eject_ms * 2 < bal_.max_eject_ms ? s->eject_ms * 2 : bal_.max_eject_ms;
+        s->ejections++;
+    }
+
+    // mu_ held
+    void healthy(Server* s) {
+        s->fails = 0;
+        s->ejected_until_ms = 0;
+        s->eject_ms = bal_.eject_ms;
+    }
+
+    // Probes get short timeouts unless the table has its own for them
+    TimeoutTable with_probe(const TimeoutTable& t) const {
+        if (bal_.health_path.empty() || t.has(bal_.health_path)) return t;
+        TimeoutTable r = t;
+        HttpTimeouts probe;
+        probe.resolve_ms = probe.connect_ms = probe.send_ms = 1000;
+        probe.receive_ms = 2000;
+        probe.total_ms   = 3000;
+        r.set(bal_.health_path, probe);
+        return r;
+    }
+
+    // Every health_ms, GET health_path from each server. Any answer but a
+    // 5xx counts as up: it puts an ejected server back in rotation.
+    static void check_loop(void* self) {
+        HttpPool* p = (HttpPool*)self;
+        HttpRoute route("GET", p->bal_.health_path);
+        while (!p->stop_.wait_ms(p->bal_.health_ms)) {
+            for (size_t i = 0; i < p->servers_.size() && !p->stop_.is_set(); i++) {
+                Server* s = p->servers_[i];
+                HttpResponse r = s->http.request(route, NULL, 0, "");
+                LockGuard lock(p->mu_);
+                if (r.status_code != 0 && r.status_code < 500) p->healthy(s);
+                else                                           p->failed(s);
+            }
+        }
+    }
+
+    void stop_checker() {
+        stop_.set();
+        checker_.join();
+    }
+
+    // mu_ held
+    uint32_t next_random() {
+        seed_ ^= seed_ << 13; seed_ ^= seed_ >> 17; seed_ ^= seed_ << 5;
+        return seed_;
+    }
+
+    HttpPool(const HttpPool&);
+    HttpPool& operator=(const HttpPool&);
+
+    PoolConfig            cfg_;
+    BalancerConfig        bal_;
+    TimeoutTable          timeouts_;
+    RequestObserver*      observer_;
+    ResponseCache*        cache_;
+    Network               network_;
+    HttpTransport*        transport_;
+    std::vector<Server*>  servers_;         // fixed once requests start
+    mutable Mutex         mu_;              // balancing state in the Servers
+    uint32_t              seed_;
+    Event                 stop_;
+    Thread                checker_;         // last: joined before the servers go
+};
+
+#endif // MPESA_HTTP_POOL_H
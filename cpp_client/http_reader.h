@@ -0,0 +1,353 @@
+/**
+ * ============================================
+ *   http_reader.h - streaming HTTP/1.1 reader
+ * ============================================
+ *
+ *  ByteBuffer     : growable receive buffer owned by a
+ *                   pooled connection and reused across
+ *                   requests. recv() writes straight into
+ *                   its tail (prepare/commit), no staging.
+ *
+ *  ResponseReader : incremental parser for the status
+ *                   line, headers and a Content-Length,
+ *                   chunked or close-delimited body. Body
+ *                   bytes are handed to a BodySink as
+ *                   pointers into the ByteBuffer, then
+ *                   discarded, so memory stays bounded by
+ *                   the socket read size, not the body.
+ *                   A gzip / deflate Content-Encoding is
+ *                   undone on the way (inflate.h); the sink
+ *                   only ever sees the plain bytes.
+ * ============================================
+ */
+#ifndef MPESA_HTTP_READER_H
+#define MPESA_HTTP_READER_H
+
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+// --- ByteBuffer ---------------------------------------------------------------
+class ByteBuffer {
+public:
+    ByteBuffer() : data_(NULL), begin_(0), end_(0), cap_(0), bytes_moved_(0) {}
+    ~ByteBuffer() { free(data_); }
+
+    const char* data() const { return data_ + begin_; }
+    size_t      size() const { return end_ - begin_; }
+    size_t      capacity() const { return cap_; }
+    bool        empty() const { return begin_ == end_; }
+
+    // Free space of at least n bytes at the tail; fill it, then commit().
+    char* prepare(size_t n) {
+        if (cap_ - end_ < n) {
+            // Reclaim consumed head space first, grow only if still short
+            if (begin_ > 0) {
+                size_t live = size();
+                if (live) memmove(data_, data_ + begin_, live);
+                bytes_moved_ += live;
+                begin_ = 0; end_ = live;
+            }
+            if (cap_ - end_ < n) {
+                size_t want = cap_ ? cap_ : 4096;
+                while (want - end_ < n) want *= 2;
+                data_ = (char*)realloc(data_, want);   // growth copy counted below
+                bytes_moved_ += end_;
+                cap_ = want;
+            }
+        }
+        return data_ + end_;
+    }
+    void commit(size_t n)  { end_ += n; }
+    void consume(size_t n) {
+        begin_ += n;
+        if (begin_ >= end_) begin_ = end_ = 0;
+    }
+    void clear() { begin_ = end_ = 0; }
+
+    // Release memory a one-off huge response left behind
+    void shrink(size_t max_keep) {
+        if (cap_ <= max_keep || size() > max_keep) return;
+        if (begin_ > 0) { memmove(data_, data_ + begin_, size()); end_ -= begin_; begin_ = 0; }
+        data_ = (char*)realloc(data_, max_keep);
+        cap_ = max_keep;
+    }
+
+    // Bytes shifted by compaction/growth (user-space copies), for benchmarks
+    unsigned long long bytes_moved() const { return bytes_moved_; }
+
+private:
+    ByteBuffer(const ByteBuffer&);
+    ByteBuffer& operator=(const ByteBuffer&);
+
+    char*  data_;
+    size_t begin_, end_, cap_;
+    unsigned long long bytes_moved_;
+};
+
+// --- Body sinks ---------------------------------------------------------------
+// Receives decoded body bytes as they arrive. Pointers are only valid for the
+// duration of the call. Return false to abort the transfer.
+class BodySink {
+public:
+    virtual ~BodySink() {}
+    virtual void on_status(int /*status_code*/) {}
+    virtual void expect(size_t /*content_length*/) {}
+    virtual bool on_data(const char* p, size_t n) = 0;
+};
+
+// Collects the whole body into a string; reserves Content-Length up front
+class StringSink : public BodySink {
+public:
+    explicit StringSink(std::string& out) : out_(out) {}
+    void expect(size_t n) { out_.reserve(n); }
+    bool on_data(const char* p, size_t n) { out_.append(p, n); return true; }
+private:
+    std::string& out_;
+};
+
+#include "inflate.h"
+
+// --- ResponseReader -----------------------------------------------------------
+class ResponseReader {
+public:
+    enum State { HEAD, BODY_LENGTH, CHUNK_SIZE, CHUNK_DATA, CHUNK_CRLF,
+                 TRAILER, BODY_EOF, DONE, FAILED };
+
+    ResponseReader() { reset(NULL); }
+
+    void reset(BodySink* sink) {
+        sink_ = sink;
+        state_ = HEAD;
+        status_ = 0;
+        http11_ = false;
+        conn_close_ = conn_keep_ = false;
+        content_length_ = -1;
+        remaining_ = 0;
+        body_bytes_ = 0;
+        coding_ = false;
+        headers_.clear();
+    }
+
+    State  state() const          { return state_; }
+    bool   done() const           { return state_ == DONE; }
+    bool   failed() const         { return state_ == FAILED; }
+    int    status() const         { return status_; }
+    long   content_length() const { return content_length_; }
+    size_t body_bytes() const     { return body_bytes_; }     // as sent, before decoding
+    bool   encoded() const        { return coding_; }
+
+    // Socket may be reused for the next request
+    bool keep_alive() const {
+        return state_ == DONE && !conn_close_ && (http11_ || conn_keep_);
+    }
+
+    // Lower-cased header lookup ("" when absent)
+    std::string header(const std::string& name) const {
+        for (size_t i = 0; i < headers_.size(); i++)
+            if (headers_[i].first == name) return headers_[i].second;
+        return "";
+    }
+
+    // Consume as much of buf as possible. Returns false on protocol
+    // error or when the sink aborted; true means "need more or done".
+    bool parse(ByteBuffer& buf) {
+        while (state_ != DONE && state_ != FAILED) {
+            const char* p = buf.data();
+            size_t n = buf.size();
+            switch (state_) {
+            case HEAD: {
+                const char* end = find_crlfcrlf(p, n);
+                if (!end) return true;
+                if (!parse_head(p, (size_t)(end - p))) return fail();
+                buf.consume((size_t)(end - p) + 4);
+                if (sink_) sink_->on_status(status_);
+                if (sink_ && content_length_ > 0 && !coding_) sink_->expect((size_t)content_length_);
+                break;
+            }
+            case BODY_LENGTH: {
+                if (remaining_ == 0) { state_ = DONE; break; }
+                if (n == 0) return true;
+                size_t take = n < remaining_ ? n : remaining_;
+                if (!deliver(p, take)) return fail();
+                buf.consume(take);
+                remaining_ -= take;
+                break;
+            }
+            case CHUNK_SIZE: {
+                const char* eol = find_crlf(p, n);
+                if (!eol) return n > 1024 ? fail() : true;
+                size_t size = 0;
+                const char* q = p;
+                int digits = 0;
+                for (; q < eol; q++, digits++) {
+                    int v = hexval(*q);
+                    if (v < 0) break;              // ";ext" or spaces end the size
+                    size = size * 16 + (size_t)v;
+                }
+                if (digits == 0) return fail();
+                buf.consume((size_t)(eol - p) + 2);
+                remaining_ = size;
+                state_ = size == 0 ? TRAILER : CHUNK_DATA;
+                break;
+            }
+            case CHUNK_DATA: {
+                if (n == 0) return true;
+                size_t take = n < remaining_ ? n : remaining_;
+                if (!deliver(p, take)) return fail();
+                buf.consume(take);
+                remaining_ -= take;
+                if (remaining_ == 0) state_ = CHUNK_CRLF;
+                break;
+            }
+            case CHUNK_CRLF: {
+                if (n < 2) return true;
+                if (p[0] != '\r' || p[1] != '\n') return fail();
+                buf.consume(2);
+                state_ = CHUNK_SIZE;
+                break;
+            }
+            case TRAILER: {
+                // Trailer headers are ignored; an empty line ends the message
+                const char* eol = find_crlf(p, n);
+                if (!eol) return true;
+                buf.consume((size_t)(eol - p) + 2);
+                if (eol == p) state_ = DONE;
+                break;
+            }
+            case BODY_EOF: {
+                if (n == 0) return true;
+                if (!deliver(p, n)) return fail();
+                buf.consume(n);
+                break;
+            }
+            default:
+                return true;
+            }
+        }
+        if (!finished()) return fail();
+        return state_ != FAILED;
+    }
+
+    // Peer closed the connection; only a close-delimited body may end here
+    bool on_eof() {
+        if (state_ == BODY_EOF) state_ = DONE;
+        if (state_ != DONE || !finished()) state_ = FAILED;
+        return state_ == DONE;
+    }
+
+private:
+    bool fail() { state_ = FAILED; return false; }
+
+    // A compressed body must also end where its stream does
+    bool finished() const { return state_ != DONE || !coding_ || inflate_.done(); }
+
+    bool deliver(const char* p, size_t n) {
+        body_bytes_ += n;
+        if (coding_) return inflate_.feed(p, n, sink_);
+        return sink_ ? sink_->on_data(p, n) : true;
+    }
+
+    static const char* find_crlf(const char* p, size_t n) {
+        for (size_t i = 0; i + 1 < n; i++) {
+            const char* cr = (const char*)memchr(p + i, '\r', n - i - 1);
+            if (!cr) return NULL;
+            if (cr[1] == '\n') return cr;
+            i = (size_t)(cr - p);
+        }
+        return NULL;
+    }
+
+    static const char* find_crlfcrlf(const char* p, size_t n) {
+        size_t off = 0;
+        while (off < n) {
+            const char* cr = find_crlf(p + off, n - off);
+            if (!cr) return NULL;
+            size_t at = (size_t)(cr - p);
+            if (at + 3 < n && cr[2] == '\r' && cr[3] == '\n') return cr;
+            off = at + 2;
+        }
+        return NULL;
+    }
+
+    static int hexval(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool parse_head(const char* p, size_t n) {
+        // Status line: HTTP/1.1 200 OK
+        if (n < 12 || memcmp(p, "HTTP/1.", 7) != 0) return false;
+        http11_ = p[7] == '1';
+        status_ = atoi(p + 9);
+        if (status_ < 100) return false;
+
+        bool chunked = false;
+        int coding = -1;                        // Inflater::Format; -1 = identity
+        const char* line = find_crlf(p, n + 2);
+        while (line && line < p + n) {
+            line += 2;
+            const char* eol = find_crlf(line, (size_t)(p + n + 2 - line));
+            if (!eol) break;
+            const char* colon = (const char*)memchr(line, ':', (size_t)(eol - line));
+            if (colon) {
+                std::string name(line, colon);
+                for (size_t i = 0; i < name.size(); i++)
+                    if (name[i] >= 'A' && name[i] <= 'Z') name[i] = (char)(name[i] + 32);
+                const char* v = colon + 1;
+                while (v < eol && (*v == ' ' || *v == '\t')) v++;
+                std::string value(v, eol);
+
+                if (name == "content-length") content_length_ = atol(value.c_str());
+                else if (name == "transfer-encoding") chunked = contains_ci(value, "chunked");
+                else if (name == "content-encoding") {
+                    if      (contains_ci(value, "gzip"))    coding = Inflater::GZIP;
+                    else if (contains_ci(value, "deflate")) coding = Inflater::ZLIB;
+                    else if (!contains_ci(value, "identity")) return false;   // never offered it
+                }
+                else if (name == "connection") {
+                    conn_close_ = contains_ci(value, "close");
+                    conn_keep_  = contains_ci(value, "keep-alive");
+                }
+                headers_.push_back(std::make_pair(name, value));
+            }
+            line = eol;
+        }
+
+        // No body for 1xx/204/304 regardless of headers
+        if (status_ == 204 || status_ == 304 || status_ < 200) state_ = DONE;
+        else if (chunked)                                       state_ = CHUNK_SIZE;
+        else if (content_length_ >= 0) { remaining_ = (size_t)content_length_; state_ = BODY_LENGTH; }
+        else                                                    state_ = BODY_EOF;
+
+        if (coding >= 0 && state_ != DONE && content_length_ != 0) {
+            coding_ = true;
+            inflate_.reset((Inflater::Format)coding);
+        }
+        return true;
+    }
+
+    static bool contains_ci(const std::string& hay, const char* needle) {
+        std::string h = hay;
+        for (size_t i = 0; i < h.size(); i++)
+            if (h[i] >= 'A' && h[i] <= 'Z') h[i] = (char)(h[i] + 32);
+        return h.find(needle) != std::string::npos;
+    }
+
+    BodySink* sink_;
+    State     state_;
+    int       status_;
+    bool      http11_;
+    bool      conn_close_, conn_keep_;
+    long      content_length_;
+    size_t    remaining_;
+    size_t    body_bytes_;
+    bool      coding_;                  // body goes through inflate_
+    Inflater  inflate_;
+    std::vector<std::pair<std::string, std::string> > headers_;
+};
+
+#endif // MPESA_HTTP_READER_H
@@ -0,0 +1,443 @@
+/**
+ * ============================================
+ *   inflate.h - streaming gzip / deflate decoder
+ * ============================================
+ *
+ *  Decodes a Content-Encoding: gzip or deflate body
+ *  as it arrives, in whatever pieces recv() returns,
+ *  and hands the plain bytes to a BodySink:
+ *
+ *      Inflater z;
+ *      z.reset(Inflater::GZIP);
+ *      while (...) if (!z.feed(p, n, &sink)) fail();
+ *      if (!z.done()) fail();          // truncated
+ *
+ *  RFC 1951 with the RFC 1952 (gzip) and RFC 1950
+ *  (zlib) wrappers; trailers are checked. Canonical
+ *  Huffman codes are decoded a bit at a time, as in
+ *  zlib's puff.c: small and plenty fast for JSON.
+ *
+ *  A symbol cut off by the end of a piece is rolled
+ *  back and decoded again once more input arrives,
+ *  so only those few unread bytes are kept. The 32 KB
+ *  window is allocated on first use and kept, like
+ *  the connection buffers, for the next response.
+ *
+ *  No zlib: the client builds with nothing but the
+ *  platform's HTTP / socket libraries. Included by
+ *  http_reader.h once BodySink is declared.
+ * ============================================
+ */
+#ifndef MPESA_INFLATE_H
+#define MPESA_INFLATE_H
+
+#include <string>
+#include <string.h>
+#include <stdint.h>
+
+// --- Checksums ----------------------------------------------------------------
+inline uint32_t crc32_update(uint32_t crc, const unsigned char* p, size_t n) {
+    static uint32_t table[256];
+    static volatile bool ready = false;          // benign race: every thread writes the same table
+    if (!ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        ready = true;
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline uint32_t adler32_update(uint32_t adler, const unsigned char* p, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n) {
+        size_t run = n < 5552 ? n : 5552;        // largest run before b can overflow
+        n -= run;
+        while (run--) { a += *p++; b += a; }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+// --- Inflater -----------------------------------------------------------------
+class Inflater {
+public:
+    enum Format { RAW, ZLIB, GZIP };
+
+    Inflater() : window_(NULL) { reset(RAW); }
+    ~Inflater() { delete[] window_; }
+
+    void reset(Format f) {
+        format_ = f;
+        state_ = HEADER;
+        in_.clear();
+        pos_ = 0;
+        bitbuf_ = 0;
+        bitcnt_ = 0;
+        last_ = false;
+        stored_left_ = 0;
+        wpos_ = 0;
+        have_ = 0;
+        out_len_ = 0;
+        check_ = f == ZLIB ? 1 : 0;
+        total_ = 0;
+    }
+
+    bool done() const   { return state_ == DONE; }
+    bool failed() const { return state_ == FAILED; }
+
+    // Decode what p[0..n) completes. False on corrupt data or when the
+    // sink aborts; bytes after the end of the stream are ignored.
+    bool feed(const char* p, size_t n, BodySink* sink) {
+        if (state_ == FAILED) return false;
+        if (state_ == DONE) return true;
+        if (in_.empty()) { in_.assign(p, n); pos_ = 0; }
+        else             in_.append(p, n);
+        sink_ = sink;
+
+        bool ok = run();
+        if (ok) ok = flush();
+        in_.erase(0, pos_);                      // keep only what was not decoded yet
+        pos_ = 0;
+        if (!ok) state_ = FAILED;
+        return ok;
+    }
+
+private:
+    enum State { HEADER, BLOCK, STORED, CODES, TRAILER, DONE, FAILED };
+    enum { MAXBITS = 15, WSIZE = 32768, OUT_CHUNK = 16384 };
+    enum Step { STEP_OK, STEP_SHORT, STEP_BAD };  // SHORT: roll back and wait for input
+
+    struct Huffman {
+        short count[MAXBITS + 1];                // codes of each length
+        short symbol[288];                       // symbols ordered by code
+    };
+
+    struct Mark {
+        size_t   pos;
+        uint32_t bitbuf;
+        int      bitcnt;
+    };
+
+    Mark mark() const { Mark m = { pos_, bitbuf_, bitcnt_ }; return m; }
+    void rewind(const Mark& m) { pos_ = m.pos; bitbuf_ = m.bitbuf; bitcnt_ = m.bitcnt; }
+
+    bool need(int n) {
+        while (bitcnt_ < n) {
+            if (pos_ >= in_.size()) return false;
+            bitbuf_ |= (uint32_t)(unsigned char)in_[pos_++] << bitcnt_;
+            bitcnt_ += 8;
+        }
+        return true;
+    }
+
+    // Only after need(n)
+    int bits(int n) {
+        int v = (int)(bitbuf_ & ((1u << n) - 1));
+        bitbuf_ >>= n;
+        bitcnt_ -= n;
+        return v;
+    }
+
+    // Headers and trailers are decoded whole or not at all; stored() and
+    // codes() keep what they finished and roll back only the last piece.
+    bool run() {
+        for (;;) {
+            Mark m = mark();
+            Step s = STEP_OK;
+            switch (state_) {
+            case HEADER:  s = header();  break;
+            case BLOCK:   s = block();   break;
+            case STORED:  s = stored();  break;
+            case CODES:   s = codes();   break;
+            case TRAILER: s = trailer(); break;
+            default:      return true;
+            }
+            if (s == STEP_BAD) return false;
+            if (s == STEP_SHORT) {
+                if (state_ != STORED && state_ != CODES) rewind(m);
+                return true;
+            }
+        }
+    }
+
+    // --- Wrappers -------------------------------------------------------------
+    Step header() {
+        if (format_ == ZLIB) {
+            if (!need(16)) return STEP_SHORT;
+            int cmf = bits(8), flg = bits(8);
+            // Some servers send raw deflate for "deflate": no valid zlib header
+            if ((cmf & 0x0F) != 8 || (cmf * 256 + flg) % 31 != 0) {
+                format_ = RAW;
+                check_ = 0;
+                pos_ -= 2;
+                bitbuf_ = 0;
+                bitcnt_ = 0;
+            } else if (flg & 0x20) {
+                return STEP_BAD;                 // preset dictionary: never used over HTTP
+            }
+        } else if (format_ == GZIP) {
+            if (!need(16)) return STEP_SHORT;
+            if (bits(8) != 0x1F || bits(8) != 0x8B) return STEP_BAD;
+            if (!need(16)) return STEP_SHORT;
+            if (bits(8) != 8) return STEP_BAD;   // deflate
+            int flags = bits(8);
+            for (int i = 0; i < 6; i++) {        // mtime, xfl, os
+                if (!need(8)) return STEP_SHORT;
+                bits(8);
+            }
+            if (flags & 4) {                     // FEXTRA
+                if (!need(16)) return STEP_SHORT;
+                int xlen = bits(16);
+                while (xlen--) { if (!need(8)) return STEP_SHORT; bits(8); }
+            }
+            for (int z = 8; z <= 16; z += 8) {   // FNAME, FCOMMENT: zero-terminated
+                if (!(flags & z)) continue;
+                for (;;) { if (!need(8)) return STEP_SHORT; if (!bits(8)) break; }
+            }
+            if (flags & 2) { if (!need(16)) return STEP_SHORT; bits(16); }   // FHCRC
+        }
+        state_ = BLOCK;
+        return STEP_OK;
+    }
+
+    Step trailer() {
+        if (!flush()) return STEP_BAD;
+        bitbuf_ >>= bitcnt_ & 7;                 // to a byte boundary
+        bitcnt_ -= bitcnt_ & 7;
+        if (format_ == GZIP) {
+            if (!need(32)) return STEP_SHORT;
+            uint32_t crc = (uint32_t)bits(16);
+            crc |= (uint32_t)bits(16) << 16;
+            if (!need(32)) return STEP_SHORT;
+            uint32_t size = (uint32_t)bits(16);
+            size |= (uint32_t)bits(16) << 16;
+            if (crc != check_ || size != (uint32_t)total_) return STEP_BAD;
+        } else if (format_ == ZLIB) {
+            if (!need(32)) return STEP_SHORT;
+            uint32_t a = 0;
+            for (int i = 0; i < 4; i++) a = (a << 8) | (uint32_t)bits(8);
+            if (a != check_) return STEP_BAD;
+        }
+        state_ = DONE;
+        return STEP_OK;
+    }
+
+    // --- Blocks ---------------------------------------------------------------
+    Step block() {
+        if (!need(3)) return STEP_SHORT;
+        last_ = bits(1) != 0;
+        int type = bits(2);
+        if (type == 0) {
+            bitbuf_ = 0;                         // need() never reads ahead a whole byte
+            bitcnt_ = 0;
+            if (pos_ + 4 > in_.size()) return STEP_SHORT;
+            const unsigned char* q = (const unsigned char*)in_.data() + pos_;
+            unsigned len = q[0] | (q[1] << 8), nlen = q[2] | (q[3] << 8);
+            if (len != (~nlen & 0xFFFF)) return STEP_BAD;
+            pos_ += 4;
+            stored_left_ = len;
+            state_ = STORED;
+            return STEP_OK;
+        }
+        if (type == 1) { fixed_tables(); state_ = CODES; return STEP_OK; }
+        if (type == 2) {
+            Step s = dynamic_tables();
+            if (s == STEP_OK) state_ = CODES;
+            return s;
+        }
+        return STEP_BAD;
+    }
+
+    Step stored() {
+        while (stored_left_) {
+            size_t avail = in_.size() - pos_;
+            if (!avail) return STEP_SHORT;
+            size_t take = avail < stored_left_ ? avail : stored_left_;
+            for (size_t i = 0; i < take; i++)
+                if (!put((unsigned char)in_[pos_ + i])) return STEP_BAD;
+            pos_ += take;
+            stored_left_ -= take;
+        }
+        state_ = last_ ? TRAILER : BLOCK;
+        return STEP_OK;
+    }
+
+    // One symbol (and its extra bits) per pass, so a roll-back loses little
+    Step codes() {
+        static const short LBASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const short LEXT[29]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const short DBASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                         257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                         8193, 12289, 16385, 24577 };
+        static const short DEXT[30]  = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                         7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        for (;;) {
+            Mark m = mark();
+            int sym = decode(lencode_);
+            if (sym == -2) { rewind(m); return STEP_SHORT; }
+            if (sym < 0) return STEP_BAD;
+            if (sym < 256) {
+                if (!put((unsigned char)sym)) return STEP_BAD;
+                continue;
+            }
+            if (sym == 256) {
+                state_ = last_ ? TRAILER : BLOCK;
+                return STEP_OK;
+            }
+            sym -= 257;
+            if (sym >= 29) return STEP_BAD;
+            if (!need(LEXT[sym])) { rewind(m); return STEP_SHORT; }
+            int len = LBASE[sym] + bits(LEXT[sym]);
+            int dsym = decode(distcode_);
+            if (dsym == -2) { rewind(m); return STEP_SHORT; }
+            if (dsym < 0 || dsym >= 30) return STEP_BAD;
+            if (!need(DEXT[dsym])) { rewind(m); return STEP_SHORT; }
+            size_t dist = (size_t)(DBASE[dsym] + bits(DEXT[dsym]));
+            if (dist > have_) return STEP_BAD;   // before the start of the stream
+            while (len--)
+                if (!put(window_[(wpos_ - dist) & (WSIZE - 1)])) return STEP_BAD;
+        }
+    }
+
+    // -2: input ran out, -1: no such code
+    int decode(const Huffman& h) {
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= MAXBITS; len++) {
+            if (!need(1)) return -2;
+            code |= bits(1);
+            int count = h.count[len];
+            if (code - count < first) return h.symbol[index + (code - first)];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    // 0 complete, > 0 incomplete, < 0 over-subscribed
+    static int build(Huffman& h, const short* lengths, int n) {
+        for (int len = 0; len <= MAXBITS; len++) h.count[len] = 0;
+        for (int s = 0; s < n; s++) h.count[lengths[s]]++;
+        if (h.count[0] == n) return 0;
+        int left = 1;
+        for (int len = 1; len <= MAXBITS; len++) {
+            left <<= 1;
+            left -= h.count[len];
+            if (left < 0) return left;
+        }
+        short offs[MAXBITS + 1];
+        offs[1] = 0;
+        for (int len = 1; len < MAXBITS; len++) offs[len + 1] = (short)(offs[len] + h.count[len]);
+        for (int s = 0; s < n; s++)
+            if (lengths[s]) h.symbol[offs[lengths[s]]++] = (short)s;
+        return left;
+    }
+
+    void fixed_tables() {
+        short lengths[288];
+        int s = 0;
+        for (; s < 144; s++) lengths[s] = 8;
+        for (; s < 256; s++) lengths[s] = 9;
+        for (; s < 280; s++) lengths[s] = 7;
+        for (; s < 288; s++) lengths[s] = 8;
+        build(lencode_, lengths, 288);
+        for (s = 0; s < 30; s++) lengths[s] = 5;
+        build(distcode_, lengths, 30);
+    }
+
+    Step dynamic_tables() {
+        static const short ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        if (!need(14)) return STEP_SHORT;
+        int nlen = bits(5) + 257, ndist = bits(5) + 1, ncode = bits(4) + 4;
+        if (nlen > 286 || ndist > 30) return STEP_BAD;
+        short lengths[320];
+        int i = 0;
+        for (; i < ncode; i++) {
+            if (!need(3)) return STEP_SHORT;
+            lengths[ORDER[i]] = (short)bits(3);
+        }
+        for (; i < 19; i++) lengths[ORDER[i]] = 0;
+        if (build(lencode_, lengths, 19) != 0) return STEP_BAD;
+
+        for (i = 0; i < nlen + ndist;) {
+            int sym = decode(lencode_);
+            if (sym == -2) return STEP_SHORT;
+            if (sym < 0) return STEP_BAD;
+            if (sym < 16) { lengths[i++] = (short)sym; continue; }
+            short len = 0;
+            int repeat;
+            if (sym == 16) {
+                if (i == 0) return STEP_BAD;
+                len = lengths[i - 1];
+                if (!need(2)) return STEP_SHORT;
+                repeat = 3 + bits(2);
+            } else if (sym == 17) {
+                if (!need(3)) return STEP_SHORT;
+                repeat = 3 + bits(3);
+            } else {
+                if (!need(7)) return STEP_SHORT;
+                repeat = 11 + bits(7);
+            }
+            if (i + repeat > nlen + ndist) return STEP_BAD;
+            while (repeat--) lengths[i++] = len;
+        }
+        if (lengths[256] == 0) return STEP_BAD;  // no end-of-block code
+        int err = build(lencode_, lengths, nlen);
+        if (err < 0 || (err > 0 && nlen - lencode_.count[0] != 1)) return STEP_BAD;
+        err = build(distcode_, lengths + nlen, ndist);
+        if (err < 0 || (err > 0 && ndist - distcode_.count[0] != 1)) return STEP_BAD;
+        return STEP_OK;
+    }
+
+    // --- Output ---------------------------------------------------------------
+    bool put(unsigned char c) {
+        if (!window_) window_ = new unsigned char[WSIZE];
+        window_[wpos_ & (WSIZE - 1)] = c;
+        wpos_++;
+        if (have_ < WSIZE) have_++;
+        out_[out_len_++] = (char)c;
+        return out_len_ < OUT_CHUNK || flush();
+    }
+
+    bool flush() {
+        if (!out_len_) return true;
+        const unsigned char* p = (const unsigned char*)out_;
+        if (format_ == GZIP)      check_ = crc32_update(check_, p, out_len_);
+        else if (format_ == ZLIB) check_ = adler32_update(check_, p, out_len_);
+        total_ += out_len_;
+        size_t n = out_len_;
+        out_len_ = 0;
+        return sink_ ? sink_->on_data(out_, n) : true;
+    }
+
+    Inflater(const Inflater&);
+    Inflater& operator=(const Inflater&);
+
+    Format         format_;
+    State          state_;
+    std::string    in_;                  // undecoded input; capacity kept
+    size_t         pos_;
+    uint32_t       bitbuf_;
+    int            bitcnt_;
+    bool           last_;                // current block is the final one
+    size_t         stored_left_;
+    Huffman        lencode_, distcode_;
+    unsigned char* window_;              // last WSIZE bytes out, for back-references
+    size_t         wpos_, have_;
+    char           out_[OUT_CHUNK];      // decoded, not yet handed to the sink
+    size_t         out_len_;
+    uint32_t       check_;               // crc32 (gzip) / adler32 (zlib) so far
+    uint64_t       total_;
+    BodySink*      sink_;
+};
+
+#endif // MPESA_INFLATE_H
@@ -0,0 +1,357 @@
+/**
+ * ============================================
+ *   json.h - single-pass JSON index
+ * ============================================
+ *
+ *  JsonIndex scans a response body once and records
+ *  a flat token tape (offsets into the body, nothing
+ *  copied) plus a small open-addressing hash table of
+ *  object keys. After that every field lookup is O(1)
+ *  and nested keys are resolved per object instead of
+ *  by substring search over the whole body.
+ *
+ *  The tape and hash table are reused across parse()
+ *  calls, so re-indexing responses of similar size
+ *  does not touch the heap. String scanning uses SSE2
+ *  when the compiler targets it (all x86-64 builds).
+ *
+ *  Usage:
+ *      JsonIndex j(r.body);
+ *      string token = j.get("access");          // first "access" anywhere
+ *      uint32_t u   = j.find(j.root(), "user"); // object member
+ *      string phone = j.get(u, "phone_number");
+ * ============================================
+ */
+#ifndef MPESA_JSON_H
+#define MPESA_JSON_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// --- Strings ------------------------------------------------------------------
+// Pointer to the closing quote of a string starting at p, or NULL
+inline const char* json_scan_string(const char* p, const char* end) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                               _mm_cmpeq_epi8(v, slash)));
+        if (!m) { p += 16; continue; }
+        p += __builtin_ctz((unsigned)m);
+        if (*p == '"') return p;
+        p += 2;                                   // skip the escaped char
+    }
+#endif
+    while (p < end) {
+        if (*p == '"') return p;
+        p += (*p == '\\') ? 2 : 1;
+    }
+    return NULL;
+}
+
+// The 4 hex digits of a \uXXXX escape at p, as UTF-8; returns what follows
+inline const char* json_append_utf8(const char* p, const char* e, std::string& out) {
+    if (e - p < 4) return e;
+    unsigned cp = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        cp <<= 4;
+        if (c >= '0' && c <= '9') cp |= (unsigned)(c - '0');
+        else if (c >= 'a' && c <= 'f') cp |= (unsigned)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') cp |= (unsigned)(c - 'A' + 10);
+    }
+    if (cp < 0x80) out += (char)cp;
+    else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); }
+    else {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    return p + 4;
+}
+
+// The string between p and e (quotes excluded) with escapes resolved
+inline void json_unescape_into(const char* p, const char* e, std::string& out) {
+    out.clear();
+    out.reserve((size_t)(e - p));
+    while (p < e) {
+        const char* bs = (const char*)memchr(p, '\\', (size_t)(e - p));
+        if (!bs) { out.append(p, e); break; }
+        out.append(p, bs);
+        if (bs + 1 >= e) break;
+        char c = bs[1];
+        p = bs + 2;
+        switch (c) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': p = json_append_utf8(p, e, out); break;
+            default:  out += c;    break;     // \" \\ \/
+        }
+    }
+}
+
+// --- Index --------------------------------------------------------------------
+class JsonIndex {
+public:
+    enum { NONE = 0xFFFFFFFFu, MAX_DEPTH = 64 };
+    enum Type { OBJECT, ARRAY, STRING, PRIMITIVE, KEY };
+
+    struct Token {
+        uint8_t  type;
+        uint32_t start;    // first byte (strings: after the opening quote)
+        uint32_t end;      // one past the last byte (strings: the closing quote)
+        uint32_t next;     // index of the first token after this subtree
+        uint32_t parent;   // enclosing object/array token
+    };
+
+    JsonIndex() : src_(NULL), len_(0), ok_(false), keys_(0), slot_scale_(0) {}
+    explicit JsonIndex(const std::string& s) : src_(NULL), len_(0), ok_(false), keys_(0), slot_scale_(0) { parse(s); }
+
+    bool parse(const std::string& s) { return parse(s.data(), s.size()); }
+
+    // Tokens point into the text, which must outlive the index: a temporary
+    // string would be gone by the first lookup. Refused at compile time
+    // where the compiler can say so (Makefile.win builds as C++98).
+#if __cplusplus >= 201103L
+    explicit JsonIndex(std::string&&) = delete;
+    bool parse(std::string&&) = delete;
+#endif
+
+    bool parse(const char* p, size_t n) {
+        src_ = p; len_ = n;
+        tokens_.clear();
+        if (tokens_.capacity() < n / 8) tokens_.reserve(n / 8);   // ~1 token per 8-12 bytes
+        keys_ = 0;
+        ok_ = scan();
+        if (!ok_) tokens_.clear();
+        build_tables();
+        return ok_;
+    }
+
+    bool     ok() const   { return ok_; }
+    uint32_t root() const { return tokens_.empty() ? (uint32_t)NONE : 0; }
+    size_t   token_count() const { return tokens_.size(); }
+    const Token& token(uint32_t t) const { return tokens_[t]; }
+
+    // Value of member `key` in object `obj`, or NONE
+    uint32_t find(uint32_t obj, const char* key, size_t klen) const {
+        if (obj == NONE || by_parent_.empty()) return NONE;
+        size_t mask = by_parent_.size() - 1;
+        for (size_t i = slot(hash(key, klen), obj); by_parent_[i]; i = (i + 1) & mask) {
+            uint32_t k = by_parent_[i] - 1;
+            if (tokens_[k].parent == obj && key_eq(k, key, klen)) return k + 1;
+        }
+        return NONE;
+    }
+    uint32_t find(uint32_t obj, const std::string& key) const { return find(obj, key.data(), key.size()); }
+
+    // First value named `key` anywhere in the document (legacy json_get semantics)
+    uint32_t find_any(const char* key, size_t klen) const {
+        if (first_.empty()) return NONE;
+        size_t mask = first_.size() - 1;
+        for (size_t i = hash(key, klen) & mask; first_[i]; i = (i + 1) & mask) {
+            uint32_t k = first_[i] - 1;
+            if (key_eq(k, key, klen)) return k + 1;
+        }
+        return NONE;
+    }
+    uint32_t find_any(const std::string& key) const { return find_any(key.data(), key.size()); }
+
+    // --- Array / object iteration ---
+    uint32_t first_child(uint32_t t) const {
+        if (t == NONE || t + 1 >= tokens_[t].next) return NONE;
+        return t + 1;
+    }
+    uint32_t next_sibling(uint32_t t) const {
+        if (t == NONE) return NONE;
+        uint32_t p = tokens_[t].parent;
+        uint32_t n = tokens_[t].next;
+        if (p == NONE || n >= tokens_[p].next) return NONE;
+        return n;
+    }
+    size_t array_size(uint32_t arr) const {
+        size_t n = 0;
+        for (uint32_t e = first_child(arr); e != NONE; e = next_sibling(e)) n++;
+        return n;
+    }
+
+    // --- Values ---
+    // Raw bytes of a token (no unescaping); {NULL,0} for NONE
+    const char* raw(uint32_t t, size_t& n) const {
+        if (t == NONE) { n = 0; return NULL; }
+        n = tokens_[t].end - tokens_[t].start;
+        return src_ + tokens_[t].start;
+    }
+
+    bool equals(uint32_t t, const char* lit) const {
+        size_t n;
+        const char* p = raw(t, n);
+        return p && strlen(lit) == n && memcmp(p, lit, n) == 0;
+    }
+
+    // Unescaped string value, or the literal text of a number/bool/null
+    std::string str(uint32_t t) const {
+        std::string out;
+        str_into(t, out);
+        return out;
+    }
+
+    void str_into(uint32_t t, std::string& out) const {
+        out.clear();
+        if (t == NONE) return;
+        const Token& tk = tokens_[t];
+        const char* p = src_ + tk.start;
+        const char* e = src_ + tk.end;
+        if (tk.type != STRING && tk.type != KEY) { out.assign(p, e); return; }
+        json_unescape_into(p, e, out);
+    }
+
+    std::string get(const std::string& key) const             { return str(find_any(key)); }
+    std::string get(uint32_t obj, const std::string& key) const { return str(find(obj, key)); }
+
+private:
+    // --- Scanner ---
+    static bool is_ws(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+    uint32_t push(uint8_t type, size_t start, size_t end, uint32_t parent) {
+        Token t;
+        t.type = type; t.start = (uint32_t)start; t.end = (uint32_t)end;
+        t.next = (uint32_t)tokens_.size() + 1; t.parent = parent;
+        tokens_.push_back(t);
+        return (uint32_t)tokens_.size() - 1;
+    }
+
+    bool scan() {
+        uint32_t stack[MAX_DEPTH];
+        bool     in_object[MAX_DEPTH];
+        bool     want_key[MAX_DEPTH];
+        int depth = 0;
+        const char* p = src_;
+        const char* end = src_ + len_;
+
+        while (p < end) {
+            char c = *p;
+            uint32_t parent = depth ? stack[depth - 1] : (uint32_t)NONE;
+            switch (c) {
+            case ' ': case '\n': case '\r': case '\t': case ':':
+                p++;
+                break;
+            case ',':
+                if (depth > 0 && in_object[depth - 1]) want_key[depth - 1] = true;
+                p++;
+                break;
+            case '{': case '[': {
+                if (depth == MAX_DEPTH) return false;
+                if (depth == 0 && !tokens_.empty()) return false;   // trailing garbage
+                stack[depth] = push(c == '{' ? OBJECT : ARRAY, (size_t)(p - src_), 0, parent);
+                in_object[depth] = want_key[depth] = (c == '{');
+                depth++;
+                p++;
+                break;
+            }
+            case '}': case ']': {
+                if (depth == 0 || (c == '}') != in_object[depth - 1]) return false;
+                Token& t = tokens_[stack[--depth]];
+                t.end  = (uint32_t)(p - src_) + 1;
+                t.next = (uint32_t)tokens_.size();
+                p++;
+                break;
+            }
+            case '"': {
+                if (depth == 0 && !tokens_.empty()) return false;
+                const char* close = json_scan_string(p + 1, end);
+                if (!close) return false;
+                bool is_key = depth > 0 && want_key[depth - 1];
+                push(is_key ? KEY : STRING, (size_t)(p + 1 - src_), (size_t)(close - src_), parent);
+                if (is_key) { want_key[depth - 1] = false; keys_++; }
+                p = close + 1;
+                break;
+            }
+            default: {
+                if (depth == 0 && !tokens_.empty()) return false;
+                const char* q = p + 1;
+                while (q < end && *q != ',' && *q != '}' && *q != ']' && !is_ws(*q)) q++;
+                push(PRIMITIVE, (size_t)(p - src_), (size_t)(q - src_), parent);
+                p = q;
+                break;
+            }
+            }
+        }
+        return depth == 0 && !tokens_.empty();
+    }
+
+    // --- Key tables ---
+    static uint32_t hash(const char* p, size_t n) {
+        uint32_t h = 2166136261u;                          // FNV-1a
+        for (size_t i = 0; i < n; i++) { h ^= (uint8_t)p[i]; h *= 16777619u; }
+        return h;
+    }
+
+    // Home slot for a (parent, key) pair. Objects get table ranges in token
+    // order, so filling the table walks memory sequentially instead of
+    // scattering across it; the key hash picks a spot inside the range.
+    size_t slot(uint32_t h, uint32_t parent) const {
+        size_t base = (size_t)(((uint64_t)parent * slot_scale_) >> 32);
+        return (base + (h & 7)) & (by_parent_.size() - 1);
+    }
+
+    bool key_eq(uint32_t k, const char* key, size_t klen) const {
+        const Token& t = tokens_[k];
+        return t.end - t.start == klen && memcmp(src_ + t.start, key, klen) == 0;
+    }
+
+    void build_tables() {
+        size_t cap = 16;
+        while (cap < keys_ * 2) cap *= 2;
+        by_parent_.assign(cap, 0);
+        first_.assign(cap, 0);
+        slot_scale_ = ((uint64_t)cap << 32) / (tokens_.size() + 1);
+        size_t mask = cap - 1;
+        for (uint32_t k = 0; k < tokens_.size(); k++) {
+            const Token& t = tokens_[k];
+            if (t.type != KEY) continue;
+            uint32_t h = hash(src_ + t.start, t.end - t.start);
+
+            size_t i = slot(h, t.parent);
+            while (by_parent_[i]) i = (i + 1) & mask;
+            by_parent_[i] = k + 1;
+
+            // Document order: keep only the first occurrence of each name
+            size_t j = h & mask;
+            bool seen = false;
+            for (; first_[j]; j = (j + 1) & mask)
+                if (key_eq(first_[j] - 1, src_ + t.start, t.end - t.start)) { seen = true; break; }
+            if (!seen) first_[j] = k + 1;
+        }
+    }
+
+    const char*           src_;
+    size_t                len_;
+    bool                  ok_;
+    size_t                keys_;
+    std::vector<Token>    tokens_;
+    std::vector<uint32_t> by_parent_;   // (parent, key) -> key token + 1
+    std::vector<uint32_t> first_;       // key -> first key token + 1
+    uint64_t              slot_scale_;  // token index -> table position, 32.32 fixed point
+};
+
+// --- JSON helper -------------------------------------------------------------
+// One-shot lookup for call sites that need a single field. Screens that read
+// several fields should build one JsonIndex and query it instead.
+inline std::string json_get(const std::string& json, const std::string& key) {
+    JsonIndex j(json);
+    return j.get(key);
+}
+
+#endif // MPESA_JSON_H
@@ -0,0 +1,188 @@
+/**
+ * ============================================
+ *   json_writer.h - allocation-free JSON bodies
+ * ============================================
+ *
+ *  JsonWriter appends JSON to a caller-supplied
+ *  buffer, normally on the stack, handling commas
+ *  and string escaping itself:
+ *
+ *      JsonBody<512> w;
+ *      w.begin_object();
+ *      w.field("username", user);       // escaped
+ *      w.field("amount", req.amount);   // Money -> 1500.00
+ *      w.end_object();
+ *      http.request(ROUTE, w.data(), w.size(), token);
+ *
+ *  Nothing touches the heap unless a body outgrows
+ *  the buffer; it then continues in an std::string
+ *  (one allocation), so a long description is never
+ *  cut short.
+ *
+ *  Escaping follows RFC 8259: quote, backslash and
+ *  every control character. Other bytes (UTF-8
+ *  included) are copied as they are, in runs.
+ * ============================================
+ */
+#ifndef MPESA_JSON_WRITER_H
+#define MPESA_JSON_WRITER_H
+
+#include <string>
+#include <string.h>
+#include <stdint.h>
+#include "money.h"
+
+// --- Escaping -----------------------------------------------------------------
+// Bytes that must be escaped inside a JSON string: 0x00-0x1F, '"', '\\'
+inline bool json_needs_escape(unsigned char c) { return c < 0x20 || c == '"' || c == '\\'; }
+
+// Escape sequence for c into seq (up to 6 bytes); returns its length
+inline size_t json_escape_char(unsigned char c, char* seq) {
+    static const char hex[] = "0123456789abcdef";
+    seq[0] = '\\';
+    switch (c) {
+    case '"':  seq[1] = '"';  return 2;
+    case '\\': seq[1] = '\\'; return 2;
+    case '\n': seq[1] = 'n';  return 2;
+    case '\r': seq[1] = 'r';  return 2;
+    case '\t': seq[1] = 't';  return 2;
+    case '\b': seq[1] = 'b';  return 2;
+    case '\f': seq[1] = 'f';  return 2;
+    }
+    seq[1] = 'u'; seq[2] = '0'; seq[3] = '0';
+    seq[4] = hex[c >> 4]; seq[5] = hex[c & 15];
+    return 6;
+}
+
+inline void json_escape_into(std::string& out, const char* p, size_t n) {
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!json_needs_escape((unsigned char)p[i])) continue;
+        out.append(p + run, i - run);
+        char seq[6];
+        out.append(seq, json_escape_char((unsigned char)p[i], seq));
+        run = i + 1;
+    }
+    out.append(p + run, n - run);
+}
+
+inline void json_escape_into(std::string& out, const std::string& s) {
+    json_escape_into(out, s.data(), s.size());
+}
+
+// --- Writer -------------------------------------------------------------------
+class JsonWriter {
+public:
+    enum { MAX_DEPTH = 16 };
+
+    JsonWriter(char* buf, size_t cap)
+        : buf_(buf), cap_(cap), len_(0), spilled_(false), depth_(0) { first_[0] = true; }
+
+    void clear() { len_ = 0; spill_.clear(); spilled_ = false; depth_ = 0; first_[0] = true; }
+
+    const char* data() const { return spilled_ ? spill_.data() : buf_; }
+    size_t      size() const { return spilled_ ? spill_.size() : len_; }
+    bool        spilled() const { return spilled_; }
+    std::string str() const  { return std::string(data(), size()); }
+
+    void begin_object() { separate(); put('{'); push(); }
+    void end_object()   { pop(); put('}'); }
+    void begin_array()  { separate(); put('['); push(); }
+    void end_array()    { pop(); put(']'); }
+
+    void key(const char* k) {
+        separate();
+        put('"'); put(k, strlen(k)); put('"'); put(':');
+        first_[depth_] = true;                   // the value follows without a comma
+    }
+
+    void value(const char* s, size_t n) { separate(); put('"'); escape(s, n); put('"'); }
+    void value(const std::string& s)    { value(s.data(), s.size()); }
+    void value(const char* s)           { value(s, strlen(s)); }
+
+    // A JSON number with two decimals, as DecimalField accepts it
+    void value(Money m) {
+        separate();
+        char t[Money::TEXT_SIZE];
+        put(t, m.format(t));
+    }
+
+    void value(long long v) {
+        separate();
+        char t[24];
+        char* q = t + sizeof(t);
+        unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+        do { *--q = (char)('0' + u % 10); u /= 10; } while (u);
+        if (v < 0) *--q = '-';
+        put(q, (size_t)(t + sizeof(t) - q));
+    }
+    void value(int v)  { value((long long)v); }
+    void value(bool v) { separate(); if (v) put("true", 4); else put("false", 5); }
+
+    // Already-encoded JSON (a nested body), copied as it is
+    void raw(const char* p, size_t n)  { separate(); put(p, n); }
+
+    template <typename T>
+    void field(const char* k, const T& v) { key(k); value(v); }
+
+private:
+    void separate() {
+        if (!first_[depth_]) put(',');
+        first_[depth_] = false;
+    }
+    void push() { if (depth_ < MAX_DEPTH - 1) depth_++; first_[depth_] = true; }
+    void pop()  { if (depth_ > 0) depth_--; }
+
+    void put(char c) {
+        if (!spilled_ && len_ < cap_) { buf_[len_++] = c; return; }
+        spill(&c, 1);
+    }
+
+    void put(const char* p, size_t n) {
+        if (!spilled_ && cap_ - len_ >= n) { memcpy(buf_ + len_, p, n); len_ += n; return; }
+        spill(p, n);
+    }
+
+    void spill(const char* p, size_t n) {
+        if (!spilled_) {
+            spill_.reserve(2 * (len_ + n));
+            spill_.assign(buf_, len_);
+            spilled_ = true;
+        }
+        spill_.append(p, n);
+    }
+
+    void escape(const char* p, size_t n) {
+        size_t run = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!json_needs_escape((unsigned char)p[i])) continue;
+            put(p + run, i - run);
+            char seq[6];
+            put(seq, json_escape_char((unsigned char)p[i], seq));
+            run = i + 1;
+        }
+        put(p + run, n - run);
+    }
+
+    JsonWriter(const JsonWriter&);
+    JsonWriter& operator=(const JsonWriter&);
+
+    char*       buf_;
+    size_t      cap_, len_;
+    std::string spill_;
+    bool        spilled_;
+    int         depth_;
+    bool        first_[MAX_DEPTH];
+};
+
+// A writer with its own N-byte buffer, for a body built on the stack
+template <size_t N>
+class JsonBody : public JsonWriter {
+public:
+    JsonBody() : JsonWriter(stack_, N) {}
+
+private:
+    char stack_[N];
+};
+
+#endif // MPESA_JSON_WRITER_H
@@ -0,0 +1,681 @@
+/**
+ * ============================================
+ *   ledger.h - accounts and transfers in memory
+ * ============================================
+ *
+ *  The money side of ledger_server.cpp: balances
+ *  and per-account history under the rules of
+ *  SendMoneyView, DepositView and WithdrawView,
+ *  kept in memory and made durable by an
+ *  append-only log (wal.h):
+ *
+ *      Ledger book(100000);
+ *      uint32_t john = book.add_account("john", "password123", "John Doe",
+ *                                       "john@example.com", "0712345678", "1234",
+ *                                       Money::from_cents(500000));
+ *      book.open_log("ledger.wal", err);         // replays it
+ *      LedgerReceipt r;
+ *      book.send(john, "0722345678", amount, "1234", "", key, r);
+ *
+ *  Accounts sit in one array reserved up front and
+ *  are found through open-addressing tables of
+ *  8-byte slots (hash, index) keyed by phone number
+ *  and by username; the account itself is only
+ *  touched on a hash match. Accounts are added
+ *  before the ledger is shared, so lookups take no
+ *  lock.
+ *
+ *  Balances and history are guarded by striped
+ *  mutexes, each padded to a cache line: account
+ *  id uses stripe id % stripes. A send takes its
+ *  two stripes in order, so opposite sends cannot
+ *  deadlock, and the debit, the credit and both rows
+ *  appear together. Transfers between accounts on
+ *  different stripes run in parallel; one stripe is
+ *  a single global lock, for comparison.
+ *
+ *  Each move of money is one log record, written
+ *  while its stripes are held so the log orders
+ *  every account's rows as they were applied. The
+ *  caller then waits for fsync with the stripes
+ *  released. fsync is group-committed as in
+ *  outbox.h: one covers every record written before
+ *  it starts. An answer is only given once its
+ *  record is on disk, but a balance read in between
+ *  may see money a crash would take back. After a
+ *  failed write or fsync every later move, and every
+ *  retry of a key, is refused (LEDGER_LOG_FAILED).
+ *  A retry that finds its key answers only once the
+ *  original's record is on disk, waiting for it the
+ *  same way with the stripes released.
+ *
+ *  Opening the log applies its records again, in
+ *  order and through the same checks; the first
+ *  torn, corrupt or inapplicable line ends it and is
+ *  cut off. Records name accounts by phone number, so
+ *  the same accounts, with the same opening
+ *  balances, must be added before every open.
+ *  Refused calls and idempotent replays are not
+ *  logged.
+ * ============================================
+ */
+#ifndef MPESA_LEDGER_H
+#define MPESA_LEDGER_H
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "platform.h"
+#include "money.h"
+#include "json.h"
+#include "json_writer.h"
+#include "wal.h"
+
+enum LedgerKind { LEDGER_DEPOSIT, LEDGER_WITHDRAW, LEDGER_SEND, LEDGER_RECEIVE };
+
+// Transaction.transaction_type
+inline const char* ledger_kind_name(int k) {
+    static const char* const names[] = { "DEPOSIT", "WITHDRAW", "SEND", "RECEIVE" };
+    return k >= 0 && k < 4 ? names[k] : "";
+}
+
+// How views.py would answer; ledger_server.cpp maps these to status codes
+enum LedgerStatus {
+    LEDGER_OK,
+    LEDGER_BAD_AMOUNT,             // 400, from the serializer: below 1.00
+    LEDGER_BAD_PIN,                // 401 "Invalid PIN"
+    LEDGER_KEY_REUSED,             // 409, key already used for another operation
+    LEDGER_INSUFFICIENT,           // 400 "Insufficient balance"
+    LEDGER_NO_RECIPIENT,           // 404 "Recipient X not found"
+    LEDGER_SELF,                   // 400 "Cannot send money to yourself"
+    LEDGER_NO_ACCOUNT,             // 404
+    LEDGER_LOG_FAILED              // 500: not durable, nothing more is accepted
+};
+
+// "TXN" + 12 hex digits, like generate_transaction_id(), but a one-to-one
+// function of the row id: unique without a table, and the same on replay
+inline void ledger_txn_id(uint64_t id, char out[16]) {
+    uint64_t x = (id * 0x9E3779B97F4A7C15ULL) & 0xFFFFFFFFFFFFULL;   // odd factor: a bijection mod 2^48
+    x ^= x >> 24;
+    snprintf(out, 16, "TXN%012llX", (unsigned long long)x);
+}
+
+// FNV-1a
+inline uint32_t ledger_hash(const char* p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) h = (h ^ (unsigned char)p[i]) * 16777619u;
+    return h;
+}
+
+// One row of an account's history, with TransactionSerializer's fields
+struct LedgerRow {
+    uint64_t    id;                // ledger-wide, grows with time
+    int64_t     at;                // created_at, Unix seconds
+    Money       amount, balance_before, balance_after;
+    int         kind;              // LedgerKind
+    char        transaction_id[16];
+    char        counterparty[16];  // recipient_phone: the other side of a send
+    std::string description, reference, idempotency_key;
+
+    LedgerRow() : id(0), at(0), kind(LEDGER_DEPOSIT) { transaction_id[0] = counterparty[0] = 0; }
+};
+
+// The answer to a money call
+struct LedgerReceipt {
+    LedgerStatus status;
+    bool         replayed;         // answered from the row with the same idempotency key
+    Money        amount, new_balance;
+    char         transaction_id[16];
+
+    LedgerReceipt() : status(LEDGER_OK), replayed(false) { transaction_id[0] = 0; }
+};
+
+struct LedgerAccount {
+    // Under the account's stripe
+    Money                  balance;
+    std::vector<LedgerRow> rows;           // oldest first, ids ascending
+    std::vector<uint32_t>  keyed;          // open addressing: row index + 1 by idempotency key
+    size_t                 key_count;
+
+    // Set once by add_account()
+    uint32_t    id;                        // user.id: index + 1
+    std::string username, password, full_name, email, phone, pin;
+
+    LedgerAccount() : key_count(0), id(0) {}
+};
+
+struct LedgerStats {
+    uint64_t commits;              // moves of money applied
+    uint64_t replays;              // answered from an earlier row
+    uint64_t refused;              // bad PIN, no funds, unknown recipient, ...
+    uint64_t records;              // log lines written
+    uint64_t syncs;                // fsyncs
+    uint64_t recovered;            // records applied again by open_log()
+    uint64_t torn_bytes;           // cut off the end of the log by open_log()
+
+    LedgerStats() : commits(0), replays(0), refused(0), records(0), syncs(0), recovered(0), torn_bytes(0) {}
+};
+
+class Ledger {
+public:
+    enum { MAX_STRIPES = 4096, PHONE_MAX = 15 };
+
+    // Room for `capacity` accounts; `stripes` is rounded up to a power of two
+    explicit Ledger(size_t capacity, size_t stripes = 256)
+        : stripe_mask_(0), next_id_(1), logging_(false), broken_(false), written_(0), synced_(0) {
+        size_t n = 1;
+        while (n < stripes && n < (size_t)MAX_STRIPES) n <<= 1;
+        stripes_ = new Stripe[n];
+        stripe_mask_ = n - 1;
+        accounts_.reserve(capacity);
+        size_t slots = 16;
+        while (slots < capacity * 2) slots <<= 1;
+        by_phone_.assign(slots, Slot());
+        by_user_.assign(slots, Slot());
+    }
+    ~Ledger() {
+        close_log();
+        delete[] stripes_;
+    }
+
+    // Before the ledger is shared. The new account's id; 0 if the username
+    // or phone is taken, the phone is too long or the ledger is full.
+    uint32_t add_account(const std::string& username, const std::string& password,
+                         const std::string& full_name, const std::string& email,
+                         const std::string& phone, const std::string& pin, Money balance) {
+        if (accounts_.size() == accounts_.capacity() || phone.empty() || phone.size() > PHONE_MAX) return 0;
+        if (find_user(username) || find_phone(phone)) return 0;
+        accounts_.push_back(LedgerAccount());
+        LedgerAccount& a = accounts_.back();
+        a.id = (uint32_t)accounts_.size();
+        a.username = username; a.password = password; a.full_name = full_name;
+        a.email = email; a.phone = phone; a.pin = pin;
+        a.balance = balance;
+        insert(by_user_, username, a.id);
+        insert(by_phone_, phone, a.id);
+        return a.id;
+    }
+
+    size_t size() const { return accounts_.size(); }
+
+    // 0 if there is none
+    uint32_t find_user(const std::string& username) const { return find(by_user_, username, &LedgerAccount::username); }
+    uint32_t find_phone(const std::string& phone) const   { return find(by_phone_, phone, &LedgerAccount::phone); }
+
+    // The profile fields never change and may be read without a lock;
+    // balance and rows only through the calls below
+    const LedgerAccount* account(uint32_t id) const {
+        return id >= 1 && id <= accounts_.size() ? &accounts_[id - 1] : NULL;
+    }
+
+    LedgerStatus deposit(uint32_t id, Money amount, const std::string& reference,
+                         const std::string& key, LedgerReceipt& out) {
+        out = LedgerReceipt();
+        out.amount = amount;
+        if (!account(id)) return refuse(out, LEDGER_NO_ACCOUNT);
+        if (!amount.positive()) return refuse(out, LEDGER_BAD_AMOUNT);
+        LedgerAccount& a = accounts_[id - 1];
+        uint64_t end = 0;
+        {
+            LockGuard lock(stripe(id));
+            if (broken_) return refuse(out, LEDGER_LOG_FAILED);
+            if (replay(a, key, LEDGER_DEPOSIT, amount, out, &end)) {
+                if (out.status != LEDGER_OK) return out.status;
+            } else {
+                uint64_t row = atomic_add(&next_id_, 1) - 1;
+                int64_t at = (int64_t)time(NULL);
+                if (logging_) {
+                    JsonBody<512> w;
+                    begin_record(w, "deposit", row, at, a, amount);
+                    if (!reference.empty()) w.field("reference", reference);
+                    if (!key.empty()) w.field("key", key);
+                    w.end_object();
+                    if (!log_record(w, end)) return refuse(out, LEDGER_LOG_FAILED);
+                }
+                apply_deposit(a, row, at, amount, reference, key);
+                receipt(a, out);
+            }
+        }
+        return commit(end, out);
+    }
+
+    LedgerStatus withdraw(uint32_t id, Money amount, const std::string& pin, const std::string& description,
+                          const std::string& key, LedgerReceipt& out) {
+        out = LedgerReceipt();
+        out.amount = amount;
+        if (!account(id)) return refuse(out, LEDGER_NO_ACCOUNT);
+        if (!amount.positive()) return refuse(out, LEDGER_BAD_AMOUNT);
+        LedgerAccount& a = accounts_[id - 1];
+        if (pin != a.pin) return refuse(out, LEDGER_BAD_PIN);
+        uint64_t end = 0;
+        {
+            LockGuard lock(stripe(id));
+            if (broken_) return refuse(out, LEDGER_LOG_FAILED);
+            if (replay(a, key, LEDGER_WITHDRAW, amount, out, &end)) {
+                if (out.status != LEDGER_OK) return out.status;
+            } else {
+                if (a.balance < amount) return refuse(out, LEDGER_INSUFFICIENT);
+                uint64_t row = atomic_add(&next_id_, 1) - 1;
+                int64_t at = (int64_t)time(NULL);
+                if (logging_) {
+                    JsonBody<512> w;
+                    begin_record(w, "withdraw", row, at, a, amount);
+                    if (!description.empty()) w.field("description", description);
+                    if (!key.empty()) w.field("key", key);
+                    w.end_object();
+                    if (!log_record(w, end)) return refuse(out, LEDGER_LOG_FAILED);
+                }
+                apply_withdraw(a, row, at, amount, description, key);
+                receipt(a, out);
+            }
+        }
+        return commit(end, out);
+    }
+
+    // Checks in SendMoneyView's order: PIN, replay, balance, recipient, self
+    LedgerStatus send(uint32_t id, const std::string& recipient_phone, Money amount, const std::string& pin,
+                      const std::string& description, const std::string& key, LedgerReceipt& out) {
+        out = LedgerReceipt();
+        out.amount = amount;
+        if (!account(id)) return refuse(out, LEDGER_NO_ACCOUNT);
+        if (!amount.positive()) return refuse(out, LEDGER_BAD_AMOUNT);
+        LedgerAccount& a = accounts_[id - 1];
+        if (pin != a.pin) return refuse(out, LEDGER_BAD_PIN);
+        uint32_t to = find_phone(recipient_phone);
+        Mutex& first  = stripe(to && stripe_of(to) < stripe_of(id) ? to : id);
+        Mutex& second = stripe(to && stripe_of(to) > stripe_of(id) ? to : id);
+        uint64_t end = 0;
+        {
+            LockGuard lock1(first);
+            OptionalLock lock2(second, &second != &first);
+            if (broken_) return refuse(out, LEDGER_LOG_FAILED);
+            if (replay(a, key, LEDGER_SEND, amount, out, &end, recipient_phone.c_str())) {
+                if (out.status != LEDGER_OK) return out.status;
+            } else {
+                if (a.balance < amount) return refuse(out, LEDGER_INSUFFICIENT);
+                if (!to)       return refuse(out, LEDGER_NO_RECIPIENT);
+                if (to == id)  return refuse(out, LEDGER_SELF);
+                LedgerAccount& b = accounts_[to - 1];
+                uint64_t row = atomic_add(&next_id_, 2) - 2;         // SEND, then RECEIVE
+                int64_t at = (int64_t)time(NULL);
+                if (logging_) {
+                    JsonBody<512> w;
+                    begin_record(w, "send", row, at, a, amount);
+                    w.field("to", b.phone);
+                    if (!description.empty()) w.field("description", description);
+                    if (!key.empty()) w.field("key", key);
+                    w.end_object();
+                    if (!log_record(w, end)) return refuse(out, LEDGER_LOG_FAILED);
+                }
+                apply_send(a, b, row, at, amount, description, key);
+                receipt(a, out);
+            }
+        }
+        return commit(end, out);
+    }
+
+    Money balance(uint32_t id) {
+        if (!account(id)) return Money();
+        LockGuard lock(stripe(id));
+        return accounts_[id - 1].balance;
+    }
+
+    // A page as TransactionHistoryView cuts it: newest first, rows older
+    // than `cursor` (0: none) and at or after `since` (0: all), `offset`
+    // rows skipped. next_cursor is 0 on the last page. The account's row count.
+    size_t history(uint32_t id, size_t limit, size_t offset, uint64_t cursor, int64_t since,
+                   std::vector<LedgerRow>& page, uint64_t& next_cursor) {
+        page.clear();
+        next_cursor = 0;
+        if (!account(id)) return 0;
+        LockGuard lock(stripe(id));
+        const std::vector<LedgerRow>& rows = accounts_[id - 1].rows;
+        size_t top = rows.size(), bottom = 0;
+        if (cursor) top = lower_bound_id(rows, cursor);
+        top = offset < top ? top - offset : 0;
+        if (since) {
+            size_t hi = top;
+            while (bottom < hi) {                   // created_at grows with the row
+                size_t mid = bottom + (hi - bottom) / 2;
+                if (rows[mid].at < since) bottom = mid + 1; else hi = mid;
+            }
+        }
+        for (size_t i = top; i > bottom && page.size() < limit; i--) page.push_back(rows[i - 1]);
+        if (top - bottom > page.size() && !page.empty()) next_cursor = page.back().id;
+        return rows.size();
+    }
+
+    // The sum of all balances, every stripe held: what conservation checks compare
+    Money total() {
+        for (size_t s = 0; s <= stripe_mask_; s++) stripes_[s].mu.lock();
+        Money sum;
+        for (size_t i = 0; i < accounts_.size(); i++) sum += accounts_[i].balance;
+        for (size_t s = stripe_mask_ + 1; s-- > 0;) stripes_[s].mu.unlock();
+        return sum;
+    }
+
+    // Open (creating) the log and apply what it holds. Accounts must be in
+    // place; money calls must not run concurrently.
+    bool open_log(const std::string& path, std::string& error) {
+        close_log();
+        if (!file_.open(path)) { error = "cannot open " + path + " (in use by another server?)"; return false; }
+        std::string log;
+        if (!file_.read_all(log)) { error = "cannot read " + path; file_.close(); return false; }
+        size_t good = replay_log(log);
+        stats_.torn_bytes = (uint64_t)(log.size() - good);
+        if (good < log.size() && !file_.truncate(good)) { error = "cannot repair " + path; file_.close(); return false; }
+        written_ = synced_ = good;
+        logging_ = true;
+        broken_ = false;
+        return true;
+    }
+
+    void close_log() {
+        LockGuard s(sync_mu_);
+        LockGuard lock(log_mu_);
+        file_.close();
+        logging_ = false;
+        written_ = synced_ = 0;
+    }
+
+    // Benches: a slower disk. Not synchronised: set before calls start.
+    void set_sync_delay_ms(unsigned ms) { file_.set_sync_delay_ms(ms); }
+
+    // A write or fsync failed: balances and history may hold moves the log
+    // lost, so they should not be served either
+    bool broken() const { return broken_; }
+
+    LedgerStats stats() {
+        LedgerStats s = stats_;
+        atomic_fence();
+        return s;
+    }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        uint32_t id;               // 0: empty
+        Slot() : hash(0), id(0) {}
+    };
+
+    struct Stripe {
+        Mutex mu;
+        char  pad[64 - sizeof(Mutex) % 64];
+    };
+
+    // The second stripe of a send, unless it is the first
+    class OptionalLock {
+    public:
+        OptionalLock(Mutex& m, bool take) : m_(take ? &m : NULL) { if (m_) m_->lock(); }
+        ~OptionalLock() { if (m_) m_->unlock(); }
+    private:
+        OptionalLock(const OptionalLock&);
+        OptionalLock& operator=(const OptionalLock&);
+        Mutex* m_;
+    };
+
+    Ledger(const Ledger&);
+    Ledger& operator=(const Ledger&);
+
+    size_t stripe_of(uint32_t id) const { return (size_t)(id - 1) & stripe_mask_; }
+    Mutex& stripe(uint32_t id) { return stripes_[stripe_of(id)].mu; }
+
+    static void insert(std::vector<Slot>& table, const std::string& key, uint32_t id) {
+        size_t mask = table.size() - 1;
+        uint32_t h = ledger_hash(key.data(), key.size());
+        size_t i = h & mask;
+        while (table[i].id) i = (i + 1) & mask;
+        table[i].hash = h;
+        table[i].id = id;
+    }
+
+    uint32_t find(const std::vector<Slot>& table, const std::string& key,
+                  std::string LedgerAccount::* field) const {
+        size_t mask = table.size() - 1;
+        uint32_t h = ledger_hash(key.data(), key.size());
+        for (size_t i = h & mask; table[i].id; i = (i + 1) & mask)
+            if (table[i].hash == h && accounts_[table[i].id - 1].*field == key) return table[i].id;
+        return 0;
+    }
+
+    static size_t lower_bound_id(const std::vector<LedgerRow>& rows, uint64_t id) {
+        size_t lo = 0, hi = rows.size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (rows[mid].id < id) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+
+    LedgerStatus refuse(LedgerReceipt& out, LedgerStatus why) {
+        atomic_add(&stats_.refused, 1);
+        out.status = why;
+        return why;
+    }
+
+    // From the row just added to `a`
+    static void receipt(const LedgerAccount& a, LedgerReceipt& out) {
+        const LedgerRow& r = a.rows.back();
+        memcpy(out.transaction_id, r.transaction_id, sizeof(out.transaction_id));
+        out.new_balance = r.balance_after;
+    }
+
+    // Stripes released. Waits for the record, or for a replay the original's
+    // record, to be on disk.
+    LedgerStatus commit(uint64_t end, LedgerReceipt& out) {
+        if (!out.replayed) atomic_add(&stats_.commits, 1);
+        if (end && !sync_to(end)) {
+            broken_ = true;
+            out.status = LEDGER_LOG_FAILED;
+        }
+        return out.status;
+    }
+
+    // --- Idempotency keys (stripe held) ---------------------------------------
+    // find_replay(): true if `key` was seen, with out set to the original
+    // answer or to LEDGER_KEY_REUSED (another kind, amount or, for a send,
+    // recipient). The original's record may still be waiting for its fsync,
+    // so a replay sets `end` to the log as written and the caller's commit()
+    // waits for it like for a record of its own.
+    bool replay(const LedgerAccount& a, const std::string& key, int kind, Money amount, LedgerReceipt& out,
+                uint64_t* end = NULL, const char* recipient = NULL) {
+        if (key.empty() || a.keyed.empty()) return false;
+        size_t mask = a.keyed.size() - 1;
+        for (size_t i = ledger_hash(key.data(), key.size()) & mask; a.keyed[i]; i = (i + 1) & mask) {
+            const LedgerRow& r = a.rows[a.keyed[i] - 1];
+            if (r.idempotency_key != key) continue;
+            if (r.kind != kind || r.amount != amount || (recipient && strcmp(r.counterparty, recipient) != 0)) {
+                refuse(out, LEDGER_KEY_REUSED);
+                return true;
+            }
+            if (end && logging_) {
+                LockGuard lock(log_mu_);
+                *end = written_;
+            }
+            out.replayed = true;
+            out.amount = r.amount;
+            out.new_balance = r.balance_after;
+            memcpy(out.transaction_id, r.transaction_id, sizeof(out.transaction_id));
+            atomic_add(&stats_.replays, 1);
+            return true;
+        }
+        return false;
+    }
+
+    static void index_key(LedgerAccount& a, uint32_t row) {
+        if ((a.key_count + 1) * 2 > a.keyed.size()) {
+            std::vector<uint32_t> bigger(a.keyed.empty() ? 16 : a.keyed.size() * 2, 0);
+            a.keyed.swap(bigger);
+            a.key_count = 0;
+            for (size_t i = 0; i < bigger.size(); i++) if (bigger[i]) place_key(a, bigger[i]);
+        }
+        place_key(a, row + 1);
+    }
+
+    static void place_key(LedgerAccount& a, uint32_t slot) {
+        const std::string& key = a.rows[slot - 1].idempotency_key;
+        size_t mask = a.keyed.size() - 1;
+        size_t i = ledger_hash(key.data(), key.size()) & mask;
+        while (a.keyed[i]) i = (i + 1) & mask;
+        a.keyed[i] = slot;
+        a.key_count++;
+    }
+
+    // --- Applying (stripes held; checks passed) -------------------------------
+    static LedgerRow& add_row(LedgerAccount& a, uint64_t id, int64_t at, int kind, Money amount, Money delta) {
+        a.rows.push_back(LedgerRow());
+        LedgerRow& r = a.rows.back();
+        r.id = id;
+        r.at = at;
+        r.kind = kind;
+        r.amount = amount;
+        r.balance_before = a.balance;
+        a.balance += delta;
+        r.balance_after = a.balance;
+        ledger_txn_id(id, r.transaction_id);
+        return r;
+    }
+
+    static void keep_key(LedgerAccount& a, const std::string& key) {
+        if (key.empty()) return;
+        a.rows.back().idempotency_key = key;
+        index_key(a, (uint32_t)(a.rows.size() - 1));
+    }
+
+    static void apply_deposit(LedgerAccount& a, uint64_t id, int64_t at, Money amount,
+                              const std::string& reference, const std::string& key) {
+        LedgerRow& r = add_row(a, id, at, LEDGER_DEPOSIT, amount, amount);
+        r.reference = reference;
+        r.description = "Deposit via agent";
+        keep_key(a, key);
+    }
+
+    static void apply_withdraw(LedgerAccount& a, uint64_t id, int64_t at, Money amount,
+                               const std::string& description, const std::string& key) {
+        LedgerRow& r = add_row(a, id, at, LEDGER_WITHDRAW, amount, -amount);
+        r.description = description.empty() ? "Cash withdrawal" : description;
+        keep_key(a, key);
+    }
+
+    static void apply_send(LedgerAccount& a, LedgerAccount& b, uint64_t id, int64_t at, Money amount,
+                           const std::string& description, const std::string& key) {
+        LedgerRow& debit = add_row(a, id, at, LEDGER_SEND, amount, -amount);
+        memcpy(debit.counterparty, b.phone.c_str(), b.phone.size() + 1);
+        debit.description = description;
+        keep_key(a, key);
+        LedgerRow& credit = add_row(b, id + 1, at, LEDGER_RECEIVE, amount, amount);
+        memcpy(credit.counterparty, a.phone.c_str(), a.phone.size() + 1);
+        credit.description = "From " + a.phone + ": " + description;
+    }
+
+    // --- Log ------------------------------------------------------------------
+    static void begin_record(JsonWriter& w, const char* op, uint64_t id, int64_t at,
+                             const LedgerAccount& a, Money amount) {
+        w.begin_object();
+        w.field("op", op);
+        w.field("id", (long long)id);
+        w.field("at", (long long)at);
+        w.field("account", a.phone);
+        w.field("amount", amount);
+    }
+
+    // Stripes held. The record is written, or nothing is.
+    bool log_record(const JsonWriter& w, uint64_t& end) {
+        std::string line;
+        line.reserve(w.size() + 10);
+        wal_frame(w.data(), w.size(), line);
+        LockGuard lock(log_mu_);
+        if (broken_) return false;
+        if (!file_.append(line.data(), line.size())) {
+            file_.truncate(written_);           // no half record for the next one to follow
+            broken_ = true;
+            return false;
+        }
+        written_ += line.size();
+        end = written_;
+        stats_.records++;
+        return true;
+    }
+
+    // Durable up to log offset `end`. One fsync covers everything written
+    // before it starts, so whoever waits behind it usually has nothing to do.
+    bool sync_to(uint64_t end) {
+        LockGuard s(sync_mu_);
+        if (synced_ >= end) return true;
+        uint64_t upto;
+        {
+            LockGuard lock(log_mu_);
+            upto = written_;
+            stats_.syncs++;
+        }
+        if (!file_.sync()) return false;
+        synced_ = upto;
+        return true;
+    }
+
+    // Applies the records in `log`; returns the bytes that are good
+    size_t replay_log(const std::string& log) {
+        JsonIndex j;
+        size_t at = 0;
+        uint64_t top = 0;
+        while (at < log.size()) {
+            size_t nl = log.find('\n', at);
+            if (nl == std::string::npos) break;     // torn: the write never finished
+            const char* json;
+            size_t len;
+            if (!wal_unframe(log.data() + at, nl - at, json, len) || !j.parse(json, len)) break;
+            std::string op = j.get("op"), key = j.get("key");
+            uint64_t id = strtoull(j.get("id").c_str(), NULL, 10);
+            int64_t when = (int64_t)strtoll(j.get("at").c_str(), NULL, 10);
+            uint32_t acct = find_phone(j.get("account"));
+            Money amount;
+            if (!id || !acct || !Money::parse(j.get("amount"), amount) || !amount.positive()) break;
+            LedgerAccount& a = accounts_[acct - 1];
+            if (!a.rows.empty() && a.rows.back().id >= id) break;  // ids only grow per account
+            LedgerReceipt seen;
+            if (replay(a, key, -1, amount, seen)) break;            // a key is applied once
+            if (op == "deposit") {
+                apply_deposit(a, id, when, amount, j.get("reference"), key);
+                if (id > top) top = id;
+            } else if (op == "withdraw") {
+                if (a.balance < amount) break;
+                apply_withdraw(a, id, when, amount, j.get("description"), key);
+                if (id > top) top = id;
+            } else if (op == "send") {
+                uint32_t to = find_phone(j.get("to"));
+                if (!to || to == acct || a.balance < amount) break;
+                LedgerAccount& b = accounts_[to - 1];
+                if (!b.rows.empty() && b.rows.back().id >= id + 1) break;
+                apply_send(a, b, id, when, amount, j.get("description"), key);
+                if (id + 1 > top) top = id + 1;
+            } else {
+                break;
+            }
+            stats_.recovered++;
+            at = nl + 1;
+        }
+        if (top >= next_id_) next_id_ = top + 1;
+        stats_.refused = stats_.replays = 0;
+        return at;
+    }
+
+    std::vector<LedgerAccount> accounts_;
+    std::vector<Slot>          by_phone_, by_user_;
+    Stripe*                    stripes_;
+    size_t                     stripe_mask_;
+    volatile uint64_t          next_id_;
+
+    LogFile           file_;
+    bool              logging_;
+    volatile bool     broken_;
+    Mutex             log_mu_;             // file_ appends, written_; taken inside stripes
+    Mutex             sync_mu_;            // synced_, fsync; never inside a stripe
+    uint64_t          written_, synced_;
+    LedgerStats       stats_;
+};
+
+#endif // MPESA_LEDGER_H
@@ -0,0 +1,539 @@
+/**
+ * ============================================
+ *   M-PESA Ledger Server (POSIX)
+ *   Native backend for load tests
+ * ============================================
+ *
+ *  Serves the terminal client's endpoints from the
+ *  in-memory ledger in ledger.h: real accounts,
+ *  passwords and PINs, money that moves between
+ *  them under striped locks, and a group-committed
+ *  log so it survives a restart. Unlike the mock
+ *  server, sends reach the recipient and every
+ *  customer has a balance of their own, so it is a
+ *  backend to load-test the client against, not a
+ *  single canned account.
+ *
+ *  Build & run:
+ *      g++ -std=c++11 -O2 -o ledger_server ledger_server.cpp -lpthread
+ *      ./ledger_server 8000
+ *      ./ledger_server 8000 --log ledger.wal      (durable; replayed on start)
+ *      ./ledger_server 8000 --accounts 100000     (user1..userN, 0790000001..)
+ *      ./ledger_server 8000 --stripes 1           (one global lock, to compare)
+ *      ./ledger_server 8000 --token-ttl 30        (access tokens live 30 s)
+ *
+ *  The demo users of the README are always there:
+ *  john and jane, password123, PIN 1234, KES 5,000
+ *  and KES 2,000. --accounts adds userN with phone
+ *  0790000000 + N, the same password and PIN and
+ *  KES 1,000. Opening balances are not logged: start
+ *  with the same --accounts to replay a log.
+ *
+ *  Endpoints, with views.py's JSON and error
+ *  messages: /api/auth/login/, refresh/ and logout/,
+ *  /api/balance/, /api/send/, /api/deposit/,
+ *  /api/withdraw/ (idempotency_key as find_replay),
+ *  /api/transactions/ (limit, offset, cursor, since),
+ *  /api/batch/ and /api/health/. ETags, gzip and
+ *  /api/events/ are left to the mock server.
+ *
+ *  Tokens are unsigned JWTs like the mock server's,
+ *  but always checked: user_id picks the account.
+ *  A money call is answered once its log record is
+ *  on disk.
+ * ============================================
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include "platform.h"
+#include "json.h"
+#include "json_writer.h"
+#include "money.h"
+#include "ledger.h"
+
+using namespace std;
+
+// --- Server state -------------------------------------------------------------
+Ledger*           g_ledger      = NULL;
+unsigned          g_token_ttl   = 8 * 3600;    // --token-ttl: access lifetime (s)
+volatile uint64_t g_jti         = 0;
+
+const size_t MAX_HISTORY_PAGE = 500;
+const size_t MAX_BATCH        = 20;
+
+long query_long(const string& path, const string& name, long def) {
+    size_t q = path.find('?');
+    while (q != string::npos) {
+        if (path.compare(q + 1, name.size() + 1, name + "=") == 0)
+            return atol(path.c_str() + q + 2 + name.size());
+        q = path.find('&', q + 1);
+    }
+    return def;
+}
+
+// Raw query value with %XX decoded; "" if absent
+string query_str(const string& path, const string& name) {
+    size_t q = path.find('?');
+    while (q != string::npos) {
+        if (path.compare(q + 1, name.size() + 1, name + "=") == 0) {
+            size_t b = q + 2 + name.size(), e = path.find('&', b);
+            string raw = path.substr(b, e == string::npos ? string::npos : e - b), v;
+            for (size_t i = 0; i < raw.size(); i++) {
+                if (raw[i] == '%' && i + 2 < raw.size()) {
+                    v += (char)strtol(raw.substr(i + 1, 2).c_str(), NULL, 16);
+                    i += 2;
+                } else v += raw[i];
+            }
+            return v;
+        }
+        q = path.find('&', q + 1);
+    }
+    return "";
+}
+
+// created_at as the mock server writes it
+string timestamp(int64_t at) {
+    time_t t = (time_t)at;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return ts;
+}
+
+// ?since=: an ISO-8601 date and time, UTC; -1 if it is not one
+int64_t parse_since(const string& s) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(s.c_str(), "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return (int64_t)timegm(&tm);
+}
+
+// --- Tokens -------------------------------------------------------------------
+string b64url(const string& in) {
+    static const char* A = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    string out;
+    unsigned acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        acc = (acc << 8) | (unsigned char)in[i];
+        bits += 8;
+        while (bits >= 6) { bits -= 6; out += A[(acc >> bits) & 63]; }
+    }
+    if (bits) out += A[(acc << (6 - bits)) & 63];
+    return out;
+}
+
+string b64url_decode(const string& in) {
+    string out;
+    unsigned acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        char c = in[i];
+        int v = c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26 :
+                c >= '0' && c <= '9' ? c - '0' + 52 : c == '-' ? 62 : c == '_' ? 63 : -1;
+        if (v < 0) break;
+        acc = (acc << 6) | (unsigned)v;
+        bits += 6;
+        if (bits >= 8) { bits -= 8; out += (char)((acc >> bits) & 0xFF); }
+    }
+    return out;
+}
+
+// header.payload.signature; alg "none" because nothing here verifies it
+string ledger_jwt(const char* type, unsigned ttl, uint32_t user) {
+    long now = (long)time(NULL);
+    char payload[192];
+    snprintf(payload, sizeof(payload),
+             "{\"token_type\":\"%s\",\"exp\":%ld,\"iat\":%ld,\"jti\":\"%llu\",\"user_id\":%u}",
+             type, now + (long)ttl, now, (unsigned long long)atomic_add(&g_jti, 1), user);
+    return b64url("{\"alg\":\"none\",\"typ\":\"JWT\"}") + "." + b64url(payload) + ".ledger";
+}
+
+// The account a live token of this type names; 0 if none
+uint32_t token_user(const string& tok, const char* type) {
+    size_t a = tok.find('.'), b = a == string::npos ? a : tok.find('.', a + 1);
+    if (b == string::npos) return 0;
+    string payload = b64url_decode(tok.substr(a + 1, b - a - 1));
+    JsonIndex claims(payload);
+    if (claims.get("token_type") != type || atol(claims.get("exp").c_str()) <= (long)time(NULL)) return 0;
+    uint32_t user = (uint32_t)strtoul(claims.get("user_id").c_str(), NULL, 10);
+    return g_ledger->account(user) ? user : 0;
+}
+
+void token_pair(JsonWriter& w, uint32_t user) {
+    w.field("access", ledger_jwt("access", g_token_ttl, user));
+    w.field("refresh", ledger_jwt("refresh", 24 * 3600, user));
+}
+
+// --- Handlers -----------------------------------------------------------------
+// DecimalField and str(Decimal) both answer amounts as strings
+void money_field(JsonWriter& w, const char* name, Money m) {
+    char t[Money::TEXT_SIZE];
+    w.key(name);
+    w.value(t, m.format(t));
+}
+
+int error_reply(const string& message, int code, string& out) {
+    JsonBody<256> w;
+    w.begin_object();
+    w.field("error", message);
+    w.end_object();
+    out.assign(w.data(), w.size());
+    return code;
+}
+
+// A money call's answer, worded as the view that would have given it
+int money_reply(const LedgerReceipt& r, const char* done, const string& recipient, string& out) {
+    switch (r.status) {
+        case LEDGER_OK:           break;
+        case LEDGER_BAD_PIN:      return error_reply("Invalid PIN", 401, out);
+        case LEDGER_KEY_REUSED:   return error_reply("Idempotency key already used for a different transaction", 409, out);
+        case LEDGER_INSUFFICIENT: return error_reply("Insufficient balance", 400, out);
+        case LEDGER_NO_RECIPIENT: return error_reply("Recipient " + recipient + " not found", 404, out);
+        case LEDGER_SELF:         return error_reply("Cannot send money to yourself", 400, out);
+        case LEDGER_NO_ACCOUNT:   return error_reply("Account not found", 404, out);
+        case LEDGER_BAD_AMOUNT:
+            out = "{\"amount\":[\"Ensure this value is greater than or equal to 1.\"]}";
+            return 400;
+        default:                  return error_reply("Transaction log unavailable", 500, out);
+    }
+    JsonBody<256> w;
+    w.begin_object();
+    w.field("message", r.replayed ? "Already processed" : done);
+    w.field("transaction_id", r.transaction_id);
+    money_field(w, "amount", r.amount);
+    if (!r.replayed && !recipient.empty()) w.field("recipient", recipient);
+    money_field(w, "new_balance", r.new_balance);
+    w.field("currency", "KES");
+    if (r.replayed) w.field("replayed", true);
+    w.end_object();
+    out.assign(w.data(), w.size());
+    return 200;
+}
+
+// One row as TransactionSerializer writes it
+void row_json(JsonWriter& w, const LedgerRow& r) {
+    w.begin_object();
+    w.field("id", (long long)r.id);
+    w.field("transaction_type", ledger_kind_name(r.kind));
+    money_field(w, "amount", r.amount);
+    w.key("recipient_phone");
+    if (r.counterparty[0]) w.value(r.counterparty); else w.raw("null", 4);
+    w.field("reference", r.reference);
+    w.field("description", r.description);
+    w.field("status", "SUCCESS");
+    w.field("transaction_id", r.transaction_id);
+    money_field(w, "balance_before", r.balance_before);
+    money_field(w, "balance_after", r.balance_after);
+    w.field("created_at", timestamp(r.at));
+    w.end_object();
+}
+
+int handle_batch(uint32_t user, const string& body, string& out);
+
+int handle(const string& method, const string& path, const string& bearer,
+           const string& body, string& out) {
+    string route = path.substr(0, path.find('?'));
+
+    if (method == "GET" && route == "/api/health/") {
+        out = "{\"status\":\"ok\"}";
+        return 200;
+    }
+    if (method == "POST" && route == "/api/auth/login/") {
+        JsonIndex j(body);
+        uint32_t user = g_ledger->find_user(j.get("username"));
+        const LedgerAccount* a = g_ledger->account(user);
+        if (!a || a->password != j.get("password")) return error_reply("Invalid username or password", 401, out);
+        JsonBody<1024> w;
+        w.begin_object();
+        w.field("message", "Login successful");
+        token_pair(w, user);
+        w.key("user");
+        w.begin_object();
+        w.field("id", (long long)a->id);
+        w.field("username", a->username);
+        w.field("full_name", a->full_name);
+        w.field("email", a->email);
+        w.field("phone_number", a->phone);
+        w.end_object();
+        w.end_object();
+        out.assign(w.data(), w.size());
+        return 200;
+    }
+    if (method == "POST" && route == "/api/auth/refresh/") {
+        JsonIndex j(body);
+        uint32_t user = token_user(j.get("refresh"), "refresh");
+        if (!user) {
+            out = "{\"detail\":\"Token is invalid or expired\",\"code\":\"token_not_valid\"}";
+            return 401;
+        }
+        JsonBody<1024> w;
+        w.begin_object();
+        token_pair(w, user);
+        w.end_object();
+        out.assign(w.data(), w.size());
+        return 200;
+    }
+    uint32_t user = token_user(bearer, "access");
+    if (!user) {
+        out = "{\"detail\":\"Given token not valid for any token type\",\"code\":\"token_not_valid\"}";
+        return 401;
+    }
+    if (method == "POST" && route == "/api/auth/logout/") {
+        out = "{\"message\":\"Logged out successfully\"}";
+        return 200;
+    }
+    if (g_ledger->broken()) return error_reply("Transaction log unavailable", 500, out);
+    if (method == "GET" && route == "/api/balance/") {
+        const LedgerAccount* a = g_ledger->account(user);
+        JsonBody<256> w;
+        w.begin_object();
+        w.field("phone_number", a->phone);
+        money_field(w, "balance", g_ledger->balance(user));
+        w.field("currency", "KES");
+        w.field("account_holder", a->full_name.empty() ? a->username : a->full_name);
+        w.end_object();
+        out.assign(w.data(), w.size());
+        return 200;
+    }
+    if (method == "POST" && (route == "/api/send/" || route == "/api/withdraw/" ||
+                             route == "/api/deposit/")) {
+        JsonIndex j(body);
+        Money amount;
+        if (!Money::parse(j.get("amount"), amount) || amount < Money::from_cents(100)) {
+            out = "{\"amount\":[\"Ensure this value is greater than or equal to 1.\"]}";
+            return 400;
+        }
+        string key = j.get("idempotency_key");
+        LedgerReceipt r;
+        if (route == "/api/deposit/") {
+            g_ledger->deposit(user, amount, j.get("reference"), key, r);
+            return money_reply(r, "Deposit successful", "", out);
+        }
+        if (route == "/api/withdraw/") {
+            g_ledger->withdraw(user, amount, j.get("pin"), j.get("description"), key, r);
+            return money_reply(r, "Withdrawal successful", "", out);
+        }
+        string to = j.get("recipient_phone");
+        if (to.empty()) { out = "{\"recipient_phone\":[\"This field is required.\"]}"; return 400; }
+        g_ledger->send(user, to, amount, j.get("pin"), j.get("description"), key, r);
+        return money_reply(r, "Money sent successfully", to, out);
+    }
+    if (method == "GET" && route == "/api/transactions/") {
+        long limit  = query_long(path, "limit", 10);
+        long offset = query_long(path, "offset", 0);
+        long cursor = query_long(path, "cursor", 0);
+        string since_text = query_str(path, "since");
+        int64_t since = since_text.empty() ? 0 : parse_since(since_text);
+        if (since < 0) return error_reply("since must be an ISO-8601 datetime", 400, out);
+        if (limit < 1) limit = 1;
+        if ((size_t)limit > MAX_HISTORY_PAGE) limit = (long)MAX_HISTORY_PAGE;
+
+        vector<LedgerRow> page;
+        uint64_t next = 0;
+        size_t count = g_ledger->history(user, (size_t)limit, offset > 0 ? (size_t)offset : 0,
+                                         cursor > 0 ? (uint64_t)cursor : 0, since, page, next);
+        JsonBody<4096> w;
+        w.begin_object();
+        w.field("count", (long long)count);
+        w.key("transactions");
+        w.begin_array();
+        for (size_t i = 0; i < page.size(); i++) row_json(w, page[i]);
+        w.end_array();
+        w.key("next_cursor");
+        if (next) w.value((long long)next); else w.raw("null", 4);
+        w.end_object();
+        out.assign(w.data(), w.size());
+        return 200;
+    }
+    if (method == "POST" && route == "/api/batch/") return handle_batch(user, body, out);
+    out = "{\"detail\":\"Not found.\"}";
+    return 404;
+}
+
+// {"requests":[{"method","path","body"}...]} -> {"responses":[{"status","body"}...]}
+int handle_batch(uint32_t user, const string& body, string& out) {
+    JsonIndex j(body);
+    uint32_t arr = j.find(j.root(), "requests");
+    size_t n = j.array_size(arr);
+    if (arr == JsonIndex::NONE || n == 0 || n > MAX_BATCH)
+        return error_reply("requests must be a list of 1-20 calls", 400, out);
+    // The calls run as the batch's caller, like BatchView's sub-requests
+    string bearer = ledger_jwt("access", 60, user);
+    out = "{\"responses\":[";
+    for (uint32_t e = j.first_child(arr); e != JsonIndex::NONE; e = j.next_sibling(e)) {
+        string m = j.get(e, "method"), p = j.get(e, "path"), sub;
+        size_t len;
+        const char* b = j.raw(j.find(e, "body"), len);
+        int code;
+        if (p.compare(0, 5, "/api/") != 0 || p.compare(0, 11, "/api/batch/") == 0 ||
+            p.compare(0, 10, "/api/auth/") == 0 || p.compare(0, 12, "/api/events/") == 0) {
+            code = error_reply("Path not allowed in a batch", 400, sub);
+        } else {
+            code = handle(m.empty() ? "GET" : m, p, bearer, b ? string(b, len) : "{}", sub);
+        }
+        if (out.size() > 14) out += ",";
+        char st[32];
+        snprintf(st, sizeof(st), "{\"status\":%d,\"body\":", code);
+        out += st + sub + "}";
+    }
+    out += "]}";
+    return 200;
+}
+
+// --- Connection loop ----------------------------------------------------------
+bool send_all(int fd, const string& s) {
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t w = send(fd, s.data() + off, s.size() - off, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        off += (size_t)w;
+    }
+    return true;
+}
+
+const char* reason(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 409: return "Conflict";
+        case 500: return "Internal Server Error";
+        default:  return "Not Found";
+    }
+}
+
+void* serve_conn(void* arg) {
+    int fd = (int)(long)arg;
+    string buf;
+    char chunk[8192];
+    for (;;) {
+        size_t header_end;
+        while ((header_end = buf.find("\r\n\r\n")) == string::npos) {
+            ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+            if (r <= 0) { close(fd); return NULL; }
+            buf.append(chunk, (size_t)r);
+        }
+
+        string head = buf.substr(0, header_end);
+        istringstream line(head);
+        string method, path;
+        line >> method >> path;
+
+        size_t body_len = 0;
+        bool conn_close = false;
+        for (size_t i = 0; i < head.size(); i++) head[i] = (char)tolower(head[i]);
+        size_t cl = head.find("content-length:");
+        if (cl != string::npos) body_len = (size_t)atol(head.c_str() + cl + 15);
+        if (head.find("connection: close") != string::npos) conn_close = true;
+        string bearer;                               // from the raw head: tokens are case-sensitive
+        size_t au = head.find("\r\nauthorization: bearer ");
+        if (au != string::npos) {
+            au += 24;
+            bearer = buf.substr(au, buf.find("\r\n", au) - au);
+        }
+
+        while (buf.size() < header_end + 4 + body_len) {
+            ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+            if (r <= 0) { close(fd); return NULL; }
+            buf.append(chunk, (size_t)r);
+        }
+        string body = buf.substr(header_end + 4, body_len);
+        buf.erase(0, header_end + 4 + body_len);
+
+        string out;
+        int code = handle(method, path, bearer, body, out);
+        ostringstream resp;
+        resp << "HTTP/1.1 " << code << " " << reason(code) << "\r\n"
+             << "Content-Type: application/json\r\n"
+             << (conn_close ? "Connection: close\r\n" : "")
+             << "Content-Length: " << out.size() << "\r\n\r\n" << out;
+        if (!send_all(fd, resp.str()) || conn_close) break;
+    }
+    close(fd);
+    return NULL;
+}
+
+// --- Entry point --------------------------------------------------------------
+int main(int argc, char** argv) {
+    int port = 8000;
+    size_t extra = 0, stripes = 256;
+    string log_path;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a == "--accounts" && i + 1 < argc) extra = (size_t)atol(argv[++i]);
+        else if (a == "--log" && i + 1 < argc) log_path = argv[++i];
+        else if (a == "--stripes" && i + 1 < argc) stripes = (size_t)atol(argv[++i]);
+        else if (a == "--token-ttl" && i + 1 < argc) g_token_ttl = (unsigned)atoi(argv[++i]);
+        else port = atoi(argv[i]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Ledger ledger(extra + 2, stripes);
+    ledger.add_account("john", "password123", "John Doe", "john@example.com", "0712345678", "1234",
+                       Money::from_cents(500000));
+    ledger.add_account("jane", "password123", "Jane Doe", "jane@example.com", "0722345678", "1234",
+                       Money::from_cents(200000));
+    for (size_t i = 1; i <= extra; i++) {
+        char user[32], phone[16];
+        snprintf(user, sizeof(user), "user%lu", (unsigned long)i);
+        snprintf(phone, sizeof(phone), "07%08lu", 90000000UL + (unsigned long)i);
+        ledger.add_account(user, "password123", "", "", phone, "1234", Money::from_cents(100000));
+    }
+    if (!log_path.empty()) {
+        string error;
+        if (!ledger.open_log(log_path, error)) {
+            cerr << "ledger_server: " << error << endl;
+            return 1;
+        }
+        LedgerStats s = ledger.stats();
+        cout << log_path << ": " << s.recovered << " records replayed";
+        if (s.torn_bytes) cout << ", " << s.torn_bytes << " torn bytes cut off";
+        cout << endl;
+    }
+    g_ledger = &ledger;
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 512) != 0) {
+        perror("ledger_server");
+        return 1;
+    }
+    cout << "M-Pesa ledger server listening on 127.0.0.1:" << port
+         << " (" << ledger.size() << " accounts, total KES " << ledger.total() << ")" << endl;
+
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t th;
+        if (pthread_create(&th, NULL, serve_conn, (void*)(long)fd) != 0) { close(fd); continue; }
+        pthread_detach(th);
+    }
+}
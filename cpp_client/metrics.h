@@ -0,0 +1,246 @@
+/**
+ * ============================================
+ *   metrics.h - per-endpoint request metrics
+ * ============================================
+ *
+ *  EndpointMetrics is a RequestObserver (http_pool.h):
+ *
+ *      EndpointMetrics g_metrics;
+ *      g_http.set_observer(&g_metrics);
+ *      ...
+ *      g_metrics.write_file("mpesa_metrics.prom");   // or .json
+ *
+ *  Every finished request is filed under its method +
+ *  route (query string dropped) with
+ *
+ *    counters   requests, transport / 4xx / 5xx errors,
+ *               timeouts and cancellations (transport
+ *               errors too),
+ *               bytes out / in, reused connections
+ *    histograms connect   start   -> TCP connected
+ *               send      start   -> request written
+ *               server    written -> first byte (TTFB)
+ *               body      first   -> last byte
+ *               total     start   -> done
+ *
+ *  Recording takes no lock: the endpoint slot is
+ *  found by a scan of an append-only table and every
+ *  counter / histogram bucket is one atomic add
+ *  (ConcurrentHistogram, histogram.h). Only the first
+ *  request to a new route takes a mutex to claim a
+ *  slot. Routes beyond MAX_ENDPOINTS go to "other".
+ * ============================================
+ */
+#ifndef MPESA_METRICS_H
+#define MPESA_METRICS_H
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <stdio.h>
+#include <string.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "histogram.h"
+
+class EndpointMetrics : public RequestObserver {
+public:
+    enum Phase { PH_CONNECT, PH_SEND, PH_SERVER, PH_BODY, PH_TOTAL, PH_COUNT };
+    enum { MAX_ENDPOINTS = 24, MAX_ROUTE = 56 };
+
+    EndpointMetrics() : used_(0) {}
+    ~EndpointMetrics() { for (size_t i = 0; i < (size_t)used_; i++) delete table_[i]; }
+
+    void on_request(const std::string& method, const std::string& path, const RequestTiming& t) {
+        size_t route_len = path.find('?');
+        if (route_len == std::string::npos) route_len = path.size();
+        Endpoint& e = slot(method, path.c_str(), route_len);
+
+        atomic_add(&e.bytes_out, t.bytes_out);
+        atomic_add(&e.bytes_in, t.bytes_in);
+        if (t.reused) atomic_add(&e.reused, 1);
+        if (t.failure == HTTP_FAIL_TIMEOUT)   atomic_add(&e.timeouts, 1);
+        if (t.failure == HTTP_FAIL_CANCELLED) atomic_add(&e.cancelled, 1);
+        if      (t.status_code == 0)   atomic_add(&e.transport_errors, 1);
+        else if (t.status_code >= 500) atomic_add(&e.status_5xx, 1);
+        else if (t.status_code >= 400) atomic_add(&e.status_4xx, 1);
+
+        if (t.connected_ns)                e.phase[PH_CONNECT].record((t.connected_ns - t.start_ns) / 1000);
+        if (t.sent_ns)                     e.phase[PH_SEND].record((t.sent_ns - t.start_ns) / 1000);
+        if (t.sent_ns && t.first_byte_ns)  e.phase[PH_SERVER].record((t.first_byte_ns - t.sent_ns) / 1000);
+        if (t.first_byte_ns)               e.phase[PH_BODY].record((t.done_ns - t.first_byte_ns) / 1000);
+        e.phase[PH_TOTAL].record((t.done_ns - t.start_ns) / 1000);
+    }
+
+    // --- Export ---
+    std::string prometheus() const {
+        std::ostringstream o;
+        o << std::fixed << std::setprecision(6);
+        o << "# HELP mpesa_client_requests_total Requests issued.\n"
+          << "# TYPE mpesa_client_requests_total counter\n";
+        for (size_t i = 0; i < published(); i++)
+            o << "mpesa_client_requests_total{" << labels(*table_[i]) << "} " << table_[i]->requests() << "\n";
+        counter(o, "mpesa_client_transport_errors_total",   "Requests with no HTTP response.",     &Endpoint::transport_errors);
+        counter(o, "mpesa_client_timeouts_total",           "Requests that ran out of time.",      &Endpoint::timeouts);
+        counter(o, "mpesa_client_cancelled_total",          "Requests cancelled by the user.",     &Endpoint::cancelled);
+        counter(o, "mpesa_client_http_4xx_total",           "Responses with a 4xx status.",        &Endpoint::status_4xx);
+        counter(o, "mpesa_client_http_5xx_total",           "Responses with a 5xx status.",        &Endpoint::status_5xx);
+        counter(o, "mpesa_client_bytes_sent_total",         "Request bytes written.",              &Endpoint::bytes_out);
+        counter(o, "mpesa_client_bytes_received_total",     "Response bytes read.",                &Endpoint::bytes_in);
+        counter(o, "mpesa_client_reused_connections_total", "Requests served on a warm socket.",   &Endpoint::reused);
+
+        static const double Q[] = { 0.5, 0.95, 0.99, 0.999 };
+        static const char*  QS[] = { "0.5", "0.95", "0.99", "0.999" };
+        o << "# HELP mpesa_client_request_phase_seconds Request latency by phase.\n"
+          << "# TYPE mpesa_client_request_phase_seconds summary\n";
+        LatencyHistogram h;
+        for (size_t i = 0; i < published(); i++) {
+            const Endpoint& e = *table_[i];
+            for (int ph = 0; ph < PH_COUNT; ph++) {
+                e.phase[ph].snapshot(h);
+                if (!h.count()) continue;
+                std::string lbl = labels(e) + ",phase=\"" + PHASE_NAMES()[ph] + "\"";
+                for (size_t q = 0; q < sizeof(Q) / sizeof(Q[0]); q++)
+                    o << "mpesa_client_request_phase_seconds{" << lbl << ",quantile=\"" << QS[q] << "\"} "
+                      << (double)h.percentile(Q[q] * 100.0) / 1e6 << "\n";
+                o << "mpesa_client_request_phase_seconds_sum{" << lbl << "} "
+                  << (double)h.sum() / 1e6 << "\n";
+                o << "mpesa_client_request_phase_seconds_count{" << lbl << "} " << h.count() << "\n";
+            }
+        }
+        return o.str();
+    }
+
+    std::string json() const {
+        std::ostringstream o;
+        o << std::fixed << std::setprecision(3) << "{\"endpoints\":[";
+        LatencyHistogram h;
+        for (size_t i = 0; i < published(); i++) {
+            const Endpoint& e = *table_[i];
+            if (i) o << ",";
+            o << "\n {\"method\":\"" << e.method << "\",\"endpoint\":\"" << e.route << "\""
+              << ",\"requests\":"         << e.requests()
+              << ",\"transport_errors\":" << e.transport_errors
+              << ",\"timeouts\":"         << e.timeouts
+              << ",\"cancelled\":"        << e.cancelled
+              << ",\"http_4xx\":"         << e.status_4xx
+              << ",\"http_5xx\":"         << e.status_5xx
+              << ",\"bytes_out\":"        << e.bytes_out
+              << ",\"bytes_in\":"         << e.bytes_in
+              << ",\"reused\":"           << e.reused
+              << ",\"phases_ms\":{";
+            bool first = true;
+            for (int ph = 0; ph < PH_COUNT; ph++) {
+                e.phase[ph].snapshot(h);
+                if (!h.count()) continue;
+                if (!first) o << ",";
+                first = false;
+                o << "\"" << PHASE_NAMES()[ph] << "\":{\"count\":" << h.count()
+                  << ",\"mean\":" << h.mean() / 1000.0
+                  << ",\"p50\":"  << (double)h.percentile(50.0) / 1000.0
+                  << ",\"p95\":"  << (double)h.percentile(95.0) / 1000.0
+                  << ",\"p99\":"  << (double)h.percentile(99.0) / 1000.0
+                  << ",\"p999\":" << (double)h.percentile(99.9) / 1000.0
+                  << ",\"max\":"  << (double)h.max() / 1000.0 << "}";
+            }
+            o << "}}";
+        }
+        o << "\n]}\n";
+        return o.str();
+    }
+
+    // ".json" -> JSON, anything else -> Prometheus text. Written to a temp
+    // file first so a scraper never reads half a file.
+    bool write_file(const std::string& path) const {
+        bool as_json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        std::string text = as_json ? json() : prometheus();
+        std::string tmp = path + ".tmp";
+        FILE* f = fopen(tmp.c_str(), "wb");
+        if (!f) return false;
+        bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+        ok = fclose(f) == 0 && ok;
+        if (!ok) { remove(tmp.c_str()); return false; }
+        remove(path.c_str());                    // rename() won't replace on Windows
+        return rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+private:
+    struct Endpoint {
+        char              method[8];
+        char              route[MAX_ROUTE];
+        size_t            route_len;
+        volatile uint64_t transport_errors, timeouts, cancelled, status_4xx, status_5xx;
+        volatile uint64_t bytes_out, bytes_in, reused;
+        ConcurrentHistogram phase[PH_COUNT];
+
+        Endpoint() : route_len(0), transport_errors(0), timeouts(0), cancelled(0), status_4xx(0),
+                     status_5xx(0), bytes_out(0), bytes_in(0), reused(0) {
+            method[0] = route[0] = '\0';
+        }
+
+        // Every request lands in the total histogram: no separate counter
+        uint64_t requests() const {
+            LatencyHistogram h;
+            phase[PH_TOTAL].snapshot(h);
+            return h.count();
+        }
+    };
+
+    static const char* const* PHASE_NAMES() {
+        static const char* const names[PH_COUNT] = { "connect", "send", "server", "body", "total" };
+        return names;
+    }
+
+    size_t published() const {
+        size_t n = used_;
+        atomic_fence();                          // pairs with the publish in slot()
+        return n;
+    }
+
+    static bool matches(const Endpoint& e, const std::string& method, const char* route, size_t len) {
+        return e.route_len == len && memcmp(e.route, route, len) == 0 && method == e.method;
+    }
+
+    Endpoint& slot(const std::string& method, const char* route, size_t len) {
+        if (len >= MAX_ROUTE) len = MAX_ROUTE - 1;
+        size_t n = published();
+        for (size_t i = 0; i < n; i++)
+            if (matches(*table_[i], method, route, len)) return *table_[i];
+
+        LockGuard lock(mu_);                     // first request to this route
+        for (size_t i = 0; i < (size_t)used_; i++)
+            if (matches(*table_[i], method, route, len)) return *table_[i];
+        if (used_ >= MAX_ENDPOINTS - 1) { route = "other"; len = 5; }
+        for (size_t i = 0; i < (size_t)used_; i++)
+            if (matches(*table_[i], method, route, len)) return *table_[i];
+        Endpoint* e = new Endpoint();            // ~160 KB of buckets: only for routes in use
+        snprintf(e->method, sizeof(e->method), "%s", method.c_str());
+        memcpy(e->route, route, len);
+        e->route[len] = '\0';
+        e->route_len = len;
+        table_[used_] = e;
+        atomic_fence();                          // slot fully written before it is visible
+        used_ = used_ + 1;
+        return *e;
+    }
+
+    static std::string labels(const Endpoint& e) {
+        return std::string("endpoint=\"") + e.route + "\",method=\"" + e.method + "\"";
+    }
+
+    void counter(std::ostringstream& o, const char* name, const char* help,
+                 volatile uint64_t Endpoint::*field) const {
+        o << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n";
+        for (size_t i = 0; i < published(); i++)
+            o << name << "{" << labels(*table_[i]) << "} " << table_[i]->*field << "\n";
+    }
+
+    EndpointMetrics(const EndpointMetrics&);
+    EndpointMetrics& operator=(const EndpointMetrics&);
+
+    Endpoint*         table_[MAX_ENDPOINTS];
+    volatile size_t   used_;
+    Mutex             mu_;
+};
+
+#endif // MPESA_METRICS_H
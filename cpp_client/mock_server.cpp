@@ -0,0 +1,832 @@
+/**
+ * ============================================
+ *   M-PESA Mock Server (POSIX)
+ *   Local stand-in for the Django backend
+ * ============================================
+ *
+ *  Speaks the same JSON contract as backend/mpesa
+ *  for the endpoints the terminal client uses, over
+ *  HTTP/1.1 keep-alive, so the client's connection
+ *  pool can be load-tested on Linux without Python.
+ *
+ *  Build & run:
+ *      g++ -std=c++11 -O2 -o mock_server mock_server.cpp -lpthread
+ *      ./mock_server 8000
+ *      ./mock_server 8000 --history 1000000   (seed a long history)
+ *      ./mock_server 8000 --latency 20        (20 ms per request)
+ *      ./mock_server 8000 --token-ttl 30      (access tokens live 30 s)
+ *      ./mock_server 8000 --drop 30           (commit, then drop the reply, 30%)
+ *      ./mock_server 8000 --slow 10:3000      (10% of replies 3 s late)
+ *      ./mock_server 8000 --stall 5           (5% answered, never replied to)
+ *      ./mock_server 8000 --trickle 5         (5% cut off halfway through the body)
+ *      ./mock_server 8000 --stall 20 --fault-path /api/balance/
+ *      ./mock_server 8000 --stream-max 5      (event streams end after 5 s)
+ *
+ *  Send / deposit / withdraw dedup on idempotency_key
+ *  like find_replay() in views.py. --drop loses the
+ *  response to that share of them after the money has
+ *  moved: the case client retries must survive.
+ *
+ *  --slow, --stall and --trickle are the faults the
+ *  client's deadlines (deadline.h) must bound. A
+ *  stalled or trickled request has still been
+ *  handled; its connection is held open and silent
+ *  until the client gives up and closes it.
+ *  --fault-path limits them to paths with a prefix.
+ *
+ *  /api/batch/ runs up to 20 calls through the same
+ *  handlers, like BatchView.
+ *
+ *  /api/transactions/ honours limit (max 500), offset,
+ *  cursor and since like TransactionHistoryView. Bodies over
+ *  16 KB go out with chunked transfer encoding.
+ *
+ *  Tokens are unsigned JWTs with the same claims
+ *  and lifetimes as SIMPLE_JWT (8 h access, 1 day
+ *  refresh), and /api/auth/refresh/ rotates both.
+ *  They are only checked with --token-ttl, so the
+ *  pool benchmark can use a fixed token.
+ *
+ *  /api/balance/ and /api/transactions/ carry an ETag
+ *  and answer a matching If-None-Match with 304, and
+ *  history pages and batch replies of 200 bytes or
+ *  more are gzipped when the client accepts it, like
+ *  conditional() and gzip_page in views.py. The
+ *  deflater is a small fixed-Huffman LZ77 one: its
+ *  ratio is below zlib's, so savings measured here
+ *  understate the real backend's.
+ *
+ *  /api/events/ streams balance and transaction
+ *  events like EventStreamView, from ?after= or
+ *  Last-Event-ID. A commit wakes every open stream
+ *  at once instead of the backend's 1 s poll; a
+ *  comment line goes out after --keepalive quiet
+ *  seconds and the stream ends after --stream-max.
+ *
+ *  /api/health/ always answers 200, for the client's
+ *  health checks. Several mock servers on different
+ *  ports stand in for a horizontally scaled backend
+ *  (each keeps its own balances).
+ *
+ *  Any username/password logs in. The account starts
+ *  with KES 5000.00 and all state lives in memory.
+ * ============================================
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include "platform.h"
+#include "json.h"
+#include "http_reader.h"        // crc32_update (inflate.h)
+
+using namespace std;
+
+// --- Server state -------------------------------------------------------------
+struct MockTxn {
+    unsigned long id;
+    string type;
+    string recipient;              // sends only
+    long   amount_cents;
+    long   balance_after_cents;
+    string transaction_id;
+    string created_at;
+};
+
+Mutex          g_mu;
+long           g_balance_cents = 500000;
+unsigned long  g_txn_seq       = 0;
+vector<MockTxn> g_txns;            // newest last; id == index + 1
+map<string, size_t> g_idem;        // idempotency_key -> index in g_txns
+
+unsigned        g_latency_ms    = 0;   // --latency: simulated DB/network time per request
+unsigned        g_token_ttl     = 0;   // --token-ttl: access lifetime (s); 0 = 8 h, unchecked
+unsigned long   g_jti           = 0;   // under g_mu
+unsigned        g_drop_pct      = 0;   // --drop: money calls whose reply is lost
+unsigned        g_slow_pct      = 0;   // --slow PCT:MS: replies held back g_slow_ms
+unsigned        g_slow_ms       = 0;
+unsigned        g_stall_pct     = 0;   // --stall: requests handled but never answered
+unsigned        g_trickle_pct   = 0;   // --trickle: replies cut off halfway through the body
+string          g_fault_path;          // --fault-path: only paths starting with this
+unsigned        g_keepalive_s   = 15;  // --keepalive: quiet event stream gets a comment line
+unsigned        g_stream_max_s  = 300; // --stream-max: event streams end after this long
+
+const size_t MAX_HISTORY_PAGE = 500;
+const size_t CHUNK_THRESHOLD  = 16 * 1024;
+const size_t GZIP_MIN         = 200;        // as django.middleware.gzip
+const size_t EVENTS_BATCH     = 100;        // rows per pass, as views.py
+
+string cents_str(long c) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%ld.%02ld", c < 0 ? "-" : "", labs(c) / 100, labs(c) % 100);
+    return buf;
+}
+
+// Naive field lookup, enough for the client's flat request bodies
+string body_field(const string& body, const string& key) {
+    string search = "\"" + key + "\":";
+    size_t p = body.find(search);
+    if (p == string::npos) return "";
+    p += search.size();
+    while (p < body.size() && body[p] == ' ') p++;
+    if (p < body.size() && body[p] == '"') {
+        size_t e = body.find('"', p + 1);
+        return body.substr(p + 1, e == string::npos ? string::npos : e - p - 1);
+    }
+    size_t e = body.find_first_of(",}", p);
+    return body.substr(p, e == string::npos ? string::npos : e - p);
+}
+
+long parse_cents(const string& s) {
+    return (long)(atof(s.c_str()) * 100.0 + 0.5);
+}
+
+long query_long(const string& path, const string& name, long def) {
+    size_t q = path.find('?');
+    while (q != string::npos) {
+        if (path.compare(q + 1, name.size() + 1, name + "=") == 0)
+            return atol(path.c_str() + q + 2 + name.size());
+        q = path.find('&', q + 1);
+    }
+    return def;
+}
+
+// Raw query value with %XX decoded; "" if absent
+string query_str(const string& path, const string& name) {
+    size_t q = path.find('?');
+    while (q != string::npos) {
+        if (path.compare(q + 1, name.size() + 1, name + "=") == 0) {
+            size_t b = q + 2 + name.size(), e = path.find('&', b);
+            string raw = path.substr(b, e == string::npos ? string::npos : e - b), v;
+            for (size_t i = 0; i < raw.size(); i++) {
+                if (raw[i] == '%' && i + 2 < raw.size()) {
+                    v += (char)strtol(raw.substr(i + 1, 2).c_str(), NULL, 16);
+                    i += 2;
+                } else v += raw[i];
+            }
+            return v;
+        }
+        q = path.find('&', q + 1);
+    }
+    return "";
+}
+
+// --- Tokens -------------------------------------------------------------------
+string b64url(const string& in) {
+    static const char* A = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    string out;
+    unsigned acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        acc = (acc << 8) | (unsigned char)in[i];
+        bits += 8;
+        while (bits >= 6) { bits -= 6; out += A[(acc >> bits) & 63]; }
+    }
+    if (bits) out += A[(acc << (6 - bits)) & 63];
+    return out;
+}
+
+string b64url_decode(const string& in) {
+    string out;
+    unsigned acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        char c = in[i];
+        int v = c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26 :
+                c >= '0' && c <= '9' ? c - '0' + 52 : c == '-' ? 62 : c == '_' ? 63 : -1;
+        if (v < 0) break;
+        acc = (acc << 6) | (unsigned)v;
+        bits += 6;
+        if (bits >= 8) { bits -= 8; out += (char)((acc >> bits) & 0xFF); }
+    }
+    return out;
+}
+
+// header.payload.signature; alg "none" because nothing here verifies it
+string mock_jwt(const char* type, unsigned ttl) {
+    unsigned long jti;
+    { LockGuard lock(g_mu); jti = ++g_jti; }
+    long now = (long)time(NULL);
+    char payload[160];
+    snprintf(payload, sizeof(payload),
+             "{\"token_type\":\"%s\",\"exp\":%ld,\"iat\":%ld,\"jti\":\"%lu\",\"user_id\":1}",
+             type, now + (long)ttl, now, jti);
+    return b64url("{\"alg\":\"none\",\"typ\":\"JWT\"}") + "." + b64url(payload) + ".mock";
+}
+
+// Right type and not past exp
+bool token_live(const string& tok, const char* type) {
+    size_t a = tok.find('.'), b = a == string::npos ? a : tok.find('.', a + 1);
+    if (b == string::npos) return false;
+    string claims = b64url_decode(tok.substr(a + 1, b - a - 1));
+    return body_field(claims, "token_type") == type &&
+           atol(body_field(claims, "exp").c_str()) > (long)time(NULL);
+}
+
+string token_pair() {
+    return "\"access\":\"" + mock_jwt("access", g_token_ttl ? g_token_ttl : 8 * 3600) +
+           "\",\"refresh\":\"" + mock_jwt("refresh", 24 * 3600) + "\"";
+}
+
+// One row a minute from 2025-01-01, so created_at grows with id
+string mock_timestamp(size_t id) {
+    time_t t = (time_t)1735689600 + (time_t)id * 60;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return ts;
+}
+
+// Synthetic history: n old transactions with a plausible running balance
+void seed_history(size_t n) {
+    const char* types[] = { "DEPOSIT", "SEND", "RECEIVE", "WITHDRAW" };
+    long balance = 0;
+    g_txns.reserve(n + 1024);
+    for (size_t i = 0; i < n; i++) {
+        MockTxn t;
+        t.id = i + 1;
+        t.type = types[i % 4];
+        t.amount_cents = 100 * (long)(1 + (i * 7919) % 500);
+        bool debit = (t.type == "SEND" || t.type == "WITHDRAW");
+        if (debit && balance < t.amount_cents) t.type = "DEPOSIT", debit = false;
+        balance += debit ? -t.amount_cents : t.amount_cents;
+        t.balance_after_cents = balance;
+        char id[32];
+        snprintf(id, sizeof(id), "TXNHIST%09lu", (unsigned long)(i + 1));
+        t.transaction_id = id;
+        t.created_at = mock_timestamp(t.id);
+        g_txns.push_back(t);
+    }
+    g_balance_cents = balance + 500000;
+}
+
+// One row as TransactionSerializer writes it
+string txn_json(const MockTxn& t) {
+    ostringstream js;
+    js << "{\"id\":" << t.id << ",\"transaction_type\":\"" << t.type
+       << "\",\"amount\":\"" << cents_str(t.amount_cents)
+       << "\",\"recipient_phone\":\"0722345678\",\"reference\":\"\",\"description\":\"\""
+       << ",\"status\":\"SUCCESS\",\"transaction_id\":\"" << t.transaction_id
+       << "\",\"balance_before\":\"0.00\",\"balance_after\":\"" << cents_str(t.balance_after_cents)
+       << "\",\"created_at\":\"" << t.created_at << "\"}";
+    return js.str();
+}
+
+// --- Handlers -----------------------------------------------------------------
+int record_txn(const string& type, long amount, long sign, const string& key, const string& recipient,
+               string& out) {
+    LockGuard lock(g_mu);
+    map<string, size_t>::const_iterator seen = key.empty() ? g_idem.end() : g_idem.find(key);
+    if (seen != g_idem.end()) {
+        const MockTxn& t = g_txns[seen->second];
+        if (t.type != type || t.amount_cents != amount || t.recipient != recipient) {
+            out = "{\"error\":\"Idempotency key already used for a different transaction\"}";
+            return 409;
+        }
+        out = "{\"message\":\"Already processed\",\"transaction_id\":\"" + t.transaction_id +
+              "\",\"amount\":\"" + cents_str(amount) +
+              "\",\"new_balance\":\"" + cents_str(t.balance_after_cents) +
+              "\",\"currency\":\"KES\",\"replayed\":true}";
+        return 200;
+    }
+    if (sign < 0 && g_balance_cents < amount) {
+        out = "{\"error\":\"Insufficient balance\"}";
+        return 400;
+    }
+    g_balance_cents += sign * amount;
+    char id[32];
+    snprintf(id, sizeof(id), "TXNMOCK%08lu", ++g_txn_seq);
+    MockTxn t;
+    t.id = g_txns.size() + 1;
+    t.created_at = mock_timestamp(t.id);
+    t.type = type; t.amount_cents = amount; t.recipient = recipient;
+    t.balance_after_cents = g_balance_cents; t.transaction_id = id;
+    g_txns.push_back(t);
+    if (!key.empty()) g_idem[key] = g_txns.size() - 1;
+    out = "{\"message\":\"OK\",\"transaction_id\":\"" + t.transaction_id +
+          "\",\"amount\":\"" + cents_str(amount) +
+          "\",\"new_balance\":\"" + cents_str(g_balance_cents) +
+          "\",\"currency\":\"KES\"}";
+    return 200;
+}
+
+int handle_batch(const string& bearer, const string& body, string& out);
+
+int handle(const string& method, const string& path, const string& bearer,
+           const string& body, string& out) {
+    string route = path.substr(0, path.find('?'));
+
+    if (method == "POST" && route == "/api/auth/login/") {
+        string user = body_field(body, "username");
+        out = "{\"message\":\"Login successful\"," + token_pair() +
+              ",\"user\":{\"id\":1,\"username\":\"" + user +
+              "\",\"full_name\":\"Mock User\",\"email\":\"\",\"phone_number\":\"0712345678\"}}";
+        return 200;
+    }
+    if (method == "GET" && route == "/api/health/") {
+        out = "{\"status\":\"ok\"}";
+        return 200;
+    }
+    if (method == "POST" && route == "/api/auth/refresh/") {
+        if (!token_live(body_field(body, "refresh"), "refresh")) {
+            out = "{\"detail\":\"Token is invalid or expired\",\"code\":\"token_not_valid\"}";
+            return 401;
+        }
+        out = "{" + token_pair() + "}";
+        return 200;
+    }
+    if (g_token_ttl && !token_live(bearer, "access")) {
+        out = "{\"detail\":\"Given token not valid for any token type\",\"code\":\"token_not_valid\"}";
+        return 401;
+    }
+    if (method == "POST" && route == "/api/auth/logout/") {
+        out = "{\"message\":\"Logged out successfully\"}";
+        return 200;
+    }
+    if (method == "GET" && route == "/api/balance/") {
+        LockGuard lock(g_mu);
+        out = "{\"phone_number\":\"0712345678\",\"balance\":\"" + cents_str(g_balance_cents) +
+              "\",\"currency\":\"KES\",\"account_holder\":\"Mock User\"}";
+        return 200;
+    }
+    if (method == "POST" && (route == "/api/send/" || route == "/api/withdraw/" ||
+                             route == "/api/deposit/")) {
+        long amount = parse_cents(body_field(body, "amount"));
+        if (amount < 100) { out = "{\"amount\":[\"Ensure this value is greater than or equal to 1.\"]}"; return 400; }
+        string key = body_field(body, "idempotency_key");
+        if (route == "/api/deposit/")  return record_txn("DEPOSIT",  amount, +1, key, "", out);
+        if (route == "/api/withdraw/") return record_txn("WITHDRAW", amount, -1, key, "", out);
+        return record_txn("SEND", amount, -1, key, body_field(body, "recipient_phone"), out);
+    }
+    if (method == "GET" && route == "/api/transactions/") {
+        size_t limit  = (size_t)query_long(path, "limit", 10);
+        size_t offset = (size_t)query_long(path, "offset", 0);
+        long   cursor = query_long(path, "cursor", 0);
+        string since  = query_str(path, "since");
+        if (limit < 1) limit = 1;
+        if (limit > MAX_HISTORY_PAGE) limit = MAX_HISTORY_PAGE;
+
+        LockGuard lock(g_mu);
+        // Newest first; a cursor means "rows older than that id"
+        size_t top = g_txns.size();
+        if (cursor > 0 && (size_t)cursor - 1 < top) top = (size_t)cursor - 1;
+        top = offset < top ? top - offset : 0;
+
+        ostringstream js;
+        js << "{\"count\":" << g_txns.size() << ",\"transactions\":[";
+        size_t n = 0;
+        // created_at grows with id, so ?since= cuts off the older tail
+        size_t bottom = 0, hi = top;
+        while (!since.empty() && bottom < hi) {
+            size_t mid = bottom + (hi - bottom) / 2;
+            if (g_txns[mid].created_at < since) bottom = mid + 1; else hi = mid;
+        }
+        for (size_t i = top; i > bottom && n < limit; i--, n++) {
+            if (n) js << ",";
+            js << txn_json(g_txns[i - 1]);
+        }
+        bool has_more = top - bottom > n;
+        js << "],\"next_cursor\":";
+        if (has_more && n > 0) js << g_txns[top - n].id; else js << "null";
+        js << "}";
+        out = js.str();
+        return 200;
+    }
+    if (method == "POST" && route == "/api/batch/") return handle_batch(bearer, body, out);
+    out = "{\"detail\":\"Not found.\"}";
+    return 404;
+}
+
+// {"requests":[{"method","path","body"}...]} -> {"responses":[{"status","body"}...]}
+int handle_batch(const string& bearer, const string& body, string& out) {
+    JsonIndex j(body);
+    uint32_t arr = j.find(j.root(), "requests");
+    size_t n = j.array_size(arr);
+    if (arr == JsonIndex::NONE || n == 0 || n > 20) {
+        out = "{\"error\":\"requests must be a list of 1-20 calls\"}";
+        return 400;
+    }
+    out = "{\"responses\":[";
+    for (uint32_t e = j.first_child(arr); e != JsonIndex::NONE; e = j.next_sibling(e)) {
+        string m = j.get(e, "method"), p = j.get(e, "path"), sub;
+        size_t len;
+        const char* b = j.raw(j.find(e, "body"), len);
+        int code;
+        if (p.compare(0, 5, "/api/") != 0 || p.compare(0, 11, "/api/batch/") == 0 ||
+            p.compare(0, 10, "/api/auth/") == 0 || p.compare(0, 12, "/api/events/") == 0) {
+            sub = "{\"error\":\"Path not allowed in a batch\"}";
+            code = 400;
+        } else {
+            code = handle(m.empty() ? "GET" : m, p, bearer, b ? string(b, len) : "{}", sub);
+        }
+        if (out.size() > 14) out += ",";
+        char st[32];
+        snprintf(st, sizeof(st), "{\"status\":%d,\"body\":", code);
+        out += st + sub + "}";
+    }
+    out += "]}";
+    return 200;
+}
+
+// --- gzip ---------------------------------------------------------------------
+// One fixed-Huffman deflate block over LZ77 matches (RFC 1951 3.2.6).
+class BitWriter {
+public:
+    explicit BitWriter(string& out) : out_(out), acc_(0), n_(0) {}
+
+    void put(uint32_t v, int bits) {
+        acc_ |= v << n_;
+        n_ += bits;
+        while (n_ >= 8) { out_ += (char)(acc_ & 0xFF); acc_ >>= 8; n_ -= 8; }
+    }
+    // Huffman codes go out most significant bit first
+    void code(uint32_t c, int len) {
+        uint32_t r = 0;
+        for (int i = 0; i < len; i++) r |= ((c >> i) & 1) << (len - 1 - i);
+        put(r, len);
+    }
+    void flush() {
+        if (n_) out_ += (char)(acc_ & 0xFF);
+        acc_ = 0; n_ = 0;
+    }
+
+private:
+    string&  out_;
+    uint32_t acc_;
+    int      n_;
+};
+
+void put_symbol(BitWriter& w, unsigned sym) {
+    if      (sym < 144) w.code(0x30 + sym, 8);
+    else if (sym < 256) w.code(0x190 + sym - 144, 9);
+    else if (sym < 280) w.code(sym - 256, 7);
+    else                w.code(0xC0 + sym - 280, 8);
+}
+
+string deflate_fixed(const string& in) {
+    static const unsigned short LBASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                              35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const unsigned char  LEXT[29]  = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                              3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const unsigned short DBASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                              257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                              8193, 12289, 16385, 24577 };
+    static const unsigned char  DEXT[30]  = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                              7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const unsigned char* p = (const unsigned char*)in.data();
+    size_t n = in.size();
+    vector<long> head(1 << 15, -1), prev(n, -1);        // hash chains over the last 32 KB
+    string out;
+    BitWriter w(out);
+    w.put(1, 1);                                          // final block
+    w.put(1, 2);                                          // fixed Huffman codes
+
+    for (size_t i = 0; i < n;) {
+        size_t best = 0, dist = 0;
+        if (i + 3 <= n) {
+            unsigned h = ((unsigned)p[i] << 10 ^ (unsigned)p[i + 1] << 5 ^ p[i + 2]) & 0x7FFF;
+            size_t max = n - i < 258 ? n - i : 258;
+            long cand = head[h];
+            for (int chain = 0; cand >= 0 && i - (size_t)cand <= 32768 && chain < 32;
+                 chain++, cand = prev[cand]) {
+                size_t len = 0;
+                while (len < max && p[cand + len] == p[i + len]) len++;
+                if (len > best) { best = len; dist = i - (size_t)cand; }
+                if (best == max) break;
+            }
+        }
+        size_t step = best >= 3 ? best : 1;
+        for (size_t k = i; k < i + step && k + 3 <= n; k++) {
+            unsigned h = ((unsigned)p[k] << 10 ^ (unsigned)p[k + 1] << 5 ^ p[k + 2]) & 0x7FFF;
+            prev[k] = head[h];
+            head[h] = (long)k;
+        }
+        if (best >= 3) {
+            int l = 28, d = 29;
+            while (LBASE[l] > best) l--;
+            while (DBASE[d] > dist) d--;
+            put_symbol(w, 257 + (unsigned)l);
+            w.put((uint32_t)(best - LBASE[l]), LEXT[l]);
+            w.code((uint32_t)d, 5);
+            w.put((uint32_t)(dist - DBASE[d]), DEXT[d]);
+        } else {
+            put_symbol(w, p[i]);
+        }
+        i += step;
+    }
+    put_symbol(w, 256);                                   // end of block
+    w.flush();
+    return out;
+}
+
+void put_le32(string& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out += (char)((v >> (8 * i)) & 0xFF);
+}
+
+string gzip(const string& in) {
+    string out("\x1f\x8b\x08\0\0\0\0\0\0\x03", 10);        // no name, no mtime, Unix
+    out += deflate_fixed(in);
+    put_le32(out, crc32_update(0, (const unsigned char*)in.data(), in.size()));
+    put_le32(out, (uint32_t)in.size());
+    return out;
+}
+
+// --- Connection loop ----------------------------------------------------------
+bool send_all(int fd, const string& s) {
+    size_t off = 0;
+    while (off < s.size()) {
+        ssize_t w = send(fd, s.data() + off, s.size() - off, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        off += (size_t)w;
+    }
+    return true;
+}
+
+const char* reason(int code) {
+    switch (code) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 409: return "Conflict";
+        default:  return "Not Found";
+    }
+}
+
+// --- Event stream -------------------------------------------------------------
+pthread_mutex_t g_events_mu = PTHREAD_MUTEX_INITIALIZER;   // before g_mu
+pthread_cond_t  g_events_cv = PTHREAD_COND_INITIALIZER;
+
+// A money call committed: wake every open stream
+void notify_streams() {
+    pthread_mutex_lock(&g_events_mu);
+    pthread_cond_broadcast(&g_events_cv);
+    pthread_mutex_unlock(&g_events_mu);
+}
+
+size_t txn_count() {
+    LockGuard lock(g_mu);
+    return g_txns.size();
+}
+
+// Until there are rows past `after` or `ms` has passed
+void wait_rows(size_t after, uint64_t ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += (time_t)(ms / 1000);
+    until.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) { until.tv_sec++; until.tv_nsec -= 1000000000L; }
+    pthread_mutex_lock(&g_events_mu);
+    while (txn_count() <= after)
+        if (pthread_cond_timedwait(&g_events_cv, &g_events_mu, &until) == ETIMEDOUT) break;
+    pthread_mutex_unlock(&g_events_mu);
+}
+
+bool send_chunk(int fd, const string& data) {
+    char sz[16];
+    snprintf(sz, sizeof(sz), "%lx\r\n", (unsigned long)data.size());
+    return send_all(fd, sz + data + "\r\n");
+}
+
+// text/event-stream, chunked, like EventStreamView: every row past `after`
+// (-1: from now on) oldest first, then the balance. Ends the connection.
+void serve_events(int fd, long after) {
+    size_t next = after < 0 ? txn_count() : (size_t)after;
+    bool ok = send_all(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                           "Cache-Control: no-cache\r\nConnection: close\r\n"
+                           "Transfer-Encoding: chunked\r\n\r\n") &&
+              send_chunk(fd, "retry: 3000\n\n");
+    uint64_t start = now_ms(), quiet = start, end = start + (uint64_t)g_stream_max_s * 1000;
+    bool first = true;
+    while (ok && now_ms() < end) {
+        string events;
+        size_t rows = 0;
+        {
+            LockGuard lock(g_mu);
+            for (; next < g_txns.size() && rows < EVENTS_BATCH; next++, rows++) {
+                ostringstream ev;
+                ev << "id: " << g_txns[next].id << "\nevent: txn\ndata: " << txn_json(g_txns[next]) << "\n\n";
+                events += ev.str();
+            }
+            if (rows || first) {
+                ostringstream ev;
+                ev << "id: " << next << "\nevent: balance\ndata: {\"balance\":\""
+                   << cents_str(g_balance_cents) << "\",\"currency\":\"KES\"}\n\n";
+                events += ev.str();
+            }
+        }
+        uint64_t now = now_ms();
+        if (!events.empty()) {
+            ok = send_chunk(fd, events);
+            quiet = now;
+            first = false;
+            if (rows == EVENTS_BATCH) continue;
+        } else if (now - quiet >= (uint64_t)g_keepalive_s * 1000) {
+            ok = send_chunk(fd, ": keep-alive\n\n");
+            quiet = now;
+        }
+        uint64_t wait = quiet + (uint64_t)g_keepalive_s * 1000 - now;
+        if (end - now < wait) wait = end - now;
+        if (ok) wait_rows(next, wait);
+    }
+    if (ok) send_all(fd, "0\r\n\r\n");
+}
+
+// --- Fault injection ----------------------------------------------------------
+enum Fault { FAULT_NONE, FAULT_SLOW, FAULT_STALL, FAULT_TRICKLE };
+
+Fault pick_fault(const string& path, unsigned& seed) {
+    if (!(g_slow_pct + g_stall_pct + g_trickle_pct)) return FAULT_NONE;
+    if (path.compare(0, g_fault_path.size(), g_fault_path) != 0) return FAULT_NONE;
+    unsigned r = (unsigned)(rand_r(&seed) % 100);
+    if (r < g_stall_pct)                              return FAULT_STALL;
+    if (r < g_stall_pct + g_trickle_pct)              return FAULT_TRICKLE;
+    if (r < g_stall_pct + g_trickle_pct + g_slow_pct) return FAULT_SLOW;
+    return FAULT_NONE;
+}
+
+// Keep the socket open and silent until the client gives up on it
+void hold(int fd) {
+    char sink[4096];
+    while (recv(fd, sink, sizeof(sink), 0) > 0) {}
+}
+
+void* serve_conn(void* arg) {
+    int fd = (int)(long)arg;
+    unsigned seed = (unsigned)fd * 2654435761u ^ (unsigned)time(NULL);
+    string buf;
+    char chunk[8192];
+    for (;;) {
+        size_t header_end;
+        while ((header_end = buf.find("\r\n\r\n")) == string::npos) {
+            ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+            if (r <= 0) { close(fd); return NULL; }
+            buf.append(chunk, (size_t)r);
+        }
+
+        string head = buf.substr(0, header_end);
+        istringstream line(head);
+        string method, path;
+        line >> method >> path;
+
+        size_t body_len = 0;
+        bool conn_close = false;
+        for (size_t i = 0; i < head.size(); i++) head[i] = (char)tolower(head[i]);
+        size_t cl = head.find("content-length:");
+        if (cl != string::npos) body_len = (size_t)atol(head.c_str() + cl + 15);
+        if (head.find("connection: close") != string::npos) conn_close = true;
+        size_t ae = head.find("\r\naccept-encoding:");
+        bool accepts_gzip = ae != string::npos &&
+                            head.substr(ae, head.find("\r\n", ae + 2) - ae).find("gzip") != string::npos;
+        string if_none_match;                        // ours are lower-case hex
+        size_t inm = head.find("\r\nif-none-match:");
+        if (inm != string::npos) {
+            inm += 16;
+            while (inm < head.size() && head[inm] == ' ') inm++;
+            if_none_match = head.substr(inm, head.find("\r\n", inm) - inm);
+        }
+        string bearer;                               // from the raw head: tokens are case-sensitive
+        size_t au = head.find("\r\nauthorization: bearer ");
+        if (au != string::npos) {
+            au += 24;
+            bearer = buf.substr(au, buf.find("\r\n", au) - au);
+        }
+        long last_event_id = -1;
+        size_t lei = head.find("\r\nlast-event-id:");
+        if (lei != string::npos) last_event_id = atol(head.c_str() + lei + 16);
+
+        while (buf.size() < header_end + 4 + body_len) {
+            ssize_t r = recv(fd, chunk, sizeof(chunk), 0);
+            if (r <= 0) { close(fd); return NULL; }
+            buf.append(chunk, (size_t)r);
+        }
+        string body = buf.substr(header_end + 4, body_len);
+        buf.erase(0, header_end + 4 + body_len);
+
+        string out;
+        if (g_latency_ms) sleep_ms(g_latency_ms);
+        if (method == "GET" && path.compare(0, 12, "/api/events/") == 0 &&
+            (!g_token_ttl || token_live(bearer, "access"))) {
+            serve_events(fd, query_long(path, "after", last_event_id));
+            break;
+        }
+        int code = handle(method, path, bearer, body, out);
+        if (method == "POST" && code == 200) notify_streams();
+        if (g_drop_pct && method == "POST" && (path == "/api/send/" || path == "/api/deposit/" ||
+                                               path == "/api/withdraw/") &&
+            (unsigned)(rand_r(&seed) % 100) < g_drop_pct)
+            break;                                   // committed, but the client never hears
+        string route = path.substr(0, path.find('?'));
+        string etag;
+        if (method == "GET" && code == 200 && (route == "/api/balance/" || route == "/api/transactions/")) {
+            char tag[16];
+            snprintf(tag, sizeof(tag), "\"%08x\"",
+                     (unsigned)crc32_update(0, (const unsigned char*)out.data(), out.size()));
+            etag = tag;
+            if (if_none_match == etag) { code = 304; out.clear(); }
+        }
+        bool gzipped = code == 200 && accepts_gzip && out.size() >= GZIP_MIN &&
+                       (route == "/api/transactions/" || route == "/api/batch/");
+        if (gzipped) out = gzip(out);
+        Fault fault = pick_fault(path, seed);
+        if (fault == FAULT_SLOW) sleep_ms(g_slow_ms);
+        if (fault == FAULT_STALL) { hold(fd); break; }
+        ostringstream resp;
+        resp << "HTTP/1.1 " << code << " " << reason(code) << "\r\n"
+             << "Content-Type: application/json\r\n"
+             << (conn_close ? "Connection: close\r\n" : "")
+             << (gzipped ? "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n" : "");
+        if (!etag.empty()) resp << "ETag: " << etag << "\r\n";
+        if (fault == FAULT_TRICKLE) {
+            resp << "Content-Length: " << out.size() << "\r\n\r\n" << out.substr(0, out.size() / 2);
+            if (send_all(fd, resp.str())) hold(fd);
+            break;
+        }
+        bool ok;
+        if (out.size() < CHUNK_THRESHOLD) {
+            resp << "Content-Length: " << out.size() << "\r\n\r\n" << out;
+            ok = send_all(fd, resp.str());
+        } else {
+            // Large bodies stream out in 8 KB chunks, like a streaming server
+            resp << "Transfer-Encoding: chunked\r\n\r\n";
+            ok = send_all(fd, resp.str());
+            for (size_t off = 0; ok && off < out.size(); off += 8192) {
+                size_t n = out.size() - off < 8192 ? out.size() - off : 8192;
+                char sz[16];
+                snprintf(sz, sizeof(sz), "%lx\r\n", (unsigned long)n);
+                ok = send_all(fd, sz + out.substr(off, n) + "\r\n");
+            }
+            if (ok) ok = send_all(fd, "0\r\n\r\n");
+        }
+        if (!ok || conn_close) break;
+    }
+    close(fd);
+    return NULL;
+}
+
+// --- Entry point --------------------------------------------------------------
+int main(int argc, char** argv) {
+    int port = 8000;
+    size_t history = 0;
+    for (int i = 1; i < argc; i++) {
+        string a = argv[i];
+        if (a == "--history" && i + 1 < argc) history = (size_t)atol(argv[++i]);
+        else if (a == "--latency" && i + 1 < argc) g_latency_ms = (unsigned)atoi(argv[++i]);
+        else if (a == "--token-ttl" && i + 1 < argc) g_token_ttl = (unsigned)atoi(argv[++i]);
+        else if (a == "--drop" && i + 1 < argc) g_drop_pct = (unsigned)atoi(argv[++i]);
+        else if (a == "--slow" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%u:%u", &g_slow_pct, &g_slow_ms) != 2) {
+                cerr << "--slow takes PCT:MS, e.g. 10:3000" << endl;
+                return 2;
+            }
+        }
+        else if (a == "--stall" && i + 1 < argc) g_stall_pct = (unsigned)atoi(argv[++i]);
+        else if (a == "--trickle" && i + 1 < argc) g_trickle_pct = (unsigned)atoi(argv[++i]);
+        else if (a == "--fault-path" && i + 1 < argc) g_fault_path = argv[++i];
+        else if (a == "--keepalive" && i + 1 < argc) g_keepalive_s = (unsigned)atoi(argv[++i]);
+        else if (a == "--stream-max" && i + 1 < argc) g_stream_max_s = (unsigned)atoi(argv[++i]);
+        else port = atoi(argv[i]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (history) seed_history(history);
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 512) != 0) {
+        perror("mock_server");
+        return 1;
+    }
+    cout << "M-Pesa mock server listening on 127.0.0.1:" << port
+         << " (" << g_txns.size() << " transactions)" << endl;
+
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t th;
+        if (pthread_create(&th, NULL, serve_conn, (void*)(long)fd) != 0) { close(fd); continue; }
+        pthread_detach(th);
+    }
+}
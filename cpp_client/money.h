@@ -0,0 +1,150 @@
+/**
+ * ============================================
+ *   money.h - fixed-point KES amounts
+ * ============================================
+ *
+ *  Money is a whole number of cents in an int64, the
+ *  same value DecimalField(max_digits=12,
+ *  decimal_places=2) stores on the server. Amounts
+ *  typed in, read from a batch file, sent in a body,
+ *  parsed from a reply and printed never pass through
+ *  a double, so sums reconcile to the cent.
+ *
+ *      Money m;
+ *      if (!Money::parse("1,500.5", m)) ...   // 150050
+ *      char buf[Money::TEXT_SIZE];
+ *      m.format(buf);                          // "1500.50"
+ *      cout << "KES " << m;                    // no stream formatting
+ *
+ *  parse() takes an optional sign, digits with
+ *  optional thousands commas (groups of exactly three
+ *  after the first), and at most two decimals
+ *  (what the server accepts); anything else fails.
+ *  format() writes into the caller's buffer and never
+ *  allocates. There is no conversion from double or
+ *  int: construct with from_cents() or parse().
+ * ============================================
+ */
+#ifndef MPESA_MONEY_H
+#define MPESA_MONEY_H
+
+#include <string>
+#include <ostream>
+#include <string.h>
+#include <stdint.h>
+
+class Money {
+public:
+    enum {
+        TEXT_SIZE  = 24,              // "-92233720368547758.08" + NUL
+        MAX_DIGITS = 10               // before the point: max_digits 12 - 2 decimals
+    };
+
+    Money() : cents_(0) {}
+
+    static Money from_cents(int64_t c) { return Money(c); }
+
+    static bool parse(const char* p, size_t n, Money& out) {
+        const char* e = p + n;
+        while (p < e && *p == ' ') p++;
+        while (e > p && e[-1] == ' ') e--;
+        bool neg = p < e && *p == '-';
+        p += (p < e && (*p == '-' || *p == '+'));
+
+        int64_t whole = 0;
+        int digits = 0;
+        int group = 0;                  // digits since the last comma
+        bool grouped = false;
+        for (; p < e; p++) {
+            unsigned d = (unsigned)(*p - '0');
+            if (d <= 9) {
+                if (++digits > MAX_DIGITS) return false;     // before whole can overflow
+                whole = whole * 10 + d;
+                group++;
+                continue;
+            }
+            if (*p != ',') break;
+            // "1,500" and "12,345,678" but not ",500", "1,5", "1234,567" or "12,34,5"
+            if (group == 0 || group > 3 || (grouped && group != 3)) return false;
+            group = 0;
+            grouped = true;
+        }
+        if (grouped && group != 3) return false;
+
+        int64_t frac = 0;
+        int k = 0;
+        if (p < e && *p == '.') {
+            p++;
+            for (; p < e && k < 3; p++, k++) {
+                unsigned d = (unsigned)(*p - '0');
+                if (d > 9) break;
+                frac = frac * 10 + d;
+            }
+            if (k > 2) return false;                    // sub-cent amounts are rejected
+            if (k == 1) frac *= 10;
+        }
+        if (p != e || (digits == 0 && k == 0)) return false;
+
+        int64_t c = whole * 100 + frac;
+        out.cents_ = neg ? -c : c;
+        return true;
+    }
+
+    static bool parse(const std::string& s, Money& out) { return parse(s.data(), s.size(), out); }
+
+    // "1500.00", "-0.50"; returns the length. buf needs TEXT_SIZE bytes.
+    size_t format(char* buf) const {
+        char tmp[TEXT_SIZE];
+        char* q = tmp + sizeof(tmp);
+        uint64_t v = cents_ < 0 ? (uint64_t)0 - (uint64_t)cents_ : (uint64_t)cents_;
+        *--q = (char)('0' + v % 10); v /= 10;
+        *--q = (char)('0' + v % 10); v /= 10;
+        *--q = '.';
+        do { *--q = (char)('0' + v % 10); v /= 10; } while (v);
+        if (cents_ < 0) *--q = '-';
+        size_t n = (size_t)(tmp + sizeof(tmp) - q);
+        memcpy(buf, q, n);
+        buf[n] = '\0';
+        return n;
+    }
+
+    std::string str() const {
+        char buf[TEXT_SIZE];
+        return std::string(buf, format(buf));
+    }
+
+    int64_t cents()    const { return cents_; }
+    bool    positive() const { return cents_ > 0; }
+
+    Money  operator-() const                { return Money(-cents_); }
+    Money  operator+(Money o) const         { return Money(cents_ + o.cents_); }
+    Money  operator-(Money o) const         { return Money(cents_ - o.cents_); }
+    Money  operator*(int k) const           { return Money(cents_ * k); }
+    Money  operator*(long k) const          { return Money(cents_ * k); }
+    Money  operator*(long long k) const     { return Money(cents_ * k); }
+    Money& operator+=(Money o)              { cents_ += o.cents_; return *this; }
+    Money& operator-=(Money o)              { cents_ -= o.cents_; return *this; }
+    bool   operator==(Money o) const        { return cents_ == o.cents_; }
+    bool   operator!=(Money o) const        { return cents_ != o.cents_; }
+    bool   operator< (Money o) const        { return cents_ <  o.cents_; }
+    bool   operator<=(Money o) const        { return cents_ <= o.cents_; }
+    bool   operator> (Money o) const        { return cents_ >  o.cents_; }
+    bool   operator>=(Money o) const        { return cents_ >= o.cents_; }
+
+private:
+    explicit Money(int64_t c) : cents_(c) {}
+    Money operator*(double) const;          // not defined: scaling by a double is a bug
+
+    int64_t cents_;
+};
+
+// int64_t must really be 64 bits for the 12-digit range (C++98: no static_assert)
+typedef char money_needs_int64[sizeof(int64_t) == 8 ? 1 : -1];
+
+inline std::ostream& operator<<(std::ostream& out, Money m) {
+    char buf[Money::TEXT_SIZE];
+    m.format(buf);
+    return out << buf;                      // honours setw()
+}
+
+#endif // MPESA_MONEY_H
@@ -17,6 +17,9 @@
  *
  *  3. Press F9 to Build & Run
  *  ---------------------------------------------
+ *  Linux / macOS (sockets + termios):
+ *      g++ -std=c++11 -O2 -o mpesa_client mpesa_client.cpp -lpthread
+ *  ---------------------------------------------
  *  Make sure Django backend is running:
  *    python manage.py runserver 0.0.0.0:8000
  * ============================================
@@ -27,18 +30,40 @@
 #include <sstream>
 #include <iomanip>
 #include <vector>
-#include <windows.h>
-#include <winhttp.h>
-#include <conio.h>
+#include <map>
+#include "terminal.h"
+#include "http_pool.h"
+#include "json.h"
+#include "money.h"
+#include "json_writer.h"
+#include "history.h"
+#include "txn_cache.h"
+#include "transactions.h"
+#include "batch.h"
+#include "async.h"
+#include "metrics.h"
+#include "auth.h"
+#include "api_batch.h"
+#include "sessions.h"
+#include "deadline.h"
+#include "config.h"
+#include "outbox.h"
+#include "events.h"
+#include "trace.h"
+#include "endpoints.h"
 
 using namespace std;
 
 // --- Server config ------------------------------------------------------------
-const wstring      SERVER_HOST = L"127.0.0.1";
-const INTERNET_PORT SERVER_PORT = 8000;
+// The default server; mpesa_client.conf or MPESA_SERVERS can list several
+const string         SERVER_HOST = "127.0.0.1";
+const unsigned short SERVER_PORT = 8000;
+const char* const    CONFIG_FILE = "mpesa_client.conf";   // servers, timeouts (config.h); optional
 
 // --- Console colors -----------------------------------------------------------
-HANDLE hConsole;
+// cout draws into g_screen's back buffer (terminal.h); a frame goes out,
+// changed cells only, whenever input is awaited or progress is shown.
+Screen* g_screen = NULL;
 #define CLR_DEFAULT  7
 #define CLR_WHITE   15
 #define CLR_GREEN   10
@@ -46,28 +71,7 @@ HANDLE hConsole;
 #define CLR_YELLOW  14
 #define CLR_CYAN    11
 
-void set_color(int c) { SetConsoleTextAttribute(hConsole, c); }
-
-// --- Session ------------------------------------------------------------------
-struct Session {
-    string access_token;
-    string refresh_token;
-    string username;
-    string full_name;
-    string phone_number;
-    bool   logged_in;
-
-    Session() : logged_in(false) {}   // C++98 constructor instead of = false
-};
-Session g_session;
-
-// --- HTTP response ------------------------------------------------------------
-struct HttpResponse {
-    int    status_code;
-    string body;
-
-    HttpResponse() : status_code(0) {}
-};
+void set_color(int c) { g_screen->set_color(c); }
 
 // --- String helpers (C++98 safe) ---------------------------------------------
 
@@ -78,12 +82,11 @@ string int_to_str(int n) {
     return ss.str();
 }
 
-// Replace C++11 stod
-double str_to_double(const string& s) {
-    double val = 0.0;
-    istringstream ss(s);
-    ss >> val;
-    return (ss.fail()) ? -1.0 : val;
+// A server amount ("1500", "1500.5") as the balance screens print Money;
+// the text as sent if it is not one
+string money_text(const string& s) {
+    Money m;
+    return Money::parse(s, m) ? m.str() : s;
 }
 
 // Replace C++11 string::back() and pop_back()
@@ -92,150 +95,177 @@ void rtrim(string& s) {
         s.erase(s.size()-1, 1);
 }
 
-// Replace C++11 nullptr with NULL for WinAPI calls
-wstring to_wide(const string& s) {
-    if (s.empty()) return L"";
-    int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
-    wstring result(len, 0);
-    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &result[0], len);
-    return result;
+// --- HTTP connection pool ----------------------------------------------------
+// Keep-alive sockets are reused across balance/send/history calls
+HttpPool g_http(SERVER_HOST, SERVER_PORT);
+ResponseCache g_http_cache;       // bodies behind conditional GETs (http_cache.h)
+TxnCache g_cache;          // selected customer's history + last balance
+AsyncClient g_async(g_http, 4);   // background requests that overlap (async.h)
+EndpointMetrics g_metrics;        // per-endpoint phase timings (metrics.h)
+TraceHook g_trace(g_http);        // MPESA_RECORD / MPESA_REPLAY (trace.h)
+
+// --- Sessions -----------------------------------------------------------------
+// Every customer logged in on this terminal, tokens kept fresh (sessions.h).
+// The menus act for the selected one.
+SessionManager g_sessions(g_http, g_async);
+
+string access_token() { return g_sessions.access_token(g_sessions.current()); }
+
+string display_name(const SessionManager::Info& s) {
+    return s.full_name.empty() ? s.username : s.full_name;
 }
 
-// --- WinHTTP request ---------------------------------------------------------
-HttpResponse winhttp_request(const string& method,
-                              const string& path,
-                              const string& body,
-                              const string& auth_token) {
-    HttpResponse resp;
+// Convenience wrappers
+HttpResponse http_post(const HttpRoute& route, const JsonWriter& body, bool auth = false) {
+    return auth ? g_sessions.request(g_sessions.current(), route, body.data(), body.size())
+                : g_http.request(route, body.data(), body.size(), "");
+}
+HttpResponse http_get(const HttpRoute& route) {
+    return g_sessions.request(g_sessions.current(), route, NULL, 0);
+}
 
-    HINTERNET hSession = WinHttpOpen(
-        L"MPesaClient/1.0",
-        WINHTTP_ACCESS_TYPE_NO_PROXY,
-        WINHTTP_NO_PROXY_NAME,
-        WINHTTP_NO_PROXY_BYPASS, 0);
+// The selected customer's balance, for the cache and the customer list
+void store_balance(Money balance) {
+    g_cache.store_balance(balance);
+    g_sessions.note_balance(g_sessions.current(), balance);
+}
 
-    if (!hSession) {
-        resp.body = "{\"error\":\"WinHTTP init failed\"}";
-        return resp;
-    }
+// --- Offline queue ------------------------------------------------------------
+// Each logged-in customer's transactions queued while the server was out of
+// reach (outbox.h). Flushed in the background whoever is selected.
+struct SessionAuth : public TokenSource {
+    SessionManager::Id id;
+    bool               use;         // false: never keeps an idle session awake
 
-    HINTERNET hConnect = WinHttpConnect(hSession, SERVER_HOST.c_str(), SERVER_PORT, 0);
-    if (!hConnect) {
-        WinHttpCloseHandle(hSession);
-        resp.body = "{\"error\":\"Cannot connect - is Django running on port 8000?\"}";
-        return resp;
-    }
+    explicit SessionAuth(SessionManager::Id i, bool u = true) : id(i), use(u) {}
+    string token() { return use ? g_sessions.access_token(id) : g_sessions.background_token(id); }
+    bool   refresh(const string& stale) { return g_sessions.refresh(id, stale); }
+};
 
-    wstring wpath   = to_wide(path);
-    wstring wmethod = to_wide(method);
-
-    HINTERNET hRequest = WinHttpOpenRequest(
-        hConnect,
-        wmethod.c_str(),
-        wpath.c_str(),
-        NULL,                         // HTTP version (default)
-        WINHTTP_NO_REFERER,
-        WINHTTP_DEFAULT_ACCEPT_TYPES,
-        0);                           // 0 = plain HTTP, not HTTPS
-
-    if (!hRequest) {
-        WinHttpCloseHandle(hConnect);
-        WinHttpCloseHandle(hSession);
-        resp.body = "{\"error\":\"Failed to create request\"}";
-        return resp;
-    }
+struct CustomerOutbox {
+    SessionAuth auth;
+    Outbox      box;
 
-    // Build request headers
-    wstring headers = L"Content-Type: application/json\r\n";
-    if (!auth_token.empty()) {
-        headers += L"Authorization: Bearer " + to_wide(auth_token) + L"\r\n";
-    }
+    explicit CustomerOutbox(SessionManager::Id id) : auth(id), box(g_http) {}
+};
 
-    BOOL sent = FALSE;
-    if (!body.empty()) {
-        sent = WinHttpSendRequest(
-            hRequest,
-            headers.c_str(), (DWORD)headers.size(),
-            (LPVOID)body.c_str(), (DWORD)body.size(),
-            (DWORD)body.size(), 0);
-    } else {
-        sent = WinHttpSendRequest(
-            hRequest,
-            headers.c_str(), (DWORD)headers.size(),
-            WINHTTP_NO_REQUEST_DATA, 0, 0, 0);
+map<SessionManager::Id, CustomerOutbox*> g_outboxes;
+
+// The selected customer's queue; NULL if their log could not be opened
+Outbox* outbox() {
+    map<SessionManager::Id, CustomerOutbox*>::iterator it = g_outboxes.find(g_sessions.current());
+    return it == g_outboxes.end() ? NULL : &it->second->box;
+}
+
+void open_outbox(SessionManager::Id id, const string& username) {
+    CustomerOutbox* q = new CustomerOutbox(id);
+    string err;
+    if (!q->box.open("mpesa_outbox_" + username + ".wal", err)) { delete q; return; }   // no queue = online only
+    q->box.start(&q->auth);
+    g_outboxes[id] = q;
+}
+
+// Stops the flush; what is still queued stays in the log for the next login
+void close_outbox(SessionManager::Id id) {
+    map<SessionManager::Id, CustomerOutbox*>::iterator it = g_outboxes.find(id);
+    if (it == g_outboxes.end()) return;
+    delete it->second;
+    g_outboxes.erase(it);
+}
+
+// --- Live updates -------------------------------------------------------------
+// The selected customer's balance and new history rows, pushed by the server
+// (events.h) while the menus wait for input. The stream's thread only queues
+// rows: the history cache belongs to the UI thread and takes them when a
+// menu is drawn. While the stream is up the session is not polled.
+class LiveUpdates : public EventListener {
+public:
+    LiveUpdates() : id_(SessionManager::NONE), has_balance_(false) {}
+
+    // Only while the stream is stopped
+    void reset(SessionManager::Id id) {
+        LockGuard lock(mu_);
+        id_ = id;
+        rows_.clear();
+        has_balance_ = false;
     }
 
-    if (!sent || !WinHttpReceiveResponse(hRequest, NULL)) {
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
-        WinHttpCloseHandle(hSession);
-        resp.body = "{\"error\":\"Request failed - make sure server is running\"}";
-        return resp;
+    void on_event(const SseEvent& e) {
+        JsonIndex j(e.data);
+        if (e.type == "txn") {
+            TxnRow row;
+            read_txn_row(j, j.root(), row);
+            LockGuard lock(mu_);
+            rows_.push_back(row);
+        } else if (e.type == "balance") {
+            Money balance;
+            if (!Money::parse(j.get("balance"), balance)) return;
+            g_sessions.note_balance(id_, balance);      // the customer list sees it at once
+            LockGuard lock(mu_);
+            balance_ = balance;
+            has_balance_ = true;
+        }
     }
 
-    // Read HTTP status code
-    DWORD status_code = 0;
-    DWORD status_size = sizeof(DWORD);
-    WinHttpQueryHeaders(
-        hRequest,
-        WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-        WINHTTP_HEADER_NAME_BY_INDEX,
-        &status_code,
-        &status_size,
-        WINHTTP_NO_HEADER_INDEX);
-    resp.status_code = (int)status_code;
-
-    // Read response body
-    DWORD bytes_available = 0;
-    while (WinHttpQueryDataAvailable(hRequest, &bytes_available) && bytes_available > 0) {
-        vector<char> buffer(bytes_available + 1, '\0');
-        DWORD bytes_read = 0;
-        WinHttpReadData(hRequest, &buffer[0], bytes_available, &bytes_read);
-        resp.body.append(&buffer[0], bytes_read);
+    void on_state(bool connected) { g_sessions.set_streamed(id_, connected); }
+
+    // Rows since the last call, oldest first; true with a new balance
+    bool take(vector<TxnRow>& rows, Money& balance) {
+        LockGuard lock(mu_);
+        rows.swap(rows_);
+        rows_.clear();
+        balance = balance_;
+        bool fresh = has_balance_;
+        has_balance_ = false;
+        return fresh;
     }
 
-    WinHttpCloseHandle(hRequest);
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return resp;
+private:
+    SessionManager::Id id_;
+    vector<TxnRow>     rows_;
+    Money              balance_;
+    bool               has_balance_;
+    Mutex              mu_;
+};
+
+LiveUpdates g_live;
+SessionAuth g_live_auth(SessionManager::NONE, false);
+EventStream g_events(g_http);     // after what it calls into: destroyed first
+
+// Follow the selected customer from the newest row in their cache
+void follow(SessionManager::Id id) {
+    g_events.stop();
+    if (id == SessionManager::NONE) return;
+    g_live_auth.id = id;
+    g_live.reset(id);
+    ostringstream after;
+    if (g_cache.newest_id()) after << g_cache.newest_id();
+    g_events.start(&g_live_auth, &g_live, after.str());
 }
 
-// Convenience wrappers
-HttpResponse http_post(const string& path, const string& body, bool auth = false) {
-    return winhttp_request("POST", path, body, auth ? g_session.access_token : "");
-}
-HttpResponse http_get(const string& path) {
-    return winhttp_request("GET", path, "", g_session.access_token);
-}
-
-// --- JSON helper -------------------------------------------------------------
-string json_get(const string& json, const string& key) {
-    string search = "\"" + key + "\":";
-    size_t pos = json.find(search);
-    if (pos == string::npos) return "";
-    pos += search.size();
-    while (pos < json.size() && json[pos] == ' ') pos++;
-    if (pos >= json.size()) return "";
-
-    if (json[pos] == '"') {
-        pos++;
-        string result;
-        while (pos < json.size() && json[pos] != '"') {
-            if (json[pos] == '\\' && pos + 1 < json.size()) pos++;
-            result += json[pos++];
-        }
-        return result;
-    }
+// Select a customer and map their cache file; no request goes out
+void switch_to(SessionManager::Id id) {
+    g_events.stop();
+    g_cache.close();
+    SessionManager::Info s;
+    if (!g_sessions.select(id) || !g_sessions.info(id, s)) return;
+    g_cache.open("mpesa_cache_" + s.username + ".dat");   // no cache = online only
+    follow(id);
+}
 
-    size_t end = json.find_first_of(",}\n]", pos);
-    if (end == string::npos) end = json.size();
-    string val = json.substr(pos, end - pos);
-    rtrim(val);
-    return val;
+// Drop the selected customer; the newest one still logged in takes over
+void end_session() {
+    g_events.stop();
+    close_outbox(g_sessions.current());
+    g_sessions.remove(g_sessions.current());
+    g_cache.close();
+    vector<SessionManager::Info> rest;
+    g_sessions.list(rest);
+    if (!rest.empty()) switch_to(rest.back().id);
 }
 
 // --- UI helpers --------------------------------------------------------------
-void clear_screen() { system("cls"); }
+void clear_screen() { g_screen->clear(); }
 
 void print_header() {
     set_color(CLR_CYAN);
@@ -259,56 +289,193 @@ void print_success(const string& msg) {
 void print_error(const string& msg) {
     set_color(CLR_RED);    cout << "  [ERROR] " << msg << "\n"; set_color(CLR_DEFAULT);
 }
+// Shown at once: "Processing..." must be visible while the request runs
 void print_info(const string& msg) {
     set_color(CLR_YELLOW); cout << "  [INFO]  " << msg << "\n"; set_color(CLR_DEFAULT);
+    g_screen->present();
 }
 
 void press_enter() {
     set_color(CLR_CYAN);
     cout << "\n  Press Enter to continue...";
     set_color(CLR_DEFAULT);
-    if (cin.peek() == '\n') cin.ignore();
-    cin.get();
+    int k;
+    while ((k = g_screen->read_key()) != '\n' && k != -1) {}
 }
 
 string get_input(const string& prompt) {
     set_color(CLR_YELLOW); cout << "  " << prompt;
     set_color(CLR_WHITE);
-    string s;
-    getline(cin, s);
+    string s = read_line(*g_screen);
     set_color(CLR_DEFAULT);
     return s;
 }
 
-// Hidden input using _getch(), shows * instead of characters
+// Hidden input: keys are read unechoed, * is drawn instead
 string get_hidden(const string& prompt) {
     set_color(CLR_YELLOW); cout << "  " << prompt;
     set_color(CLR_WHITE);
-    string s;
-    char ch;
-    while ((ch = (char)_getch()) != '\r') {
-        if (ch == '\b') {
-            if (!s.empty()) {
-                s.erase(s.size()-1, 1);   // C++98 safe erase
-                cout << "\b \b";
-            }
-        } else if (ch >= 32 && ch < 127) {
-            s += ch;
-            cout << '*';
-        }
-    }
-    cout << "\n";
+    string s = read_line(*g_screen, "*");
     set_color(CLR_DEFAULT);
     return s;
 }
 
-double get_amount(const string& prompt) {
+// A positive amount with at most two decimals ("1,500.50")
+bool get_amount(const string& prompt, Money& amount) {
     string s = get_input(prompt);
-    if (s.empty()) return -1.0;
-    return str_to_double(s);
+    return Money::parse(s, amount) && amount.positive();
 }
 
+// --- Cancellable calls --------------------------------------------------------
+// The request runs on its own thread while this one watches the keyboard:
+// Esc cancels it, and the pool gives up within CANCEL_POLL_MS (deadline.h).
+// Every call is bounded by its timeouts anyway; Esc is for not waiting them out.
+const unsigned ESC_HINT_MS = 300;   // quicker calls finish before the hint shows
+
+struct EscCall {
+    CancelToken cancel;
+    Event       done;
+
+    virtual ~EscCall() {}
+    virtual void call() = 0;        // worker thread
+
+    // Returns once call() has; inline if no thread can be started
+    void go() {
+        Thread worker;
+        if (!worker.start(run, this)) { run(this); return; }
+        uint64_t start = now_ms();
+        bool hinted = false;
+        while (!done.wait_ms(CancelToken::CANCEL_POLL_MS)) {
+            if (!hinted && !cancel.cancelled() && now_ms() - start >= ESC_HINT_MS) {
+                print_info("Press Esc to cancel.");
+                hinted = true;
+            }
+            if (g_screen->peek_key(0) == KEY_ESC) {
+                g_screen->read_key();
+                if (!cancel.cancelled()) { cancel.cancel(); print_info("Cancelling..."); }
+            }
+        }
+        worker.join();
+    }
+
+private:
+    static void run(void* self) {
+        EscCall* c = (EscCall*)self;
+        c->call();
+        c->done.set();
+    }
+};
+
+// One request, for the selected customer if `auth`
+struct RequestCall : EscCall {
+    const HttpRoute& route;
+    const char*      body;
+    size_t           len;
+    bool             auth;
+    HttpResponse     r;
+
+    RequestCall(const HttpRoute& rt, const char* b, size_t n, bool a)
+        : route(rt), body(b), len(n), auth(a) {}
+
+    void call() {
+        r = auth ? g_sessions.request(g_sessions.current(), route, body, len, &cancel)
+                 : g_http.request(route, body, len, "", NULL, &cancel);
+    }
+};
+
+// A money call with its automatic retries (transactions.h)
+struct TxnCall : EscCall {
+    const TxnRequest& req;
+    string            token;
+    TxnResult         r;
+
+    TxnCall(const TxnRequest& q, const string& tok) : req(q), token(tok) {}
+
+    void call() { r = post_txn(g_http, token, req, RetryPolicy(), &cancel); }
+};
+
 // --- Feature: Login -----------------------------------------------------------
+void print_dashboard(RequestBatch& dash, const HttpResponse& bal, const HistoryPage& recent) {
+    dash.wait();
+    BalanceReply reply;
+    if (json_decode(bal.body, reply) && bal.status_code == 200) {
+        store_balance(reply.balance);
+        set_color(CLR_CYAN); cout << "\n  Balance        : "; set_color(CLR_GREEN); cout << "KES " << reply.balance << "\n";
+        set_color(CLR_DEFAULT);
+    }
+
+    const vector<TxnRow>& rows = recent.rows;
+    if (recent.status_code != 200 || rows.empty()) return;
+    set_color(CLR_CYAN); cout << "  Recent activity:\n"; set_color(CLR_DEFAULT);
+    for (size_t i = 0; i < rows.size(); i++) {
+        const TxnRow& t = rows[i];
+        set_color(t.transaction_type == "SEND" || t.transaction_type == "WITHDRAW" ? CLR_RED : CLR_GREEN);
+        cout << "    " << left << setw(10) << t.transaction_type << setw(14) << money_text(t.amount)
+             << t.created_at.substr(0, 10) << "\n";
+    }
+    set_color(CLR_DEFAULT);
+}
+
+// --- Offline queue screens ----------------------------------------------------
+string queued_text(const TxnRequest& t) {
+    ostringstream out;
+    out << txn_type_name(t.type) << " KES " << t.amount;
+    if (t.type == TXN_SEND) out << " to " << t.recipient_phone;
+    return out.str();
+}
+
+// Entries from an earlier run: sends and withdrawals wait for the PIN,
+// which is never kept on disk
+void release_queued(bool at_login) {
+    Outbox* q = outbox();
+    if (!q || !q->pending()) return;
+    size_t waiting = q->waiting_for_pin();
+    if (at_login)
+        print_info(int_to_str((int)q->pending()) + " transaction(s) queued offline earlier will be sent in the background.");
+    if (!waiting) return;
+    string pin = get_hidden("Enter M-Pesa PIN to release " + int_to_str((int)waiting) +
+                            " of them (Enter to keep them queued): ");
+    if (!pin.empty()) q->supply_pin(pin);
+}
+
+// What the background flush settled since the menu was last drawn
+void report_queued() {
+    Outbox* q = outbox();
+    if (!q) return;
+    vector<OutboxOutcome> done;
+    q->take_outcomes(done);
+    for (size_t i = 0; i < done.size(); i++) {
+        const TxnResult& r = done[i].result;
+        if (r.ok()) {
+            print_success("Queued " + queued_text(done[i].entry.req) + " went through: " + r.transaction_id);
+            store_balance(r.new_balance);
+        } else {
+            print_error("Queued " + queued_text(done[i].entry.req) + " was refused: " + r.error);
+        }
+    }
+    if (q->pin_rejected()) print_error("The PIN for queued transactions was refused. Choose 9 to enter it again.");
+    size_t n = q->pending();
+    if (!n) return;
+    q->kick();                              // whatever just ran may have found the link back
+    size_t waiting = q->waiting_for_pin();
+    print_info(int_to_str((int)n) + " transaction(s) queued offline" +
+               (waiting ? ", " + int_to_str((int)waiting) + " waiting for the PIN." : ", sending when the server is back."));
+}
+
+// What the event stream pushed since the menu was last drawn
+void report_live() {
+    vector<TxnRow> rows;
+    Money balance;
+    if (g_live.take(rows, balance)) g_cache.store_balance(balance);
+    if (rows.empty()) return;
+    // An empty cache is filled by the first history sync, from the newest row back
+    if (g_cache.newest_id()) g_cache.append(rows, false);
+    for (size_t i = 0; i < rows.size(); i++)
+        if (rows[i].transaction_type == "RECEIVE")
+            print_success("Received KES " + money_text(rows[i].amount) + ". New balance: KES " +
+                          money_text(rows[i].balance_after));
+}
+
 void do_login() {
     clear_screen(); print_header();
     set_color(CLR_WHITE); cout << "\n  === LOGIN ===\n\n"; set_color(CLR_DEFAULT);
@@ -323,26 +490,58 @@ void do_login() {
 
     cout << "\n"; print_info("Connecting to M-Pesa server...");
 
-    string body = "{\"username\":\"" + username + "\",\"password\":\"" + password + "\"}";
-    HttpResponse r = http_post("/api/auth/login/", body);
-
+    LoginRequest req;
+    req.username = username;
+    req.password = password;
+    JsonBody<256> body;
+    json_encode(body, req);
+    RequestCall login(endpoint_route<LoginEndpoint>(), body.data(), body.size(), false);
+    login.go();
+    const HttpResponse& r = login.r;
+
+    LoginReply reply;
+    bool complete = json_decode(r.body, reply);
+    if (r.cancelled()) {
+        print_info("Login cancelled.");
+        press_enter(); return;
+    }
+    if (r.timed_out()) {
+        print_error(reply.error + ". Try again in a moment.");
+        press_enter(); return;
+    }
     if (r.status_code == 0) {
         print_error("Cannot reach server. Run: python manage.py runserver");
         press_enter(); return;
     }
 
-    if (r.status_code == 200) {
-        g_session.access_token  = json_get(r.body, "access");
-        g_session.refresh_token = json_get(r.body, "refresh");
-        g_session.username      = username;
-        g_session.full_name     = json_get(r.body, "full_name");
-        g_session.phone_number  = json_get(r.body, "phone_number");
-        g_session.logged_in     = true;
-        string name = g_session.full_name.empty() ? username : g_session.full_name;
-        print_success("Welcome, " + name + "!");
-        print_success("Phone: " + g_session.phone_number);
+    if (r.status_code == 200 && complete) {
+        SessionManager::Id again = g_sessions.find(username);
+        if (again != SessionManager::NONE) {            // logging in again replaces it
+            close_outbox(again);
+            g_sessions.remove(again);
+        }
+        SessionManager::Info me;
+        me.username     = username;
+        me.full_name    = reply.user.full_name;
+        me.phone_number = reply.user.phone_number;
+        SessionManager::Id id = g_sessions.add(me.username, me.full_name, me.phone_number,
+                                               reply.access, reply.refresh);
+        switch_to(id);
+        open_outbox(id, me.username);
+        // Dashboard: balance and recent activity in one background round-trip
+        HttpResponse bal;
+        HistoryPage  recent;
+        RequestBatch dash(access_token());
+        dash.add(BalanceEndpoint::method(), BalanceEndpoint::path(), "", &bal);
+        dash.add_history("", 3, &recent);
+        g_async.submit(&dash);
+
+        print_success("Welcome, " + display_name(me) + "!");
+        print_success("Phone: " + me.phone_number);
+        print_dashboard(dash, bal, recent);
+        release_queued(true);
     } else {
-        string err = json_get(r.body, "error");
+        string err = reply.error;
         if (err.empty()) err = "Login failed (HTTP " + int_to_str(r.status_code) + ")";
         print_error(err);
     }
@@ -351,42 +550,137 @@ void do_login() {
 
 // --- Feature: Logout ----------------------------------------------------------
 void do_logout() {
-    http_post("/api/auth/logout/", "{\"refresh\":\"" + g_session.refresh_token + "\"}", true);
-    g_session = Session();   // C++98: Session() not Session{}
+    Outbox* q = outbox();
+    size_t queued = q ? q->pending() : 0;
+    string refresh = g_sessions.refresh_token(g_sessions.current());
+    RefreshRequest req;
+    req.refresh = refresh;
+    JsonBody<1024> body;
+    json_encode(body, req);
+    http_post(endpoint_route<LogoutEndpoint>(), body, true);
+    end_session();
     clear_screen(); print_header();
     print_success("Logged out successfully. Goodbye!");
+    if (queued) print_info(int_to_str((int)queued) + " queued transaction(s) stay on this terminal and go out at the next login.");
+    SessionManager::Info next;
+    if (g_sessions.info(g_sessions.current(), next)) print_info("Now serving " + display_name(next) + ".");
     press_enter();
 }
 
 // --- Feature: Balance ---------------------------------------------------------
+// The last confirmed balance is drawn straight from the cache while the
+// live one is fetched.
+void print_balance_box(Money balance) {
+    set_color(CLR_GREEN);
+    cout << "  +================================+\n";
+    cout << "  |  Available Balance             |\n";
+    cout << "  |  KES ";
+    set_color(CLR_WHITE); cout << left << setw(26) << balance;
+    set_color(CLR_GREEN); cout << "|\n";
+    cout << "  +================================+\n";
+    set_color(CLR_DEFAULT);
+}
+
 void do_balance() {
     clear_screen(); print_header();
     set_color(CLR_WHITE); cout << "\n  === M-PESA BALANCE ===\n\n"; set_color(CLR_DEFAULT);
     print_divider();
 
-    HttpResponse r = http_get("/api/balance/");
-    if (r.status_code == 200) {
-        string balance = json_get(r.body, "balance");
-        string phone   = json_get(r.body, "phone_number");
-        string holder  = json_get(r.body, "account_holder");
+    RequestCall fetch(endpoint_route<BalanceEndpoint>(), NULL, 0, true);
+    Money cached;
+    int64_t synced_at = 0;
+    bool have_cached = g_cache.cached_balance(cached, synced_at);
+    SessionManager::Info me;
+    if (have_cached && g_sessions.info(g_sessions.current(), me)) {
         cout << "\n";
-        set_color(CLR_CYAN);  cout << "  Account Holder : "; set_color(CLR_WHITE); cout << holder << "\n";
-        set_color(CLR_CYAN);  cout << "  Phone Number   : "; set_color(CLR_WHITE); cout << phone  << "\n\n";
-        set_color(CLR_GREEN);
-        cout << "  +================================+\n";
-        cout << "  |  Available Balance             |\n";
-        cout << "  |  KES ";
-        set_color(CLR_WHITE); cout << left << setw(26) << balance;
-        set_color(CLR_GREEN); cout << "|\n";
-        cout << "  +================================+\n";
-        set_color(CLR_DEFAULT);
+        set_color(CLR_CYAN);  cout << "  Account Holder : "; set_color(CLR_WHITE); cout << display_name(me) << "\n";
+        set_color(CLR_CYAN);  cout << "  Phone Number   : "; set_color(CLR_WHITE); cout << me.phone_number << "\n\n";
+        print_balance_box(cached);
+        print_info("Cached balance - checking with server...");
+        fetch.go();
+
+        BalanceReply reply;
+        if (json_decode(fetch.r.body, reply) && fetch.r.status_code == 200) {
+            store_balance(reply.balance);
+            if (reply.balance == cached) print_success("Balance confirmed.");
+            else { print_success("Balance updated:"); print_balance_box(reply.balance); }
+        } else if (fetch.r.cancelled()) {
+            print_info("Cancelled (showing cached value).");
+        } else {
+            const string& err = reply.error;
+            print_error(err.empty() ? "Could not refresh balance (showing cached value)." : err);
+        }
+        press_enter();
+        return;
+    }
+
+    fetch.go();
+    const HttpResponse& r = fetch.r;
+    BalanceReply reply;
+    if (json_decode(r.body, reply) && r.status_code == 200) {
+        store_balance(reply.balance);
+        cout << "\n";
+        set_color(CLR_CYAN);  cout << "  Account Holder : "; set_color(CLR_WHITE); cout << reply.account_holder << "\n";
+        set_color(CLR_CYAN);  cout << "  Phone Number   : "; set_color(CLR_WHITE); cout << reply.phone_number << "\n\n";
+        print_balance_box(reply.balance);
+    } else if (r.cancelled()) {
+        print_info("Cancelled.");
     } else {
-        string err = json_get(r.body, "error");
+        const string& err = reply.error;
         print_error(err.empty() ? "Failed to get balance." : err);
     }
     press_enter();
 }
 
+// --- Transactions -------------------------------------------------------------
+// The idempotency key is fixed before the first attempt, so neither the
+// automatic retries in post_txn() nor a resend from the offline queue can
+// apply the same transaction twice. Esc stops the retries, but an attempt
+// already sent may still have been applied - once.
+
+// Into the selected customer's offline queue, with the key already chosen
+TxnResult queue_txn(Outbox& q, TxnRequest& req, const string& why) {
+    TxnResult r;
+    if (!q.enqueue(req)) {
+        r.error = why + ". It could not be queued either; check Transaction History before trying again.";
+        return r;
+    }
+    r.queued = true;
+    print_info(why + ".");
+    print_success("Queued. It goes out, once, as soon as the server can be reached.");
+    return r;
+}
+
+TxnResult submit_txn(TxnRequest& req) {
+    req.idempotency_key = new_idempotency_key();
+    Outbox* q = outbox();
+    if (q && q->pending())                  // never overtake what is already queued
+        return queue_txn(*q, req, "Earlier transactions are still queued; this one goes after them");
+    for (;;) {
+        TxnCall call(req, access_token());
+        call.go();
+        TxnResult& r = call.r;
+        if (r.failure == HTTP_FAIL_CANCELLED) {
+            r.error = "Cancelled. If it reached the server it went through once; check Transaction History.";
+            return r;
+        }
+        if (r.replayed)
+            print_info("An earlier attempt had already gone through; it was not repeated.");
+        else if (r.status_code != 0 && r.attempts > 1)
+            print_info("Went through after " + int_to_str(r.attempts) + " attempts.");
+        if (r.status_code != 0) return r;
+        if (q) return queue_txn(*q, req, r.error + " (" + int_to_str(r.attempts) + " attempts)");
+
+        print_error(r.error + " (" + int_to_str(r.attempts) + " attempts)");
+        string c = get_input("Retry? It cannot be applied twice (y/n): ");
+        if (c != "y" && c != "Y") {
+            r.error = "Not confirmed. Check Transaction History before trying again.";
+            return r;
+        }
+        print_info("Retrying...");
+    }
+}
+
 // --- Feature: Send Money ------------------------------------------------------
 void do_send() {
     clear_screen(); print_header();
@@ -396,8 +690,8 @@ void do_send() {
     string recipient = get_input("Recipient Phone (e.g. 0722345678): ");
     if (recipient.empty()) { print_error("Phone is required."); press_enter(); return; }
 
-    double amount = get_amount("Amount (KES): ");
-    if (amount <= 0) { print_error("Invalid amount."); press_enter(); return; }
+    Money amount;
+    if (!get_amount("Amount (KES): ", amount)) { print_error("Invalid amount."); press_enter(); return; }
 
     string desc = get_input("Description (optional, Enter to skip): ");
     string pin  = get_hidden("Enter M-Pesa PIN: ");
@@ -405,24 +699,25 @@ void do_send() {
 
     cout << "\n"; print_info("Processing transaction...");
 
-    ostringstream body;
-    body << "{\"recipient_phone\":\"" << recipient
-         << "\",\"amount\":"          << fixed << setprecision(2) << amount
-         << ",\"pin\":\""             << pin   << "\""
-         << ",\"description\":\""     << desc  << "\"}";
+    TxnRequest req;
+    req.type            = TXN_SEND;
+    req.recipient_phone = recipient;
+    req.amount          = amount;
+    req.pin             = pin;
+    req.description     = desc;
 
-    HttpResponse r = http_post("/api/send/", body.str(), true);
-    if (r.status_code == 200) {
+    TxnResult r = submit_txn(req);
+    if (r.ok()) {
         print_success("Money sent successfully!");
         cout << "\n";
-        set_color(CLR_CYAN); cout << "  Transaction ID : "; set_color(CLR_WHITE); cout << json_get(r.body, "transaction_id") << "\n";
+        set_color(CLR_CYAN); cout << "  Transaction ID : "; set_color(CLR_WHITE); cout << r.transaction_id << "\n";
         set_color(CLR_CYAN); cout << "  Sent To        : "; set_color(CLR_WHITE); cout << recipient << "\n";
-        set_color(CLR_CYAN); cout << "  Amount         : "; set_color(CLR_WHITE); cout << "KES " << fixed << setprecision(2) << amount << "\n";
-        set_color(CLR_CYAN); cout << "  New Balance    : "; set_color(CLR_GREEN); cout << "KES " << json_get(r.body, "new_balance") << "\n";
+        set_color(CLR_CYAN); cout << "  Amount         : "; set_color(CLR_WHITE); cout << "KES " << amount << "\n";
+        set_color(CLR_CYAN); cout << "  New Balance    : "; set_color(CLR_GREEN); cout << "KES " << r.new_balance << "\n";
+        store_balance(r.new_balance);
         set_color(CLR_DEFAULT);
-    } else {
-        string err = json_get(r.body, "error");
-        print_error(err.empty() ? "Transaction failed." : err);
+    } else if (!r.queued) {
+        print_error(r.error);
     }
     press_enter();
 }
@@ -434,27 +729,28 @@ void do_deposit() {
     print_info("Simulate a cash deposit via M-Pesa agent");
     print_divider();
 
-    double amount = get_amount("Deposit Amount (KES): ");
-    if (amount <= 0) { print_error("Invalid amount."); press_enter(); return; }
+    Money amount;
+    if (!get_amount("Deposit Amount (KES): ", amount)) { print_error("Invalid amount."); press_enter(); return; }
     string ref = get_input("Reference (optional): ");
 
     cout << "\n"; print_info("Processing deposit...");
 
-    ostringstream body;
-    body << "{\"amount\":"        << fixed << setprecision(2) << amount
-         << ",\"reference\":\"" << ref << "\"}";
+    TxnRequest req;
+    req.type      = TXN_DEPOSIT;
+    req.amount    = amount;
+    req.reference = ref;
 
-    HttpResponse r = http_post("/api/deposit/", body.str(), true);
-    if (r.status_code == 200) {
+    TxnResult r = submit_txn(req);
+    if (r.ok()) {
         print_success("Deposit successful!");
         cout << "\n";
-        set_color(CLR_CYAN); cout << "  Transaction ID : "; set_color(CLR_WHITE); cout << json_get(r.body, "transaction_id") << "\n";
-        set_color(CLR_CYAN); cout << "  Amount         : "; set_color(CLR_WHITE); cout << "KES " << fixed << setprecision(2) << amount << "\n";
-        set_color(CLR_CYAN); cout << "  New Balance    : "; set_color(CLR_GREEN); cout << "KES " << json_get(r.body, "new_balance") << "\n";
+        set_color(CLR_CYAN); cout << "  Transaction ID : "; set_color(CLR_WHITE); cout << r.transaction_id << "\n";
+        set_color(CLR_CYAN); cout << "  Amount         : "; set_color(CLR_WHITE); cout << "KES " << amount << "\n";
+        set_color(CLR_CYAN); cout << "  New Balance    : "; set_color(CLR_GREEN); cout << "KES " << r.new_balance << "\n";
+        store_balance(r.new_balance);
         set_color(CLR_DEFAULT);
-    } else {
-        string err = json_get(r.body, "error");
-        print_error(err.empty() ? "Deposit failed." : err);
+    } else if (!r.queued) {
+        print_error(r.error);
     }
     press_enter();
 }
@@ -465,47 +761,44 @@ void do_withdraw() {
     set_color(CLR_WHITE); cout << "\n  === WITHDRAW CASH ===\n\n"; set_color(CLR_DEFAULT);
     print_divider();
 
-    double amount = get_amount("Withdrawal Amount (KES): ");
-    if (amount <= 0) { print_error("Invalid amount."); press_enter(); return; }
+    Money amount;
+    if (!get_amount("Withdrawal Amount (KES): ", amount)) { print_error("Invalid amount."); press_enter(); return; }
     string pin = get_hidden("Enter M-Pesa PIN: ");
     if (pin.empty()) { print_error("PIN is required."); press_enter(); return; }
 
     cout << "\n"; print_info("Processing withdrawal...");
 
-    ostringstream body;
-    body << "{\"amount\":"    << fixed << setprecision(2) << amount
-         << ",\"pin\":\""     << pin   << "\""
-         << ",\"description\":\"Cash withdrawal\"}";
+    TxnRequest req;
+    req.type        = TXN_WITHDRAW;
+    req.amount      = amount;
+    req.pin         = pin;
+    req.description = "Cash withdrawal";
 
-    HttpResponse r = http_post("/api/withdraw/", body.str(), true);
-    if (r.status_code == 200) {
+    TxnResult r = submit_txn(req);
+    if (r.ok()) {
         print_success("Withdrawal successful!");
         cout << "\n";
-        set_color(CLR_CYAN); cout << "  Transaction ID : "; set_color(CLR_WHITE); cout << json_get(r.body, "transaction_id") << "\n";
-        set_color(CLR_CYAN); cout << "  Amount         : "; set_color(CLR_WHITE); cout << "KES " << fixed << setprecision(2) << amount << "\n";
-        set_color(CLR_CYAN); cout << "  New Balance    : "; set_color(CLR_GREEN); cout << "KES " << json_get(r.body, "new_balance") << "\n";
+        set_color(CLR_CYAN); cout << "  Transaction ID : "; set_color(CLR_WHITE); cout << r.transaction_id << "\n";
+        set_color(CLR_CYAN); cout << "  Amount         : "; set_color(CLR_WHITE); cout << "KES " << amount << "\n";
+        set_color(CLR_CYAN); cout << "  New Balance    : "; set_color(CLR_GREEN); cout << "KES " << r.new_balance << "\n";
+        store_balance(r.new_balance);
         set_color(CLR_DEFAULT);
-    } else {
-        string err = json_get(r.body, "error");
-        print_error(err.empty() ? "Withdrawal failed." : err);
+    } else if (!r.queued) {
+        print_error(r.error);
     }
     press_enter();
 }
 
 // --- Feature: Transaction History --------------------------------------------
-void do_history() {
+const int HISTORY_PAGE_SIZE = 10;
+
+void print_history_page(const HistoryPage& page, size_t page_no) {
     clear_screen(); print_header();
-    set_color(CLR_WHITE); cout << "\n  === TRANSACTION HISTORY (Last 10) ===\n\n"; set_color(CLR_DEFAULT);
+    set_color(CLR_WHITE); cout << "\n  === TRANSACTION HISTORY (Page " << page_no + 1 << ") ===\n\n"; set_color(CLR_DEFAULT);
     print_divider();
 
-    HttpResponse r = http_get("/api/transactions/?limit=10");
-    if (r.status_code != 200) {
-        print_error("Failed to fetch transactions.");
-        press_enter(); return;
-    }
-
     set_color(CLR_CYAN); cout << "  Total: ";
-    set_color(CLR_WHITE); cout << json_get(r.body, "count") << " transactions\n\n";
+    set_color(CLR_WHITE); cout << page.count << " transactions\n\n";
 
     set_color(CLR_YELLOW);
     cout << "  " << left << setw(10) << "TYPE"
@@ -516,41 +809,152 @@ void do_history() {
     cout << "  " << string(58, '-') << "\n";
     set_color(CLR_DEFAULT);
 
-    string s = r.body;
-    size_t pos = 0;
-    int n = 0;
-    while (n < 10) {
-        size_t p = s.find("\"transaction_type\"", pos);
-        if (p == string::npos) break;
-        string sub    = s.substr(p, 500);
-        string t_type = json_get(sub, "transaction_type");
-        string t_amt  = json_get(sub, "amount");
-        string t_bal  = json_get(sub, "balance_after");
-        string t_id   = json_get(sub, "transaction_id");
-
-        if (t_type == "SEND" || t_type == "WITHDRAW") set_color(CLR_RED);
+    for (size_t i = 0; i < page.rows.size(); i++) {
+        const TxnRow& t = page.rows[i];
+        if (t.transaction_type == "SEND" || t.transaction_type == "WITHDRAW") set_color(CLR_RED);
         else set_color(CLR_GREEN);
 
-        cout << "  " << left << setw(10) << t_type
-                              << setw(14) << t_amt
-                              << setw(14) << t_bal
-                              << t_id << "\n";
+        cout << "  " << left << setw(10) << t.transaction_type
+                              << setw(14) << money_text(t.amount)
+                              << setw(14) << money_text(t.balance_after)
+                              << t.transaction_id << "\n";
         set_color(CLR_DEFAULT);
-        pos = p + 1;
-        n++;
     }
-    if (n == 0) print_info("No transactions yet.");
+    if (page.rows.empty()) print_info("No transactions yet.");
+}
+
+// Cached pages are served from disk; only pages past the cached window go
+// to the server. Without a connection the cache is still browsable.
+void load_history_page(const string& cursor, HistoryPage& page, HistoryPrefetch* prefetch) {
+    if (g_cache.page_before(cursor, HISTORY_PAGE_SIZE, page)) return;
+    if (prefetch && prefetch->take(cursor, page)) return;
+    fetch_history_page(g_http, access_token(), cursor, HISTORY_PAGE_SIZE, page);
+}
+
+void do_history() {
+    bool offline = false;
+    if (g_cache.is_open()) {
+        string err;
+        offline = sync_history(g_http, access_token(), g_cache, err) != 200;
+    }
+
+    // cursors[k] fetched page k; "" is the newest page
+    vector<string> cursors(1, string());
+    HistoryPage page;
+    HistoryPrefetch prefetch;
+    load_history_page("", page, NULL);
+
+    while (true) {
+        if (page.status_code != 200) {
+            clear_screen(); print_header();
+            print_error(page.error.empty() ? "Failed to fetch transactions." : page.error);
+            press_enter(); return;
+        }
+
+        print_history_page(page, cursors.size() - 1);
+        if (offline) print_info("Offline - showing cached transactions.");
+        bool has_next = !page.next_cursor.empty();
+        bool has_prev = cursors.size() > 1;
+
+        // Next page downloads while the user reads this one (unless it is cached)
+        HistoryPage probe;
+        if (has_next && !g_cache.page_before(page.next_cursor, HISTORY_PAGE_SIZE, probe))
+            prefetch.start(g_http, access_token(), page.next_cursor, HISTORY_PAGE_SIZE);
+
+        cout << "\n";
+        print_divider();
+        if (has_next) cout << "  [N]  Next page\n";
+        if (has_prev) cout << "  [P]  Previous page\n";
+        cout << "  [Enter]  Back to menu\n";
+        string c = get_input("Select option: ");
+
+        if ((c == "n" || c == "N") && has_next) {
+            string next = page.next_cursor;
+            load_history_page(next, page, &prefetch);
+            cursors.push_back(next);
+        } else if ((c == "p" || c == "P") && has_prev) {
+            prefetch.cancel();
+            cursors.pop_back();
+            load_history_page(cursors.back(), page, NULL);
+        } else if (c.empty() || c == "q" || c == "Q") {
+            prefetch.cancel();
+            return;
+        }
+    }
+}
+
+// --- Feature: Metrics ---------------------------------------------------------
+// Snapshot of every request this session, for Prometheus' textfile
+// collector or a quick look in any JSON viewer.
+void do_metrics() {
+    clear_screen(); print_header();
+    set_color(CLR_WHITE); cout << "\n  EXPORT METRICS\n"; set_color(CLR_DEFAULT);
+    print_divider();
+    const char* files[] = { "mpesa_metrics.prom", "mpesa_metrics.json" };
+    for (int i = 0; i < 2; i++) {
+        if (g_metrics.write_file(files[i])) print_success(string("Wrote ") + files[i]);
+        else                                print_error(string("Could not write ") + files[i]);
+    }
     press_enter();
 }
 
+// --- Feature: Customers -------------------------------------------------------
+// Several customers can stay logged in at once, e.g. at an agent's counter.
+// Balances here come from the background poll, so neither the list nor a
+// switch waits on the server.
+void do_customers() {
+    while (true) {
+        clear_screen(); print_header();
+        set_color(CLR_WHITE); cout << "\n  === CUSTOMERS ===\n\n"; set_color(CLR_DEFAULT);
+        print_divider();
+        vector<SessionManager::Info> all;
+        g_sessions.list(all);
+        SessionManager::Id cur = g_sessions.current();
+        for (size_t i = 0; i < all.size(); i++) {
+            const SessionManager::Info& s = all[i];
+            set_color(s.id == cur ? CLR_GREEN : CLR_DEFAULT);
+            cout << "  [" << (i + 1) << "]  " << left << setw(24) << display_name(s) << setw(14) << s.phone_number;
+            if (s.balance_ms) cout << "KES " << s.balance;
+            if (s.expired)   cout << "  (expired)";
+            else if (s.idle) cout << "  (idle)";
+            cout << "\n";
+        }
+        set_color(CLR_DEFAULT);
+        print_divider();
+        cout << "  [A]  Add customer (login)\n";
+        cout << "  [Enter]  Back to menu\n";
+
+        string c = get_input("Select option: ");
+        int k = atoi(c.c_str());
+        if (c == "a" || c == "A") { do_login(); return; }
+        if (k >= 1 && k <= (int)all.size()) { switch_to(all[k - 1].id); return; }
+        if (c.empty() || g_screen->input_closed()) return;
+        print_error("Invalid option.");
+        press_enter();
+    }
+}
+
 // --- Menus --------------------------------------------------------------------
 void main_menu() {
-    while (true) {
+    SessionManager::Info me;
+    while (g_sessions.info(g_sessions.current(), me)) {
+        if (me.expired) {                    // refresh token rejected: log in again
+            print_error("Session expired for " + display_name(me) + ". Please log in again.");
+            end_session();
+            press_enter();
+            continue;
+        }
         clear_screen(); print_header();
-        string name = g_session.full_name.empty() ? g_session.username : g_session.full_name;
         set_color(CLR_CYAN); cout << "\n  Logged in: ";
-        set_color(CLR_WHITE); cout << name << "  [" << g_session.phone_number << "]\n\n";
+        set_color(CLR_WHITE); cout << display_name(me) << "  [" << me.phone_number << "]";
+        size_t others = g_sessions.size() - 1;
+        if (others) { set_color(CLR_CYAN); cout << "  +" << others << " more"; }
+        cout << "\n\n";
         set_color(CLR_DEFAULT);
+        report_live();
+        report_queued();
+        Outbox* q = outbox();
+        bool held = q && q->waiting_for_pin();
 
         set_color(CLR_WHITE); cout << "  MAIN MENU\n"; set_color(CLR_DEFAULT);
         print_divider();
@@ -559,17 +963,23 @@ void main_menu() {
         cout << "  [3]  Deposit\n";
         cout << "  [4]  Withdraw\n";
         cout << "  [5]  Transaction History\n";
-        cout << "  [6]  Logout\n";
+        cout << "  [6]  Export Metrics\n";
+        cout << "  [7]  Switch / Add Customer\n";
+        cout << "  [8]  Logout\n";
+        if (held) cout << "  [9]  Release Queued Transactions\n";
         print_divider();
 
-        string c = get_input("Select option (1-6): ");
+        string c = get_input(held ? "Select option (1-9): " : "Select option (1-8): ");
         if      (c == "1") do_balance();
         else if (c == "2") do_send();
         else if (c == "3") do_deposit();
         else if (c == "4") do_withdraw();
         else if (c == "5") do_history();
-        else if (c == "6") { do_logout(); break; }
-        else { print_error("Invalid option. Choose 1-6."); press_enter(); }
+        else if (c == "6") do_metrics();
+        else if (c == "7") do_customers();
+        else if (c == "8" || g_screen->input_closed()) do_logout();
+        else if (c == "9" && held) release_queued(false);
+        else { print_error(held ? "Invalid option. Choose 1-9." : "Invalid option. Choose 1-8."); press_enter(); }
     }
 }
 
@@ -586,8 +996,8 @@ void welcome_menu() {
         string c = get_input("Select option: ");
         if (c == "1") {
             do_login();
-            if (g_session.logged_in) main_menu();
-        } else if (c == "0") {
+            if (g_sessions.current() != SessionManager::NONE) main_menu();
+        } else if (c == "0" || g_screen->input_closed()) {
             clear_screen(); print_header();
             set_color(CLR_GREEN); cout << "\n  Thank you for using M-Pesa Terminal!\n\n";
             set_color(CLR_DEFAULT); break;
@@ -599,9 +1009,37 @@ void welcome_menu() {
 }
 
 // --- Entry point --------------------------------------------------------------
-int main() {
-    hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    SetConsoleOutputCP(CP_UTF8);
+int main(int argc, char** argv) {
+    g_http.set_observer(&g_metrics);
+    g_http.set_cache(&g_http_cache);
+
+    // Servers and per-endpoint timeouts (config.h); built-in defaults without the file
+    ClientConfig cfg;
+    string err;
+    if (!load_config(CONFIG_FILE, cfg, err)) {
+        cerr << "[ERROR] " << err << "\n";
+        return 1;
+    }
+    if (cfg.servers.empty()) cfg.servers.push_back(ServerAddr(SERVER_HOST, SERVER_PORT));
+    g_http.set_servers(cfg.servers, cfg.balancer);
+    g_http.set_timeouts(cfg.timeouts);
+
+    // Headless bulk mode: no menus, no console UI (see batch.h)
+    if (argc > 1) return batch_main(argc, argv, cfg);
+
+    // A session recorded to a trace, or replayed from one with no server
+    if (!g_trace.from_env(err)) {
+        cerr << "[ERROR] " << err << "\n";
+        return 1;
+    }
+
+    ConsoleTerminal term;
+    Screen screen(term);
+    g_screen = &screen;
+    streambuf* console = cout.rdbuf(&screen);
     welcome_menu();
+    screen.present();
+    cout.rdbuf(console);
+    cout << "\n";
     return 0;
 }
@@ -0,0 +1,525 @@
+/**
+ * ============================================
+ *   outbox.h - transactions queued while offline
+ * ============================================
+ *
+ *  When the server cannot be reached, a send,
+ *  deposit or withdrawal is written to a per-customer
+ *  log instead of failing, and a background worker
+ *  sends the queue, in order, once the link is back:
+ *
+ *      Outbox box(g_http);
+ *      box.open("mpesa_outbox_john.wal", err);
+ *      box.start(&auth);               // flushes in the background
+ *      box.enqueue(req);               // durable once it returns
+ *
+ *  The log is append-only text, one record a line:
+ *
+ *      <crc32 hex8> {"op":"queue","seq":7,...}
+ *      <crc32 hex8> {"op":"done","seq":7,"status":200,...}
+ *
+ *  enqueue() returns only after its record is on
+ *  disk. fsync is group-committed: whoever syncs
+ *  first covers every record written before it, so
+ *  concurrent callers and a whole group of "done"
+ *  records share one. Opening the log replays it;
+ *  the first torn or corrupt line ends it and is cut
+ *  off, and entries with no "done" record are pending
+ *  again. A failed fsync may have lost pages already
+ *  written, so the log is cut back to what was last
+ *  synced and takes no more records until reopened;
+ *  every enqueue() not yet durable returns 0.
+ *
+ *  The worker sends up to RequestBatch::MAX_CALLS
+ *  entries per POST /api/batch/, each with the
+ *  idempotency key it was queued with. An entry sent
+ *  just before a crash goes out again after restart
+ *  and the server replays the original (find_replay
+ *  in views.py): nothing is lost, nothing is applied
+ *  twice. No response, 429 and 5xx keep the entry
+ *  queued and back off; any other answer settles it.
+ *  Settling stops at the first entry that stays
+ *  queued: answers to the entries after it in the
+ *  same batch are not taken, and those entries go
+ *  out again behind it. One the server did apply is
+ *  then answered from its key; one it refused (say,
+ *  no funds yet) is tried again in order.
+ *
+ *  PINs are never written to disk. An entry replayed
+ *  from the log after a restart waits for the PIN to
+ *  be entered again (supply_pin); a deposit needs
+ *  none. The queue stops at such an entry, so later
+ *  ones never overtake it.
+ * ============================================
+ */
+#ifndef MPESA_OUTBOX_H
+#define MPESA_OUTBOX_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "json.h"
+#include "json_writer.h"
+#include "money.h"
+#include "transactions.h"
+#include "api_batch.h"
+#include "wal.h"
+#include "auth.h"
+
+// --- Entries ------------------------------------------------------------------
+struct OutboxEntry {
+    uint64_t   seq;                // order in the log
+    TxnRequest req;                // idempotency_key set; pin in memory only
+    time_t     queued_at;
+
+    OutboxEntry() : seq(0), queued_at(0) {}
+    bool needs_pin() const { return req.type != TXN_DEPOSIT && req.pin.empty(); }
+};
+
+// A queued entry the server has answered, for the UI to report
+struct OutboxOutcome {
+    OutboxEntry entry;
+    TxnResult   result;
+};
+
+struct OutboxStats {
+    unsigned long queued;          // enqueue() calls that succeeded
+    unsigned long recovered;       // pending entries found by open()
+    unsigned long torn_bytes;      // cut off the end of the log by open()
+    unsigned long settled;         // answered: ok() or refused
+    unsigned long round_trips;     // batch POSTs (or single calls) sent
+    unsigned long syncs;           // fsyncs, all kinds
+
+    OutboxStats() : queued(0), recovered(0), torn_bytes(0), settled(0), round_trips(0), syncs(0) {}
+};
+
+// --- Outbox -------------------------------------------------------------------
+class Outbox {
+public:
+    enum {
+        RETRY_MIN_MS  = 1000,          // first backoff after a failed flush
+        RETRY_MAX_MS  = 30000,         // ... doubling up to this
+        IDLE_MS       = 60000,         // nothing sendable: wake anyway, now and then
+        COMPACT_BYTES = 64 * 1024      // empty the log once settled and this big
+    };
+
+    explicit Outbox(HttpPool& http)
+        : http_(http), auth_(NULL), group_(RequestBatch::MAX_CALLS), next_seq_(1),
+          written_(0), synced_(0), unsettled_(0), broken_(false), stopping_(false), pin_rejected_(false) {}
+    ~Outbox() { close(); }
+
+    // Open (creating) and replay the log. Nothing is sent until start().
+    bool open(const std::string& path, std::string& error) {
+        close();
+        LockGuard s(sync_mu_);
+        LockGuard lock(mu_);
+        path_ = path;
+        if (!file_.open(path)) { error = "cannot open " + path + " (in use by another window?)"; return false; }
+        std::string log;
+        if (!file_.read_all(log)) { error = "cannot read " + path; file_.close(); return false; }
+        size_t good = replay(log);
+        stats_.recovered = (unsigned long)entries_.size();
+        stats_.torn_bytes = (unsigned long)(log.size() - good);
+        if (good < log.size() && !file_.truncate(good)) { error = "cannot repair " + path; file_.close(); return false; }
+        written_ = synced_ = good;
+        if (entries_.empty() && good) compact();
+        return true;
+    }
+
+    // Stop the worker and close the log; pending entries stay in it
+    void close() {
+        stop();
+        LockGuard s(sync_mu_);
+        LockGuard lock(mu_);
+        file_.close();
+        entries_.clear();
+        outcomes_.clear();
+        next_seq_ = 1;
+        written_ = synced_ = 0;
+        unsettled_ = 0;
+        broken_ = false;
+        pin_rejected_ = false;
+    }
+
+    bool is_open() {
+        LockGuard lock(mu_);
+        return file_.is_open();
+    }
+
+    // Entries per batch POST; Not synchronised: set once before start()
+    void set_group(size_t n) { group_ = n < 1 ? 1 : n > (size_t)RequestBatch::MAX_CALLS ? (size_t)RequestBatch::MAX_CALLS : n; }
+
+    // Background flushing with tokens from `auth`, which must outlive stop()
+    void start(TokenSource* auth) {
+        stop();
+        auth_ = auth;
+        stopping_ = false;
+        wake_.set();                        // first pass straight away
+        worker_.start(flush_loop, this);
+    }
+
+    // Cancels a flush in flight; its entries stay queued
+    void stop() {
+        if (!worker_.running()) return;
+        stopping_ = true;
+        cancel_.cancel();
+        wake_.set();
+        worker_.join();
+        cancel_.reset();
+    }
+
+    // The link may be back: flush now instead of at the next retry
+    void kick() { wake_.set(); }
+
+    // Queue req (its idempotency key is set if empty). The seq once the
+    // record is on disk; 0 if it could not be written or synced, and then
+    // it is not in the log either.
+    uint64_t enqueue(TxnRequest& req) {
+        if (req.idempotency_key.empty()) req.idempotency_key = new_idempotency_key();
+        OutboxEntry e;
+        e.req = req;
+        e.queued_at = time(NULL);
+        uint64_t end;
+        {
+            LockGuard lock(mu_);
+            if (!file_.is_open() || broken_) return 0;
+            e.seq = next_seq_;
+            std::string line;
+            queue_record(e, line);
+            if (!file_.append(line.data(), line.size())) {
+                file_.truncate(written_);           // no half record for the next one to follow
+                return 0;
+            }
+            next_seq_++;
+            written_ += line.size();
+            end = written_;
+            unsettled_++;
+        }
+        bool durable = sync_to(end);
+        LockGuard lock(mu_);
+        unsettled_--;
+        if (!durable) return 0;             // sync_to() cut it off the log
+        std::deque<OutboxEntry>::iterator at = entries_.end();
+        while (at != entries_.begin() && (at - 1)->seq > e.seq) --at;   // concurrent enqueues
+        entries_.insert(at, e);
+        stats_.queued++;
+        wake_.set();
+        return e.seq;
+    }
+
+    size_t pending() {
+        LockGuard lock(mu_);
+        return entries_.size();
+    }
+
+    void list(std::vector<OutboxEntry>& out) {
+        LockGuard lock(mu_);
+        out.assign(entries_.begin(), entries_.end());
+    }
+
+    // Entries held back until the PIN is entered again
+    size_t waiting_for_pin() {
+        LockGuard lock(mu_);
+        size_t n = 0;
+        for (size_t i = 0; i < entries_.size(); i++) if (entries_[i].needs_pin()) n++;
+        return n;
+    }
+
+    // The server refused a PIN since the last call; those entries wait again
+    bool pin_rejected() {
+        LockGuard lock(mu_);
+        bool r = pin_rejected_;
+        pin_rejected_ = false;
+        return r;
+    }
+
+    void supply_pin(const std::string& pin) {
+        {
+            LockGuard lock(mu_);
+            for (size_t i = 0; i < entries_.size(); i++)
+                if (entries_[i].needs_pin()) entries_[i].req.pin = pin;
+        }
+        wake_.set();
+    }
+
+    // Answers that came in since the last call
+    bool take_outcomes(std::vector<OutboxOutcome>& out) {
+        LockGuard lock(mu_);
+        out.clear();
+        out.swap(outcomes_);
+        return !out.empty();
+    }
+
+    OutboxStats stats() {
+        LockGuard lock(mu_);
+        return stats_;
+    }
+
+    // Send pending entries group by group until none is left, one waits
+    // for a PIN, or the server cannot be reached (false). On the caller's
+    // thread; the worker runs the same.
+    bool flush(TokenSource& auth) {
+        bool refreshed = false;
+        while (!stopping_) {
+            std::vector<OutboxEntry> group;
+            {
+                LockGuard lock(mu_);
+                for (size_t i = 0; i < entries_.size() && group.size() < group_; i++) {
+                    if (entries_[i].needs_pin()) break;
+                    group.push_back(entries_[i]);
+                }
+            }
+            if (group.empty()) return true;
+
+            std::string token = auth.token();
+            std::vector<HttpResponse> replies(group.size());
+            RequestBatch batch(token);
+            batch.set_cancel(&cancel_);
+            for (size_t i = 0; i < group.size(); i++) {
+                JsonBody<512> body;
+                txn_body(group[i].req, group[i].req.idempotency_key.c_str(), body);
+                batch.add("POST", txn_route(group[i].req.type).path,
+                          std::string(body.data(), body.size()), &replies[i]);
+            }
+            batch.send(http_);
+
+            {
+                LockGuard lock(mu_);
+                stats_.round_trips += (unsigned long)batch.round_trips();
+            }
+            int progress = settle(group, replies);
+            if (progress < 0) {                 // the token, not the entries
+                if (refreshed || !auth.refresh(token)) return false;
+                refreshed = true;
+                continue;
+            }
+            if (progress == 0) return false;    // unreachable, busy or failing: back off
+            refreshed = false;
+        }
+        return false;
+    }
+
+private:
+    // mu_ held. Rebuilds entries_ from the log; returns the bytes that are good.
+    size_t replay(const std::string& log) {
+        entries_.clear();
+        size_t at = 0;
+        uint64_t top = 0;
+        while (at < log.size()) {
+            size_t nl = log.find('\n', at);
+            if (nl == std::string::npos) break;     // torn: the write never finished
+            const char* json;
+            size_t len;
+            if (!wal_unframe(log.data() + at, nl - at, json, len)) break;
+            JsonIndex j;
+            j.parse(json, len);
+            std::string op = j.get("op");
+            uint64_t seq = strtoull(j.get("seq").c_str(), NULL, 10);
+            if (!seq || (op != "queue" && op != "done")) break;
+            if (op == "queue") {
+                OutboxEntry e;
+                e.seq = seq;
+                if (!parse_txn_type(j.get("type"), e.req.type) || !Money::parse(j.get("amount"), e.req.amount)) break;
+                e.req.recipient_phone = j.get("recipient_phone");
+                e.req.description     = j.get("description");
+                e.req.reference       = j.get("reference");
+                e.req.idempotency_key = j.get("key");
+                e.queued_at           = (time_t)strtoll(j.get("at").c_str(), NULL, 10);
+                entries_.push_back(e);
+            } else {
+                for (std::deque<OutboxEntry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+                    if (it->seq == seq) { entries_.erase(it); break; }
+            }
+            if (seq > top) top = seq;
+            at = nl + 1;
+        }
+        next_seq_ = top + 1;
+        return at;
+    }
+
+    void queue_record(const OutboxEntry& e, std::string& line) {
+        JsonBody<512> w;
+        w.begin_object();
+        w.field("op", "queue");
+        w.field("seq", (long long)e.seq);
+        w.field("type", txn_type_name(e.req.type));
+        w.field("amount", e.req.amount);
+        if (!e.req.recipient_phone.empty()) w.field("recipient_phone", e.req.recipient_phone);
+        if (!e.req.description.empty())     w.field("description", e.req.description);
+        if (!e.req.reference.empty())       w.field("reference", e.req.reference);
+        w.field("key", e.req.idempotency_key);
+        w.field("at", (long long)e.queued_at);
+        w.end_object();
+        wal_frame(w.data(), w.size(), line);
+    }
+
+    static void done_record(uint64_t seq, const TxnResult& r, std::string& line) {
+        JsonBody<256> w;
+        w.begin_object();
+        w.field("op", "done");
+        w.field("seq", (long long)seq);
+        w.field("status", r.status_code);
+        if (!r.transaction_id.empty()) w.field("transaction_id", r.transaction_id);
+        w.end_object();
+        wal_frame(w.data(), w.size(), line);
+    }
+
+    // Durable up to log offset `end`. One fsync covers everything written
+    // before it starts, so whoever waits behind it usually has nothing to do.
+    bool sync_to(uint64_t end) {
+        LockGuard s(sync_mu_);
+        if (synced_ >= end) return true;
+        uint64_t upto;
+        {
+            LockGuard lock(mu_);
+            if (broken_) return false;
+            upto = written_;
+            stats_.syncs++;
+        }
+        if (!file_.sync()) {
+            // The kernel may have dropped the unsynced pages, and a later
+            // fsync could report success anyway: keep only what is known
+            // durable and refuse further records
+            LockGuard lock(mu_);
+            broken_ = true;
+            if (file_.truncate(synced_)) written_ = synced_;
+            return false;
+        }
+        synced_ = upto;
+        return true;
+    }
+
+    // Record answers in queue order up to the first entry that must be sent
+    // again; it and everything after it stay queued. Entries settled, or -1
+    // if the token was refused.
+    int settle(const std::vector<OutboxEntry>& group, const std::vector<HttpResponse>& replies) {
+        std::string lines;
+        int settled = 0;
+        bool auth_failed = false;
+        uint64_t end;
+        {
+            LockGuard lock(mu_);
+            for (size_t i = 0; i < group.size(); i++) {
+                const HttpResponse& r = replies[i];
+                TxnReply reply;
+                json_decode(r.body, reply);
+                if (r.status_code == 401 && reply.error == "Invalid PIN") {   // not token_rejected()
+                    forget_pin(group[i].seq);
+                    pin_rejected_ = true;
+                    break;
+                }
+                if (token_rejected(r)) { auth_failed = true; break; }
+                if (txn_retryable(r.status_code) || r.status_code >= 500) break;
+
+                OutboxOutcome o;
+                o.entry = group[i];
+                o.result.status_code = r.status_code;
+                o.result.attempts = 1;
+                if (r.status_code == 200) {
+                    o.result.transaction_id = reply.transaction_id;
+                    o.result.new_balance = reply.new_balance;
+                    o.result.replayed = reply.replayed;
+                } else {
+                    o.result.error = reply.error.empty() ? reply.detail : reply.error;
+                    if (o.result.error.empty()) o.result.error = "Refused (HTTP " + int_text(r.status_code) + ")";
+                }
+                done_record(group[i].seq, o.result, lines);
+                remove(group[i].seq);
+                o.entry.req.pin.clear();
+                outcomes_.push_back(o);
+                settled++;
+            }
+            if (!settled) return auth_failed ? -1 : 0;
+            if (broken_ || !file_.append(lines.data(), lines.size())) {
+                file_.truncate(written_);       // answers are kept in memory; resent later if need be
+                return settled;
+            }
+            written_ += lines.size();
+            end = written_;
+            stats_.settled += (unsigned long)settled;
+        }
+        sync_to(end);                           // one fsync for the whole group
+        maybe_compact();
+        return settled;
+    }
+
+    // mu_ held
+    void remove(uint64_t seq) {
+        for (std::deque<OutboxEntry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
+            if (it->seq == seq) { entries_.erase(it); return; }
+    }
+
+    void forget_pin(uint64_t seq) {
+        for (size_t i = 0; i < entries_.size(); i++)
+            if (entries_[i].seq == seq) entries_[i].req.pin.clear();
+    }
+
+    // Empty a settled log once it has grown; nothing in it is needed again
+    void maybe_compact() {
+        LockGuard s(sync_mu_);
+        LockGuard lock(mu_);
+        if (entries_.empty() && !unsettled_ && !broken_ && written_ >= COMPACT_BYTES) compact();
+    }
+
+    // sync_mu_ and mu_ held, nothing pending
+    void compact() {
+        if (!file_.truncate(0)) return;
+        file_.sync();
+        stats_.syncs++;
+        written_ = synced_ = 0;
+        next_seq_ = 1;
+    }
+
+    static std::string int_text(int v) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", v);
+        return buf;
+    }
+
+    static void flush_loop(void* self) {
+        Outbox* o = (Outbox*)self;
+        unsigned backoff = 0;
+        for (;;) {
+            o->wake_.wait_ms(backoff ? backoff : (unsigned)IDLE_MS);
+            o->wake_.reset();
+            if (o->stopping_) return;
+            if (o->flush(*o->auth_)) { backoff = 0; continue; }
+            if (o->stopping_) return;
+            backoff = backoff ? backoff * 2 : (unsigned)RETRY_MIN_MS;
+            if (backoff > (unsigned)RETRY_MAX_MS) backoff = RETRY_MAX_MS;
+        }
+    }
+
+    Outbox(const Outbox&);
+    Outbox& operator=(const Outbox&);
+
+    HttpPool&                  http_;
+    TokenSource*               auth_;
+    size_t                     group_;
+    std::string                path_;
+    LogFile                    file_;
+    std::deque<OutboxEntry>    entries_;        // pending, by seq
+    std::vector<OutboxOutcome> outcomes_;
+    OutboxStats                stats_;
+    uint64_t                   next_seq_;
+    uint64_t                   written_;        // log bytes appended
+    uint64_t                   synced_;         // ... and known durable (sync_mu_)
+    int                        unsettled_;      // written, not yet durable or pending
+    bool                       broken_;         // an fsync failed; no more appends
+    volatile bool              stopping_;
+    bool                       pin_rejected_;
+    Thread                     worker_;
+    Event                      wake_;
+    CancelToken                cancel_;
+    Mutex                      sync_mu_;        // before mu_
+    Mutex                      mu_;
+};
+
+#endif // MPESA_OUTBOX_H
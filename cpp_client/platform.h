@@ -0,0 +1,281 @@
+/**
+ * ============================================
+ *   platform.h - threading & clock wrappers
+ * ============================================
+ *
+ *  TDM-GCC 4.9.2 uses the win32 thread model, so
+ *  std::thread / std::mutex are NOT available there.
+ *  These wrappers (mutex, event, semaphore, thread,
+ *  atomics, clock, process id) sit directly on the WinAPI on Windows and
+ *  on pthreads everywhere else.
+ * ============================================
+ */
+#ifndef MPESA_PLATFORM_H
+#define MPESA_PLATFORM_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include <stdint.h>
+
+// --- Mutex -------------------------------------------------------------------
+class Mutex {
+public:
+#ifdef _WIN32
+    Mutex()  { InitializeCriticalSection(&cs_); }
+    ~Mutex() { DeleteCriticalSection(&cs_); }
+    void lock()   { EnterCriticalSection(&cs_); }
+    void unlock() { LeaveCriticalSection(&cs_); }
+#else
+    Mutex()  { pthread_mutex_init(&m_, NULL); }
+    ~Mutex() { pthread_mutex_destroy(&m_); }
+    void lock()   { pthread_mutex_lock(&m_); }
+    void unlock() { pthread_mutex_unlock(&m_); }
+#endif
+
+private:
+    Mutex(const Mutex&);              // non-copyable (C++98 style)
+    Mutex& operator=(const Mutex&);
+#ifdef _WIN32
+    CRITICAL_SECTION cs_;
+#else
+    pthread_mutex_t  m_;
+#endif
+};
+
+// Scoped lock, released on every return path
+class LockGuard {
+public:
+    explicit LockGuard(Mutex& m) : m_(m) { m_.lock(); }
+    ~LockGuard() { m_.unlock(); }
+private:
+    LockGuard(const LockGuard&);
+    LockGuard& operator=(const LockGuard&);
+    Mutex& m_;
+};
+
+// --- Event -------------------------------------------------------------------
+// Manual-reset: once set(), every wait() returns until reset().
+class Event {
+public:
+#ifdef _WIN32
+    Event()  { h_ = CreateEvent(NULL, TRUE, FALSE, NULL); }
+    ~Event() { CloseHandle(h_); }
+    void set()   { SetEvent(h_); }
+    void reset() { ResetEvent(h_); }
+    void wait()  { WaitForSingleObject(h_, INFINITE); }
+    bool wait_ms(unsigned ms) { return WaitForSingleObject(h_, ms) == WAIT_OBJECT_0; }
+    bool is_set() { return wait_ms(0); }
+#else
+    Event() : set_(false) {
+        pthread_mutex_init(&m_, NULL);
+        pthread_cond_init(&c_, NULL);
+    }
+    ~Event() { pthread_cond_destroy(&c_); pthread_mutex_destroy(&m_); }
+    void set() {
+        pthread_mutex_lock(&m_);
+        set_ = true;
+        pthread_cond_broadcast(&c_);
+        pthread_mutex_unlock(&m_);
+    }
+    void reset() { pthread_mutex_lock(&m_); set_ = false; pthread_mutex_unlock(&m_); }
+    void wait() {
+        pthread_mutex_lock(&m_);
+        while (!set_) pthread_cond_wait(&c_, &m_);
+        pthread_mutex_unlock(&m_);
+    }
+    bool wait_ms(unsigned ms) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += ms / 1000;
+        ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+        pthread_mutex_lock(&m_);
+        while (!set_ && pthread_cond_timedwait(&c_, &m_, &ts) == 0) {}
+        bool s = set_;
+        pthread_mutex_unlock(&m_);
+        return s;
+    }
+    bool is_set() { pthread_mutex_lock(&m_); bool s = set_; pthread_mutex_unlock(&m_); return s; }
+#endif
+
+private:
+    Event(const Event&);
+    Event& operator=(const Event&);
+#ifdef _WIN32
+    HANDLE h_;
+#else
+    pthread_mutex_t m_;
+    pthread_cond_t  c_;
+    bool            set_;
+#endif
+};
+
+// --- Semaphore ---------------------------------------------------------------
+// Counting semaphore for work queues: post() once per item, wait() per take.
+class Semaphore {
+public:
+#ifdef _WIN32
+    Semaphore()  { h_ = CreateSemaphore(NULL, 0, 0x7fffffff, NULL); }
+    ~Semaphore() { CloseHandle(h_); }
+    void post() { ReleaseSemaphore(h_, 1, NULL); }
+    void wait() { WaitForSingleObject(h_, INFINITE); }
+#else
+    Semaphore() : count_(0) {
+        pthread_mutex_init(&m_, NULL);
+        pthread_cond_init(&c_, NULL);
+    }
+    ~Semaphore() { pthread_cond_destroy(&c_); pthread_mutex_destroy(&m_); }
+    void post() {
+        pthread_mutex_lock(&m_);
+        count_++;
+        pthread_cond_signal(&c_);
+        pthread_mutex_unlock(&m_);
+    }
+    void wait() {
+        pthread_mutex_lock(&m_);
+        while (count_ == 0) pthread_cond_wait(&c_, &m_);
+        count_--;
+        pthread_mutex_unlock(&m_);
+    }
+#endif
+
+private:
+    Semaphore(const Semaphore&);
+    Semaphore& operator=(const Semaphore&);
+#ifdef _WIN32
+    HANDLE h_;
+#else
+    pthread_mutex_t m_;
+    pthread_cond_t  c_;
+    unsigned        count_;
+#endif
+};
+
+// --- Thread ------------------------------------------------------------------
+// Runs fn(arg) on its own thread. The Thread object must outlive the thread;
+// the destructor joins if the caller has not.
+class Thread {
+public:
+    typedef void (*Func)(void*);
+
+    Thread() : fn_(NULL), arg_(NULL), running_(false) {}
+    ~Thread() { join(); }
+
+    bool start(Func fn, void* arg) {
+        if (running_) return false;
+        fn_ = fn; arg_ = arg;
+#ifdef _WIN32
+        handle_ = CreateThread(NULL, 0, trampoline, this, 0, NULL);
+        running_ = handle_ != NULL;
+#else
+        running_ = pthread_create(&handle_, NULL, trampoline, this) == 0;
+#endif
+        return running_;
+    }
+
+    void join() {
+        if (!running_) return;
+#ifdef _WIN32
+        WaitForSingleObject(handle_, INFINITE);
+        CloseHandle(handle_);
+#else
+        pthread_join(handle_, NULL);
+#endif
+        running_ = false;
+    }
+
+    bool running() const { return running_; }
+
+private:
+    Thread(const Thread&);
+    Thread& operator=(const Thread&);
+
+#ifdef _WIN32
+    static DWORD WINAPI trampoline(LPVOID self) {
+        Thread* t = (Thread*)self;
+        t->fn_(t->arg_);
+        return 0;
+    }
+    HANDLE handle_;
+#else
+    static void* trampoline(void* self) {
+        Thread* t = (Thread*)self;
+        t->fn_(t->arg_);
+        return NULL;
+    }
+    pthread_t handle_;
+#endif
+    Func  fn_;
+    void* arg_;
+    bool  running_;
+};
+
+// --- Atomics -----------------------------------------------------------------
+// Lock-free 64-bit counters for hot paths (metrics). GCC builtins work on
+// both TDM-GCC and Linux GCC; std::atomic is not an option in C++98.
+inline uint64_t atomic_add(volatile uint64_t* p, uint64_t v) {
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONGLONG*)p, (LONGLONG)v) + v;
+#else
+    return __sync_add_and_fetch(p, v);
+#endif
+}
+
+inline bool atomic_cas(volatile uint64_t* p, uint64_t expected, uint64_t desired) {
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedCompareExchange64((volatile LONGLONG*)p, (LONGLONG)desired,
+                                                  (LONGLONG)expected) == expected;
+#else
+    return __sync_bool_compare_and_swap(p, expected, desired);
+#endif
+}
+
+// Full barrier: publishes plain writes before a flag/count other threads read
+inline void atomic_fence() {
+#ifdef _MSC_VER
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+// --- Clock -------------------------------------------------------------------
+// Monotonic time; never goes backwards when the wall clock is adjusted.
+inline uint64_t now_ns() {
+#ifdef _WIN32
+    static LARGE_INTEGER freq = { { 0, 0 } };
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (uint64_t)((double)t.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+inline uint64_t now_ms() { return now_ns() / 1000000ULL; }
+
+inline void sleep_ms(unsigned ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+inline unsigned long process_id() {
+#ifdef _WIN32
+    return (unsigned long)GetCurrentProcessId();
+#else
+    return (unsigned long)getpid();
+#endif
+}
+
+#endif // MPESA_PLATFORM_H
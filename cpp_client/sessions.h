@@ -0,0 +1,424 @@
+/**
+ * ============================================
+ *   sessions.h - many logged-in customers at once
+ * ============================================
+ *
+ *  SessionManager holds every customer logged in
+ *  on this terminal, each with its own token pair,
+ *  over the one HttpPool and AsyncClient:
+ *
+ *      SessionManager g_sessions(g_http, g_async);
+ *      Id id = g_sessions.add(user, name, phone, access, refresh);
+ *      g_sessions.select(id);                  // switch: no I/O
+ *      g_sessions.request(id, endpoint_route<BalanceEndpoint>(), NULL, 0);
+ *
+ *  Tokens follow TokenManager's schedule and share
+ *  its refresh step (TokenPair, auth.h): renewed in
+ *  the background at 80% of their life, inline if
+ *  that has not landed in time, once more after a
+ *  rejected token, and single-flight per session.
+ *  One background thread serves every session; the
+ *  renewals and balance polls it finds due go out
+ *  together on the AsyncClient workers, so a hundred
+ *  sessions cost a hundred requests, not threads.
+ *
+ *  A session whose balance is pushed to it (an
+ *  open event stream, events.h) is not polled.
+ *
+ *  A session unused for IDLE_S drops its access
+ *  token and is no longer renewed or polled. What is
+ *  left is the profile, the refresh token and the
+ *  last balance, a few hundred bytes; the next use
+ *  refreshes inline.
+ *
+ *  Every method is thread-safe. Sessions are named
+ *  by Id, never by pointer, so one can be removed
+ *  while a background request for it is in flight.
+ * ============================================
+ */
+#ifndef MPESA_SESSIONS_H
+#define MPESA_SESSIONS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "json.h"
+#include "json_writer.h"
+#include "endpoints.h"
+#include "money.h"
+#include "async.h"
+#include "auth.h"
+
+class SessionManager {
+public:
+    typedef uint32_t Id;
+
+    enum {
+        NONE          = 0,
+        POLL_S        = 30,        // balance refresh for sessions in use
+        IDLE_S        = 600,       // unused this long: drop the access token
+        MAX_JOBS      = 16         // requests per background pass
+    };
+
+    // A copy of one session for the UI
+    struct Info {
+        Id          id;
+        std::string username, full_name, phone_number;
+        Money       balance;
+        uint64_t    balance_ms;    // now_ms() of the last balance; 0 = none yet
+        bool        idle, expired;
+
+        Info() : id(NONE), balance_ms(0), idle(false), expired(false) {}
+    };
+
+    SessionManager(HttpPool& http, AsyncClient& async)
+        : http_(http), async_(async), next_id_(1), current_(NONE),
+          idle_ms_((uint64_t)IDLE_S * 1000), poll_ms_((uint64_t)POLL_S * 1000),
+          refreshes_(0), polls_(0) {}
+    ~SessionManager() {
+        stop();
+        for (Map::iterator it = sessions_.begin(); it != sessions_.end(); ++it) delete it->second;
+    }
+
+    // After a login. Starts the background thread on first use.
+    Id add(const std::string& username, const std::string& full_name, const std::string& phone,
+           const std::string& access, const std::string& refresh) {
+        Entry* e = new Entry;
+        e->username = username; e->full_name = full_name; e->phone_number = phone;
+        e->tokens.refresh = refresh;
+        e->tokens.install(access);
+        e->used_ms = now_ms();
+        e->poll_ms = e->used_ms + poll_ms_;     // the login screen fetches the first one
+        Id id;
+        {
+            LockGuard lock(mu_);
+            id = next_id_++;
+            sessions_[id] = e;
+        }
+        if (!worker_.running()) {
+            stop_.reset();
+            worker_.start(work_loop, this);     // no thread: inline refresh still works
+        }
+        return id;
+    }
+
+    // Logout / expiry. A refresh in flight lands on nothing.
+    void remove(Id id) {
+        Entry* e = NULL;
+        {
+            LockGuard lock(mu_);
+            Map::iterator it = sessions_.find(id);
+            if (it == sessions_.end()) return;
+            e = it->second;
+            sessions_.erase(it);
+            if (current_ == id) current_ = NONE;
+        }
+        delete e;                               // its Flight, if any, belongs to the refresher
+    }
+
+    // Switching is a map lookup: tokens and balances are already here
+    bool select(Id id) {
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        if (!e) return false;
+        current_ = id;
+        e->used_ms = now_ms();
+        return true;
+    }
+
+    Id current() {
+        LockGuard lock(mu_);
+        return current_;
+    }
+
+    // The session already holding `username`, or NONE
+    Id find(const std::string& username) {
+        LockGuard lock(mu_);
+        for (Map::const_iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+            if (it->second->username == username) return it->first;
+        return NONE;
+    }
+
+    bool info(Id id, Info& out) {
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        if (!e) return false;
+        copy_info(id, *e, out);
+        return true;
+    }
+
+    // Every session, in login order
+    void list(std::vector<Info>& out) {
+        LockGuard lock(mu_);
+        out.resize(sessions_.size());
+        size_t i = 0;
+        for (Map::const_iterator it = sessions_.begin(); it != sessions_.end(); ++it, ++i)
+            copy_info(it->first, *it->second, out[i]);
+    }
+
+    size_t size() {
+        LockGuard lock(mu_);
+        return sessions_.size();
+    }
+
+    // As TokenManager::access_token(); marks the session as in use
+    std::string access_token(Id id) { return token(id, true); }
+
+    // For background work: never wakes an idle session (empty while idle)
+    std::string background_token(Id id) { return token(id, false); }
+
+    std::string refresh_token(Id id) {
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        return e ? e->tokens.refresh : std::string();
+    }
+
+    // The server refused the refresh token: only a new login helps
+    bool expired(Id id) {
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        return e && e->tokens.dead;
+    }
+
+    // A balance the UI fetched itself, so the list shows the newest one
+    void note_balance(Id id, Money balance) {
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        if (!e) return;
+        e->balance = balance;
+        e->balance_ms = now_ms();
+    }
+
+    // Balance updates arrive on an event stream: stop polling for them
+    void set_streamed(Id id, bool on) {
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        if (!e) return;
+        if (on) e->flags |= STREAMED;
+        else    e->flags &= ~(unsigned)STREAMED;
+    }
+
+    // Replace `stale` with a fresh access token for this session, as
+    // TokenManager::refresh(): one request however many threads ask.
+    bool refresh(Id id, const std::string& stale) {
+        Flight* f;
+        std::string rt;
+        {
+            LockGuard lock(mu_);
+            Entry* e = find(id);
+            if (!e) return false;
+            if (e->tokens.access != stale) return !e->tokens.access.empty();
+            if (e->tokens.dead || e->tokens.refresh.empty()) return false;
+            if (!e->flight) {
+                e->flight = new Flight;
+                rt = e->tokens.refresh;
+            } else {
+                e->flight->waiters++;
+            }
+            f = e->flight;
+        }
+        if (rt.empty()) {                       // someone else is refreshing
+            f->done.wait();
+            LockGuard lock(mu_);
+            if (--f->waiters == 0) delete f;
+            Entry* e = find(id);
+            return e && e->tokens.access != stale && !e->tokens.access.empty();
+        }
+
+        HttpResponse r = request_refresh(http_, endpoint_route<RefreshEndpoint>(), rt);
+        bool renewed = false;
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        if (e) {
+            renewed = rotate_tokens(e->tokens, r);
+            if (renewed) refreshes_++;
+            e->flight = NULL;
+        }
+        f->done.set();
+        if (f->waiters == 0) delete f;
+        return renewed;
+    }
+
+    // Authenticated request; a rejected token triggers one refresh and one retry
+    HttpResponse request(Id id, const HttpRoute& route, const char* body, size_t body_len,
+                         CancelToken* cancel = NULL) {
+        std::string tok = access_token(id);
+        HttpResponse r = http_.request(route, body, body_len, tok, NULL, cancel);
+        if (token_rejected(r) && refresh(id, tok))
+            r = http_.request(route, body, body_len, access_token(id), NULL, cancel);
+        return r;
+    }
+
+    // One background pass: idle out, then renew and poll what is due, all
+    // at once on the AsyncClient. Returns ms until the next deadline.
+    unsigned run_due() {
+        Job* jobs[MAX_JOBS];
+        int n = 0;
+        uint64_t next_ms = 60000;
+        {
+            LockGuard lock(mu_);
+            uint64_t now = now_ns(), ms = now / 1000000ULL;
+            for (Map::iterator it = sessions_.begin(); it != sessions_.end(); ++it) {
+                Entry* e = it->second;
+                TokenPair& t = e->tokens;
+                if (t.access.empty() || t.dead || e->flight) continue;
+                if (ms - e->used_ms >= idle_ms_) {
+                    std::string().swap(t.access);           // give the memory back
+                    t.stale_ns = t.renew_ns = 0;
+                    continue;
+                }
+                bool renew = t.renew_ns && now >= t.renew_ns && !t.refresh.empty();
+                bool poll  = ms >= e->poll_ms;
+                if (poll && (e->flags & STREAMED)) {            // pushed; poll again if it drops
+                    e->poll_ms = ms + poll_ms_;
+                    poll = false;
+                }
+                if ((renew || poll) && n == MAX_JOBS) { next_ms = 0; continue; }
+                if (renew) { jobs[n++] = new Job(this, it->first, t.access, true); continue; }
+                if (poll) {
+                    jobs[n++] = new Job(this, it->first, t.access, false);
+                    e->poll_ms = ms + poll_ms_;
+                    continue;
+                }
+                uint64_t due = e->used_ms + idle_ms_ - ms;
+                if (t.renew_ns && (t.renew_ns - now) / 1000000ULL + 1 < due)
+                    due = (t.renew_ns - now) / 1000000ULL + 1;
+                if (e->poll_ms - ms < due) due = e->poll_ms - ms;
+                if (due < next_ms) next_ms = due;
+            }
+        }
+        for (int i = 0; i < n; i++) async_.submit(jobs[i]);
+        for (int i = 0; i < n; i++) delete jobs[i];     // waits for each
+        return n ? 0 : (unsigned)next_ms;
+    }
+
+    void stop() {
+        stop_.set();
+        worker_.join();
+    }
+
+    // Shorter timings for tests and the benchmark
+    void tune(uint64_t idle_ms, uint64_t poll_ms) {
+        LockGuard lock(mu_);
+        idle_ms_ = idle_ms;
+        poll_ms_ = poll_ms;
+    }
+
+    uint64_t refreshes() { LockGuard lock(mu_); return refreshes_; }
+    uint64_t polls()     { LockGuard lock(mu_); return polls_; }
+
+private:
+    enum { STREAMED = 1 };
+
+    // One refresh in flight; the last of the refresher and its waiters frees it
+    struct Flight {
+        Event done;
+        int   waiters;
+        Flight() : waiters(0) {}
+    };
+
+    // Kept small: one per logged-in customer, most of them idle
+    struct Entry {
+        std::string username, full_name, phone_number;
+        TokenPair   tokens;                     // access is empty while idle
+        uint64_t    used_ms, poll_ms, balance_ms;
+        Money       balance;
+        Flight*     flight;
+        unsigned    flags;
+
+        Entry() : used_ms(0), poll_ms(0), balance_ms(0), flight(NULL), flags(0) {}
+    };
+    typedef std::map<Id, Entry*> Map;
+
+    // A background renewal or balance poll
+    class Job : public AsyncTask {
+    public:
+        Job(SessionManager* m, Id id, const std::string& tok, bool renew)
+            : m_(m), id_(id), tok_(tok), renew_(renew) {}
+        ~Job() { wait(); }
+
+        void run(HttpPool&) { if (renew_) m_->refresh(id_, tok_); else m_->poll(id_); }
+
+    private:
+        SessionManager* m_;
+        Id              id_;
+        std::string     tok_;
+        bool            renew_;
+    };
+
+    // mu_ held
+    Entry* find(Id id) {
+        Map::iterator it = sessions_.find(id);
+        return it == sessions_.end() ? NULL : it->second;
+    }
+
+    static void copy_info(Id id, const Entry& e, Info& out) {
+        out.id = id;
+        out.username = e.username; out.full_name = e.full_name; out.phone_number = e.phone_number;
+        out.balance = e.balance;
+        out.balance_ms = e.balance_ms;
+        out.idle = e.tokens.access.empty();
+        out.expired = e.tokens.dead;
+    }
+
+    // `use` is false for background work, so polling never keeps a session awake
+    std::string token(Id id, bool use) {
+        std::string tok;
+        {
+            LockGuard lock(mu_);
+            Entry* e = find(id);
+            if (!e) return tok;
+            if (use) e->used_ms = now_ms();
+            tok = e->tokens.access;
+            if (e->tokens.usable(now_ns())) return tok;
+            if (!use && tok.empty()) return tok;            // idle: leave it asleep
+        }
+        refresh(id, tok);                                   // also wakes an idle session
+        LockGuard lock(mu_);
+        Entry* e = find(id);
+        return e ? e->tokens.access : std::string();
+    }
+
+    void poll(Id id) {
+        std::string tok = token(id, false);
+        if (tok.empty()) return;
+        const HttpRoute& route = endpoint_route<BalanceEndpoint>();
+        HttpResponse r = http_.request(route, NULL, 0, tok);
+        if (token_rejected(r) && refresh(id, tok))
+            r = http_.request(route, NULL, 0, token(id, false));
+        BalanceReply reply;
+        if (!json_decode(r.body, reply) || r.status_code != 200) return;
+        LockGuard lock(mu_);
+        polls_++;
+        Entry* e = find(id);
+        if (!e) return;
+        e->balance = reply.balance;
+        e->balance_ms = now_ms();
+    }
+
+    static void work_loop(void* self) {
+        SessionManager* m = (SessionManager*)self;
+        for (;;) {
+            unsigned wait = m->run_due();
+            if (m->stop_.wait_ms(wait)) return;
+        }
+    }
+
+    SessionManager(const SessionManager&);
+    SessionManager& operator=(const SessionManager&);
+
+    HttpPool&    http_;
+    AsyncClient& async_;
+    Mutex        mu_;
+    Map          sessions_;
+    Id           next_id_, current_;
+    uint64_t     idle_ms_, poll_ms_;
+    uint64_t     refreshes_, polls_;
+    Event        stop_;
+    Thread       worker_;
+};
+
+#endif // MPESA_SESSIONS_H
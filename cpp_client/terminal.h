@@ -0,0 +1,579 @@
+/**
+ * ============================================
+ *   terminal.h - back-buffered terminal screen
+ * ============================================
+ *
+ *  Screen is an std::streambuf over a grid of cells,
+ *  so the UI keeps drawing with cout:
+ *
+ *      ConsoleTerminal term;             // or HeadlessTerminal
+ *      Screen screen(term);
+ *      cout.rdbuf(&screen);
+ *      screen.clear();                   // new screen: back buffer only
+ *      screen.set_color(CLR_CYAN);
+ *      cout << "  Balance: " << balance << "\n";
+ *      string pin = read_line(screen, "*");   // presents, then reads keys
+ *
+ *  Nothing reaches the terminal until present(). It
+ *  compares the back buffer with what the terminal
+ *  shows and emits only the cells that changed:
+ *  cursor moves, SGR colour changes and text, plus
+ *  "erase to end of line" for cleared tails. A frame
+ *  is one write call. Redrawing an unchanged screen
+ *  costs nothing; a typed character costs a few
+ *  bytes.
+ *
+ *  Colours are the Windows console attributes the
+ *  client always used (7 = default, 10 = green, ...).
+ *  A cell holds one UTF-8 character.
+ *
+ *  peek_key() waits a bounded time for a key without
+ *  taking it, so a screen busy with a request can
+ *  watch for Esc (KEY_ESC) and leave any other key
+ *  for the next read.
+ *
+ *  Backends (TermBackend):
+ *    ConsoleTerminal   Windows: VT sequences when the
+ *                      console supports them, else the
+ *                      frame is replayed with console
+ *                      API calls. POSIX: termios
+ *                      non-canonical, no-echo input.
+ *    HeadlessTerminal  Scripted keys in, frames
+ *                      captured; for tests and bench.
+ * ============================================
+ */
+#ifndef MPESA_TERMINAL_H
+#define MPESA_TERMINAL_H
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <ostream>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <conio.h>
+#else
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#endif
+
+enum { TERM_DEFAULT_COLOR = 7 };
+enum { KEY_NONE = -2, KEY_ESC = 27 };
+
+// --- Backend ------------------------------------------------------------------
+class TermBackend {
+public:
+    virtual ~TermBackend() {}
+    // One frame of ANSI text; returns the system calls it took
+    virtual int  write(const char* p, size_t n) = 0;
+    // Next key without echo: a byte, '\n' for Enter, 8 for backspace,
+    // KEY_ESC, -1 at end of input
+    virtual int  read_key() = 0;
+    // True once read_key() would not block (end of input counts), waiting
+    // at most ms for it
+    virtual bool key_ready(unsigned ms) = 0;
+    virtual void size(int& rows, int& cols) { rows = 25; cols = 80; }
+};
+
+// --- Headless -----------------------------------------------------------------
+class HeadlessTerminal : public TermBackend {
+public:
+    HeadlessTerminal(int rows = 25, int cols = 80, const std::string& keys = "")
+        : rows_(rows), cols_(cols), keys_(keys), next_(0) {}
+
+    int write(const char* p, size_t n) { output_.append(p, n); return 1; }
+
+    int read_key() {
+        if (next_ >= keys_.size()) return -1;
+        return (unsigned char)keys_[next_++];
+    }
+
+    bool key_ready(unsigned) { return true; }      // a key, or the end of the script
+
+    void size(int& rows, int& cols) { rows = rows_; cols = cols_; }
+
+    void feed(const std::string& keys)  { keys_ += keys; }
+    const std::string& output() const   { return output_; }
+    void clear_output()                 { output_.clear(); }
+
+private:
+    int         rows_, cols_;
+    std::string keys_;
+    size_t      next_;
+    std::string output_;
+};
+
+#ifdef _WIN32
+// --- Windows console ----------------------------------------------------------
+class ConsoleTerminal : public TermBackend {
+public:
+    ConsoleTerminal() : vt_(false) {
+        out_ = GetStdHandle(STD_OUTPUT_HANDLE);
+        SetConsoleOutputCP(CP_UTF8);
+        DWORD mode = 0;
+        if (GetConsoleMode(out_, &mode)) {
+            old_mode_ = mode;
+            // ENABLE_VIRTUAL_TERMINAL_PROCESSING (Windows 10+); older consoles refuse it
+            vt_ = SetConsoleMode(out_, mode | 0x0004) != 0;
+        }
+    }
+    ~ConsoleTerminal() { if (vt_) SetConsoleMode(out_, old_mode_); }
+
+    int write(const char* p, size_t n) {
+        if (vt_) {
+            DWORD w = 0;
+            WriteFile(out_, p, (DWORD)n, &w, NULL);
+            return 1;
+        }
+        return replay(p, n);
+    }
+
+    int read_key() {
+        int c = _getch();
+        if (c == 0 || c == 0xE0) { _getch(); return 0; }   // arrow / function key
+        if (c == '\r') return '\n';
+        return c;
+    }
+
+    bool key_ready(unsigned ms) {
+        for (;;) {
+            if (_kbhit()) return true;
+            if (!ms) return false;
+            unsigned step = ms < 10 ? ms : 10;
+            Sleep(step);
+            ms -= step;
+        }
+    }
+
+    void size(int& rows, int& cols) {
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        if (!GetConsoleScreenBufferInfo(out_, &info)) { rows = 25; cols = 80; return; }
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+        cols = info.srWindow.Right - info.srWindow.Left + 1;
+    }
+
+private:
+    // Pre-VT console: apply the few sequences Screen emits (CUP, SGR, EL,
+    // ED) through the console API. Text runs are still one call each.
+    int replay(const char* p, size_t n) {
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        GetConsoleScreenBufferInfo(out_, &info);
+        SHORT top = info.srWindow.Top, width = info.dwSize.X;
+        int calls = 1;
+        size_t i = 0;
+        while (i < n) {
+            if (p[i] != '\x1b') {
+                size_t j = i;
+                while (j < n && p[j] != '\x1b') j++;
+                DWORD w = 0;
+                WriteConsoleA(out_, p + i, (DWORD)(j - i), &w, NULL);
+                calls++;
+                i = j;
+                continue;
+            }
+            int arg[4] = { 0, 0, 0, 0 }, nargs = 0;
+            size_t j = i + 2;                                 // past ESC [
+            for (; j < n && (p[j] == ';' || (p[j] >= '0' && p[j] <= '9')); j++) {
+                if (p[j] == ';') { if (nargs < 3) nargs++; }
+                else arg[nargs] = arg[nargs] * 10 + (p[j] - '0');
+            }
+            char cmd = j < n ? p[j] : 0;
+            i = j + 1;
+            GetConsoleScreenBufferInfo(out_, &info);
+            COORD at = info.dwCursorPosition;
+            DWORD w = 0;
+            if (cmd == 'H') {
+                COORD to = { (SHORT)(arg[1] - 1), (SHORT)(top + arg[0] - 1) };
+                SetConsoleCursorPosition(out_, to);
+            } else if (cmd == 'm') {
+                WORD attr = TERM_DEFAULT_COLOR;
+                for (int k = 0; k <= nargs; k++) {
+                    int a = arg[k];
+                    if (a >= 30 && a <= 37) attr = (WORD)swap_rb(a - 30);
+                    if (a >= 90 && a <= 97) attr = (WORD)(swap_rb(a - 90) | 8);
+                }
+                SetConsoleTextAttribute(out_, attr);
+            } else if (cmd == 'K') {
+                FillConsoleOutputCharacterA(out_, ' ', (DWORD)(width - at.X), at, &w);
+            } else if (cmd == 'J') {
+                COORD origin = { 0, top };
+                DWORD cells = (DWORD)width * (DWORD)(info.srWindow.Bottom - top + 1);
+                FillConsoleOutputCharacterA(out_, ' ', cells, origin, &w);
+                FillConsoleOutputAttribute(out_, TERM_DEFAULT_COLOR, cells, origin, &w);
+            }
+            calls += 2;
+        }
+        return calls;
+    }
+
+    // ANSI numbers colours RGB, console attributes BGR
+    static int swap_rb(int c) { return (c & 2) | ((c & 1) << 2) | ((c & 4) >> 2); }
+
+    HANDLE out_;
+    DWORD  old_mode_;
+    bool   vt_;
+};
+
+#else
+// --- POSIX terminal -----------------------------------------------------------
+class ConsoleTerminal : public TermBackend {
+public:
+    ConsoleTerminal() : raw_(false) {
+        if (!isatty(0) || tcgetattr(0, &saved()) != 0) return;
+        struct termios t = saved();
+        t.c_lflag &= ~(tcflag_t)(ICANON | ECHO);          // keys one by one, we echo
+        t.c_cc[VMIN] = 1;
+        t.c_cc[VTIME] = 0;
+        raw_ = tcsetattr(0, TCSAFLUSH, &t) == 0;
+        if (raw_) {
+            signal(SIGINT, on_signal);                      // don't leave the tty raw
+            signal(SIGTERM, on_signal);
+        }
+    }
+    ~ConsoleTerminal() { if (raw_) restore(); }
+
+    int write(const char* p, size_t n) {
+        int calls = 0;
+        while (n > 0) {
+            ssize_t w = ::write(1, p, n);
+            calls++;
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            p += w; n -= (size_t)w;
+        }
+        return calls;
+    }
+
+    int read_key() {
+        unsigned char c;
+        for (;;) {
+            ssize_t r = ::read(0, &c, 1);
+            if (r == 1) break;
+            if (r < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        if (c == '\r') return '\n';
+        if (c == 127)  return 8;
+        if (c == 27) {                                      // ESC [ ... final: arrows etc.
+            if (!key_ready(30)) return KEY_ESC;             // nothing follows: the Esc key
+            unsigned char k;
+            if (::read(0, &k, 1) == 1 && (k == '[' || k == 'O'))
+                while (::read(0, &k, 1) == 1 && !(k >= 0x40 && k <= 0x7E)) {}
+            return 0;
+        }
+        return c;
+    }
+
+    bool key_ready(unsigned ms) {
+        struct pollfd p;
+        p.fd = 0; p.events = POLLIN; p.revents = 0;
+        return poll(&p, 1, (int)ms) != 0;                   // EOF and errors count as ready
+    }
+
+    void size(int& rows, int& cols) {
+        struct winsize ws;
+        if (ioctl(1, TIOCGWINSZ, &ws) == 0 && ws.ws_row && ws.ws_col) { rows = ws.ws_row; cols = ws.ws_col; }
+        else { rows = 25; cols = 80; }
+    }
+
+private:
+    static struct termios& saved() {
+        static struct termios t;
+        return t;
+    }
+    static void restore() { tcsetattr(0, TCSAFLUSH, &saved()); }
+    static void on_signal(int sig) {
+        restore();
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    bool raw_;
+};
+#endif
+
+// --- Screen -------------------------------------------------------------------
+struct FrameStats {
+    uint64_t frames;         // present() calls that wrote something
+    uint64_t bytes;          // bytes handed to the backend
+    uint64_t syscalls;       // write calls the backend made
+    uint64_t last_bytes;     // of the most recent frame
+
+    FrameStats() : frames(0), bytes(0), syscalls(0), last_bytes(0) {}
+};
+
+class Screen : public std::streambuf {
+public:
+    enum {
+        MAX_COLS = 120,
+        SKIP_MAX = 6        // unchanged cells re-sent rather than jumped ("\x1b[r;cH" is 6+)
+    };
+
+    // rows / cols 0 = the backend's size
+    explicit Screen(TermBackend& term, int rows = 0, int cols = 0)
+        : term_(term), row_(0), col_(0), color_(TERM_DEFAULT_COLOR),
+          term_color_(TERM_DEFAULT_COLOR), term_row_(-1), term_col_(-1), pending_(0), glyph_bytes_(0),
+          peeked_(KEY_NONE), started_(false), closed_(false) {
+        int r, c;
+        term.size(r, c);
+        rows_ = rows > 0 ? rows : r;
+        cols_ = cols > 0 ? cols : c;
+        if (rows_ < 1) rows_ = 1;
+        if (cols_ > MAX_COLS) cols_ = MAX_COLS;
+        if (cols_ < 1) cols_ = 1;
+        back_.assign((size_t)rows_ * cols_, Cell());
+        front_ = back_;
+        frame_.reserve(4096);
+    }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+    void set_color(int attr) { color_ = (uint8_t)attr; }
+
+    // Start a new screen. The terminal keeps the old one until present().
+    void clear() {
+        std::fill(back_.begin(), back_.end(), Cell());
+        row_ = col_ = 0;
+        pending_ = 0;
+    }
+
+    // Send what changed since the last frame, in one write
+    void present() {
+        frame_.clear();
+        if (!started_) {
+            frame_ += "\x1b[0m\x1b[2J";
+            std::fill(front_.begin(), front_.end(), Cell());
+            term_color_ = TERM_DEFAULT_COLOR;
+            term_row_ = term_col_ = -1;
+            started_ = true;
+        }
+        int& cr = term_row_;                                // terminal cursor, -1 unknown
+        int& cc = term_col_;
+        for (int r = 0; r < rows_; r++) {
+            const Cell* b = &back_[(size_t)r * cols_];
+            Cell*       f = &front_[(size_t)r * cols_];
+            int tail = cols_;                               // back row is blank from here
+            while (tail > 0 && b[tail - 1].blank()) tail--;
+            for (int c = 0; c < cols_; c++) {
+                if (b[c] == f[c]) continue;
+                if (c >= tail) {                            // rest of the row: erase in one go
+                    move_to(r, c, cr, cc);
+                    sgr(TERM_DEFAULT_COLOR);
+                    frame_ += "\x1b[K";
+                    for (int k = c; k < cols_; k++) f[k] = Cell();
+                    break;
+                }
+                if (cr == r && cc < c && c - cc <= SKIP_MAX && plain(b, cc, c)) {
+                    for (; cc < c; cc++) { put_glyph(b[cc].glyph); f[cc] = b[cc]; }
+                }                                           // cheaper than a cursor move
+                move_to(r, c, cr, cc);
+                if (!b[c].blank()) sgr(b[c].color);
+                put_glyph(b[c].glyph);
+                f[c] = b[c];
+                if (++cc >= cols_) cr = -1;                 // pending wrap: position explicitly
+            }
+        }
+        move_to(row_, col_ < cols_ ? col_ : cols_ - 1, cr, cc);
+        if (frame_.empty()) return;
+        stats_.frames++;
+        stats_.bytes += frame_.size();
+        stats_.last_bytes = frame_.size();
+        stats_.syscalls += (uint64_t)term_.write(frame_.data(), frame_.size());
+    }
+
+    // Forget what the terminal shows: the next frame redraws everything
+    void invalidate() { started_ = false; }
+
+    int read_key() {
+        present();
+        int k = peeked_;
+        peeked_ = KEY_NONE;
+        if (k == KEY_NONE) k = term_.read_key();
+        if (k == -1) closed_ = true;
+        return k;
+    }
+
+    // The next key, left for read_key(), or KEY_NONE if none comes within ms
+    int peek_key(unsigned ms) {
+        if (peeked_ == KEY_NONE && !closed_) {
+            present();
+            if (term_.key_ready(ms)) peeked_ = term_.read_key();
+        }
+        return closed_ ? -1 : peeked_;
+    }
+
+    // The backend ran out of input (EOF on a pipe, end of a script)
+    bool input_closed() const { return closed_; }
+
+    const FrameStats& stats() const { return stats_; }
+
+    // What the terminal shows on row r (as of the last present), for tests
+    std::string row_text(int r) const {
+        std::string s;
+        for (int c = 0; c < cols_; c++) {
+            uint32_t g = front_[(size_t)r * cols_ + c].glyph;
+            for (int k = 0; k < 4 && (g >> (8 * k)) & 0xFF; k++) s += (char)((g >> (8 * k)) & 0xFF);
+        }
+        size_t e = s.find_last_not_of(' ');
+        return e == std::string::npos ? std::string() : s.substr(0, e + 1);
+    }
+
+protected:
+    int overflow(int ch) {
+        if (ch == traits_type::eof()) return traits_type::not_eof(ch);
+        put((unsigned char)ch);
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* p, std::streamsize n) {
+        for (std::streamsize i = 0; i < n; i++) put((unsigned char)p[i]);
+        return n;
+    }
+
+private:
+    struct Cell {
+        uint32_t glyph;      // UTF-8 bytes, first byte lowest
+        uint8_t  color;
+
+        Cell() : glyph(' '), color(TERM_DEFAULT_COLOR) {}
+        bool blank() const { return glyph == ' '; }
+        // Spaces look the same in any foreground colour
+        bool operator==(const Cell& o) const {
+            return glyph == o.glyph && (color == o.color || glyph == ' ');
+        }
+    };
+
+    void put(unsigned char ch) {
+        if (pending_ && (ch & 0xC0) == 0x80) {              // UTF-8 continuation
+            Cell& prev = back_[(size_t)row_ * cols_ + col_ - 1];
+            prev.glyph |= (uint32_t)ch << (8 * glyph_bytes_++);
+            pending_--;
+            return;
+        }
+        pending_ = 0;
+        switch (ch) {
+        case '\n': newline(); return;
+        case '\r': col_ = 0; return;
+        case '\b': if (col_ > 0) col_--; return;
+        case '\t': do put(' '); while (col_ % 8); return;
+        }
+        if (ch < 0x20) return;
+        if (col_ >= cols_) newline();
+        Cell& c = back_[(size_t)row_ * cols_ + col_++];
+        c.glyph = ch;
+        c.color = ch == ' ' ? (uint8_t)TERM_DEFAULT_COLOR : color_;
+        glyph_bytes_ = 1;
+        if (ch >= 0xF0)      pending_ = 3;
+        else if (ch >= 0xE0) pending_ = 2;
+        else if (ch >= 0xC0) pending_ = 1;
+    }
+
+    void newline() {
+        col_ = 0;
+        if (++row_ < rows_) return;
+        row_ = rows_ - 1;                                   // scroll the back buffer
+        back_.erase(back_.begin(), back_.begin() + cols_);
+        back_.insert(back_.end(), (size_t)cols_, Cell());
+    }
+
+    // Cells [from, to) can be rewritten as they are without a colour change
+    bool plain(const Cell* b, int from, int to) const {
+        for (int k = from; k < to; k++)
+            if (!b[k].blank() && b[k].color != term_color_) return false;
+        return true;
+    }
+
+    void move_to(int r, int c, int& cr, int& cc) {
+        if (r == cr && c == cc) return;
+        char buf[24];
+        frame_.append(buf, (size_t)format_cup(buf, r + 1, c + 1));
+        cr = r; cc = c;
+    }
+
+    static int format_cup(char* buf, int r, int c) {
+        char* q = buf;
+        *q++ = '\x1b'; *q++ = '[';
+        q += format_int(q, r);
+        *q++ = ';';
+        q += format_int(q, c);
+        *q++ = 'H';
+        return (int)(q - buf);
+    }
+
+    static int format_int(char* out, int v) {
+        char t[12];
+        int n = 0;
+        do { t[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+        for (int i = 0; i < n; i++) out[i] = t[n - 1 - i];
+        return n;
+    }
+
+    // Console attribute -> SGR; ANSI numbers colours RGB, the console BGR
+    void sgr(uint8_t attr) {
+        if (attr == term_color_) return;
+        term_color_ = attr;
+        if (attr == TERM_DEFAULT_COLOR) { frame_ += "\x1b[0m"; return; }
+        int rgb = (attr & 2) | ((attr & 1) << 2) | ((attr & 4) >> 2);
+        char buf[12] = { '\x1b', '[', '0', ';', (char)(attr & 8 ? '9' : '3'), (char)('0' + rgb), 'm' };
+        frame_.append(buf, 7);
+    }
+
+    void put_glyph(uint32_t g) {
+        do { frame_ += (char)(g & 0xFF); g >>= 8; } while (g);
+    }
+
+    Screen(const Screen&);
+    Screen& operator=(const Screen&);
+
+    TermBackend&      term_;
+    int               rows_, cols_;
+    std::vector<Cell> back_, front_;    // front_ = what the terminal shows
+    int               row_, col_;
+    uint8_t           color_, term_color_;
+    int               term_row_, term_col_;
+    int               pending_;         // UTF-8 continuation bytes still due
+    int               glyph_bytes_;     // ... and bytes already in the cell
+    int               peeked_;          // key taken by peek_key(), or KEY_NONE
+    bool              started_, closed_;
+    std::string       frame_;
+    FrameStats        stats_;
+};
+
+// --- Line input ---------------------------------------------------------------
+// Reads keys up to Enter, echoing each through the screen (or `mask`,
+// e.g. "*" for a PIN). Backspace edits; -1 from the backend ends input.
+inline std::string read_line(Screen& screen, const char* mask = NULL) {
+    std::ostream out(&screen);
+    std::string s;
+    for (;;) {
+        int k = screen.read_key();
+        if (k == '\n' || k == -1) break;
+        if (k == 8) {
+            if (s.empty()) continue;
+            // drop a whole UTF-8 character
+            size_t n = s.size() - 1;
+            while (!mask && n > 0 && ((unsigned char)s[n] & 0xC0) == 0x80) n--;
+            s.erase(n);
+            out << "\b \b";
+            continue;
+        }
+        if (k < 32 || k == 127) continue;
+        s += (char)k;
+        if (mask) out << mask;
+        else      out << (char)k;
+    }
+    out << "\n";
+    return s;
+}
+
+#endif // MPESA_TERMINAL_H
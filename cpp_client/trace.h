@@ -0,0 +1,699 @@
+/**
+ * ============================================
+ *   trace.h - record and replay HTTP traffic
+ * ============================================
+ *
+ *  TraceRecorder sits between HttpPool and its
+ *  servers and writes every exchange - request,
+ *  status, validators, body, timing - to a compact
+ *  binary trace. TraceReplayer answers the same
+ *  requests from that file with no server at all,
+ *  at full speed or at the recorded latency:
+ *
+ *      TraceRecorder rec(g_http.network());
+ *      rec.open("session.trace", err);
+ *      g_http.set_transport(&rec);
+ *      ...
+ *      TraceReplayer rep;
+ *      rep.open("session.trace", err);
+ *      g_http.set_transport(&rep);
+ *
+ *  or, for the client as a whole, MPESA_RECORD=file
+ *  and MPESA_REPLAY=file (TraceHook).
+ *
+ *  Requests are matched by method and path in the
+ *  order they were recorded, up to WINDOW places
+ *  out of order (threads race). Recording happens
+ *  below the response cache, so a 304 replays as a
+ *  304 and the cache above does the rest.
+ *
+ *  Passwords, PINs and tokens never reach the file:
+ *  their JSON string values are written as
+ *  "redacted", and bearer tokens are not kept.
+ *
+ *  File: "MPTR" 1, then one record per exchange:
+ *
+ *      varint  length of what follows
+ *      zigzag  start, us after the previous record's
+ *      varint  us until the response was complete
+ *      varint  0 = method, path follow; n = route n-1
+ *      byte    flags (TRACE_AUTH ...)
+ *      bytes   request body
+ *      varint  status (0 = none)
+ *      byte    failure, byte phase
+ *      bytes   etag, last-modified (TRACE_VALIDATORS)
+ *      bytes   response body (unless TRACE_REPEAT)
+ *
+ *  bytes = varint length + data. The first MAX_ROUTES
+ *  routes get numbers; a body of up to REPEAT_MAX
+ *  bytes equal to the route's last one is written
+ *  as TRACE_REPEAT. Files are read as they stream:
+ *  a trace of millions of calls needs no more memory
+ *  than one of ten.
+ * ============================================
+ */
+#ifndef MPESA_TRACE_H
+#define MPESA_TRACE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "http_cache.h"
+#include "deadline.h"
+
+// --- Record -------------------------------------------------------------------
+enum {
+    TRACE_AUTH       = 1,       // the request carried a bearer token
+    TRACE_COND       = 2,       // ... and validators (a conditional GET)
+    TRACE_VALIDATORS = 4,       // the response came with ETag / Last-Modified
+    TRACE_REPEAT     = 8        // response body = the route's previous one
+};
+
+struct TraceRecord {
+    int64_t     at_us;          // request start, since the trace began
+    uint32_t    took_us;        // ... until the response was complete
+    std::string method, path;
+    bool        auth, conditional;
+    std::string request;        // body sent
+    int         status;         // status line seen; 0 if none
+    HttpFailure failure;        // set even after a status: the body broke off
+    HttpPhase   phase;
+    Validators  validators;
+    std::string response;       // body as the caller saw it (decoded)
+
+    TraceRecord() : at_us(0), took_us(0), auth(false), conditional(false), status(0),
+                    failure(HTTP_FAIL_NONE), phase(HTTP_PHASE_NONE) {}
+
+    // Bodies change hands without a copy
+    void swap(TraceRecord& o) {
+        std::swap(at_us, o.at_us);
+        std::swap(took_us, o.took_us);
+        method.swap(o.method);
+        path.swap(o.path);
+        std::swap(auth, o.auth);
+        std::swap(conditional, o.conditional);
+        request.swap(o.request);
+        std::swap(status, o.status);
+        std::swap(failure, o.failure);
+        std::swap(phase, o.phase);
+        validators.etag.swap(o.validators.etag);
+        validators.last_modified.swap(o.validators.last_modified);
+        response.swap(o.response);
+    }
+};
+
+// JSON string values of secret fields become "redacted", wherever they are
+inline void trace_redact(std::string& json) {
+    static const char* const keys[] = { "\"password\"", "\"pin\"", "\"access\"", "\"refresh\"" };
+    static const char MASK[] = "redacted";
+    for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+        size_t klen = strlen(keys[k]);
+        for (size_t at = json.find(keys[k]); at != std::string::npos; at = json.find(keys[k], at + 1)) {
+            size_t i = at + klen;
+            while (i < json.size() && (json[i] == ' ' || json[i] == '\t')) i++;
+            if (i >= json.size() || json[i] != ':') continue;           // a value, not a key
+            i++;
+            while (i < json.size() && (json[i] == ' ' || json[i] == '\t')) i++;
+            if (i >= json.size() || json[i] != '"') continue;
+            size_t end = ++i;
+            while (end < json.size() && json[end] != '"') end += json[end] == '\\' ? 2 : 1;
+            if (end > json.size()) end = json.size();
+            json.replace(i, end - i, MASK);
+        }
+    }
+}
+
+// --- Encoding -----------------------------------------------------------------
+inline void trace_put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) { out += (char)(v | 0x80); v >>= 7; }
+    out += (char)v;
+}
+
+inline void trace_put_bytes(std::string& out, const std::string& s) {
+    trace_put_varint(out, s.size());
+    out += s;
+}
+
+// Bounds-checked reads from one record's payload
+struct TraceCursor {
+    const char* p;
+    const char* end;
+    bool        ok;
+
+    TraceCursor(const char* b, size_t n) : p(b), end(b + n), ok(true) {}
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (p == end) break;
+            unsigned char c = (unsigned char)*p++;
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) return v;
+        }
+        ok = false;
+        return 0;
+    }
+    unsigned byte() {
+        if (p == end) { ok = false; return 0; }
+        return (unsigned char)*p++;
+    }
+    void bytes(std::string& s) {
+        uint64_t n = varint();
+        if (!ok || n > (uint64_t)(end - p)) { ok = false; s.clear(); return; }
+        s.assign(p, (size_t)n);
+        p += n;
+    }
+};
+
+// Same body, for TRACE_REPEAT (FNV-1a; a collision needs 2^64 luck)
+inline uint64_t trace_hash(const std::string& s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); i++) { h ^= (unsigned char)s[i]; h *= 1099511628211ULL; }
+    return h;
+}
+
+static const char TRACE_MAGIC[] = "MPTR";
+enum { TRACE_VERSION = 1, TRACE_MAX_ROUTES = 4096, TRACE_REPEAT_MAX = 4096 };
+
+// --- Writer -------------------------------------------------------------------
+class TraceWriter {
+public:
+    TraceWriter() : f_(NULL), last_at_(0), records_(0), bytes_(0) {}
+    ~TraceWriter() { close(); }
+
+    bool open(const std::string& path, std::string& err) {
+        close();
+        f_ = fopen(path.c_str(), "wb");
+        if (!f_) { err = "cannot write " + path; return false; }
+        setvbuf(f_, NULL, _IOFBF, 1 << 20);
+        fwrite(TRACE_MAGIC, 1, 4, f_);
+        fputc(TRACE_VERSION, f_);
+        routes_.clear();
+        last_.clear();
+        last_at_ = 0;
+        records_ = 0;
+        bytes_ = 5;
+        return true;
+    }
+
+    bool is_open() const { return f_ != NULL; }
+
+    bool write(const TraceRecord& r) {
+        if (!f_) return false;
+        std::string& o = buf_;
+        o.clear();
+        int64_t d = r.at_us - last_at_;
+        last_at_ = r.at_us;
+        trace_put_varint(o, ((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+        trace_put_varint(o, r.took_us);
+
+        std::string key = r.method + ' ' + r.path;
+        std::map<std::string, uint32_t>::iterator route = routes_.find(key);
+        if (route != routes_.end()) {
+            trace_put_varint(o, route->second + 1);
+        } else {
+            trace_put_varint(o, 0);
+            trace_put_bytes(o, r.method);
+            trace_put_bytes(o, r.path);
+            if (routes_.size() < TRACE_MAX_ROUTES) {
+                uint32_t id = (uint32_t)routes_.size();
+                route = routes_.insert(std::make_pair(key, id)).first;
+                last_.push_back(Body());
+            }
+        }
+
+        unsigned flags = (r.auth ? TRACE_AUTH : 0) | (r.conditional ? TRACE_COND : 0) |
+                         (r.validators.empty() ? 0 : TRACE_VALIDATORS);
+        if (route != routes_.end() && r.response.size() <= TRACE_REPEAT_MAX) {
+            Body& b = last_[route->second];
+            uint64_t h = trace_hash(r.response);
+            if (b.set && b.size == r.response.size() && b.hash == h) flags |= TRACE_REPEAT;
+            b.set = true;
+            b.size = r.response.size();
+            b.hash = h;
+        }
+        o += (char)flags;
+        trace_put_bytes(o, r.request);
+        trace_put_varint(o, (uint64_t)r.status);
+        o += (char)r.failure;
+        o += (char)r.phase;
+        if (flags & TRACE_VALIDATORS) {
+            trace_put_bytes(o, r.validators.etag);
+            trace_put_bytes(o, r.validators.last_modified);
+        }
+        if (!(flags & TRACE_REPEAT)) trace_put_bytes(o, r.response);
+
+        std::string len;
+        trace_put_varint(len, o.size());
+        if (fwrite(len.data(), 1, len.size(), f_) != len.size() ||
+            fwrite(o.data(), 1, o.size(), f_) != o.size()) return false;
+        records_++;
+        bytes_ += len.size() + o.size();
+        return true;
+    }
+
+    // Flushes; false if anything failed to reach the disk
+    bool close() {
+        if (!f_) return true;
+        bool ok = !ferror(f_);
+        ok = fclose(f_) == 0 && ok;
+        f_ = NULL;
+        return ok;
+    }
+
+    unsigned long records() const { return records_; }
+    uint64_t      bytes() const   { return bytes_; }
+
+private:
+    struct Body {
+        bool     set;
+        size_t   size;
+        uint64_t hash;
+
+        Body() : set(false), size(0), hash(0) {}
+    };
+
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+
+    FILE*                           f_;
+    std::map<std::string, uint32_t> routes_;    // "GET /api/balance/" -> n
+    std::vector<Body>               last_;      // by route number
+    int64_t                         last_at_;
+    unsigned long                   records_;
+    uint64_t                        bytes_;
+    std::string                     buf_;
+};
+
+// --- Reader -------------------------------------------------------------------
+class TraceReader {
+public:
+    TraceReader() : f_(NULL), last_at_(0), damaged_(false) {}
+    ~TraceReader() { close(); }
+
+    bool open(const std::string& path, std::string& err) {
+        close();
+        f_ = fopen(path.c_str(), "rb");
+        if (!f_) { err = "cannot read " + path; return false; }
+        setvbuf(f_, NULL, _IOFBF, 1 << 20);
+        char head[5];
+        if (fread(head, 1, 5, f_) != 5 || memcmp(head, TRACE_MAGIC, 4) != 0) {
+            err = path + " is not a trace";
+            close();
+            return false;
+        }
+        if (head[4] != TRACE_VERSION) {
+            err = path + ": unknown trace version";
+            close();
+            return false;
+        }
+        routes_.clear();
+        last_.clear();
+        last_at_ = 0;
+        damaged_ = false;
+        return true;
+    }
+
+    // The next record; false at the end of the file or a damaged record
+    // (a recording cut off mid-write ends there: damaged() says so)
+    bool next(TraceRecord& r) {
+        if (!f_) return false;
+        uint64_t n = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            int c = fgetc(f_);
+            if (c == EOF) { damaged_ = shift != 0; return false; }
+            n |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) break;
+            if (shift >= 28) { damaged_ = true; return false; }
+        }
+        buf_.resize((size_t)n);
+        if (n && fread(&buf_[0], 1, (size_t)n, f_) != n) { damaged_ = true; return false; }
+        if (!decode(r)) { damaged_ = true; return false; }
+        return true;
+    }
+
+    bool damaged() const { return damaged_; }
+
+    void close() {
+        if (f_) fclose(f_);
+        f_ = NULL;
+    }
+
+private:
+    bool decode(TraceRecord& r) {
+        TraceCursor c(buf_.data(), buf_.size());
+        uint64_t z = c.varint();
+        last_at_ += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+        r.at_us = last_at_;
+        r.took_us = (uint32_t)c.varint();
+
+        uint64_t ref = c.varint();
+        int route = -1;
+        if (ref == 0) {
+            c.bytes(r.method);
+            c.bytes(r.path);
+            if (routes_.size() < TRACE_MAX_ROUTES) {
+                route = (int)routes_.size();
+                routes_.push_back(std::make_pair(r.method, r.path));
+                last_.push_back(std::string());
+            }
+        } else if (ref <= routes_.size()) {
+            route = (int)ref - 1;
+            r.method = routes_[route].first;
+            r.path = routes_[route].second;
+        } else {
+            return false;
+        }
+
+        unsigned flags = c.byte();
+        r.auth = (flags & TRACE_AUTH) != 0;
+        r.conditional = (flags & TRACE_COND) != 0;
+        c.bytes(r.request);
+        r.status = (int)c.varint();
+        unsigned failure = c.byte(), phase = c.byte();
+        if (failure > HTTP_FAIL_CANCELLED || phase > HTTP_PHASE_RECEIVE) return false;
+        r.failure = (HttpFailure)failure;
+        r.phase = (HttpPhase)phase;
+        r.validators = Validators();
+        if (flags & TRACE_VALIDATORS) {
+            c.bytes(r.validators.etag);
+            c.bytes(r.validators.last_modified);
+        }
+        if (flags & TRACE_REPEAT) {
+            if (route < 0) return false;
+            r.response = last_[route];
+        } else {
+            c.bytes(r.response);
+            if (route >= 0 && r.response.size() <= TRACE_REPEAT_MAX) last_[route] = r.response;
+        }
+        return c.ok;
+    }
+
+    TraceReader(const TraceReader&);
+    TraceReader& operator=(const TraceReader&);
+
+    FILE*                                            f_;
+    std::vector<std::pair<std::string, std::string> > routes_;
+    std::vector<std::string>                         last_;     // small bodies, by route
+    int64_t                                          last_at_;
+    bool                                             damaged_;
+    std::string                                      buf_;
+};
+
+// --- Recorder -----------------------------------------------------------------
+class TraceRecorder : public HttpTransport {
+public:
+    enum { MAX_BODY = 16 * 1024 * 1024 };       // longer streamed bodies are cut here
+
+    explicit TraceRecorder(HttpTransport& next) : next_(next), began_ns_(0) {}
+
+    bool open(const std::string& path, std::string& err) {
+        LockGuard lock(mu_);
+        if (!out_.open(path, err)) return false;
+        began_ns_ = now_ns();
+        return true;
+    }
+
+    bool close() {
+        LockGuard lock(mu_);
+        return out_.close();
+    }
+
+    HttpResponse exchange(const HttpRoute& route, const char* body, size_t body_len,
+                          const std::string& auth_token, BodySink* sink,
+                          CancelToken* cancel, const Validators* cond) {
+        uint64_t start = now_ns();
+        Tap tap(sink);
+        HttpResponse r = next_.exchange(route, body, body_len, auth_token, sink ? &tap : NULL,
+                                        cancel, cond);
+        uint64_t done = now_ns();
+
+        TraceRecord rec;
+        rec.took_us     = (uint32_t)((done - start) / 1000);
+        rec.method      = route.method;
+        rec.path        = route.path;
+        rec.auth        = !auth_token.empty();
+        rec.conditional = cond != NULL;
+        rec.request.assign(body ? body : "", body ? body_len : 0);
+        rec.status      = sink ? tap.status() : r.status_code;
+        rec.failure     = r.failure;
+        rec.phase       = r.phase;
+        rec.validators  = r.validators;
+        if (sink)                 rec.response = tap.copy();
+        else if (r.status_code)   rec.response = r.body;
+        trace_redact(rec.request);
+        trace_redact(rec.response);
+
+        LockGuard lock(mu_);
+        if (out_.is_open()) {
+            rec.at_us = (int64_t)(start - began_ns_) / 1000;
+            out_.write(rec);
+        }
+        return r;
+    }
+
+    unsigned long records() {
+        LockGuard lock(mu_);
+        return out_.records();
+    }
+
+private:
+    // The status line and a copy of a streamed body
+    class Tap : public TeeSink {
+    public:
+        explicit Tap(BodySink* next) : TeeSink(next, MAX_BODY), status_(0) {}
+        void on_status(int code) { status_ = code; TeeSink::on_status(code); }
+        int status() const { return status_; }
+    private:
+        int status_;
+    };
+
+    TraceRecorder(const TraceRecorder&);
+    TraceRecorder& operator=(const TraceRecorder&);
+
+    HttpTransport& next_;
+    uint64_t       began_ns_;
+    TraceWriter    out_;            // mu_
+    Mutex          mu_;
+};
+
+// --- Replayer -----------------------------------------------------------------
+enum TracePace {
+    TRACE_FULL_SPEED,           // answer at once
+    TRACE_RECORDED              // take as long as the server did
+};
+
+struct ReplayStats {
+    unsigned long replayed;     // requests answered from the trace
+    unsigned long unmatched;    // ... not in it: failed as if no server answered
+    unsigned long skipped;      // recorded requests never made, left behind
+
+    ReplayStats() : replayed(0), unmatched(0), skipped(0) {}
+};
+
+class TraceReplayer : public HttpTransport {
+public:
+    enum {
+        WINDOW = 64,            // how far out of recorded order a request may come
+        CHUNK  = 16 * 1024      // streamed bodies are fed in pieces this size
+    };
+
+    TraceReplayer() : pace_(TRACE_FULL_SPEED), read_(0), taken_(0), eof_(true) {}
+
+    bool open(const std::string& path, std::string& err) {
+        LockGuard lock(mu_);
+        if (!in_.open(path, err)) return false;
+        window_.clear();
+        read_ = taken_ = 0;
+        eof_ = false;
+        stats_ = ReplayStats();
+        return true;
+    }
+
+    // Not synchronised: set once before requests start
+    void set_pace(TracePace p) { pace_ = p; }
+
+    HttpResponse exchange(const HttpRoute& route, const char* /*body*/, size_t /*body_len*/,
+                          const std::string& /*auth_token*/, BodySink* sink,
+                          CancelToken* cancel, const Validators* /*cond*/) {
+        HttpResponse r;
+        TraceRecord rec;
+        if (!take(route.method, route.path, rec)) {
+            r.fail(HTTP_FAIL_CONNECT, HTTP_PHASE_CONNECT);
+            return r;
+        }
+        if (pace_ == TRACE_RECORDED && !wait_us(rec.took_us, cancel)) {
+            r.fail(HTTP_FAIL_CANCELLED, HTTP_PHASE_RECEIVE);
+            return r;
+        }
+        if (rec.status) {
+            r.status_code = rec.status;
+            r.validators = rec.validators;
+            if (!sink) {
+                r.body.swap(rec.response);
+            } else {
+                sink->on_status(rec.status);
+                sink->expect(rec.response.size());
+                for (size_t at = 0; at < rec.response.size(); at += CHUNK) {
+                    size_t n = rec.response.size() - at < (size_t)CHUNK ? rec.response.size() - at
+                                                                        : (size_t)CHUNK;
+                    if (!sink->on_data(rec.response.data() + at, n)) {
+                        r.fail(HTTP_FAIL_RECEIVE, HTTP_PHASE_RECEIVE);
+                        return r;
+                    }
+                }
+            }
+        }
+        if (rec.failure != HTTP_FAIL_NONE || !rec.status) r.fail(rec.failure, rec.phase);
+        return r;
+    }
+
+    ReplayStats stats() {
+        LockGuard lock(mu_);
+        return stats_;
+    }
+
+    // Reads the rest of the trace: the recorded requests never made, all told
+    unsigned long finish() {
+        LockGuard lock(mu_);
+        TraceRecord rec;
+        while (!eof_ && in_.next(rec)) read_++;
+        eof_ = true;
+        stats_.skipped += window_.size();
+        window_.clear();
+        return stats_.skipped;
+    }
+
+    bool damaged() {
+        LockGuard lock(mu_);
+        return in_.damaged();
+    }
+
+private:
+    struct Pending {
+        uint64_t    seq;
+        TraceRecord rec;
+    };
+
+    static bool matches(const TraceRecord& r, const std::string& method, const std::string& path) {
+        return r.path == path && r.method == method;
+    }
+
+    // The earliest pending record for method + path, reading ahead up to
+    // WINDOW records past the last one taken
+    bool take(const std::string& method, const std::string& path, TraceRecord& out) {
+        LockGuard lock(mu_);
+        for (std::deque<Pending>::iterator it = window_.begin(); it != window_.end(); ++it) {
+            if (!matches(it->rec, method, path)) continue;
+            uint64_t seq = it->seq;
+            out.swap(it->rec);
+            window_.erase(it);
+            taken(seq);
+            return true;
+        }
+        while (!eof_ && read_ < taken_ + WINDOW) {
+            if (!in_.next(out)) { eof_ = true; break; }
+            uint64_t seq = read_++;
+            if (matches(out, method, path)) {
+                taken(seq);
+                return true;
+            }
+            window_.push_back(Pending());
+            window_.back().seq = seq;
+            window_.back().rec.swap(out);
+        }
+        stats_.unmatched++;
+        return false;
+    }
+
+    // mu_ held. Records the replay has moved WINDOW past are not coming.
+    void taken(uint64_t seq) {
+        stats_.replayed++;
+        if (seq + 1 > taken_) taken_ = seq + 1;
+        while (!window_.empty() && window_.front().seq + WINDOW < taken_) {
+            window_.pop_front();
+            stats_.skipped++;
+        }
+    }
+
+    // False if cancelled first
+    static bool wait_us(uint32_t us, CancelToken* cancel) {
+        uint64_t until = now_ns() + (uint64_t)us * 1000;
+        for (;;) {
+            if (cancel && cancel->cancelled()) return false;
+            uint64_t now = now_ns();
+            if (now >= until) return true;
+            if (until - now < 1000000) continue;        // sleep_ms(1) would overshoot: spin
+            uint64_t left_ms = (until - now + 999999) / 1000000;
+            sleep_ms(left_ms < (uint64_t)CancelToken::CANCEL_POLL_MS ? (unsigned)left_ms
+                                                                    : (unsigned)CancelToken::CANCEL_POLL_MS);
+        }
+    }
+
+    TraceReplayer(const TraceReplayer&);
+    TraceReplayer& operator=(const TraceReplayer&);
+
+    TracePace           pace_;
+    TraceReader         in_;        // mu_
+    std::deque<Pending> window_;    // read, not yet asked for; by seq
+    uint64_t            read_;      // records read so far
+    uint64_t            taken_;     // 1 + the latest record answered
+    bool                eof_;
+    ReplayStats         stats_;
+    Mutex               mu_;
+};
+
+// --- Hook ---------------------------------------------------------------------
+// MPESA_RECORD=<file> records everything `http` exchanges with its servers;
+// MPESA_REPLAY=<file> answers it from such a recording instead (with
+// MPESA_REPLAY_PACE=recorded, as slowly as the server did).
+class TraceHook {
+public:
+    explicit TraceHook(HttpPool& http) : http_(http), recorder_(http.network()), active_(false) {}
+    ~TraceHook() { detach(); }
+
+    // False, with err, if a file named in the environment cannot be opened
+    bool from_env(std::string& err) {
+        const char* replay = getenv("MPESA_REPLAY");
+        const char* record = getenv("MPESA_RECORD");
+        if (replay && *replay) {
+            if (!replayer_.open(replay, err)) return false;
+            const char* pace = getenv("MPESA_REPLAY_PACE");
+            if (pace && strcmp(pace, "recorded") == 0) replayer_.set_pace(TRACE_RECORDED);
+            http_.set_transport(&replayer_);
+            active_ = true;
+        } else if (record && *record) {
+            if (!recorder_.open(record, err)) return false;
+            http_.set_transport(&recorder_);
+            active_ = true;
+        }
+        return true;
+    }
+
+    // Back to the servers; the recording is flushed
+    void detach() {
+        if (!active_) return;
+        http_.set_transport(NULL);
+        recorder_.close();
+        active_ = false;
+    }
+
+private:
+    TraceHook(const TraceHook&);
+    TraceHook& operator=(const TraceHook&);
+
+    HttpPool&     http_;
+    TraceRecorder recorder_;
+    TraceReplayer replayer_;
+    bool          active_;
+};
+
+#endif // MPESA_TRACE_H
@@ -0,0 +1,224 @@
+/**
+ * ============================================
+ *   transactions.h - send / deposit / withdraw
+ * ============================================
+ *
+ *  The one request path for money-moving calls.
+ *  The interactive screens and batch mode (batch.h)
+ *  both build a TxnRequest and call post_txn(), so a
+ *  scripted payroll goes through exactly the same
+ *  body format and response handling as a cashier
+ *  typing it in.
+ *
+ *  Every call carries an idempotency key and is
+ *  retried on transport errors and 502/503/504/429
+ *  with full-jitter exponential backoff, until a
+ *  deadline. The server answers a repeated key from
+ *  the original transaction (find_replay in
+ *  views.py), so a retry after a lost response can
+ *  never move the money twice.
+ *
+ *  Each attempt is bounded by the pool's deadlines
+ *  (deadline.h); a timed-out attempt is retried like
+ *  any other lost response. A CancelToken stops the
+ *  call in flight and any retry still to come.
+ * ============================================
+ */
+#ifndef MPESA_TRANSACTIONS_H
+#define MPESA_TRANSACTIONS_H
+
+#include <string>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include "platform.h"
+#include "http_pool.h"
+#include "json.h"
+#include "money.h"
+#include "json_writer.h"
+#include "endpoints.h"
+
+// --- Request / result ---------------------------------------------------------
+enum TxnType { TXN_SEND, TXN_DEPOSIT, TXN_WITHDRAW };
+
+struct TxnRequest {
+    TxnType     type;
+    std::string recipient_phone;   // SEND only
+    Money       amount;            // KES
+    std::string pin;               // SEND / WITHDRAW
+    std::string description;       // SEND / WITHDRAW
+    std::string reference;         // DEPOSIT
+    std::string idempotency_key;   // same on every retry; post_txn() fills it if empty
+
+    TxnRequest() : type(TXN_SEND) {}
+};
+
+struct TxnResult {
+    int         status_code;       // 0 = transport failure
+    HttpFailure failure;           // ... and why (http_pool.h)
+    std::string transaction_id;
+    Money       new_balance;
+    std::string error;
+    int         attempts;          // requests sent, retries included
+    bool        replayed;          // an earlier attempt had already gone through
+    bool        queued;            // not sent yet: waiting in the offline queue (outbox.h)
+
+    TxnResult() : status_code(0), failure(HTTP_FAIL_NONE), attempts(0), replayed(false), queued(false) {}
+    bool ok() const { return status_code == 200; }
+};
+
+inline const char* txn_type_name(TxnType t) {
+    switch (t) {
+    case TXN_DEPOSIT:  return "DEPOSIT";
+    case TXN_WITHDRAW: return "WITHDRAW";
+    default:           return "SEND";
+    }
+}
+
+// "send" / "SEND" / "deposit" ... ; false if unknown
+inline bool parse_txn_type(const std::string& s, TxnType& out) {
+    std::string u;
+    for (size_t i = 0; i < s.size(); i++) u += (char)toupper((unsigned char)s[i]);
+    if (u == "SEND")     { out = TXN_SEND;     return true; }
+    if (u == "DEPOSIT")  { out = TXN_DEPOSIT;  return true; }
+    if (u == "WITHDRAW") { out = TXN_WITHDRAW; return true; }
+    return false;
+}
+
+// --- Body building ------------------------------------------------------------
+inline const HttpRoute& txn_route(TxnType t) {
+    switch (t) {
+    case TXN_DEPOSIT:  return endpoint_route<DepositEndpoint>();
+    case TXN_WITHDRAW: return endpoint_route<WithdrawEndpoint>();
+    default:           return endpoint_route<SendEndpoint>();
+    }
+}
+
+// 128 random-looking bits as 32 hex chars. Clock, pid, a counter and an
+// address are mixed through splitmix64, so two terminals (or two threads)
+// never produce the same key in practice.
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+inline std::string new_idempotency_key() {
+    static volatile uint64_t counter = 0;
+    uint64_t n = atomic_add(&counter, 1);
+    uint64_t seed = now_ns() ^ ((uint64_t)time(NULL) << 32) ^ ((uint64_t)process_id() << 16)
+                  ^ (uint64_t)(size_t)&counter;
+    uint64_t a = splitmix64(seed ^ splitmix64(n));
+    uint64_t b = splitmix64(a ^ seed);
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)a, (unsigned long long)b);
+    return buf;
+}
+
+// The body for req, with `key` as its idempotency key (none if empty):
+// the endpoint's request struct, encoded (endpoints.h)
+inline void txn_body(const TxnRequest& req, const char* key, JsonWriter& w) {
+    if (req.type == TXN_DEPOSIT) {
+        DepositRequest d;
+        d.amount          = req.amount;
+        d.reference       = req.reference;
+        d.idempotency_key = key;
+        json_encode(w, d);
+    } else if (req.type == TXN_WITHDRAW) {
+        WithdrawRequest wd;
+        wd.amount          = req.amount;
+        wd.pin             = req.pin;
+        if (req.description.empty()) wd.description = "Cash withdrawal";
+        else                         wd.description = req.description;
+        wd.idempotency_key = key;
+        json_encode(w, wd);
+    } else {
+        SendRequest s;
+        s.recipient_phone = req.recipient_phone;
+        s.amount          = req.amount;
+        s.pin             = req.pin;
+        s.description     = req.description;
+        s.idempotency_key = key;
+        json_encode(w, s);
+    }
+}
+
+// A send / deposit / withdraw reply into out
+inline void txn_result(const HttpResponse& r, TxnType type, TxnResult& out) {
+    out.status_code = r.status_code;
+    out.failure     = r.failure;
+    TxnReply reply;
+    json_decode(r.body, reply);
+    if (r.status_code == 200) {
+        out.transaction_id.swap(reply.transaction_id);
+        out.new_balance = reply.new_balance;
+        out.replayed    = reply.replayed;
+    } else {
+        out.error.swap(reply.error);
+        if (out.error.empty()) out.error.swap(reply.detail);        // DRF auth errors
+        if (out.error.empty()) {
+            char buf[48];
+            snprintf(buf, sizeof(buf), "%s failed (HTTP %d)", txn_type_name(type), r.status_code);
+            out.error = buf;
+        }
+    }
+}
+
+// --- Retry policy -------------------------------------------------------------
+struct RetryPolicy {
+    unsigned deadline_ms;      // no new attempt starts after this long
+    unsigned base_ms;          // backoff ceiling before the first retry
+    unsigned max_backoff_ms;   // ... doubling up to this
+    int      max_attempts;
+
+    RetryPolicy() : deadline_ms(20000), base_ms(250), max_backoff_ms(4000), max_attempts(6) {}
+};
+
+// No response at all, or the server / a proxy said "try again"
+inline bool txn_retryable(int status_code) {
+    return status_code == 0 || status_code == 429 || status_code == 502 ||
+           status_code == 503 || status_code == 504;
+}
+
+// Full jitter: uniform in [0, min(max, base * 2^(attempt-1))]
+inline unsigned txn_backoff_ms(const RetryPolicy& p, int attempt, uint64_t& rng) {
+    uint64_t ceiling = p.base_ms;
+    for (int i = 1; i < attempt && ceiling < p.max_backoff_ms; i++) ceiling *= 2;
+    if (ceiling > p.max_backoff_ms) ceiling = p.max_backoff_ms;
+    rng = splitmix64(rng);
+    return (unsigned)(rng % (ceiling + 1));
+}
+
+// --- Call ---------------------------------------------------------------------
+inline TxnResult post_txn(HttpPool& http, const std::string& token, const TxnRequest& req,
+                          const RetryPolicy& policy = RetryPolicy(), CancelToken* cancel = NULL) {
+    std::string fresh;
+    if (req.idempotency_key.empty()) fresh = new_idempotency_key();
+    const std::string& key = fresh.empty() ? req.idempotency_key : fresh;
+    JsonBody<512> body;                     // on the stack unless a description is huge
+    txn_body(req, key.c_str(), body);
+    uint64_t rng = now_ns();
+    uint64_t t0 = now_ms();
+
+    TxnResult out;
+    HttpResponse r;
+    for (;;) {
+        r = http.request(txn_route(req.type), body.data(), body.size(), token, NULL, cancel);
+        out.attempts++;
+        if (r.cancelled() || !txn_retryable(r.status_code) || out.attempts >= policy.max_attempts) break;
+        unsigned wait = txn_backoff_ms(policy, out.attempts, rng);
+        if (now_ms() - t0 + wait >= policy.deadline_ms) break;
+        uint64_t until = now_ms() + wait;            // back off, but stay cancellable
+        while (!(cancel && cancel->cancelled()) && now_ms() < until) {
+            uint64_t left = until - now_ms();
+            sleep_ms(left < CancelToken::CANCEL_POLL_MS ? (unsigned)left : (unsigned)CancelToken::CANCEL_POLL_MS);
+        }
+        if (cancel && cancel->cancelled()) { r.fail(HTTP_FAIL_CANCELLED, HTTP_PHASE_NONE); break; }
+    }
+
+    txn_result(r, req.type, out);
+    return out;
+}
+
+#endif // MPESA_TRANSACTIONS_H
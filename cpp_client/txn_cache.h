@@ -0,0 +1,387 @@
+/**
+ * ============================================
+ *   txn_cache.h - local transaction cache
+ * ============================================
+ *
+ *  Transactions never change once the server has
+ *  written them, so the client keeps them on disk and
+ *  only asks for rows newer than the newest cached
+ *  created_at (?since=...).
+ *
+ *  File layout (memory-mapped, append-only):
+ *
+ *      [CacheHeader 256 B][CacheRecord 256 B] x count
+ *
+ *  Records are kept oldest-first and are written past
+ *  the committed count before header.count is bumped,
+ *  so a crash mid-append leaves the old contents
+ *  intact. Duplicates (same transaction_id) are
+ *  skipped. The cache covers a contiguous window
+ *  ending at the newest transaction; header.complete
+ *  is set once it reaches the account's first row.
+ *
+ *  The header also keeps the last confirmed balance so
+ *  do_balance() can draw instantly and refresh after.
+ * ============================================
+ */
+#ifndef MPESA_TXN_CACHE_H
+#define MPESA_TXN_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "history.h"
+#include "money.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// --- Memory-mapped file -------------------------------------------------------
+class MappedFile {
+public:
+    MappedFile() : data_(NULL), size_(0) {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE; map_ = NULL;
+#else
+        fd_ = -1;
+#endif
+    }
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                            NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+        DWORD high = 0;
+        size_t size = GetFileSize(file_, &high);
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) != 0) { close(); return false; }
+        size_t size = (size_t)st.st_size;
+#endif
+        return size == 0 || map(size);
+    }
+
+    void close() {
+        unmap();
+#ifdef _WIN32
+        if (file_ != INVALID_HANDLE_VALUE) { CloseHandle(file_); file_ = INVALID_HANDLE_VALUE; }
+#else
+        if (fd_ >= 0) { ::close(fd_); fd_ = -1; }
+#endif
+    }
+
+    // Grow the file (never shrinks) and remap it
+    bool resize(size_t size) {
+        if (size <= size_) return true;
+        unmap();
+#ifndef _WIN32
+        if (ftruncate(fd_, (off_t)size) != 0) return false;
+#endif
+        return map(size);      // Windows extends the file when mapping past EOF
+    }
+
+    // Write dirty pages of [off, off+n) back to disk
+    void flush(size_t off, size_t n) {
+        if (!data_ || !n) return;
+#ifdef _WIN32
+        FlushViewOfFile(data_ + off, n);
+        FlushFileBuffers(file_);
+#else
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = off / page * page;
+        msync(data_ + start, off + n - start, MS_SYNC);
+#endif
+    }
+
+    char*  data() const { return data_; }
+    size_t size() const { return size_; }
+    bool   is_open() const {
+#ifdef _WIN32
+        return file_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ >= 0;
+#endif
+    }
+
+private:
+    bool map(size_t size) {
+#ifdef _WIN32
+        map_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE,
+                                  (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+        if (!map_) return false;
+        data_ = (char*)MapViewOfFile(map_, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!data_) { CloseHandle(map_); map_ = NULL; return false; }
+#else
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) return false;
+        data_ = (char*)p;
+#endif
+        size_ = size;
+        return true;
+    }
+
+    void unmap() {
+        if (!data_) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(map_); map_ = NULL;
+#else
+        munmap(data_, size_);
+#endif
+        data_ = NULL; size_ = 0;
+    }
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    char*  data_;
+    size_t size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE map_;
+#else
+    int    fd_;
+#endif
+};
+
+// --- On-disk layout -----------------------------------------------------------
+struct CacheHeader {
+    char     magic[4];              // "MPTC"
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;                 // committed records
+    uint32_t complete;              // 1 = oldest account row is cached
+    uint32_t reserved;
+    int64_t  balance_synced_at;     // unix time of last confirmed balance, 0 = never
+    char     balance[Money::TEXT_SIZE];
+    char     pad[256 - 32 - Money::TEXT_SIZE];
+};
+
+struct CacheRecord {
+    int64_t id;                     // server primary key (history cursor)
+    char    transaction_type[12];
+    char    amount[24];
+    char    balance_after[24];
+    char    transaction_id[56];
+    char    created_at[40];
+    char    pad[256 - 8 - 12 - 24 - 24 - 56 - 40];
+};
+
+// Compile-time layout check (no static_assert before C++11)
+typedef char cache_header_is_256_bytes[sizeof(CacheHeader) == 256 ? 1 : -1];
+typedef char cache_record_is_256_bytes[sizeof(CacheRecord) == 256 ? 1 : -1];
+
+// --- Cache --------------------------------------------------------------------
+class TxnCache {
+public:
+    enum { VERSION = 1, INITIAL_SYNC_ROWS = 500 };
+
+    TxnCache() {}
+
+    bool open(const std::string& path) {
+        close();
+        if (!file_.open(path)) return false;
+        if (file_.size() < sizeof(CacheHeader) || !valid_header()) {
+            // New or unreadable file: start over with an empty cache
+            if (!file_.resize(sizeof(CacheHeader) + 64 * sizeof(CacheRecord))) { close(); return false; }
+            CacheHeader* h = header();
+            memset(h, 0, sizeof(CacheHeader));
+            memcpy(h->magic, "MPTC", 4);
+            h->version = VERSION;
+            h->record_size = sizeof(CacheRecord);
+            file_.flush(0, sizeof(CacheHeader));
+        }
+        // Records past the end of the file (torn grow) are not committed
+        size_t fits = (file_.size() - sizeof(CacheHeader)) / sizeof(CacheRecord);
+        if (header()->count > fits) header()->count = (uint32_t)fits;
+        rebuild_index();
+        return true;
+    }
+
+    void close() {
+        file_.close();
+        by_txn_id_.clear();
+        by_id_.clear();
+    }
+
+    bool   is_open() const  { return file_.data() != NULL; }
+    size_t size() const     { return is_open() ? header()->count : 0; }
+    bool   complete() const { return is_open() && header()->complete != 0; }
+
+    bool contains(const std::string& transaction_id) const {
+        return by_txn_id_.count(transaction_id) != 0;
+    }
+
+    std::string newest_created_at() const {
+        return size() ? std::string(record(size() - 1)->created_at) : std::string();
+    }
+
+    // Server id of the newest row, where a pushed event stream resumes; 0 if empty
+    int64_t newest_id() const {
+        return size() ? record(size() - 1)->id : 0;
+    }
+
+    // Rows must be oldest-first. Returns how many were new.
+    size_t append(const std::vector<TxnRow>& rows, bool reached_start) {
+        if (!is_open()) return 0;
+        uint32_t count = header()->count;
+        size_t need = sizeof(CacheHeader) + (count + rows.size()) * sizeof(CacheRecord);
+        if (need > file_.size()) {
+            size_t cap = file_.size();
+            while (cap < need) cap *= 2;
+            if (!file_.resize(cap)) return 0;
+        }
+
+        uint32_t added = 0;
+        for (size_t i = 0; i < rows.size(); i++) {
+            const TxnRow& t = rows[i];
+            if (t.transaction_id.empty() || contains(t.transaction_id)) continue;
+            CacheRecord* r = record(count + added);
+            memset(r, 0, sizeof(CacheRecord));
+            r->id = atoll(t.id.c_str());
+            copy_field(r->transaction_type, sizeof(r->transaction_type), t.transaction_type);
+            copy_field(r->amount,           sizeof(r->amount),           t.amount);
+            copy_field(r->balance_after,    sizeof(r->balance_after),    t.balance_after);
+            copy_field(r->transaction_id,   sizeof(r->transaction_id),   t.transaction_id);
+            copy_field(r->created_at,       sizeof(r->created_at),       t.created_at);
+            by_txn_id_[t.transaction_id] = count + added;
+            by_id_[r->id] = count + added;
+            added++;
+        }
+
+        // Records first, then the count that makes them visible
+        file_.flush(offset_of(count), added * sizeof(CacheRecord));
+        header()->count = count + added;
+        if (reached_start) header()->complete = 1;
+        file_.flush(0, sizeof(CacheHeader));
+        return added;
+    }
+
+    // Up to `limit` rows older than `cursor` ("" = newest), newest first.
+    // Returns false when the cache cannot answer and the server must.
+    bool page_before(const std::string& cursor, int limit, HistoryPage& page) const {
+        if (!is_open()) return false;
+        size_t end = size();                     // one past the newest row to show
+        if (!cursor.empty()) {
+            std::map<int64_t, uint32_t>::const_iterator it = by_id_.find(atoll(cursor.c_str()));
+            if (it == by_id_.end()) return false;
+            end = it->second;
+        }
+        if (end < (size_t)limit && !complete()) return false;
+
+        page = HistoryPage();
+        page.status_code = 200;
+        size_t begin = end > (size_t)limit ? end - (size_t)limit : 0;
+        for (size_t i = end; i > begin; i--) {
+            const CacheRecord* r = record(i - 1);
+            TxnRow t;
+            char id[24];
+            snprintf(id, sizeof(id), "%lld", (long long)r->id);
+            t.id               = id;
+            t.transaction_type = r->transaction_type;
+            t.amount           = r->amount;
+            t.balance_after    = r->balance_after;
+            t.transaction_id   = r->transaction_id;
+            t.created_at       = r->created_at;
+            page.rows.push_back(t);
+        }
+        if (begin > 0 || !complete())
+            page.next_cursor = page.rows.empty() ? "" : page.rows.back().id;
+        return true;
+    }
+
+    // --- Balance snapshot ---
+    // Kept as text ("1500.00") so the file layout is unchanged
+    bool cached_balance(Money& balance, int64_t& synced_at) const {
+        if (!is_open() || header()->balance_synced_at == 0) return false;
+        if (!Money::parse(header()->balance, strlen(header()->balance), balance)) return false;
+        synced_at = header()->balance_synced_at;
+        return true;
+    }
+
+    void store_balance(Money balance) {
+        if (!is_open()) return;
+        balance.format(header()->balance);
+        header()->balance_synced_at = (int64_t)time(NULL);
+        file_.flush(0, sizeof(CacheHeader));
+    }
+
+private:
+    static void copy_field(char* dst, size_t cap, const std::string& src) {
+        size_t n = src.size() < cap - 1 ? src.size() : cap - 1;
+        memcpy(dst, src.data(), n);
+        dst[n] = '\0';
+    }
+
+    bool valid_header() const {
+        const CacheHeader* h = header();
+        return memcmp(h->magic, "MPTC", 4) == 0 && h->version == VERSION &&
+               h->record_size == sizeof(CacheRecord);
+    }
+
+    void rebuild_index() {
+        by_txn_id_.clear();
+        by_id_.clear();
+        for (uint32_t i = 0; i < header()->count; i++) {
+            by_txn_id_[record(i)->transaction_id] = i;
+            by_id_[record(i)->id] = i;
+        }
+    }
+
+    static size_t offset_of(size_t i) { return sizeof(CacheHeader) + i * sizeof(CacheRecord); }
+    CacheHeader*       header()                { return (CacheHeader*)file_.data(); }
+    const CacheHeader* header() const          { return (const CacheHeader*)file_.data(); }
+    CacheRecord*       record(size_t i)        { return (CacheRecord*)(file_.data() + offset_of(i)); }
+    const CacheRecord* record(size_t i) const  { return (const CacheRecord*)(file_.data() + offset_of(i)); }
+
+    TxnCache(const TxnCache&);
+    TxnCache& operator=(const TxnCache&);
+
+    MappedFile                        file_;
+    std::map<std::string, uint32_t>   by_txn_id_;   // dedupe on append
+    std::map<int64_t, uint32_t>       by_id_;       // history cursor -> record
+};
+
+// --- Sync ---------------------------------------------------------------------
+// Pull everything newer than the cache (or the newest INITIAL_SYNC_ROWS for an
+// empty cache) and append it. Returns the HTTP status of the last request;
+// 200 with nothing new costs one small round-trip.
+inline int sync_history(HttpPool& http, const std::string& token, TxnCache& cache,
+                        std::string& error, size_t* added = NULL) {
+    std::string since = cache.newest_created_at();
+    std::vector<TxnRow> fresh;                   // newest first, as served
+    std::string cursor;
+    HistoryPage page;
+    bool reached_start = false;
+    for (;;) {
+        fetch_history_page(http, token, cursor, 500, page, since);
+        if (page.status_code != 200) {
+            error = page.error;
+            return page.status_code;
+        }
+        fresh.insert(fresh.end(), page.rows.begin(), page.rows.end());
+        if (page.next_cursor.empty()) { reached_start = since.empty(); break; }
+        if (since.empty() && fresh.size() >= (size_t)TxnCache::INITIAL_SYNC_ROWS) break;
+        cursor = page.next_cursor;
+    }
+    std::vector<TxnRow> oldest_first(fresh.rbegin(), fresh.rend());
+    size_t n = cache.append(oldest_first, reached_start);
+    if (added) *added = n;
+    return 200;
+}
+
+#endif // MPESA_TXN_CACHE_H
@@ -0,0 +1,177 @@
+/**
+ * ============================================
+ *   wal.h - append-only logs on disk
+ * ============================================
+ *
+ *  The file and record framing under the offline
+ *  queue (outbox.h) and the ledger (ledger.h).
+ *  A record is one line of JSON behind the CRC-32
+ *  of that JSON:
+ *
+ *      <crc32 hex8> {"op":...}
+ *
+ *  Whoever replays a log stops at the first line
+ *  that is torn (no newline) or fails its CRC, and
+ *  cuts the file there.
+ * ============================================
+ */
+#ifndef MPESA_WAL_H
+#define MPESA_WAL_H
+
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include "platform.h"
+#include "http_reader.h"        // crc32_update (inflate.h)
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// --- Log file -----------------------------------------------------------------
+// Append, sync, truncate; held exclusively so two terminals never flush
+// the same queue
+class LogFile {
+public:
+    LogFile() : sync_delay_ms_(0) {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        fd_ = -1;
+#endif
+    }
+    ~LogFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        return file_ != INVALID_HANDLE_VALUE;
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+        if (fd_ < 0) return false;
+        if (flock(fd_, LOCK_EX | LOCK_NB) != 0) { close(); return false; }
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (file_ != INVALID_HANDLE_VALUE) { CloseHandle(file_); file_ = INVALID_HANDLE_VALUE; }
+#else
+        if (fd_ >= 0) { ::close(fd_); fd_ = -1; }
+#endif
+    }
+
+    bool read_all(std::string& out) {
+        out.clear();
+        char buf[16384];
+#ifdef _WIN32
+        SetFilePointer(file_, 0, NULL, FILE_BEGIN);
+        DWORD got = 0;
+        while (ReadFile(file_, buf, sizeof(buf), &got, NULL) && got) out.append(buf, got);
+#else
+        off_t at = 0;
+        for (;;) {
+            ssize_t got = pread(fd_, buf, sizeof(buf), at);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) return false;
+            if (got == 0) break;
+            out.append(buf, (size_t)got);
+            at += got;
+        }
+#endif
+        return true;
+    }
+
+    // All of p[0..n) at the end of the file, or false
+    bool append(const char* p, size_t n) {
+#ifdef _WIN32
+        SetFilePointer(file_, 0, NULL, FILE_END);
+        DWORD put = 0;
+        return WriteFile(file_, p, (DWORD)n, &put, NULL) && put == n;
+#else
+        while (n) {
+            ssize_t put = write(fd_, p, n);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) return false;
+            p += put;
+            n -= (size_t)put;
+        }
+        return true;
+#endif
+    }
+
+    bool sync() {
+        if (sync_delay_ms_) sleep_ms(sync_delay_ms_);
+#ifdef _WIN32
+        return FlushFileBuffers(file_) != 0;
+#else
+        return fsync(fd_) == 0;
+#endif
+    }
+
+    bool truncate(uint64_t size) {
+#ifdef _WIN32
+        LONG high = (LONG)(size >> 32);
+        SetFilePointer(file_, (LONG)(size & 0xFFFFFFFFu), &high, FILE_BEGIN);
+        return SetEndOfFile(file_) != 0;
+#else
+        return ftruncate(fd_, (off_t)size) == 0;
+#endif
+    }
+
+    // Benches: every sync() takes this much longer, like a busy disk
+    void set_sync_delay_ms(unsigned ms) { sync_delay_ms_ = ms; }
+
+    bool is_open() const {
+#ifdef _WIN32
+        return file_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ >= 0;
+#endif
+    }
+
+private:
+    LogFile(const LogFile&);
+    LogFile& operator=(const LogFile&);
+
+#ifdef _WIN32
+    HANDLE file_;
+#else
+    int    fd_;
+#endif
+    unsigned sync_delay_ms_;
+};
+
+// --- Record format ------------------------------------------------------------
+// "<crc32 of json, 8 hex> <json>\n"
+inline void wal_frame(const char* json, size_t n, std::string& out) {
+    char crc[10];
+    snprintf(crc, sizeof(crc), "%08x ", (unsigned)crc32_update(0, (const unsigned char*)json, n));
+    out.append(crc, 9);
+    out.append(json, n);
+    out += '\n';
+}
+
+// The JSON of the line at [p, p+n) (newline excluded); false if torn or corrupt
+inline bool wal_unframe(const char* p, size_t n, const char*& json, size_t& len) {
+    if (n < 11 || p[8] != ' ') return false;
+    uint32_t want = 0;
+    for (int i = 0; i < 8; i++) {
+        char c = p[i];
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+        if (v < 0) return false;
+        want = want << 4 | (uint32_t)v;
+    }
+    json = p + 9;
+    len = n - 9;
+    return crc32_update(0, (const unsigned char*)json, len) == want;
+}
+
+#endif // MPESA_WAL_H